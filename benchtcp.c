@@ -0,0 +1,607 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "tcp_frame.h"
+#include "tcp_hist.h"
+
+#define DEFAULT_PORT 8888
+#define BUFFER_SIZE 1024
+#define TEXT_MAX_MESSAGE 900        // 服务器在文本协议下会截断约924字节以上的消息
+#define MAX_PIPELINE 4096
+#define BENCH_MAX_EVENTS 256
+
+// 压测参数
+typedef struct {
+    const char* server_ip;
+    int server_port;
+    int connections;
+    int threads;
+    int message_size;
+    double rate;            // 所有连接合计每秒发送的消息数，0表示不限速（收到回复立即发送下一条）
+    int pipeline;           // 每个连接最多同时等待的请求数
+    int duration;           // 秒
+    int framed;
+} bench_config_t;
+
+// 每个连接的状态
+typedef struct {
+    int fd;
+    int welcome_lines;      // 文本协议：欢迎消息还剩几行没有读完
+    int welcomed;           // 帧协议：是否已收到WELCOME帧
+    int inflight;
+    uint64_t next_send;     // 限速模式下下一条消息的计划发送时间
+    uint64_t* sent_at;      // 等待回复的请求的发送时间（环形队列）
+    unsigned sent_head;
+    unsigned sent_tail;
+    netbuf_t in;
+    netbuf_t out;
+    int writable_wait;      // 是否在等待EPOLLOUT
+} bench_conn_t;
+
+typedef struct {
+    int id;
+    bench_conn_t* conns;
+    int conn_count;
+    int epoll_fd;
+    const char* request;    // 预先编码好的请求，每次发送同样的内容
+    size_t request_len;
+    uint64_t interval;      // 限速模式下同一连接两条消息之间的间隔（纳秒）
+    uint64_t start;
+    uint64_t deadline;
+    uint64_t requests;
+    uint64_t responses;
+    uint64_t bytes_received;
+    uint64_t errors;
+    histogram_t hist;
+} bench_thread_t;
+
+bench_config_t bench_config = {
+    .server_ip = "127.0.0.1",
+    .server_port = DEFAULT_PORT,
+    .connections = 10,
+    .threads = 1,
+    .message_size = 64,
+    .rate = 0,
+    .pipeline = 1,
+    .duration = 10,
+    .framed = 0,
+};
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void print_usage(const char* program_name) {
+    printf("📊 TCP服务器压测工具\n");
+    printf("=======================================\n");
+    printf("使用方法: %s [选项] [服务器地址] [端口]\n", program_name);
+    printf("服务器地址可以是IPv4、IPv6、主机名或 unix:路径\n");
+    printf("\n选项:\n");
+    printf("  -h, --help              显示帮助\n");
+    printf("  -c, --connections N     连接数 (默认 %d)\n", bench_config.connections);
+    printf("  -t, --threads M         压测线程数，连接平均分配到各线程 (默认 %d)\n", bench_config.threads);
+    printf("  -s, --size BYTES        每条消息的字节数 (默认 %d)\n", bench_config.message_size);
+    printf("  -r, --rate N            所有连接合计每秒发送的消息数，0表示不限速 (默认 0)\n");
+    printf("  -p, --pipeline N        每个连接最多同时等待的请求数 (默认 %d，仅帧协议)\n", bench_config.pipeline);
+    printf("  -d, --duration SEC      压测时长 (默认 %d 秒)\n", bench_config.duration);
+    printf("  -F, --framed            使用长度前缀帧协议 (服务器需启用帧协议)\n");
+    printf("\n示例:\n");
+    printf("  %s -c 100 -t 4 -d 30 127.0.0.1          # 100个连接，收到回复立即发送下一条\n", program_name);
+    printf("  %s -F -c 50 -p 16 -s 256 127.0.0.1      # 帧协议，每个连接流水线深度16\n", program_name);
+    printf("  %s -c 200 -r 20000 127.0.0.1 8888       # 固定速率，测量该负载下的延迟\n", program_name);
+    printf("\n💡 提示:\n");
+    printf("  - 限速模式下延迟从计划发送时间开始计算，服务器变慢时不会低估延迟\n");
+    printf("  - 文本协议没有消息边界，每个连接一次只发送一条消息\n");
+}
+
+// 解析整数参数，失败时返回-1
+int parse_option_int(const char* name, const char* value, int min, int max) {
+    char* end;
+    long n;
+    
+    if (value == NULL) {
+        printf("❌ 选项 %s 需要一个参数\n", name);
+        return -1;
+    }
+    n = strtol(value, &end, 10);
+    if (*end != '\0' || n < min || n > max) {
+        printf("❌ 选项 %s 的值必须在 %d-%d 之间: %s\n", name, min, max, value);
+        return -1;
+    }
+    return (int)n;
+}
+
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// 解析服务器地址："unix:路径"（"unix:@名字"为抽象命名空间）或IP、主机名，主机名使用解析出的第一个地址
+int bench_resolve(const char* host, int port, struct sockaddr_storage* addr, socklen_t* len) {
+    struct addrinfo hints;
+    struct addrinfo* list;
+    char service[8];
+    
+    memset(addr, 0, sizeof(*addr));
+    if (strncmp(host, "unix:", 5) == 0) {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+        size_t path_len = strlen(host + 5);
+        
+        if (path_len == 0 || path_len >= sizeof(un->sun_path)) return -1;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, host + 5, path_len);
+        if (un->sun_path[0] == '@') un->sun_path[0] = '\0';
+        *len = offsetof(struct sockaddr_un, sun_path) + path_len + (host[5] != '@');
+        return 0;
+    }
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &list) != 0) return -1;
+    memcpy(addr, list->ai_addr, list->ai_addrlen);
+    *len = list->ai_addrlen;
+    freeaddrinfo(list);
+    return 0;
+}
+
+// 建立一个连接（阻塞式connect，连接建立后切换为非阻塞）
+int bench_connect(const struct sockaddr_storage* server_addr, socklen_t addr_len) {
+    int opt = 1;
+    int fd = socket(server_addr->ss_family, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    
+    if (connect(fd, (const struct sockaddr*)server_addr, addr_len) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (server_addr->ss_family != AF_UNIX) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    set_nonblocking(fd);
+    return fd;
+}
+
+// 构造请求：内容为可打印字符，文本协议以换行结尾（回复也以换行结尾，用来分隔回复）
+char* build_request(size_t* request_len) {
+    size_t size = bench_config.message_size;
+    size_t len = bench_config.framed ? FRAME_HEADER_SIZE + size : size;
+    char* request = malloc(len);
+    char* payload;
+    
+    if (request == NULL) return NULL;
+    payload = bench_config.framed ? request + FRAME_HEADER_SIZE : request;
+    for (size_t i = 0; i < size; i++) payload[i] = 'a' + i % 26;
+    if (bench_config.framed) {
+        frame_encode_header((unsigned char*)request, FRAME_DATA, 0, (uint32_t)size);
+    } else {
+        payload[size - 1] = '\n';
+    }
+    *request_len = len;
+    return request;
+}
+
+void conn_update_events(bench_thread_t* thread, bench_conn_t* conn) {
+    int want = conn->out.len > 0;
+    struct epoll_event ev;
+    
+    if (want == conn->writable_wait) return;
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+    ev.data.ptr = conn;
+    epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->writable_wait = want;
+}
+
+// 把out中的数据尽量发出去，返回-1表示连接出错
+int conn_flush(bench_conn_t* conn) {
+    while (conn->out.len > 0) {
+        ssize_t n = send(conn->fd, conn->out.data, conn->out.len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        netbuf_consume(&conn->out, n);
+    }
+    return 0;
+}
+
+// 收到一条回复：按发送顺序匹配请求并记录延迟
+void conn_complete(bench_thread_t* thread, bench_conn_t* conn, uint64_t now) {
+    if (conn->inflight == 0) return;
+    uint64_t sent = conn->sent_at[conn->sent_head++ % bench_config.pipeline];
+    conn->inflight--;
+    if (sent >= thread->start) {
+        thread->responses++;
+        hist_record(&thread->hist, now - sent);
+    }
+}
+
+// 解析in中完整的回复，返回-1表示连接出错
+int conn_parse(bench_thread_t* thread, bench_conn_t* conn, uint64_t now) {
+    if (bench_config.framed) {
+        frame_header_t header;
+        size_t offset = 0;
+        int rc;
+        
+        while ((rc = frame_parse(conn->in.data + offset, conn->in.len - offset, &header)) == 1) {
+            offset += FRAME_HEADER_SIZE + header.length;
+            if (header.type == FRAME_WELCOME) {
+                conn->welcomed = 1;
+            } else if (header.type == FRAME_DATA) {
+                conn_complete(thread, conn, now);
+            } else {
+                thread->errors++;
+                conn_complete(thread, conn, now);
+            }
+        }
+        netbuf_consume(&conn->in, offset);
+        return rc < 0 ? -1 : 0;
+    }
+    
+    // 文本协议：每个换行结束一条回复
+    char* start = conn->in.data;
+    char* end = conn->in.data + conn->in.len;
+    char* newline;
+    while ((newline = memchr(start, '\n', end - start)) != NULL) {
+        start = newline + 1;
+        if (conn->welcome_lines > 0) {
+            conn->welcome_lines--;
+        } else {
+            conn_complete(thread, conn, now);
+        }
+    }
+    netbuf_consume(&conn->in, start - conn->in.data);
+    return 0;
+}
+
+int conn_on_readable(bench_thread_t* thread, bench_conn_t* conn) {
+    while (1) {
+        if (netbuf_reserve(&conn->in, BUFFER_SIZE * 16) < 0) return -1;
+        ssize_t n = recv(conn->fd, conn->in.data + conn->in.len, conn->in.cap - conn->in.len, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (n == 0) return -1;
+        conn->in.len += n;
+        thread->bytes_received += n;
+        if (conn_parse(thread, conn, now_ns()) < 0) return -1;
+    }
+}
+
+int conn_ready(const bench_conn_t* conn) {
+    return bench_config.framed ? conn->welcomed : conn->welcome_lines == 0;
+}
+
+void conn_drop(bench_thread_t* thread, bench_conn_t* conn) {
+    printf("⚠️  线程 %d: 连接被关闭或出错: %s\n", thread->id, errno ? strerror(errno) : "对端关闭");
+    close(conn->fd);
+    conn->fd = -1;
+    thread->errors++;
+}
+
+// 发送到期的请求，返回距离下一次计划发送的时间（纳秒），没有计划发送时返回UINT64_MAX
+uint64_t thread_send_due(bench_thread_t* thread, uint64_t now) {
+    uint64_t wait = UINT64_MAX;
+    
+    for (int i = 0; i < thread->conn_count; i++) {
+        bench_conn_t* conn = &thread->conns[i];
+        if (conn->fd < 0 || !conn_ready(conn)) continue;
+        
+        while (conn->inflight < bench_config.pipeline) {
+            uint64_t scheduled = now;
+            if (thread->interval > 0) {
+                if (conn->next_send > now) {
+                    if (conn->next_send - now < wait) wait = conn->next_send - now;
+                    break;
+                }
+                // 延迟从计划时间开始计算，避免coordinated omission
+                scheduled = conn->next_send;
+                conn->next_send += thread->interval;
+            }
+            if (netbuf_append(&conn->out, thread->request, thread->request_len) < 0) break;
+            conn->sent_at[conn->sent_tail++ % bench_config.pipeline] = scheduled;
+            conn->inflight++;
+            thread->requests++;
+        }
+        
+        if (conn_flush(conn) < 0) {
+            conn_drop(thread, conn);
+            continue;
+        }
+        conn_update_events(thread, conn);
+    }
+    return wait;
+}
+
+// 等待事件，超时精确到纳秒：限速模式下发送时间的误差会直接计入延迟
+// 内核不支持epoll_pwait2(5.11以下)时退回到毫秒精度的epoll_wait
+int bench_wait(int epoll_fd, struct epoll_event* events, int max_events, uint64_t wait_ns) {
+    static int pwait2_supported = 1;
+    struct timespec timeout;
+    
+    if (pwait2_supported) {
+        timeout.tv_sec = wait_ns / 1000000000ull;
+        timeout.tv_nsec = wait_ns % 1000000000ull;
+        int n = epoll_pwait2(epoll_fd, events, max_events, &timeout, NULL);
+        if (n >= 0 || errno != ENOSYS) return n;
+        pwait2_supported = 0;
+    }
+    return epoll_wait(epoll_fd, events, max_events, (int)((wait_ns + 999999) / 1000000));
+}
+
+void* bench_thread_main(void* arg) {
+    bench_thread_t* thread = (bench_thread_t*)arg;
+    struct epoll_event events[BENCH_MAX_EVENTS];
+    
+    while (1) {
+        uint64_t now = now_ns();
+        if (now >= thread->deadline) break;
+        
+        uint64_t wait = thread_send_due(thread, now);
+        uint64_t until_deadline = thread->deadline - now;
+        if (wait > until_deadline) wait = until_deadline;
+        if (wait > 100000000ull) wait = 100000000ull;
+        
+        int n = bench_wait(thread->epoll_fd, events, BENCH_MAX_EVENTS, wait);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("❌ epoll_wait失败");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            bench_conn_t* conn = events[i].data.ptr;
+            if (conn->fd < 0) continue;
+            if (events[i].events & EPOLLOUT) {
+                if (conn_flush(conn) < 0) {
+                    conn_drop(thread, conn);
+                    continue;
+                }
+                conn_update_events(thread, conn);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                errno = 0;
+                if (conn_on_readable(thread, conn) < 0) conn_drop(thread, conn);
+            }
+        }
+    }
+    return NULL;
+}
+
+void print_latency(const char* name, uint64_t ns) {
+    printf("  %-6s %10.1f µs\n", name, ns / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+    struct sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    bench_thread_t* threads;
+    pthread_t* handles;
+    histogram_t* total;
+    char* request;
+    size_t request_len;
+    int positional = 0;
+    
+    // 解析命令行参数：选项可以出现在任意位置，其余依次为服务器地址和端口
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        int n = 0;
+        
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if (strcmp(arg, "-F") == 0 || strcmp(arg, "--framed") == 0) {
+            bench_config.framed = 1;
+        } else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--connections") == 0) {
+            if ((n = parse_option_int(arg, value, 1, 1000000)) < 0) return 1;
+            bench_config.connections = n;
+            i++;
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--threads") == 0) {
+            if ((n = parse_option_int(arg, value, 1, 1024)) < 0) return 1;
+            bench_config.threads = n;
+            i++;
+        } else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--size") == 0) {
+            if ((n = parse_option_int(arg, value, 1, FRAME_MAX_PAYLOAD)) < 0) return 1;
+            bench_config.message_size = n;
+            i++;
+        } else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--rate") == 0) {
+            if ((n = parse_option_int(arg, value, 0, 100000000)) < 0) return 1;
+            bench_config.rate = n;
+            i++;
+        } else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--pipeline") == 0) {
+            if ((n = parse_option_int(arg, value, 1, MAX_PIPELINE)) < 0) return 1;
+            bench_config.pipeline = n;
+            i++;
+        } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0) {
+            if ((n = parse_option_int(arg, value, 1, 86400)) < 0) return 1;
+            bench_config.duration = n;
+            i++;
+        } else if (arg[0] == '-') {
+            printf("❌ 未知选项: %s\n", arg);
+            printf("💡 提示: 使用 %s -h 查看帮助信息\n", argv[0]);
+            return 1;
+        } else if (positional == 0) {
+            bench_config.server_ip = arg;
+            positional++;
+        } else if (positional == 1) {
+            if ((n = parse_option_int("端口", arg, 1, 65535)) < 0) return 1;
+            bench_config.server_port = n;
+            positional++;
+        }
+    }
+    
+    if (!bench_config.framed) {
+        if (bench_config.pipeline > 1) {
+            printf("⚠️  文本协议没有消息边界，流水线深度固定为1（需要流水线请使用 -F）\n");
+            bench_config.pipeline = 1;
+        }
+        if (bench_config.message_size > TEXT_MAX_MESSAGE) {
+            printf("⚠️  文本协议下服务器会截断过长的消息，消息大小限制为 %d 字节\n", TEXT_MAX_MESSAGE);
+            bench_config.message_size = TEXT_MAX_MESSAGE;
+        }
+        if (bench_config.message_size < 2) bench_config.message_size = 2;
+    }
+    if (bench_config.threads > bench_config.connections) bench_config.threads = bench_config.connections;
+    
+    if (bench_resolve(bench_config.server_ip, bench_config.server_port, &server_addr, &server_addr_len) < 0) {
+        printf("❌ 无法解析服务器地址: %s\n", bench_config.server_ip);
+        return 1;
+    }
+    
+    request = build_request(&request_len);
+    threads = calloc(bench_config.threads, sizeof(bench_thread_t));
+    handles = calloc(bench_config.threads, sizeof(pthread_t));
+    total = calloc(1, sizeof(histogram_t));
+    if (request == NULL || threads == NULL || handles == NULL || total == NULL) {
+        perror("❌ 内存分配失败");
+        return 1;
+    }
+    
+    printf("📊 TCP服务器压测\n");
+    printf("=======================================\n");
+    if (server_addr.ss_family == AF_UNIX) {
+        printf("目标服务器: %s (%s)\n", bench_config.server_ip, bench_config.framed ? "帧协议" : "文本协议");
+    } else {
+        printf("目标服务器: %s:%d (%s)\n", bench_config.server_ip, bench_config.server_port,
+               bench_config.framed ? "帧协议" : "文本协议");
+    }
+    printf("连接数: %d, 线程数: %d, 消息大小: %d 字节, 流水线深度: %d\n",
+           bench_config.connections, bench_config.threads, bench_config.message_size, bench_config.pipeline);
+    if (bench_config.rate > 0) {
+        printf("发送速率: %.0f 条/秒, ", bench_config.rate);
+    } else {
+        printf("发送速率: 不限速, ");
+    }
+    printf("时长: %d 秒\n", bench_config.duration);
+    printf("=======================================\n");
+    
+    // 建立连接，平均分配到各线程
+    raise_fd_limit();
+    printf("🔗 正在建立 %d 个连接...\n", bench_config.connections);
+    for (int t = 0; t < bench_config.threads; t++) {
+        bench_thread_t* thread = &threads[t];
+        int count = bench_config.connections / bench_config.threads +
+                    (t < bench_config.connections % bench_config.threads);
+        
+        thread->id = t;
+        thread->request = request;
+        thread->request_len = request_len;
+        thread->conns = calloc(count, sizeof(bench_conn_t));
+        thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (thread->conns == NULL || thread->epoll_fd == -1) {
+            perror("❌ 初始化压测线程失败");
+            return 1;
+        }
+        if (bench_config.rate > 0) {
+            thread->interval = (uint64_t)(1e9 * bench_config.connections / bench_config.rate);
+        }
+        
+        for (int i = 0; i < count; i++) {
+            bench_conn_t* conn = &thread->conns[i];
+            struct epoll_event ev;
+            
+            conn->fd = bench_connect(&server_addr, server_addr_len);
+            if (conn->fd < 0) {
+                printf("❌ 第 %d 个连接失败: %s\n", t + i * bench_config.threads + 1, strerror(errno));
+                return 1;
+            }
+            conn->welcome_lines = 3;    // 文本协议的欢迎消息固定为3行
+            conn->sent_at = calloc(bench_config.pipeline, sizeof(uint64_t));
+            if (conn->sent_at == NULL) {
+                perror("❌ 内存分配失败");
+                return 1;
+            }
+            ev.events = EPOLLIN;
+            ev.data.ptr = conn;
+            epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev);
+            thread->conn_count++;
+        }
+    }
+    
+    printf("🚀 开始压测...\n");
+    uint64_t start = now_ns();
+    for (int t = 0; t < bench_config.threads; t++) {
+        bench_thread_t* thread = &threads[t];
+        thread->start = start;
+        thread->deadline = start + (uint64_t)bench_config.duration * 1000000000ull;
+        // 各连接的首次发送时间错开，避免同时发出
+        for (int i = 0; i < thread->conn_count; i++) {
+            thread->conns[i].next_send = start + thread->interval * i / (thread->conn_count ? thread->conn_count : 1);
+        }
+        if (pthread_create(&handles[t], NULL, bench_thread_main, thread) != 0) {
+            perror("❌ 创建线程失败");
+            return 1;
+        }
+    }
+    
+    uint64_t requests = 0, responses = 0, bytes = 0, errors = 0;
+    int alive = 0;
+    for (int t = 0; t < bench_config.threads; t++) {
+        pthread_join(handles[t], NULL);
+        requests += threads[t].requests;
+        responses += threads[t].responses;
+        bytes += threads[t].bytes_received;
+        errors += threads[t].errors;
+        hist_merge(total, &threads[t].hist);
+        for (int i = 0; i < threads[t].conn_count; i++) {
+            if (threads[t].conns[i].fd >= 0) {
+                alive++;
+                close(threads[t].conns[i].fd);
+            }
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    
+    printf("\n📈 压测结果\n");
+    printf("=======================================\n");
+    printf("发送请求: %llu, 收到回复: %llu, 错误: %llu, 存活连接: %d/%d\n",
+           (unsigned long long)requests, (unsigned long long)responses,
+           (unsigned long long)errors, alive, bench_config.connections);
+    printf("吞吐量: %.0f 条/秒, %.2f MB/秒 (接收)\n", responses / elapsed, bytes / elapsed / (1024 * 1024));
+    if (total->total > 0) {
+        printf("延迟:\n");
+        print_latency("min", total->min);
+        print_latency("mean", (uint64_t)(total->sum / total->total));
+        print_latency("p50", hist_percentile(total, 50));
+        print_latency("p90", hist_percentile(total, 90));
+        print_latency("p99", hist_percentile(total, 99));
+        print_latency("p999", hist_percentile(total, 99.9));
+        print_latency("max", total->max);
+    } else {
+        printf("⚠️  没有收到任何回复\n");
+    }
+    printf("=======================================\n");
+    
+    return errors > 0 || total->total == 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,9 +10,20 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "tcp_frame.h"
+#include "tcp_client.h"
 
 #define BUFFER_SIZE 1024
 #define DEFAULT_PORT 8888
+#define DEFAULT_CONNECT_TIMEOUT 5   // 连接超时（秒）
+#define DEFAULT_RETRIES 5           // 连接失败或断开后的重连次数
+#define OUTPUT_LIMIT (64 * 1024)    // 待发送的数据超过该值时暂停读取标准输入
+#define FRAMED_LINE_LIMIT (64 * 1024)   // 帧协议下过长的行按该长度拆分（文本协议受服务器接收缓冲区限制）
 
 // 全局变量，用于信号处理
 volatile sig_atomic_t keep_running = 1;
@@ -31,12 +43,40 @@ void signal_handler(int sig) {
 void print_usage(const char* program_name) {
     printf("🌐 TCP客户端程序 (跨机器版本)\n");
     printf("=======================================\n");
-    printf("使用方法: %s [服务器IP] [端口]\n", program_name);
+    printf("使用方法: %s [选项] [服务器地址] [端口]\n", program_name);
+    printf("          %s [选项] 地址:端口 [地址:端口 ...]\n", program_name);
+    printf("服务器地址可以是IPv4、IPv6、主机名或 unix:路径 (带端口的IPv6写作 [地址]:端口)\n");
+    printf("\n选项:\n");
+    printf("  -h, --help          显示帮助\n");
+    printf("  -i, --interactive   交互式输入服务器地址\n");
+    printf("  -F, --framed        使用长度前缀帧协议 (服务器需启用帧协议)\n");
+    printf("  -z, --compress      帧协议下请求压缩较大的消息 (服务器需使用 --compress)\n");
+    printf("  -t, --timeout SEC   连接超时 (默认 %d 秒)\n", DEFAULT_CONNECT_TIMEOUT);
+    printf("      --no-probe      跳过连接前的连通性测试，直接建立连接\n");
+    printf("  -r, --retries N     连接失败或断开后最多重连N次，按指数退避等待，0表示不重连 (默认 %d)\n",
+           DEFAULT_RETRIES);
+    printf("      --get NAME      帧协议下下载服务器 --files 目录中的文件后退出\n");
+    printf("  -o, --output PATH   下载保存的路径 (默认为当前目录下的同名文件)\n");
+    printf("      --put PATH      帧协议下上传文件到服务器 --files 目录后退出 (服务器需使用 --upload)\n");
+    printf("      --as NAME       上传后在服务器上的文件名 (默认与PATH的文件名相同)\n");
+    printf("      --tls           使用TLS加密连接 (服务器需使用 --tls-cert)，用系统的CA证书验证服务器\n");
+    printf("      --tls-ca FILE   使用TLS，用FILE中的CA证书验证服务器 (证书中需包含服务器的IP或主机名)\n");
+    printf("      --tls-no-verify 使用TLS但不验证服务器证书，只用于测试\n");
     printf("\n示例:\n");
     printf("  %s                        # 连接到本机 127.0.0.1:8888\n", program_name);
     printf("  %s 192.168.1.100          # 连接到 192.168.1.100:8888\n", program_name);
     printf("  %s 192.168.1.100 9999     # 连接到 192.168.1.100:9999\n", program_name);
     printf("  %s 10.0.0.5 8888          # 连接到 10.0.0.5:8888\n", program_name);
+    printf("  %s -F 10.0.0.5            # 使用帧协议连接\n", program_name);
+    printf("  %s -F -z 10.0.0.5         # 使用帧协议并压缩大于1KB的消息\n", program_name);
+    printf("  %s 10.0.0.5:8888 10.0.0.6:8888  # 多个服务器，断开后改连下一个\n", program_name);
+    printf("  %s [fe80::1%%eth0]:8888     # IPv6地址\n", program_name);
+    printf("  %s server.lan:8888          # 主机名，IPv6和IPv4地址都会尝试\n", program_name);
+    printf("  %s unix:/run/servertcp.sock # 同一台机器上通过UNIX socket连接\n", program_name);
+    printf("  %s -F --get data.bin 10.0.0.5     # 下载文件\n", program_name);
+    printf("  %s -F --put ./data.bin 10.0.0.5   # 上传文件\n", program_name);
+    printf("  %s --tls-ca ca.pem 10.0.0.5       # TLS加密连接\n", program_name);
+    printf("  cat msgs.txt | %s -F      # 从管道读取时连续发送(pipelining)\n", program_name);
     printf("\n常用内网IP范围:\n");
     printf("  192.168.x.x  (家庭/办公网络)\n");
     printf("  10.x.x.x     (企业网络)\n");
@@ -44,48 +84,22 @@ void print_usage(const char* program_name) {
     printf("\n💡 提示:\n");
     printf("  - 确保目标机器上的服务器程序正在运行\n");
     printf("  - 检查防火墙设置是否允许连接\n");
-    printf("  - 使用 ping IP地址 测试网络连通性\n");
+    printf("  - 使用 ping 服务器地址 测试网络连通性\n");
 }
 
 // 测试网络连通性
-int test_connectivity(const char* server_ip, int server_port) {
+int test_connectivity(const client_server_t* server, int timeout_sec) {
     printf("🔍 测试网络连通性...\n");
+    printf("   正在尝试连接 %s...\n", server->name);
     
-    // 创建测试socket
-    int test_socket = socket(AF_INET, SOCK_STREAM, 0);
+    int test_socket = client_connect(server->host, server->port, timeout_sec * 1000);
     if (test_socket == -1) {
-        printf("❌ 创建测试socket失败: %s\n", strerror(errno));
-        return 0;
-    }
-    
-    // 设置连接超时
-    struct timeval timeout;
-    timeout.tv_sec = 5;  // 5秒超时
-    timeout.tv_usec = 0;
-    setsockopt(test_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(test_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-    
-    struct sockaddr_in test_addr;
-    memset(&test_addr, 0, sizeof(test_addr));
-    test_addr.sin_family = AF_INET;
-    test_addr.sin_port = htons(server_port);
-    
-    if (inet_pton(AF_INET, server_ip, &test_addr.sin_addr) <= 0) {
-        printf("❌ IP地址格式错误: %s\n", server_ip);
-        close(test_socket);
-        return 0;
-    }
-    
-    printf("   正在尝试连接 %s:%d...\n", server_ip, server_port);
-    
-    if (connect(test_socket, (struct sockaddr*)&test_addr, sizeof(test_addr)) < 0) {
         printf("❌ 连接测试失败: %s\n", strerror(errno));
         printf("\n🔧 可能的解决方案:\n");
         printf("   1. 检查服务器是否正在运行\n");
-        printf("   2. 验证IP地址和端口是否正确\n");
+        printf("   2. 验证服务器地址和端口是否正确\n");
         printf("   3. 检查防火墙设置\n");
-        printf("   4. 确认网络连通性: ping %s\n", server_ip);
-        close(test_socket);
+        if (server->port != 0) printf("   4. 确认网络连通性: ping %s\n", server->host);
         return 0;
     }
     
@@ -95,10 +109,10 @@ int test_connectivity(const char* server_ip, int server_port) {
 }
 
 // 显示连接信息
-void show_connection_info(const char* server_ip, int server_port) {
+void show_connection_info(const char* target) {
     printf("\n📡 连接信息\n");
     printf("===================\n");
-    printf("目标服务器: %s:%d\n", server_ip, server_port);
+    printf("目标服务器: %s\n", target);
     
     // 显示本地时间
     time_t now = time(NULL);
@@ -121,7 +135,7 @@ void get_server_info_interactive(char** server_ip, int* server_port) {
     printf("=======================\n");
     
     // 获取IP地址
-    printf("请输入服务器IP地址 (回车使用默认 127.0.0.1): ");
+    printf("请输入服务器地址 (IP、主机名或unix:路径，回车使用默认 127.0.0.1): ");
     fflush(stdout);
     
     if (fgets(ip_buffer, sizeof(ip_buffer), stdin) != NULL) {
@@ -157,15 +171,462 @@ void get_server_info_interactive(char** server_ip, int* server_port) {
     printf("✅ 配置完成: %s:%d\n", *server_ip, *server_port);
 }
 
+// 打印服务器发来的一个帧
+void print_frame(const frame_header_t* header, const char* payload) {
+    if (header->type == FRAME_ERROR) {
+        printf("❌ 服务器错误: %.*s\n", (int)header->length, payload);
+    } else if (header->type == FRAME_DATA) {
+        printf("📨 服务器回复: %.*s", (int)header->length, payload);
+        if (header->length == 0 || payload[header->length - 1] != '\n') printf("\n");
+        printf("─────────────────────────────────────\n");
+    }
+}
+
+// 全双工会话：同时读取标准输入和socket，输入的每一行立即发送，不等待回复；
+// 服务器的回复和主动推送的消息到达时立即显示
+typedef struct {
+    client_pool_t* pool;
+    client_conn_t* conn;    // 当前的连接，重连后fd和接收缓冲区随之更新
+    int framed;
+    int tty;                // 标准输入是终端：显示提示符，支持help/info命令
+    int prompt_shown;       // 提示符后面还没有换行
+    int line_start;         // 文本协议：下一个收到的字节是一行的开头
+    int input_done;         // 已经读到EOF或quit，并把退出请求放入了发送缓冲区
+    int shut;               // 退出请求发送完后已关闭写方向
+    int sent;
+    int received;
+    size_t raw_bytes;       // 压缩前的消息字节数（只统计尝试压缩的消息）
+    size_t packed_bytes;    // 这些消息实际发送的字节数
+    netbuf_t out;           // 还没有发送出去的数据，发送缓冲区满时在这里排队
+    netbuf_t line;          // 标准输入中还没有读完的一行
+    netbuf_t plain;         // 解压后的回复
+} session_t;
+
+void session_prompt(session_t* session) {
+    if (!session->tty || session->input_done || session->prompt_shown) return;
+    printf("💭 请输入消息: ");
+    fflush(stdout);
+    session->prompt_shown = 1;
+}
+
+// 在显示收到的消息之前擦掉提示符，显示完后再重新显示
+void session_break_prompt(session_t* session) {
+    if (!session->prompt_shown) return;
+    printf("\r\033[K");
+    session->prompt_shown = 0;
+}
+
+// 启用了压缩的连接上，较大的消息直接压缩到发送缓冲区中；压缩后不更小时返回0，由调用者按原样发送
+int session_queue_packed(session_t* session, const char* data, size_t len) {
+    size_t need = LZ_HEADER_SIZE + lz_bound(len);
+    size_t packed;
+    
+    if (netbuf_reserve(&session->out, FRAME_HEADER_SIZE + need) < 0) return -1;
+    packed = lz_pack(data, len, session->out.data + session->out.len + FRAME_HEADER_SIZE, need);
+    session->raw_bytes += len;
+    session->packed_bytes += packed > 0 ? packed : len;
+    if (packed == 0) return 0;
+    frame_encode_header((unsigned char*)session->out.data + session->out.len, FRAME_DATA, FRAME_FLAG_LZ,
+                        (uint32_t)packed);
+    session->out.len += FRAME_HEADER_SIZE + packed;
+    return 1;
+}
+
+// 把一条消息（或退出请求）放入发送缓冲区
+int session_queue(session_t* session, uint8_t type, const char* data, size_t len) {
+    if (session->framed) {
+        if (type == FRAME_DATA && session->conn->compress && len >= session->conn->compress_threshold) {
+            int rc = session_queue_packed(session, data, len);
+            if (rc != 0) return rc < 0 ? -1 : 0;
+        }
+        return frame_append(&session->out, type, 0, NULL, 0, data, len);
+    }
+    if (type == FRAME_QUIT) return netbuf_append(&session->out, "quit\n", 5);
+    return netbuf_append(&session->out, data, len);
+}
+
+// 处理标准输入的一行：本地命令、退出或发送到服务器
+int session_on_line(session_t* session, const char* message, size_t len) {
+    session->prompt_shown = 0;
+    
+    if (session->tty && strncmp(message, "help", 4) == 0) {
+        printf("\n📋 可用命令:\n");
+        printf("  quit - 退出程序\n");
+        printf("  help - 显示此帮助\n");
+        printf("  info - 显示连接信息\n");
+        printf("  其他 - 发送到服务器\n\n");
+        return 0;
+    }
+    if (session->tty && strncmp(message, "info", 4) == 0) {
+        show_connection_info(session->pool->servers[session->conn->server].name);
+        return 0;
+    }
+    if (strncmp(message, "quit", 4) == 0) {
+        if (session->tty) printf("👋 正在断开连接...\n");
+        session->input_done = 1;
+        return session_queue(session, FRAME_QUIT, NULL, 0);
+    }
+    
+    session->sent++;
+    return session_queue(session, FRAME_DATA, message, len);
+}
+
+// 标准输入可读：read不经过stdio缓冲，poll才能准确反映是否还有输入
+// 读到EOF时发送最后不完整的一行并请求断开
+int session_on_stdin(session_t* session) {
+    if (netbuf_reserve(&session->line, BUFFER_SIZE) < 0) return -1;
+    ssize_t n = read(STDIN_FILENO, session->line.data + session->line.len,
+                     session->line.cap - session->line.len);
+    if (n < 0) return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    
+    if (n == 0) {
+        if (session->tty) printf("\n📥 收到EOF信号，退出...\n");
+        if (session->line.len > 0 && session_on_line(session, session->line.data, session->line.len) < 0) {
+            return -1;
+        }
+        session->line.len = 0;
+        if (session->input_done) return 0;
+        session->input_done = 1;
+        return session_queue(session, FRAME_QUIT, NULL, 0);
+    }
+    session->line.len += n;
+    
+    // 一次读取可能包含多行，也可能只有半行；过长的行拆分发送
+    size_t limit = session->framed ? FRAMED_LINE_LIMIT : BUFFER_SIZE - 1;
+    while (!session->input_done && session->line.len > 0) {
+        char* newline = memchr(session->line.data, '\n', session->line.len);
+        size_t len;
+        if (newline != NULL && (size_t)(newline - session->line.data) < limit) {
+            len = newline - session->line.data + 1;
+        } else if (session->line.len >= limit) {
+            len = limit;
+        } else {
+            break;
+        }
+        if (session_on_line(session, session->line.data, len) < 0) return -1;
+        netbuf_consume(&session->line, len);
+    }
+    if (session->input_done) session->line.len = 0;
+    return 0;
+}
+
+// 文本协议没有消息边界：收到多少显示多少，每行开头加上标记
+void session_show_text(session_t* session, const char* data, size_t len) {
+    session_break_prompt(session);
+    while (len > 0) {
+        const char* newline = memchr(data, '\n', len);
+        size_t chunk = newline != NULL ? (size_t)(newline - data + 1) : len;
+        if (session->line_start) printf("📨 ");
+        fwrite(data, 1, chunk, stdout);
+        session->line_start = newline != NULL;
+        data += chunk;
+        len -= chunk;
+    }
+    fflush(stdout);
+}
+
+// 帧协议按帧头确定消息边界，不受TCP拆分/合并影响；显示in中所有完整的帧，返回-1表示帧无效
+int session_show_frames(session_t* session) {
+    frame_header_t header;
+    int rc;
+    
+    while ((rc = frame_parse(session->conn->in.data, session->conn->in.len, &header)) == 1) {
+        const char* payload = session->conn->in.data + FRAME_HEADER_SIZE;
+        size_t frame_len = FRAME_HEADER_SIZE + header.length;
+        
+        // 压缩的回复解压后再显示
+        if (header.flags & FRAME_FLAG_LZ) {
+            ssize_t size = lz_unpacked_size(payload, header.length);
+            if (size < 0 || size > FRAME_MAX_PAYLOAD || netbuf_reserve(&session->plain, size) < 0 ||
+                lz_unpack(payload, header.length, session->plain.data, size) != size) {
+                rc = -1;
+                break;
+            }
+            payload = session->plain.data;
+            header.length = (uint32_t)size;
+        }
+        session_break_prompt(session);
+        print_frame(&header, payload);
+        if (header.type == FRAME_DATA || header.type == FRAME_ERROR) session->received++;
+        netbuf_consume(&session->conn->in, frame_len);
+    }
+    fflush(stdout);
+    if (rc < 0) {
+        session_break_prompt(session);
+        printf("❌ 收到无效的帧\n");
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+// socket可读，返回0继续，-1表示连接已关闭或出错
+int session_on_socket(session_t* session) {
+    while (1) {
+        if (netbuf_reserve(&session->conn->in, BUFFER_SIZE) < 0) return -1;
+        ssize_t n = recv(session->conn->fd, session->conn->in.data + session->conn->in.len,
+                         session->conn->in.cap - session->conn->in.len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) {
+            session_break_prompt(session);
+            if (!session->line_start) printf("\n");
+            if (n < 0) {
+                printf("❌ 接收消息失败: %s\n", strerror(errno));
+            } else if (!session->input_done) {
+                printf("🔌 服务器关闭了连接\n");
+            }
+            return -1;
+        }
+        
+        if (!session->framed) {
+            session_show_text(session, session->conn->in.data, n);
+            continue;
+        }
+        session->conn->in.len += n;
+        if (session_show_frames(session) < 0) return -1;
+    }
+}
+
+// 尽量发送缓冲区中的数据，返回0继续，-1表示出错
+int session_flush(session_t* session) {
+    while (session->out.len > 0) {
+        ssize_t n = send(session->conn->fd, session->out.data, session->out.len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0) {
+            session_break_prompt(session);
+            printf("❌ 发送消息失败: %s\n", strerror(errno));
+            return -1;
+        }
+        netbuf_consume(&session->out, n);
+    }
+    return 0;
+}
+
+// 运行会话直到连接结束（发送quit后服务器处理完之前的消息再关闭）
+// 返回1表示输入还没有处理完连接就断开了，调用者可以重连后继续
+int duplex_session(session_t* session) {
+    client_conn_t* conn = session->conn;
+    int dropped = 0;
+    
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL, 0) | O_NONBLOCK);
+    // 接收欢迎消息时多读到的数据
+    if (!session->framed) {
+        session_show_text(session, conn->in.data, conn->in.len);
+        conn->in.len = 0;
+    } else if (session_show_frames(session) < 0) {
+        return 1;
+    }
+    
+    while (keep_running) {
+        struct pollfd pfd[2];
+        int nfds = 1;
+        
+        session_prompt(session);
+        pfd[0].fd = conn->fd;
+        pfd[0].events = POLLIN | (session->out.len > 0 ? POLLOUT : 0);
+        // 服务器接收变慢时不再读取输入，待发送的数据不会无限增长
+        if (!session->input_done && session->out.len < OUTPUT_LIMIT) {
+            pfd[1].fd = STDIN_FILENO;
+            pfd[1].events = POLLIN;
+            nfds = 2;
+        }
+        if (poll(pfd, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        
+        if ((pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) && session_on_socket(session) < 0) {
+            dropped = 1;
+            break;
+        }
+        if (nfds == 2 && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) && session_on_stdin(session) < 0) break;
+        if (session->out.len > 0 && session_flush(session) < 0) {
+            dropped = 1;
+            break;
+        }
+        
+        // 文本协议没有消息边界，和前面的消息合并到达的quit不会被识别，关闭写方向让服务器一定能看到结束
+        if (session->input_done && session->out.len == 0 && !session->shut) {
+            shutdown(conn->fd, SHUT_WR);
+            session->shut = 1;
+        }
+    }
+    return dropped && !session->input_done;
+}
+
+// 显示服务器的欢迎消息
+void print_welcome(const client_conn_t* conn) {
+    if (conn->welcome.len == 0) return;
+    printf("\n📨 服务器欢迎消息:\n");
+    printf("─────────────────────────\n");
+    printf("%.*s", (int)conn->welcome.len, conn->welcome.data);
+    printf("─────────────────────────\n");
+}
+
+// 显示TLS握手的结果：重连时能否恢复会话、加解密是否由内核完成
+void print_tls(const client_pool_t* pool, const client_conn_t* conn) {
+    if (pool->tls == NULL || pool->servers[conn->server].port == 0) return;
+    printf("🔒 TLS已建立 (%s，%s)\n",
+           (conn->tls_info & TLS_INFO_RESUMED) ? "恢复了上次的会话" : "完整握手",
+           (conn->tls_info & TLS_INFO_OFFLOADED) ? "由内核kTLS加解密" : "由中继线程加解密");
+}
+
+// 连接到服务器，失败时按退避时间等待后重试，最多retries次；返回0成功
+int connect_with_retry(client_pool_t* pool, client_conn_t* conn, int retries) {
+    for (int attempt = 0; keep_running; attempt++) {
+        errno = EAGAIN;
+        if (client_conn_open(pool, conn) == 0) return 0;
+        if (errno != EAGAIN) {
+            printf("❌ 连接 %s 失败: %s\n", pool->servers[conn->server].name,
+                   pool->tls != NULL ? tls_last_error() : strerror(errno));
+            if (errno == ECONNREFUSED && pool->framed) printf("💡 请确认服务器正在运行并已启用帧协议\n");
+        }
+        if (attempt >= retries) return -1;
+        
+        uint64_t now = client_now_ms();
+        uint64_t retry_at = client_pool_next_retry(pool);
+        int wait_ms = retry_at > now ? (int)(retry_at - now) : 0;
+        printf("🔄 %d 毫秒后重连 (%d/%d)...\n", wait_ms, attempt + 1, retries);
+        poll(NULL, 0, wait_ms);
+    }
+    return -1;
+}
+
+// ==================== 文件传输 ====================
+
+typedef struct {
+    uint64_t started;       // 开始时间（毫秒）
+    uint64_t shown;         // 上次显示进度的时间
+} progress_t;
+
+// 显示进度条和当前吞吐量，最多每200毫秒刷新一次
+void show_progress(uint64_t done, uint64_t size, void* arg) {
+    progress_t* progress = (progress_t*)arg;
+    uint64_t now = client_now_ms();
+    double seconds = (now - progress->started) / 1000.0;
+    int percent = size > 0 ? (int)(done * 100 / size) : 100;
+    char bar[31];
+    
+    if (done < size && now - progress->shown < 200) return;
+    progress->shown = now;
+    memset(bar, ' ', sizeof(bar) - 1);
+    memset(bar, '#', percent * (sizeof(bar) - 1) / 100);
+    bar[sizeof(bar) - 1] = '\0';
+    printf("\r📁 [%s] %3d%% %llu/%llu 字节  %.1f MB/s", bar, percent, 
+           (unsigned long long)done, (unsigned long long)size,
+           seconds > 0 ? done / seconds / (1024 * 1024) : 0.0);
+    fflush(stdout);
+}
+
+// 传输结束：换行结束进度条，输出总耗时和平均吞吐量
+void finish_progress(const progress_t* progress, uint64_t size) {
+    double seconds = (client_now_ms() - progress->started) / 1000.0;
+    
+    printf("\n✅ 传输完成: %llu 字节, %.2f 秒, %.1f MB/s\n", (unsigned long long)size, seconds,
+           seconds > 0 ? size / seconds / (1024 * 1024) : 0.0);
+}
+
+// 下载name保存到output：先写入同一目录下的临时文件，完成后再改名为output，
+// 服务器拒绝或下载中断时删除临时文件，不会破坏output原有的内容；output是管道等非普通文件时直接写入。返回0成功
+int download_file(client_pool_t* pool, client_conn_t* conn, const char* name, const char* output) {
+    progress_t progress = { client_now_ms(), 0 };
+    netbuf_t reply = {0};
+    uint64_t size;
+    const char* file_name;
+    size_t name_len;
+    char temp[PATH_MAX];
+    struct stat st;
+    int direct = stat(output, &st) == 0 && !S_ISREG(st.st_mode);
+    int fd = -1;
+    int type;
+    
+    if (direct) {
+        fd = open(output, O_WRONLY | O_CLOEXEC);
+    } else if (snprintf(temp, sizeof(temp), "%s.XXXXXX", output) >= (int)sizeof(temp)) {
+        errno = ENAMETOOLONG;
+    } else if ((fd = mkostemp(temp, O_CLOEXEC)) != -1) {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0644 & ~mask);   // mkstemp创建的文件权限为0600，改为和直接创建时一样
+    }
+    if (fd == -1) {
+        printf("❌ 无法创建 %s: %s\n", output, strerror(errno));
+        return -1;
+    }
+    printf("📥 下载 %s -> %s\n", name, output);
+    type = client_get_file(conn, name, fd, pool->request_timeout_ms, show_progress, &progress, &reply);
+    close(fd);
+    if (type == FRAME_FILE && !direct && rename(temp, output) < 0) {
+        printf("❌ 无法保存为 %s: %s\n", output, strerror(errno));
+        type = -1;
+    } else if (type == FRAME_FILE && frame_parse_file(reply.data, reply.len, &size, &file_name, &name_len) == 0) {
+        finish_progress(&progress, size);
+    } else if (type == FRAME_ERROR) {
+        printf("❌ 服务器拒绝: %.*s\n", (int)reply.len, reply.data);
+    } else {
+        printf("\n❌ 下载失败: %s\n", strerror(errno));
+    }
+    if (type != FRAME_FILE && !direct) unlink(temp);
+    netbuf_free(&reply);
+    return type == FRAME_FILE ? 0 : -1;
+}
+
+// 上传path，在服务器上保存为name；返回0成功
+int upload_file(client_pool_t* pool, client_conn_t* conn, const char* path, const char* name) {
+    progress_t progress = { client_now_ms(), 0 };
+    netbuf_t reply = {0};
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int type;
+    
+    if (fd == -1 || fstat(fd, &st) < 0) {
+        printf("❌ 无法读取 %s: %s\n", path, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        printf("❌ %s 不是普通文件\n", path);
+        close(fd);
+        return -1;
+    }
+    printf("📤 上传 %s -> %s (%lld 字节)\n", path, name, (long long)st.st_size);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    type = client_put_file(conn, name, fd, st.st_size, pool->request_timeout_ms, show_progress, &progress, &reply);
+    close(fd);
+    if (type == FRAME_DATA) {
+        finish_progress(&progress, st.st_size);
+        printf("📨 %.*s", (int)reply.len, reply.data);
+    } else if (type == FRAME_ERROR) {
+        printf("\n❌ 服务器拒绝: %.*s\n", (int)reply.len, reply.data);
+    } else {
+        printf("\n❌ 上传失败: %s\n", strerror(errno));
+    }
+    netbuf_free(&reply);
+    return type == FRAME_DATA ? 0 : -1;
+}
+
 int main(int argc, char* argv[]) {
-    int client_socket;
-    struct sockaddr_in server_addr;
-    char buffer[BUFFER_SIZE];
-    char message[BUFFER_SIZE];
-    int bytes_received;
+    client_pool_t pool;
+    client_conn_t* conn;
+    session_t session;
+    const char* targets[CLIENT_MAX_SERVERS];
+    int target_count = 0;   // -1表示使用server_ip和server_port
     char* server_ip = "127.0.0.1";
     int server_port = DEFAULT_PORT;
     int interactive_mode = 0;
+    int framed = 0;
+    int compress = 0;
+    int probe = 1;
+    int connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    int retries = DEFAULT_RETRIES;
+    int reachable = 0;
+    const char* get_name = NULL;
+    const char* put_path = NULL;
+    const char* output = NULL;
+    const char* put_name = NULL;
+    const char* tls_ca = NULL;
+    int tls = 0;
+    int tls_verify = 1;
     
     // 设置信号处理
     signal(SIGINT, signal_handler);
@@ -176,36 +637,129 @@ int main(int argc, char* argv[]) {
     printf("版本: 1.1 - 增强跨机器连接功能\n");
     printf("=======================================\n");
     
-    // 解析命令行参数
-    if (argc > 1) {
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+    // 解析命令行参数：选项可以出现在任意位置，其余为服务器地址和端口，或若干个"地址:端口"
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             return 0;
-        } else if (strcmp(argv[1], "-i") == 0 || strcmp(argv[1], "--interactive") == 0) {
+        } else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--interactive") == 0) {
             interactive_mode = 1;
+        } else if (strcmp(argv[i], "-F") == 0 || strcmp(argv[i], "--framed") == 0) {
+            framed = 1;
+        } else if (strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "--compress") == 0) {
+            compress = 1;
+        } else if (strcmp(argv[i], "--no-probe") == 0) {
+            probe = 0;
+        } else if (strcmp(argv[i], "--tls") == 0) {
+            tls = 1;
+        } else if (strcmp(argv[i], "--tls-no-verify") == 0) {
+            tls = 1;
+            tls_verify = 0;
+        } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--timeout") == 0) {
+            if (i + 1 >= argc || (connect_timeout = atoi(argv[++i])) <= 0) {
+                printf("❌ 错误: 连接超时必须是正整数 (秒)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--retries") == 0) {
+            if (i + 1 >= argc || (retries = atoi(argv[++i])) < 0) {
+                printf("❌ 错误: 重连次数必须是非负整数\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--get") == 0 || strcmp(argv[i], "--put") == 0 ||
+                   strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0 || strcmp(argv[i], "--as") == 0 ||
+                   strcmp(argv[i], "--tls-ca") == 0) {
+            if (i + 1 >= argc) {
+                printf("❌ 错误: %s 需要一个参数\n", argv[i]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--get") == 0) {
+                get_name = argv[++i];
+            } else if (strcmp(argv[i], "--put") == 0) {
+                put_path = argv[++i];
+            } else if (strcmp(argv[i], "--as") == 0) {
+                put_name = argv[++i];
+            } else if (strcmp(argv[i], "--tls-ca") == 0) {
+                tls = 1;
+                tls_ca = argv[++i];
+            } else {
+                output = argv[++i];
+            }
+        } else if (target_count < CLIENT_MAX_SERVERS) {
+            targets[target_count++] = argv[i];
         } else {
-            server_ip = argv[1];
+            printf("❌ 错误: 最多指定 %d 个服务器\n", CLIENT_MAX_SERVERS);
+            return 1;
         }
     }
     
-    if (argc > 2 && !interactive_mode) {
-        server_port = atoi(argv[2]);
+    // "服务器地址 端口"的写法，地址可以是不带端口的IPv6地址
+    if (target_count == 2 && targets[1][0] != '\0' && strspn(targets[1], "0123456789") == strlen(targets[1])) {
+        server_ip = (char*)targets[0];
+        server_port = atoi(targets[1]);
         if (server_port <= 0 || server_port > 65535) {
             printf("❌ 错误: 端口号必须在 1-65535 之间\n");
             return 1;
         }
+        target_count = -1;
     }
     
     // 交互式模式
-    if (interactive_mode || argc == 1) {
+    if (interactive_mode || target_count == 0) {
         get_server_info_interactive(&server_ip, &server_port);
+        target_count = -1;
+    }
+    
+    if (compress && !framed) {
+        printf("⚠️  压缩需要帧协议 (-F)，已忽略 -z\n");
+        compress = 0;
+    }
+    if ((get_name != NULL || put_path != NULL) && !framed) {
+        printf("❌ 错误: 文件传输需要帧协议 (-F)\n");
+        return 1;
+    }
+    if (get_name != NULL && put_path != NULL) {
+        printf("❌ 错误: --get 和 --put 不能同时使用\n");
+        return 1;
+    }
+    if (get_name != NULL && output == NULL) output = get_name;
+    if (put_path != NULL && put_name == NULL) {
+        put_name = strrchr(put_path, '/') != NULL ? strrchr(put_path, '/') + 1 : put_path;
+    }
+    
+    client_pool_init(&pool, framed);
+    pool.compress = compress;
+    pool.connect_timeout_ms = connect_timeout * 1000;
+    if (tls) {
+        pool.tls = tls_client_ctx(tls_ca, tls_verify);
+        if (pool.tls == NULL) {
+            printf("❌ 无法启用TLS: %s\n", tls_last_error());
+            return 1;
+        }
+        // OpenSSL写socket时没有MSG_NOSIGNAL
+        signal(SIGPIPE, SIG_IGN);
+    }
+    if (target_count == -1) {
+        if (client_pool_add(&pool, server_ip, server_port) < 0) {
+            printf("❌ 错误: 无效的服务器地址 %s\n", server_ip);
+            return 1;
+        }
+    } else {
+        for (int i = 0; i < target_count; i++) {
+            if (client_pool_add(&pool, targets[i], DEFAULT_PORT) < 0) {
+                printf("❌ 错误: 无效的服务器地址 %s (应为 地址、地址:端口、[IPv6]:端口 或 unix:路径)\n", targets[i]);
+                return 1;
+            }
+        }
     }
     
     // 显示连接信息
-    show_connection_info(server_ip, server_port);
+    show_connection_info(pool.servers[0].name);
     
-    // 测试网络连通性
-    if (!test_connectivity(server_ip, server_port)) {
+    // 测试网络连通性（多建立一次连接，--no-probe跳过），有一个服务器可以连接即可
+    for (int i = 0; probe && i < pool.server_count && !reachable; i++) {
+        reachable = test_connectivity(&pool.servers[i], connect_timeout);
+    }
+    if (probe && !reachable) {
         printf("\n❌ 连接前测试失败，程序退出\n");
         printf("💡 提示: 使用 %s -h 查看帮助信息\n", argv[0]);
         return 1;
@@ -213,126 +767,111 @@ int main(int argc, char* argv[]) {
     
     printf("\n🚀 正在建立连接...\n");
     
-    // 创建socket
-    client_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (client_socket == -1) {
-        printf("❌ 创建socket失败: %s\n", strerror(errno));
-        return 1;
-    }
-    
-    global_socket = client_socket;
-    
-    // 配置服务器地址
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
-    
-    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-        printf("❌ 错误: 无效的IP地址 %s\n", server_ip);
-        close(client_socket);
+    // 只使用一个连接槽：断开后按退避时间重连，有多个服务器时依次改连下一个
+    if (client_pool_start(&pool, 1) < 0) {
+        printf("❌ 内存分配失败\n");
         return 1;
     }
-    
-    // 连接到服务器
-    if (connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        printf("❌ 连接失败: %s\n", strerror(errno));
+    conn = &pool.conns[0];
+    if (conn->fd == -1 && connect_with_retry(&pool, conn, retries) < 0) {
         printf("\n🔧 故障排除建议:\n");
         printf("1. 确保服务器程序正在运行\n");
-        printf("2. 检查IP地址: %s\n", server_ip);
-        printf("3. 检查端口: %d\n", server_port);
-        printf("4. 测试网络连通性: ping %s\n", server_ip);
-        printf("5. 检查防火墙设置\n");
-        printf("6. 确认服务器在正确的网络接口上监听\n");
-        close(client_socket);
+        printf("2. 检查服务器地址: %s\n", pool.servers[conn->server].name);
+        if (pool.servers[conn->server].port != 0) {
+            printf("3. 测试网络连通性: ping %s\n", pool.servers[conn->server].host);
+        }
+        printf("4. 检查防火墙设置\n");
+        printf("5. 确认服务器在正确的网络接口上监听\n");
+        client_pool_destroy(&pool);
         return 1;
     }
     
-    printf("✅ 成功连接到服务器 %s:%d!\n", server_ip, server_port);
-    
-    // 接收服务器的欢迎消息
-    memset(buffer, 0, BUFFER_SIZE);
-    bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        printf("\n📨 服务器欢迎消息:\n");
-        printf("─────────────────────────\n");
-        printf("%s", buffer);
-        printf("─────────────────────────\n");
+    // 一次性的文件传输：传输完后退出，中途断开不重连
+    if (get_name != NULL || put_path != NULL) {
+        int rc;
+        
+        printf("✅ 成功连接到服务器 %s!\n", pool.servers[conn->server].name);
+        print_tls(&pool, conn);
+        // 服务器拒绝上传时可能在文件发完之前关闭连接
+        signal(SIGPIPE, SIG_IGN);
+        rc = get_name != NULL ? download_file(&pool, conn, get_name, output)
+                              : upload_file(&pool, conn, put_path, put_name);
+        client_pool_destroy(&pool);
+        tls_relay_drain(CLIENT_CONNECT_TIMEOUT_MS);
+        tls_ctx_free(pool.tls);
+        return rc < 0 ? 1 : 0;
     }
     
-    printf("\n💬 进入聊天模式\n");
-    printf("===============================\n");
-    printf("📝 使用说明:\n");
-    printf("  - 输入消息并按回车发送\n");
-    printf("  - 输入 'quit' 正常退出\n");
-    printf("  - 按 Ctrl+C 强制退出\n");
-    printf("  - 输入 'help' 显示帮助\n");
-    printf("  - 输入 'info' 显示连接信息\n");
-    printf("===============================\n\n");
+    memset(&session, 0, sizeof(session));
+    session.pool = &pool;
+    session.conn = conn;
+    session.framed = framed;
+    session.tty = isatty(STDIN_FILENO);
+    
+    if (session.tty) {
+        printf("\n💬 进入聊天模式\n");
+        printf("===============================\n");
+        printf("📝 使用说明:\n");
+        printf("  - 输入消息并按回车发送，不必等待回复\n");
+        printf("  - 服务器的回复和推送的消息会随时显示\n");
+        printf("  - 输入 'quit' 正常退出\n");
+        printf("  - 按 Ctrl+C 强制退出\n");
+        printf("  - 输入 'help' 显示帮助\n");
+        printf("  - 输入 'info' 显示连接信息\n");
+        printf("===============================\n");
+    } else {
+        printf("\n📦 标准输入不是终端，连续发送所有消息 (pipelining)\n");
+    }
     
-    // 主循环：发送和接收消息
-    while (keep_running) {
-        printf("💭 请输入消息: ");
-        fflush(stdout);
-        
-        // 读取用户输入
-        if (fgets(message, sizeof(message), stdin) == NULL) {
-            printf("\n📥 读取输入失败或收到EOF信号，退出...\n");
-            break;
+    // 同时收发，直到服务器关闭连接；意外断开时重连后继续处理剩下的输入
+    while (1) {
+        global_socket = conn->fd;
+        printf("✅ 成功连接到服务器 %s!\n", pool.servers[conn->server].name);
+        if (compress) {
+            printf(conn->compress ? "🗜️  服务器已同意压缩，不小于 %zu 字节的消息压缩后发送\n"
+                                  : "⚠️  服务器未启用压缩 (--compress)，按原样发送\n",
+                   conn->compress_threshold);
         }
+        print_tls(&pool, conn);
+        print_welcome(conn);
+        printf("\n");
+        session.line_start = 1;
+        session.shut = 0;
         
-        // 处理特殊命令
-        if (strncmp(message, "help", 4) == 0) {
-            printf("\n📋 可用命令:\n");
-            printf("  quit - 退出程序\n");
-            printf("  help - 显示此帮助\n");
-            printf("  info - 显示连接信息\n");
-            printf("  其他 - 发送到服务器\n\n");
-            continue;
-        }
-        
-        if (strncmp(message, "info", 4) == 0) {
-            show_connection_info(server_ip, server_port);
-            continue;
-        }
+        if (!duplex_session(&session)) break;
         
-        // 检查是否为退出命令
-        if (strncmp(message, "quit", 4) == 0) {
-            printf("👋 正在断开连接...\n");
-            send(client_socket, message, strlen(message), 0);
-            break;
+        // 已经发出的请求不会再收到回复，没有发完的数据也无法确定边界，一起丢弃
+        if (session.out.len > 0) {
+            printf("⚠️  丢弃 %zu 字节未发送完的数据\n", session.out.len);
+            session.out.len = 0;
         }
-        
-        // 发送消息到服务器
-        if (send(client_socket, message, strlen(message), 0) < 0) {
-            printf("❌ 发送消息失败: %s\n", strerror(errno));
-            printf("🔄 连接可能已断开，尝试重新连接或退出程序\n");
-            break;
-        }
-        
-        // 接收服务器回复
-        memset(buffer, 0, BUFFER_SIZE);
-        bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
-        
-        if (bytes_received <= 0) {
-            if (bytes_received == 0) {
-                printf("🔌 服务器关闭了连接\n");
-            } else {
-                printf("❌ 接收消息失败: %s\n", strerror(errno));
-            }
+        client_conn_failed(&pool, conn);
+        if (retries == 0 || connect_with_retry(&pool, conn, retries) < 0) {
             printf("💡 连接已断开，程序退出\n");
             break;
         }
-        
-        buffer[bytes_received] = '\0';
-        printf("📨 服务器回复: %s", buffer);
-        printf("─────────────────────────────────────\n");
+    }
+    
+    if (framed) {
+        printf("📊 已发送 %d 条消息，收到 %d 条回复\n", session.sent, session.received);
+        if (session.raw_bytes > 0) {
+            printf("🗜️  压缩: %zu 字节 -> %zu 字节 (%.1f%%)\n", session.raw_bytes, session.packed_bytes,
+                   100.0 * session.packed_bytes / session.raw_bytes);
+        }
+    } else if (!session.tty) {
+        printf("📊 已发送 %d 条消息\n", session.sent);
     }
     
     // 关闭socket
-    close(client_socket);
+    netbuf_free(&session.out);
+    netbuf_free(&session.line);
+    netbuf_free(&session.plain);
+    client_pool_destroy(&pool);
+    // 中继线程随进程结束，先等它把最后发出的消息加密发送完
+    tls_relay_drain(CLIENT_CONNECT_TIMEOUT_MS);
+    tls_ctx_free(pool.tls);
     printf("\n👋 客户端已关闭\n");
     printf("感谢使用 TCP 客户端程序！\n");
     
     return 0;
-}
\ No newline at end of file
+}
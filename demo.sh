@@ -43,7 +43,7 @@ case $choice in
         
         # 启动多线程服务器
         echo "正在启动多线程服务器..."
-        (echo "3") | ./servertcp &
+        ./servertcp -m multithread &
         SERVER_PID=$!
         
         # 等待服务器启动
@@ -78,7 +78,7 @@ case $choice in
         
         # 启动多线程服务器
         echo "正在启动多线程服务器..."
-        (echo "3") | ./servertcp &
+        ./servertcp -m multithread &
         SERVER_PID=$!
         
         # 等待服务器启动
@@ -110,6 +110,13 @@ compile_programs() {
         else
             echo "❌ 未找到clienttcp.c文件"
         fi
+        
+        if [ -f "benchtcp.c" ]; then
+            gcc -Wall -Wextra -std=c99 -pthread -o benchtcp benchtcp.c
+            echo "✅ 压测工具编译完成"
+        else
+            echo "❌ 未找到benchtcp.c文件"
+        fi
     fi
 }
 
@@ -187,7 +194,7 @@ hostname -I 2>/dev/null | awk '{print "  " $1}' || echo "  无法获取IP地址"
 
 echo ""
 echo "启动服务器程序..."
-./servertcp
+./servertcp "$@"
 EOF
 
     # 客户端启动脚本
@@ -223,6 +230,8 @@ show_usage() {
     echo "📋 可用文件:"
     echo "  servertcp        - 服务器程序"
     echo "  clienttcp        - 客户端程序"
+    echo "  benchtcp         - 压测工具"
+    echo "  tcp_client.h     - 客户端连接池库 (批处理程序直接包含，需要同目录的tcp_frame.h和tcp_lz.h)"
     echo "  start_server.sh  - 服务器启动脚本"
     echo "  start_client.sh  - 客户端启动脚本"
     echo ""
@@ -1,8 +1,10 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/wait.h>
@@ -11,369 +13,6464 @@
 #include <errno.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+#include <linux/errqueue.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <stddef.h>
 
-#define PORT 8888
-#define BUFFER_SIZE 1024
-#define MAX_CLIENTS 10
+#include "tcp_frame.h"
+#include "tcp_log.h"
+#include "tcp_metrics.h"
+#include "tcp_timer.h"
+#include "tcp_lz.h"
+#include "tcp_handler.h"
+#include "tcp_kv.h"
+#include "tcp_journal.h"
+#include "tcp_tls.h"
+
+#define DEFAULT_PORT 8888
+#define BUFFER_SIZE 1024    // 欢迎消息等固定长度缓冲区，也是默认的读缓冲区大小
+#define MIN_READ_BUFFER 256
+#define MAX_READ_BUFFER (64 * 1024)
+#define DEFAULT_THREAD_STACK_KB 128
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define URING_BUF_KEEP (16 * 1024)  // 繁忙连接在两次发送之间最多保留的发送缓冲区大小
+#define ZEROCOPY_MIN_BYTES (10 * 1024)  // 小于该字节数的发送用普通sendmsg，等待完成通知比复制更慢
+#define DEFAULT_BACKLOG SOMAXCONN
+#define EPOLL_MAX_EVENTS 256
+#define DEFAULT_POOL_SIZE 64
+#define DEFAULT_QUEUE_DEPTH 256
+#define DEFAULT_URING_ENTRIES 1024
+#define DEFAULT_URING_BUFFERS 1024
+#define RING_MIN_CAPACITY 4096
+#define REPLY_MAX_FRAMES 64
+#define REPLY_MAX_IOV (REPLY_MAX_FRAMES * 4)
+#define PEER_ADDR_LEN 64    // "IP:端口"字符串的长度（IPv6为"[IP]:端口"）
+#define MAX_LISTENERS 16            // --bind最多的地址数
+#define BIND_LIST_LEN 1024          // --bind参数（逗号分隔的地址列表）的最大长度
+#define DEFAULT_STATS_PORT (DEFAULT_PORT + 1)
+#define DEFAULT_STATS_INTERVAL 10
+#define TIMEOUT_TICK_MS 100         // 超时检查的精度（时间轮的tick）
+#define DEFAULT_READ_TIMEOUT 30
+#define DEFAULT_WRITE_TIMEOUT 30
+#define DEFAULT_KEEPALIVE_IDLE 60
+#define DEFAULT_KEEPALIVE_INTERVAL 10
+#define DEFAULT_KEEPALIVE_COUNT 6
+#define ADMIT_STRIPES 64            // 来源IP表的分段数，每段一把锁
+#define ADMIT_STRIPE_SLOTS 2048     // 每段的槽位数
+#define ACCEPT_BATCH 64             // 事件循环每次唤醒最多接受的连接数，连接洪泛时不饿死已有连接
+#define ACCEPT_SHED_WAIT_MS 100     // fd用尽时阻塞式accept循环等待新连接的时间
+#define DEFAULT_DRAIN_TIMEOUT 30
+#define RESTART_READY_TIMEOUT_MS 10000  // 热重启时等待新进程就绪的最长时间
+#define LISTEN_FDS_ENV "SERVERTCP_LISTEN_FDS"   // 热重启：新进程继承的监听socket
+#define READY_FD_ENV "SERVERTCP_READY_FD"       // 热重启：新进程就绪后通知旧进程的管道
+#define CHAT_DEFAULT_QUEUE (256 * 1024)     // 聊天室成员允许积压的字节数
+#define CHAT_DEFAULT_ROOM "lobby"
+#define CHAT_ROOM_NAME 32
+#define CHAT_ROOM_BUCKETS 256
+#define CHAT_FLUSH_IOV 64           // 每次writev最多发送的消息数
+#define DEFAULT_COMPRESS_THRESHOLD 1024 // 回复达到该字节数时才压缩，太小的消息压缩不划算
+#define XFER_CHUNK (4 * 1024 * 1024)    // 文件传输每次sendfile/splice的最大字节数
+#define XFER_PIPE_SIZE (1024 * 1024)    // 上传时splice管道的容量
+#define XFER_BURST 16                   // 事件循环每次最多传输的块数，之后让出给其他连接
+#define XFER_PROGRESS_BYTES (256ULL * 1024 * 1024)  // 每传输这么多字节输出一次进度
+#define XFER_UPLOAD_NAME_MAX (NAME_MAX - 6)  // 临时文件名".名字.part"比上传的文件名长6个字节
+#define DEFAULT_JOURNAL_SEGMENT_MB 64
+#define DEFAULT_JOURNAL_SYNC_MS 10
+#define JOURNAL_SLOW_SYNC_NS (100 * 1000000ULL)     // 一次同步超过这么久时输出警告
+
+// 客户端地址。双栈socket上的IPv4连接在accept后转换为AF_INET，与IPv4 socket上的连接一样显示和计数；
+// UNIX socket的对端一般没有绑定地址，改为记录对端的进程号（SO_PEERCRED）
+typedef union {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+    struct {
+        sa_family_t family;     // AF_UNIX
+        pid_t pid;
+    } un;
+} peer_addr_t;
 
 // 线程参数结构体
 typedef struct {
     int client_socket;
-    struct sockaddr_in client_addr;
+    peer_addr_t client_addr;
 } thread_args_t;
 
+// 线程池队列满时的处理策略
+typedef enum {
+    BACKPRESSURE_REJECT = 1,    // 立即拒绝新连接
+    BACKPRESSURE_QUEUE = 2,     // 暂停accept，让新连接留在内核队列中
+    BACKPRESSURE_BLOCK = 3      // 先accept，再阻塞等待队列空位
+} backpressure_t;
+
+// 应用层协议
+typedef enum {
+    PROTOCOL_TEXT = 0,      // 每次recv的内容作为一条消息（兼容telnet/nc）
+    PROTOCOL_FRAMED = 1     // 长度前缀帧协议，支持pipelining
+} protocol_t;
+
+// 服务器运行参数，可以来自命令行、配置文件或交互式输入
+typedef struct {
+    int mode;               // 服务器类型（菜单编号1-3、5-8，4是退出），0表示启动后交互式选择
+    int quiet;              // 不输出启动横幅、网络环境检查和IP地址列表
+    char bind_addr[BIND_LIST_LEN];  // 逗号分隔的监听地址：IPv4、IPv6（"::"为双栈）或unix:路径
+    int port;
+    protocol_t protocol;
+    int backlog;            // listen队列长度
+    int read_buffer;        // 文本协议每次recv（io_uring每个接收缓冲区）的字节数
+    int rcvbuf;             // SO_RCVBUF，0表示使用内核默认值
+    int sndbuf;             // SO_SNDBUF，0表示使用内核默认值
+    int nodelay;            // TCP_NODELAY
+    int thread_stack_kb;    // worker/reactor线程的栈大小（KB）
+    int reactor_threads;    // 多reactor模式的线程数，0表示使用CPU核数
+    int cpu_affinity;       // 是否把reactor线程绑定到CPU核心
+    int pool_size;          // 多线程模式的worker线程数，0表示每个连接一个线程
+    int queue_depth;        // 线程池等待队列长度
+    backpressure_t backpressure;
+    int prefork_workers;    // 预派生worker进程数，0表示使用CPU核数
+    int prefork_reuseport;  // 预派生worker是否各自使用SO_REUSEPORT监听socket
+    unsigned uring_entries; // io_uring提交队列深度
+    unsigned uring_buffers; // io_uring接收缓冲区个数（2的幂）
+    int zerocopy_threshold; // 帧协议下一批回复达到该字节数时使用MSG_ZEROCOPY，0表示不使用
+    int log_level;          // log_level_t，LOG_LEVEL_INFO及以下不输出每条消息的日志
+    int log_rate_limit;     // 每个线程每秒最多的连接/消息日志条数，0表示不限
+    int stats_port;         // 只监听127.0.0.1的统计端口，0表示不启用
+    int stats_interval;     // 输出统计摘要的间隔（秒），0表示不输出
+    int idle_timeout;       // 多久没有收到任何数据就断开（秒），0表示不限
+    int read_timeout;       // 帧协议下一条消息开始到达后多久内必须收完（秒），0表示不限
+    int write_timeout;      // 一次发送因对端不读取而阻塞的最长时间（秒），0表示不限
+    int max_lifetime;       // 连接的最长存活时间（秒），0表示不限
+    int keepalive;          // SO_KEEPALIVE，探测已经消失的对端
+    int keepalive_idle;     // TCP_KEEPIDLE：空闲多久后开始探测（秒）
+    int keepalive_interval; // TCP_KEEPINTVL：探测间隔（秒）
+    int keepalive_count;    // TCP_KEEPCNT：连续多少次探测无响应后断开
+    int max_connections;    // 所有进程合计的最大连接数，0表示不限
+    int max_per_ip;         // 每个来源IP的最大连接数，0表示不限
+    int per_ip_rate;        // 每个来源IP每秒最多新建的连接数（令牌桶），0表示不限
+    int per_ip_burst;       // 令牌桶容量，允许的突发连接数
+    int drain_timeout;      // 收到SIGTERM后等待现有连接结束的最长时间（秒）
+    int chat;               // 聊天室模式：消息转发给同一房间的其他客户端（仅事件驱动模式）
+    int chat_queue;         // 聊天室成员的发送队列最多积压的字节数，超过时断开
+    int compress;           // 帧协议下是否同意客户端在握手时请求的负载压缩
+    int compress_threshold; // 启用压缩的连接上，回复达到该字节数时才压缩
+    char files_dir[PATH_MAX];   // 帧协议下可以下载文件的目录，空字符串表示不启用文件传输
+    int upload;             // 是否接受客户端上传文件到files_dir
+    int kv_memory;          // 键值存储的总内存（MB），0表示不启用/get /set等命令
+    char journal_dir[PATH_MAX]; // 消息日志目录，空字符串表示不记录收到的消息
+    int journal_segment;    // 每个日志段文件的大小（MB）
+    int journal_sync_ms;    // 有新记录后最多等待多久同步一次
+    int journal_wait;       // 阻塞式模式是否等记录落盘后才回复
+    char tls_cert[PATH_MAX];    // PEM格式的证书链，空字符串表示不启用TLS
+    char tls_key[PATH_MAX];     // 证书的私钥
+} server_config_t;
+
+server_config_t server_config = {
+    .mode = 0,
+    .quiet = 0,
+    .bind_addr = "::",
+    .port = DEFAULT_PORT,
+    .protocol = PROTOCOL_TEXT,
+    .backlog = DEFAULT_BACKLOG,
+    .read_buffer = BUFFER_SIZE,
+    .rcvbuf = 0,
+    .sndbuf = 0,
+    .nodelay = 0,
+    .thread_stack_kb = DEFAULT_THREAD_STACK_KB,
+    .reactor_threads = 0,
+    .cpu_affinity = 0,
+    .pool_size = DEFAULT_POOL_SIZE,
+    .queue_depth = DEFAULT_QUEUE_DEPTH,
+    .backpressure = BACKPRESSURE_BLOCK,
+    .prefork_workers = 0,
+    .prefork_reuseport = 0,
+    .uring_entries = DEFAULT_URING_ENTRIES,
+    .uring_buffers = DEFAULT_URING_BUFFERS,
+    .zerocopy_threshold = 0,
+    .log_level = LOG_LEVEL_DEBUG,
+    .log_rate_limit = 0,
+    .stats_port = DEFAULT_STATS_PORT,
+    .stats_interval = DEFAULT_STATS_INTERVAL,
+    .idle_timeout = 0,
+    .read_timeout = DEFAULT_READ_TIMEOUT,
+    .write_timeout = DEFAULT_WRITE_TIMEOUT,
+    .max_lifetime = 0,
+    .keepalive = 1,
+    .keepalive_idle = DEFAULT_KEEPALIVE_IDLE,
+    .keepalive_interval = DEFAULT_KEEPALIVE_INTERVAL,
+    .keepalive_count = DEFAULT_KEEPALIVE_COUNT,
+    .max_connections = 0,
+    .max_per_ip = 0,
+    .per_ip_rate = 0,
+    .per_ip_burst = 0,
+    .drain_timeout = DEFAULT_DRAIN_TIMEOUT,
+    .chat = 0,
+    .chat_queue = CHAT_DEFAULT_QUEUE,
+    .compress = 0,
+    .compress_threshold = DEFAULT_COMPRESS_THRESHOLD,
+    .files_dir = "",
+    .upload = 0,
+    .kv_memory = 0,
+    .journal_dir = "",
+    .journal_segment = DEFAULT_JOURNAL_SEGMENT_MB,
+    .journal_sync_ms = DEFAULT_JOURNAL_SYNC_MS,
+    .journal_wait = 0,
+    .tls_cert = "",
+    .tls_key = "",
+};
+
+// 当前运行模式，作为统计指标的mode标签
+const char* server_mode_name = "basic";
+int stats_listen_fd = -1;
+int files_dir_fd = -1;      // 启用文件传输时为--files目录
+kv_store_t* kv_store;       // NULL表示没有启用键值存储
+journal_t journal;          // journal.shared为NULL表示没有启用消息日志
+SSL_CTX* tls_ctx;           // NULL表示不启用TLS
+
 // 信号处理函数，处理僵尸进程
 void sigchld_handler(int sig) {
     (void)sig; // 避免未使用参数警告
     while (waitpid(-1, NULL, WNOHANG) > 0);
 }
 
-// 获取本机所有IP地址
-void print_server_ips() {
-    struct ifaddrs *ifaddrs_ptr, *ifa;
-    char ip_str[INET_ADDRSTRLEN];
-    
-    printf("\n服务器可用的IP地址:\n");
-    printf("====================\n");
+// 单调时钟（纳秒），用于统计处理时间
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// fork出的worker进程：不继承统计端口，计数改用自己的槽位
+void stats_after_fork() {
+    if (stats_listen_fd != -1) close(stats_listen_fd);
+    stats_listen_fd = -1;
+    metrics_after_fork();
+}
+
+// 一个--bind地址，端口在所有参数确定后填入
+typedef struct {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+        struct sockaddr_un un;
+    } addr;
+    socklen_t len;
+    int v6only;             // IPv6 socket只接受IPv6连接；"::"在列表中没有0.0.0.0时是双栈的
+    int shared_fd;          // UNIX socket没有SO_REUSEPORT分发，各reactor/worker共用这一个，-1表示还没有创建
+    char name[sizeof(struct sockaddr_un) + 8];  // 显示用的"IP:端口"、"[IP]:端口"或"unix:路径"
+} listen_addr_t;
+
+// 一个accept循环、reactor或worker的监听socket，fds[i]对应listen_addrs[i]
+typedef struct {
+    int fds[MAX_LISTENERS];
+    int count;
+} listeners_t;
+
+listen_addr_t listen_addrs[MAX_LISTENERS];
+int listen_addr_count;
+int handed_over;            // 监听socket已交给热重启的新进程，退出时不删除UNIX socket文件
+
+// 把IPv4/IPv6地址格式化为"IP:端口"或"[IP]:端口"
+const char* format_ip_port(char* out, size_t size, const struct sockaddr* sa) {
+    char ip[INET6_ADDRSTRLEN];
+    
+    if (sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)sa;
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        snprintf(out, size, "[%s]:%d", ip, ntohs(in6->sin6_port));
+    } else {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)sa;
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        snprintf(out, size, "%s:%d", ip, ntohs(in->sin_port));
+    }
+    return out;
+}
+
+// 解析一个监听地址：IPv4、IPv6（可以加方括号，链路本地地址带%网卡名）、unix:路径或unix:@抽象名字，
+// 失败返回-1
+int parse_listen_addr(const char* text, int port, listen_addr_t* out) {
+    struct addrinfo hints;
+    struct addrinfo* result;
+    char host[INET6_ADDRSTRLEN + IF_NAMESIZE];
+    size_t len = strlen(text);
+    
+    memset(out, 0, sizeof(*out));
+    out->shared_fd = -1;
+    if (strncmp(text, "unix:", 5) == 0) {
+        const char* path = text + 5;
+        size_t path_len = strlen(path);
+        
+        if (path_len == 0 || path_len >= sizeof(out->addr.un.sun_path)) return -1;
+        out->addr.un.sun_family = AF_UNIX;
+        memcpy(out->addr.un.sun_path, path, path_len);
+        // 抽象命名空间不在文件系统中创建文件：名字以'\0'开头，长度不包括结尾的'\0'
+        if (path[0] == '@') {
+            out->addr.un.sun_path[0] = '\0';
+            out->len = offsetof(struct sockaddr_un, sun_path) + path_len;
+        } else {
+            out->len = offsetof(struct sockaddr_un, sun_path) + path_len + 1;
+        }
+        snprintf(out->name, sizeof(out->name), "%s", text);
+        return 0;
+    }
+    
+    if (len > 2 && text[0] == '[' && text[len - 1] == ']') {
+        text++;
+        len -= 2;
+    }
+    if (len == 0 || len >= sizeof(host)) return -1;
+    memcpy(host, text, len);
+    host[len] = '\0';
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_NUMERICHOST | AI_PASSIVE;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0) return -1;
+    memcpy(&out->addr, result->ai_addr, result->ai_addrlen);
+    out->len = result->ai_addrlen;
+    freeaddrinfo(result);
+    if (out->addr.sa.sa_family == AF_INET6) {
+        out->addr.in6.sin6_port = htons(port);
+    } else {
+        out->addr.in.sin_port = htons(port);
+    }
+    format_ip_port(out->name, sizeof(out->name), &out->addr.sa);
+    return 0;
+}
+
+int listen_addr_is_any4(const listen_addr_t* addr) {
+    return addr->addr.sa.sa_family == AF_INET && addr->addr.in.sin_addr.s_addr == htonl(INADDR_ANY);
+}
+
+int listen_addr_is_any6(const listen_addr_t* addr) {
+    return addr->addr.sa.sa_family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&addr->addr.in6.sin6_addr);
+}
+
+// 解析逗号分隔的--bind列表，返回地址数；失败返回-1（已输出原因）
+int parse_bind_list(const char* value, int port, listen_addr_t* addrs) {
+    char list[BIND_LIST_LEN];
+    char* save = NULL;
+    int count = 0;
+    int any4 = 0;
+    
+    if (strlen(value) >= sizeof(list)) {
+        printf("❌ 监听地址列表太长 (最多 %d 个字符)\n", BIND_LIST_LEN - 1);
+        return -1;
+    }
+    strcpy(list, value);
+    for (char* item = strtok_r(list, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        size_t len;
+        
+        while (*item == ' ') item++;
+        len = strlen(item);
+        while (len > 0 && item[len - 1] == ' ') item[--len] = '\0';
+        if (count == MAX_LISTENERS) {
+            printf("❌ 最多监听 %d 个地址\n", MAX_LISTENERS);
+            return -1;
+        }
+        if (parse_listen_addr(item, port, &addrs[count]) < 0) {
+            printf("❌ 无效的监听地址: %s (应为IPv4地址、IPv6地址或unix:路径)\n", item);
+            return -1;
+        }
+        if (listen_addr_is_any4(&addrs[count])) any4 = 1;
+        count++;
+    }
+    if (count == 0) {
+        printf("❌ 至少需要一个监听地址\n");
+        return -1;
+    }
+    // 同时监听0.0.0.0时"::"不能再接受IPv4连接，否则两者绑定同一端口会冲突
+    for (int i = 0; i < count; i++) {
+        if (addrs[i].addr.sa.sa_family == AF_INET6) addrs[i].v6only = any4 || !listen_addr_is_any6(&addrs[i]);
+    }
+    return count;
+}
+
+// 输出监听地址，通配地址（0.0.0.0、::）展开为本机各网卡的地址
+void print_server_ips() {
+    struct ifaddrs *ifaddrs_ptr, *ifa;
+    char addr_str[PEER_ADDR_LEN];
+    int any4 = 0;
+    int any6 = 0;
+    
+    if (server_config.quiet) return;
+    
+    printf("\n服务器可用的地址:\n");
+    printf("====================\n");
+    
+    for (int i = 0; i < listen_addr_count; i++) {
+        const listen_addr_t* addr = &listen_addrs[i];
+        
+        if (addr->addr.sa.sa_family == AF_UNIX) {
+            printf("  %s (UNIX socket - 仅本机进程访问)\n", addr->name);
+        } else if (listen_addr_is_any4(addr)) {
+            any4 = 1;
+        } else if (listen_addr_is_any6(addr)) {
+            any6 = 1;
+            if (!addr->v6only) any4 = 1;
+        } else if ((addr->addr.sa.sa_family == AF_INET && (ntohl(addr->addr.in.sin_addr.s_addr) >> 24) == 127) ||
+                   (addr->addr.sa.sa_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&addr->addr.in6.sin6_addr))) {
+            printf("  %s (本地回环 - 仅本机访问)\n", addr->name);
+        } else {
+            printf("  %s\n", addr->name);
+        }
+    }
+    
+    if (any4 || any6) {
+        if (getifaddrs(&ifaddrs_ptr) == -1) {
+            perror("获取网络接口失败");
+            return;
+        }
+        for (ifa = ifaddrs_ptr; ifa != NULL; ifa = ifa->ifa_next) {
+            listen_addr_t addr;
+            
+            if (ifa->ifa_addr == NULL) continue;
+            if (ifa->ifa_addr->sa_family == AF_INET && any4) {
+                memcpy(&addr.addr.in, ifa->ifa_addr, sizeof(addr.addr.in));
+                addr.addr.in.sin_port = htons(server_config.port);
+            } else if (ifa->ifa_addr->sa_family == AF_INET6 && any6) {
+                memcpy(&addr.addr.in6, ifa->ifa_addr, sizeof(addr.addr.in6));
+                // 链路本地地址需要指定网卡才能连接，不适合直接告诉客户端
+                if (IN6_IS_ADDR_LINKLOCAL(&addr.addr.in6.sin6_addr)) continue;
+                addr.addr.in6.sin6_port = htons(server_config.port);
+            } else {
+                continue;
+            }
+            format_ip_port(addr_str, sizeof(addr_str), &addr.addr.sa);
+            if (ifa->ifa_flags & IFF_LOOPBACK) {
+                printf("  %s (本地回环 - 仅本机访问)\n", addr_str);
+            } else {
+                printf("  %s (%s - 可供其他机器访问)\n", addr_str, ifa->ifa_name);
+            }
+        }
+        freeifaddrs(ifaddrs_ptr);
+    }
+    
+    printf("====================\n");
+    printf("客户端可以使用上述任意地址连接到服务器\n");
+    printf("建议使用标注为'可供其他机器访问'的地址，同一台机器上的程序可以使用UNIX socket\n\n");
+}
+
+// 把客户端地址格式化为"IP:端口"（IPv6为"[IP]:端口"，UNIX socket为"unix:对端进程号"），
+// 每个连接只在accept时格式化一次（inet_ntoa使用共享的静态缓冲区，不是线程安全的）
+const char* format_peer(char* out, size_t size, peer_addr_t addr) {
+    if (addr.sa.sa_family == AF_UNIX) {
+        snprintf(out, size, "unix:%d", (int)addr.un.pid);
+        return out;
+    }
+    return format_ip_port(out, size, &addr.sa);
+}
+
+// accept之后调用：双栈socket上的IPv4连接（::ffff:a.b.c.d）转换为AF_INET，UNIX socket记录对端进程号
+void normalize_peer(int client_socket, peer_addr_t* addr) {
+    if (addr->sa.sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&addr->in6.sin6_addr)) {
+        struct sockaddr_in in;
+        
+        memset(&in, 0, sizeof(in));
+        in.sin_family = AF_INET;
+        in.sin_port = addr->in6.sin6_port;
+        memcpy(&in.sin_addr, &addr->in6.sin6_addr.s6_addr[12], sizeof(in.sin_addr));
+        addr->in = in;
+    } else if (addr->sa.sa_family == AF_UNIX) {
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        
+        addr->un.pid = getsockopt(client_socket, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 ? cred.pid : 0;
+    }
+}
+
+// 格式化欢迎消息，返回消息长度
+int format_welcome(char* out, size_t size, const char* peer) {
+    return snprintf(out, size, 
+                    "欢迎连接到TCP服务器!\n服务器信息: 进程ID=%d, 线程ID=%ld\n客户端信息: %s\n", 
+                    getpid(), pthread_self(), peer);
+}
+
+// 检查是否是退出命令
+int is_quit_command(const char* buffer) {
+    return strncmp(buffer, "quit", 4) == 0;
+}
+
+// 格式化回复头部，同一线程内不变，每个连接（或每个reactor）只需格式化一次
+int format_reply_prefix(char* out, size_t size) {
+    return snprintf(out, size, "服务器回复 [PID:%d,TID:%ld]: ", getpid(), (long)pthread_self());
+}
+
+// 文本协议回显的消息长度，过长的消息会被截断
+size_t echo_payload_len(const char* buffer) {
+    size_t max_msg_len = server_config.read_buffer - 100; // 为格式字符串留出空间
+    size_t len = strlen(buffer);
+    return len > max_msg_len ? max_msg_len : len;
+}
+
+// 按当前协议把欢迎消息追加到out
+int append_welcome(netbuf_t* out, const char* peer) {
+    char welcome[BUFFER_SIZE];
+    int len = format_welcome(welcome, sizeof(welcome), peer);
+    
+    if (server_config.protocol == PROTOCOL_FRAMED) {
+        return frame_append(out, FRAME_WELCOME, 0, NULL, 0, welcome, len);
+    }
+    return netbuf_append(out, welcome, len);
+}
+
+// ==================== 连接超时 ====================
+
+// 连接的时间点（tick），0表示对应的状态不存在；阻塞式模式下由reaper线程读取，所以用原子操作读写
+typedef struct {
+    uint64_t created;
+    uint64_t last_read;         // 最近一次收到数据
+    uint64_t partial_since;     // 缓冲区中开始有不完整的消息
+    uint64_t write_since;       // 当前这次发送开始阻塞
+} conn_times_t;
+
+// 当前tick，从1开始，0留给"没有发生"
+uint64_t timeout_tick() {
+    return monotonic_ns() / (TIMEOUT_TICK_MS * 1000000ULL) + 1;
+}
+
+int timeouts_enabled() {
+    return server_config.idle_timeout > 0 || server_config.read_timeout > 0 ||
+           server_config.write_timeout > 0 || server_config.max_lifetime > 0;
+}
+
+void conn_times_init(conn_times_t* times, uint64_t now) {
+    times->created = times->last_read = now;
+    times->partial_since = times->write_since = 0;
+}
+
+// active为1时记录状态开始的时间（已经开始的不更新），为0时清除
+void timeout_mark(uint64_t* since, int active, uint64_t now) {
+    if (!active) {
+        __atomic_store_n(since, 0, __ATOMIC_RELAXED);
+    } else if (__atomic_load_n(since, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(since, now, __ATOMIC_RELAXED);
+    }
+}
+
+// 检查一项超时：已超时返回1，否则把截止时间合并到next
+int timeout_expired(const uint64_t* since, int seconds, uint64_t now, uint64_t* next) {
+    uint64_t start = __atomic_load_n(since, __ATOMIC_RELAXED);
+    uint64_t deadline;
+    
+    if (start == 0 || seconds <= 0) return 0;
+    deadline = start + (uint64_t)seconds * (1000 / TIMEOUT_TICK_MS);
+    if (deadline <= now) return 1;
+    if (deadline < *next) *next = deadline;
+    return 0;
+}
+
+// 检查连接是否超时：超时返回0并设置reason，否则返回下一次需要检查的tick（UINT64_MAX表示不需要）
+// 收到数据时只更新时间点，不移动定时器；定时器到期时再按最新的时间点重新计算
+uint64_t conn_timeout_check(const conn_times_t* times, uint64_t now, const char** reason) {
+    uint64_t next = UINT64_MAX;
+    int recheck = 0;
+    
+    if (timeout_expired(&times->write_since, server_config.write_timeout, now, &next)) {
+        *reason = "发送超时";
+        return 0;
+    }
+    if (timeout_expired(&times->partial_since, server_config.read_timeout, now, &next)) {
+        *reason = "读取超时";
+        return 0;
+    }
+    if (timeout_expired(&times->last_read, server_config.idle_timeout, now, &next)) {
+        *reason = "空闲超时";
+        return 0;
+    }
+    if (timeout_expired(&times->created, server_config.max_lifetime, now, &next)) {
+        *reason = "超过最大连接时长";
+        return 0;
+    }
+    
+    // 发送和读取超时的起点可能在下一次检查之前才出现，检查间隔不能超过这两个超时
+    if (server_config.write_timeout > 0) recheck = server_config.write_timeout;
+    if (server_config.read_timeout > 0 && (recheck == 0 || server_config.read_timeout < recheck)) {
+        recheck = server_config.read_timeout;
+    }
+    if (recheck > 0 && now + (uint64_t)recheck * (1000 / TIMEOUT_TICK_MS) < next) {
+        next = now + (uint64_t)recheck * (1000 / TIMEOUT_TICK_MS);
+    }
+    return next;
+}
+
+// 把连接加入时间轮（没有启用任何超时时不加入）
+void timeout_schedule(timer_wheel_t* wheel, timer_node_t* timer, const conn_times_t* times) {
+    const char* reason;
+    uint64_t next = conn_timeout_check(times, wheel->now, &reason);
+    
+    if (next != UINT64_MAX) timer_add(wheel, timer, next);
+}
+
+void log_timeout(const char* peer, const char* reason) {
+    log_info("⏱️  客户端 %s %s，断开连接\n", peer, reason);
+    metrics_count(timeouts, 1);
+}
+
+// 阻塞式模式（基础、多进程、多线程、线程池）的连接：处理线程阻塞在recv/send中，
+// 由reaper线程推进时间轮，超时后shutdown socket，让阻塞的调用返回
+typedef struct {
+    timer_node_t timer;
+    conn_times_t times;
+    int fd;                     // -1表示没有登记
+    const char* expired;        // 超时原因，由reaper线程设置
+} blocking_conn_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // 时间轮为空时reaper线程在这里等待
+    int running;
+    timer_wheel_t wheel;
+} reaper_t;
+
+reaper_t reaper = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, { 0 } };
+
+void* reaper_thread(void* arg) {
+    struct timespec tick = { 0, TIMEOUT_TICK_MS * 1000000L };
+    timer_node_t* node;
+    
+    (void)arg;
+    pthread_mutex_lock(&reaper.lock);
+    while (1) {
+        if (reaper.wheel.count == 0) {
+            pthread_cond_wait(&reaper.wakeup, &reaper.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&reaper.lock);
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&reaper.lock);
+        
+        timer_advance(&reaper.wheel, timeout_tick());
+        while ((node = timer_expired(&reaper.wheel)) != NULL) {
+            blocking_conn_t* conn = (blocking_conn_t*)node;
+            const char* reason;
+            uint64_t next = conn_timeout_check(&conn->times, reaper.wheel.now, &reason);
+            
+            if (next == 0) {
+                __atomic_store_n(&conn->expired, reason, __ATOMIC_RELEASE);
+                shutdown(conn->fd, SHUT_RDWR);
+            } else if (next != UINT64_MAX) {
+                timer_add(&reaper.wheel, node, next);
+            }
+        }
+    }
+    return NULL;
+}
+
+// 登记连接，第一次登记时启动本进程的reaper线程
+void reaper_register(blocking_conn_t* conn, int fd) {
+    pthread_t thread;
+    
+    conn->fd = -1;
+    conn->expired = NULL;
+    conn->timer.next = NULL;
+    if (!timeouts_enabled()) return;
+    
+    pthread_mutex_lock(&reaper.lock);
+    if (!reaper.running) {
+        timer_wheel_init(&reaper.wheel, timeout_tick());
+        if (pthread_create(&thread, NULL, reaper_thread, NULL) != 0) {
+            pthread_mutex_unlock(&reaper.lock);
+            log_warn("⚠️  创建超时检查线程失败，连接不会因超时断开\n");
+            return;
+        }
+        pthread_detach(thread);
+        reaper.running = 1;
+    }
+    timer_advance(&reaper.wheel, timeout_tick());
+    conn->fd = fd;
+    conn_times_init(&conn->times, reaper.wheel.now);
+    timeout_schedule(&reaper.wheel, &conn->timer, &conn->times);
+    pthread_cond_signal(&reaper.wakeup);
+    pthread_mutex_unlock(&reaper.lock);
+}
+
+// 注销连接，必须在close之前调用，保证reaper不会shutdown一个已被复用的fd；返回超时原因
+const char* reaper_unregister(blocking_conn_t* conn) {
+    if (conn->fd == -1) return NULL;
+    pthread_mutex_lock(&reaper.lock);
+    timer_del(&reaper.wheel, &conn->timer);
+    pthread_mutex_unlock(&reaper.lock);
+    conn->fd = -1;
+    return __atomic_load_n(&conn->expired, __ATOMIC_ACQUIRE);
+}
+
+int reaper_expired(blocking_conn_t* conn) {
+    return __atomic_load_n(&conn->expired, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// 阻塞式连接收到了数据
+void blocking_touch(blocking_conn_t* conn) {
+    if (conn->fd != -1) __atomic_store_n(&conn->times.last_read, timeout_tick(), __ATOMIC_RELAXED);
+}
+
+// 阻塞式连接开始或结束一次发送/一条不完整的消息
+void blocking_mark(blocking_conn_t* conn, uint64_t* since, int active) {
+    if (conn->fd != -1) timeout_mark(since, active, timeout_tick());
+}
+
+// fork出的子进程中reaper线程不存在，第一次登记时重新启动
+void reaper_after_fork() {
+    pthread_mutex_init(&reaper.lock, NULL);
+    pthread_cond_init(&reaper.wakeup, NULL);
+    reaper.running = 0;
+}
+
+// ==================== 平滑关闭和热重启 ====================
+
+// SIGTERM/SIGINT：停止接受新连接，等现有连接结束（最多drain_timeout秒）后退出，再收到一次则立即退出；
+// SIGUSR2：热重启，用同样的参数启动新程序并把监听socket传给它，新程序就绪后本进程开始排空。
+// 这些信号在所有线程中都被屏蔽，由lifecycle线程用sigwait同步处理；开始排空时写lifecycle_wake_fd
+// （eventfd，之后一直可读），唤醒各个accept循环
+int draining;
+int lifecycle_wake_fd = -1;
+int lifecycle_is_worker;        // 预派生worker只响应排空，热重启由master负责
+void (*drain_hook)(void);       // 开始排空时调用，预派生master用它通知worker
+int active_clients;             // 阻塞式模式中已交给处理线程、尚未处理完的连接数
+char** saved_argv;
+int* listen_fds;                // 本进程的监听socket（包括统计端口），热重启时传给新进程
+int listen_fd_count;
+int* inherited_fds;             // 从旧进程继承、尚未使用的监听socket，-1表示已使用
+int inherited_fd_count;
+int ready_fd = -1;              // 就绪后通知旧进程
+
+int server_draining() {
+    return __atomic_load_n(&draining, __ATOMIC_ACQUIRE);
+}
+
+void lifecycle_signals(sigset_t* set) {
+    sigemptyset(set);
+    sigaddset(set, SIGTERM);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGUSR2);
+}
+
+void register_listen_fd(int fd) {
+    int* fds = realloc(listen_fds, (listen_fd_count + 1) * sizeof(int));
+    if (fds == NULL) return;
+    listen_fds = fds;
+    listen_fds[listen_fd_count++] = fd;
+}
+
+// 取出一个绑定在addr上的继承socket（IPv4、IPv6或UNIX socket），没有时返回-1
+int adopt_listen_fd(const struct sockaddr* addr, socklen_t addr_len) {
+    for (int i = 0; i < inherited_fd_count; i++) {
+        struct sockaddr_storage bound;
+        socklen_t len = sizeof(bound);
+        
+        if (inherited_fds[i] == -1) continue;
+        memset(&bound, 0, sizeof(bound));
+        if (getsockname(inherited_fds[i], (struct sockaddr*)&bound, &len) < 0 ||
+            len != addr_len || memcmp(&bound, addr, len) != 0) {
+            continue;
+        }
+        int fd = inherited_fds[i];
+        inherited_fds[i] = -1;
+        return fd;
+    }
+    return -1;
+}
+
+// 监听socket都已建立：关闭用不到的继承socket（例如改了端口），通知旧进程开始排空
+void server_ready() {
+    pid_t pid = getpid();
+    
+    for (int i = 0; i < inherited_fd_count; i++) {
+        if (inherited_fds[i] != -1) close(inherited_fds[i]);
+    }
+    free(inherited_fds);
+    inherited_fds = NULL;
+    inherited_fd_count = 0;
+    
+    if (ready_fd == -1) return;
+    if (write(ready_fd, &pid, sizeof(pid)) != sizeof(pid)) perror("⚠️  通知旧进程失败");
+    close(ready_fd);
+    ready_fd = -1;
+}
+
+// 启动新程序，等它接管监听socket；失败时返回-1，本进程继续正常运行。
+// 新程序由中间进程启动后中间进程立即退出，它不是本进程的子进程，排空时等待子进程不会等到它
+int hot_restart() {
+    extern char** environ;
+    char** envp;
+    char* fds_env;
+    char ready_env[64];
+    int ready[2];
+    int env_count = 0;
+    int fd_count = 0;
+    pid_t new_pid = 0;
+    pid_t pid;
+    size_t len;
+    
+    if (server_config.mode == 0) {
+        printf("⚠️  交互式启动的服务器不支持热重启，请用 --mode 启动\n");
+        return -1;
+    }
+    
+    // fork之后只能调用异步信号安全的函数，参数和环境变量在这里准备好
+    fds_env = malloc(strlen(LISTEN_FDS_ENV) + 2 + (size_t)listen_fd_count * 12);
+    while (environ[env_count] != NULL) env_count++;
+    envp = calloc(env_count + 3, sizeof(char*));
+    if (fds_env == NULL || envp == NULL || pipe2(ready, O_CLOEXEC) < 0) {
+        perror("❌ 热重启失败");
+        free(fds_env);
+        free(envp);
+        return -1;
+    }
+    
+    len = (size_t)sprintf(fds_env, "%s=", LISTEN_FDS_ENV);
+    for (int i = 0; i < listen_fd_count; i++) {
+        int listening = 0;
+        socklen_t opt_len = sizeof(listening);
+        if (getsockopt(listen_fds[i], SOL_SOCKET, SO_ACCEPTCONN, &listening, &opt_len) < 0 || !listening) continue;
+        len += sprintf(fds_env + len, "%s%d", fd_count++ > 0 ? "," : "", listen_fds[i]);
+    }
+    snprintf(ready_env, sizeof(ready_env), "%s=%d", READY_FD_ENV, ready[1]);
+    
+    env_count = 0;
+    for (char** env = environ; *env != NULL; env++) {
+        if (strncmp(*env, LISTEN_FDS_ENV "=", strlen(LISTEN_FDS_ENV) + 1) == 0 ||
+            strncmp(*env, READY_FD_ENV "=", strlen(READY_FD_ENV) + 1) == 0) {
+            continue;
+        }
+        envp[env_count++] = *env;
+    }
+    envp[env_count++] = fds_env;
+    envp[env_count++] = ready_env;
+    
+    printf("🔁 热重启: 启动新进程 %s，传递 %d 个监听socket\n", saved_argv[0], fd_count);
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        if (fork() != 0) _exit(0);
+        for (int i = 0; i < listen_fd_count; i++) fcntl(listen_fds[i], F_SETFD, 0);
+        fcntl(ready[1], F_SETFD, 0);
+        execvpe(saved_argv[0], saved_argv, envp);
+        _exit(127);
+    }
+    close(ready[1]);
+    free(fds_env);
+    free(envp);
+    if (pid < 0) {
+        perror("❌ 热重启失败");
+        close(ready[0]);
+        return -1;
+    }
+    waitpid(pid, NULL, 0); // 多进程模式下可能已被SIGCHLD处理函数回收
+    
+    // 新进程退出（管道关闭）或超时都算失败
+    struct pollfd pfd = { ready[0], POLLIN, 0 };
+    if (poll(&pfd, 1, RESTART_READY_TIMEOUT_MS) > 0 && read(ready[0], &new_pid, sizeof(new_pid)) != sizeof(new_pid)) {
+        new_pid = 0;
+    }
+    close(ready[0]);
+    if (new_pid <= 0) {
+        printf("❌ 热重启失败: 新进程已退出或 %d 秒内没有就绪，继续运行\n", RESTART_READY_TIMEOUT_MS / 1000);
+        return -1;
+    }
+    printf("✅ 新进程 %d 已接管监听socket\n", new_pid);
+    handed_over = 1;
+    return 0;
+}
+
+// 开始排空：各accept循环被唤醒后关闭监听socket，处理完现有连接后返回
+void drain_begin(const char* reason) {
+    uint64_t one = 1;
+    
+    printf("🛑 %s，停止接受新连接，等待现有连接结束 (最多 %d 秒)\n", reason, server_config.drain_timeout);
+    fflush(stdout);
+    __atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+    if (lifecycle_wake_fd != -1 && write(lifecycle_wake_fd, &one, sizeof(one)) < 0) {
+        perror("⚠️  唤醒accept循环失败");
+    }
+    if (drain_hook != NULL) drain_hook();
+}
+
+// 排空完成时主线程返回、进程正常退出；超过期限时由本线程退出进程，剩余的连接随之关闭
+void* lifecycle_thread(void* arg) {
+    uint64_t deadline = 0;
+    sigset_t signals;
+    int sig;
+    
+    (void)arg;
+    lifecycle_signals(&signals);
+    while (1) {
+        if (!server_draining()) {
+            if (sigwait(&signals, &sig) != 0) continue;
+            if (sig == SIGUSR2) {
+                if (lifecycle_is_worker || hot_restart() < 0) continue;
+                drain_begin("新进程已就绪");
+            } else {
+                drain_begin(sig == SIGINT ? "收到SIGINT" : "收到SIGTERM");
+            }
+            deadline = monotonic_ns() + (uint64_t)server_config.drain_timeout * 1000000000ULL;
+            continue;
+        }
+        
+        uint64_t now = monotonic_ns();
+        struct timespec remaining = { 0, 0 };
+        if (now < deadline) {
+            remaining.tv_sec = (deadline - now) / 1000000000ULL;
+            remaining.tv_nsec = (deadline - now) % 1000000000ULL;
+        }
+        sig = sigtimedwait(&signals, NULL, &remaining);
+        if ((sig < 0 && errno == EINTR) || sig == SIGUSR2) continue;
+        if (sig < 0) {
+            printf("⏰ 排空超过 %d 秒，强制关闭剩余连接\n", server_config.drain_timeout);
+        } else {
+            printf("🛑 再次收到退出信号，立即退出\n");
+        }
+        break;
+    }
+    exit(0);
+    return NULL;
+}
+
+// 启动lifecycle线程，调用者已经屏蔽了相关信号
+int lifecycle_start() {
+    pthread_t thread;
+    
+    lifecycle_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (lifecycle_wake_fd == -1 || pthread_create(&thread, NULL, lifecycle_thread, NULL) != 0) return -1;
+    pthread_detach(thread);
+    return 0;
+}
+
+// 在创建任何线程之前调用：屏蔽信号（之后创建的线程都会继承），读取旧进程传来的监听socket
+int lifecycle_init(char* argv[]) {
+    const char* env;
+    sigset_t signals;
+    
+    saved_argv = argv;
+    lifecycle_signals(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    env = getenv(LISTEN_FDS_ENV);
+    if (env != NULL) {
+        inherited_fds = calloc(strlen(env) / 2 + 1, sizeof(int));
+        for (const char* p = env; inherited_fds != NULL && *p != '\0'; p++) {
+            char* end;
+            long fd = strtol(p, &end, 10);
+            if (end == p) break;
+            fcntl((int)fd, F_SETFD, FD_CLOEXEC);
+            inherited_fds[inherited_fd_count++] = (int)fd;
+            p = end;
+            if (*p == '\0') break;
+        }
+        unsetenv(LISTEN_FDS_ENV);
+    }
+    env = getenv(READY_FD_ENV);
+    if (env != NULL) {
+        ready_fd = atoi(env);
+        fcntl(ready_fd, F_SETFD, FD_CLOEXEC);
+        unsetenv(READY_FD_ENV);
+    }
+    
+    return lifecycle_start();
+}
+
+// 预派生worker中lifecycle线程不存在：重新启动，使用自己的eventfd，只唤醒本进程的reactor
+void lifecycle_after_fork() {
+    if (lifecycle_wake_fd != -1) close(lifecycle_wake_fd);
+    lifecycle_wake_fd = -1;
+    lifecycle_is_worker = 1;
+    drain_hook = NULL;
+    if (lifecycle_start() < 0) printf("⚠️  worker %d 无法平滑关闭\n", getpid());
+}
+
+// 阻塞式模式：等待处理线程处理完本进程的所有连接（包括线程池队列中的）
+void drain_wait_clients() {
+    struct timespec tick = { 0, TIMEOUT_TICK_MS * 1000000L };
+    
+    while (__atomic_load_n(&active_clients, __ATOMIC_ACQUIRE) > 0) nanosleep(&tick, NULL);
+}
+
+// ==================== 准入控制 ====================
+
+// 每个来源IP的连接数和令牌桶，放在所有进程共享的内存中，按IP哈希分成多段分别加锁
+typedef struct {
+    uint64_t source;            // admit_source()，0表示空槽位
+    int connections;
+    uint64_t tokens;            // 令牌数 x 1000
+    uint64_t refilled;          // 上次补充令牌的时间（纳秒）
+} admit_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;       // 进程间共享
+    admit_entry_t entries[ADMIT_STRIPE_SLOTS];
+} admit_stripe_t;
+
+typedef struct {
+    int active;                 // 所有进程的当前连接数，原子操作
+    admit_stripe_t stripes[ADMIT_STRIPES];
+} admit_shared_t;
+
+admit_shared_t* admit_area;     // NULL表示没有启用准入控制
+
+int admit_per_ip_enabled() {
+    return server_config.max_per_ip > 0 || server_config.per_ip_rate > 0;
+}
+
+// 在启动任何worker之前调用；没有设置任何限制时不做任何事
+int admit_init() {
+    pthread_mutexattr_t attr;
+    admit_shared_t* area;
+    
+    if (server_config.max_connections == 0 && !admit_per_ip_enabled()) return 0;
+    if (server_config.per_ip_rate > 0 && server_config.per_ip_burst == 0) {
+        server_config.per_ip_burst = server_config.per_ip_rate;
+    }
+    area = mmap(NULL, sizeof(admit_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) return -1;
+    
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < ADMIT_STRIPES; i++) pthread_mutex_init(&area->stripes[i].lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    admit_area = area;
+    
+    if (!server_config.quiet) {
+        printf("🚦 准入控制: 最多 %d 个连接 (0表示不限), 每个IP最多 %d 个, 每个IP每秒 %d 个新连接 (突发 %d)\n",
+               server_config.max_connections, server_config.max_per_ip,
+               server_config.per_ip_rate, server_config.per_ip_burst);
+    }
+    return 0;
+}
+
+// 准入控制的来源：IPv4按地址；IPv6按/64前缀（一台主机通常独占一个/64，可以随意更换其中的地址），
+// 链路本地地址的前缀都相同，改用完整地址，IPv6的来源设置最高位，与IPv4不会重复。
+// UNIX socket返回0，只计入总连接数，不按来源限制
+uint64_t admit_source(const peer_addr_t* addr) {
+    uint64_t prefix, suffix;
+    
+    if (addr->sa.sa_family == AF_INET) return addr->in.sin_addr.s_addr;
+    if (addr->sa.sa_family != AF_INET6) return 0;
+    memcpy(&prefix, addr->in6.sin6_addr.s6_addr, sizeof(prefix));
+    if (IN6_IS_ADDR_LINKLOCAL(&addr->in6.sin6_addr)) {
+        memcpy(&suffix, addr->in6.sin6_addr.s6_addr + 8, sizeof(suffix));
+        prefix ^= suffix * 0x9E3779B97F4A7C15ULL;
+    }
+    return prefix | 1ULL << 63;
+}
+
+uint32_t admit_hash(uint64_t source) {
+    return (uint32_t)((source * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+// 查找来源对应的槽位，create为1时不存在就分配（优先复用没有连接、令牌已满的槽位），失败返回NULL
+admit_entry_t* admit_lookup(admit_stripe_t* stripe, uint32_t hash, uint64_t source, int create, uint64_t now) {
+    admit_entry_t* reusable = NULL;
+    uint64_t full = (uint64_t)server_config.per_ip_burst * 1000;
+    
+    for (int i = 0; i < ADMIT_STRIPE_SLOTS; i++) {
+        admit_entry_t* entry = &stripe->entries[(hash + i) % ADMIT_STRIPE_SLOTS];
+        if (entry->source == source) return entry;
+        if (entry->source == 0) {
+            if (reusable == NULL) reusable = entry;
+            break;
+        }
+        if (create && reusable == NULL && entry->connections == 0 &&
+            (server_config.per_ip_rate == 0 ||
+             entry->tokens + (now - entry->refilled) / 1000000 * server_config.per_ip_rate >= full)) {
+            reusable = entry;
+        }
+    }
+    if (!create || reusable == NULL) return NULL;
+    reusable->source = source;
+    reusable->connections = 0;
+    reusable->tokens = full;
+    reusable->refilled = now;
+    return reusable;
+}
+
+// 决定是否接受一个新连接：接受时计入连接数并返回NULL，拒绝时返回原因
+const char* admit_connection(uint64_t source) {
+    const char* reason = NULL;
+    
+    if (admit_area == NULL) return NULL;
+    if (server_config.max_connections > 0 &&
+        __atomic_add_fetch(&admit_area->active, 1, __ATOMIC_RELAXED) > server_config.max_connections) {
+        __atomic_sub_fetch(&admit_area->active, 1, __ATOMIC_RELAXED);
+        return "连接数已达上限";
+    }
+    if (!admit_per_ip_enabled() || source == 0) return NULL;
+    
+    uint32_t hash = admit_hash(source);
+    admit_stripe_t* stripe = &admit_area->stripes[hash % ADMIT_STRIPES];
+    uint64_t now = monotonic_ns();
+    
+    pthread_mutex_lock(&stripe->lock);
+    admit_entry_t* entry = admit_lookup(stripe, hash / ADMIT_STRIPES, source, 1, now);
+    if (entry == NULL) {
+        reason = "来源IP过多";
+    } else if (server_config.max_per_ip > 0 && entry->connections >= server_config.max_per_ip) {
+        reason = "来源IP的连接数已达上限";
+    } else if (server_config.per_ip_rate > 0) {
+        // 按经过的时间补充令牌（每毫秒 rate/1000 个），新连接消耗一个
+        uint64_t full = (uint64_t)server_config.per_ip_burst * 1000;
+        entry->tokens += (now - entry->refilled) / 1000000 * server_config.per_ip_rate;
+        entry->refilled += (now - entry->refilled) / 1000000 * 1000000;
+        if (entry->tokens > full) entry->tokens = full;
+        if (entry->tokens < 1000) {
+            reason = "来源IP新建连接过快";
+        } else {
+            entry->tokens -= 1000;
+        }
+    }
+    if (reason == NULL) entry->connections++;
+    pthread_mutex_unlock(&stripe->lock);
+    
+    if (reason != NULL && server_config.max_connections > 0) {
+        __atomic_sub_fetch(&admit_area->active, 1, __ATOMIC_RELAXED);
+    }
+    return reason;
+}
+
+// 连接关闭时调用，与admit_connection成对
+void admit_release(uint64_t source) {
+    if (admit_area == NULL) return;
+    if (server_config.max_connections > 0) __atomic_sub_fetch(&admit_area->active, 1, __ATOMIC_RELAXED);
+    if (!admit_per_ip_enabled() || source == 0) return;
+    
+    uint32_t hash = admit_hash(source);
+    admit_stripe_t* stripe = &admit_area->stripes[hash % ADMIT_STRIPES];
+    
+    pthread_mutex_lock(&stripe->lock);
+    admit_entry_t* entry = admit_lookup(stripe, hash / ADMIT_STRIPES, source, 0, 0);
+    if (entry != NULL && entry->connections > 0) entry->connections--;
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+// 快速拒绝：发送一条简短的繁忙提示（帧协议下为ERROR帧，不等待发送完成）后立即关闭
+void reject_busy(int client_socket) {
+    static const char busy[] = "服务器繁忙，请稍后重试\n";
+    unsigned char frame[FRAME_HEADER_SIZE + sizeof(busy)];
+    
+    if (server_config.protocol == PROTOCOL_FRAMED) {
+        frame_encode_header(frame, FRAME_ERROR, 0, sizeof(busy) - 2);
+        memcpy(frame + FRAME_HEADER_SIZE, busy, sizeof(busy) - 2);
+        send(client_socket, frame, FRAME_HEADER_SIZE + sizeof(busy) - 2, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } else {
+        send(client_socket, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    close(client_socket);
+}
+
+// 准入检查：拒绝时发送繁忙提示并关闭socket，返回-1
+int admit_or_reject(int client_socket, peer_addr_t* client_addr) {
+    const char* reason = admit_connection(admit_source(client_addr));
+    char peer[PEER_ADDR_LEN];
+    
+    if (reason == NULL) return 0;
+    log_info("🚫 %s，拒绝客户端 %s\n", reason, format_peer(peer, sizeof(peer), *client_addr));
+    reject_busy(client_socket);
+    metrics_count(rejected, 1);
+    return -1;
+}
+
+int reserve_fd_open() {
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// 文件描述符用尽时accept一直失败（Linux在等待连接之前就分配fd），连接留在监听队列中，
+// 循环会立即再次失败而空转。预留一个fd：用尽时先关闭它，接受一个连接并立即拒绝，再重新预留。
+// wait_ms为等待新连接到达的最长时间，阻塞式accept循环用它代替空转；返回1表示拒绝了一个连接
+int accept_shed(int listen_fd, int* reserve_fd, int wait_ms) {
+    static __thread uint64_t last_warning;
+    struct pollfd pfd = { listen_fd, POLLIN, 0 };
+    int shed = 0;
+    
+    if (monotonic_ns() - last_warning >= 1000000000ULL) {
+        last_warning = monotonic_ns();
+        log_warn("⚠️  文件描述符已用尽 (%s)，新连接将被拒绝\n", strerror(errno));
+    }
+    
+    if (*reserve_fd != -1) close(*reserve_fd);
+    *reserve_fd = -1;
+    if (poll(&pfd, 1, wait_ms) > 0) {
+        int client_socket = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_socket >= 0) {
+            reject_busy(client_socket);
+            metrics_count(rejected, 1);
+            shed = 1;
+        }
+    }
+    *reserve_fd = reserve_fd_open();
+    return shed;
+}
+
+int is_fd_exhausted(int err) {
+    return err == EMFILE || err == ENFILE;
+}
+
+// 阻塞式accept循环共用：接受一个连接并做准入检查，出错或被拒绝时返回-1（调用者继续循环）。
+// 监听socket是非阻塞的（热重启时新旧进程共享accept队列，连接可能被对方取走），
+// 先等待任意一个监听socket可读或开始排空，开始排空后调用者的循环条件不再成立。
+// 几个监听socket同时可读时从上次之后的那个开始，一个地址上的连接洪泛不会饿死其他地址
+int accept_client(const listeners_t* listeners, peer_addr_t* client_addr, int* reserve_fd) {
+    static __thread int next;
+    struct pollfd pfd[MAX_LISTENERS + 1];
+    socklen_t client_len = sizeof(*client_addr);
+    int client_socket;
+    int server_socket = -1;
+    
+    for (int i = 0; i < listeners->count; i++) {
+        pfd[i].fd = listeners->fds[i];
+        pfd[i].events = POLLIN;
+    }
+    pfd[listeners->count].fd = lifecycle_wake_fd;
+    pfd[listeners->count].events = POLLIN;
+    if (poll(pfd, listeners->count + 1, -1) <= 0 || pfd[listeners->count].revents != 0) return -1;
+    for (int i = 0; i < listeners->count && server_socket == -1; i++) {
+        int index = (next + i) % listeners->count;
+        if (pfd[index].revents != 0) {
+            server_socket = listeners->fds[index];
+            next = index + 1;
+        }
+    }
+    if (server_socket == -1) return -1;
+    
+    client_socket = accept(server_socket, &client_addr->sa, &client_len);
+    if (client_socket < 0) {
+        if (is_fd_exhausted(errno)) {
+            accept_shed(server_socket, reserve_fd, ACCEPT_SHED_WAIT_MS);
+        } else if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+            log_error("❌ 接受连接失败: %s\n", strerror(errno));
+        }
+        return -1;
+    }
+    normalize_peer(client_socket, client_addr);
+    if (admit_or_reject(client_socket, client_addr) < 0) return -1;
+    return client_socket;
+}
+
+// ==================== TLS ====================
+
+// 按--tls-cert/--tls-key创建SSL_CTX，在fork出任何worker之前调用，子进程继承同一个会话票据密钥
+int tls_init() {
+    if (server_config.tls_cert[0] == '\0') return 0;
+    tls_ctx = tls_server_ctx(server_config.tls_cert, server_config.tls_key);
+    if (tls_ctx == NULL) return -1;
+    // OpenSSL写socket时没有MSG_NOSIGNAL，客户端中途断开时不能因SIGPIPE终止进程
+    signal(SIGPIPE, SIG_IGN);
+    printf("🔒 TLS: 证书 %s (TLS 1.2，会话票据；内核支持时由kTLS加解密，否则经过中继线程)\n",
+           server_config.tls_cert);
+    return 0;
+}
+
+// UNIX socket上的连接只能来自本机，不加密（kTLS也只支持TCP）
+int peer_uses_tls(const peer_addr_t* addr) {
+    return tls_ctx != NULL && addr->sa.sa_family != AF_UNIX;
+}
+
+void tls_failed(const char* peer) {
+    metrics_count(tls_failures, 1);
+    log_warn("⚠️  客户端 %s TLS握手失败: %s\n", peer, tls_last_error());
+}
+
+// 握手完成：记录指标并取出收发数据用的fd（kTLS时就是fd本身，否则是中继socketpair的一端）
+// 失败返回-1，fd已经关闭
+int tls_established(SSL* ssl, int fd, const char* peer, int nonblock) {
+    int info = tls_info(ssl);
+    
+    metrics_count(tls_handshakes, 1);
+    if (info & TLS_INFO_RESUMED) metrics_count(tls_resumed, 1);
+    if (info & TLS_INFO_OFFLOADED) metrics_count(tls_offloaded, 1);
+    log_debug("🔒 客户端 %s TLS握手完成 (%s，%s)\n", peer,
+              (info & TLS_INFO_RESUMED) ? "恢复会话" : "完整握手",
+              (info & TLS_INFO_OFFLOADED) ? "kTLS" : "中继线程");
+    fd = tls_detach(ssl, fd, nonblock);
+    if (fd < 0) log_error("❌ 客户端 %s 建立TLS中继失败: %s\n", peer, strerror(errno));
+    return fd;
+}
+
+// 阻塞式模式在处理连接的线程（进程）中完成握手，最多等待一个读超时
+// 返回收发数据用的fd，失败返回-1，client_socket已经关闭
+int tls_accept_client(int client_socket, const char* peer) {
+    int timeout_ms = server_config.read_timeout > 0 ? server_config.read_timeout * 1000 : TLS_HANDSHAKE_TIMEOUT_MS;
+    SSL* ssl = tls_new(tls_ctx, client_socket, 1);
+    
+    if (ssl == NULL || tls_handshake(ssl, client_socket, timeout_ms) < 0) {
+        tls_failed(peer);
+        if (ssl != NULL) tls_free(ssl);
+        close(client_socket);
+        return -1;
+    }
+    return tls_established(ssl, client_socket, peer, 0);
+}
+
+// ==================== 命令 ====================
+
+// 内置命令，加入新命令只需实现处理函数并在builtin_handlers中加一行（见tcp_handler.h）
+
+int command_help(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply);
+
+// /echo 文本：与普通消息的回显相同
+int command_echo(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    char prefix[64];
+    int prefix_len = format_reply_prefix(prefix, sizeof(prefix));
+    
+    (void)ctx;
+    if (netbuf_append(reply, prefix, prefix_len) < 0 || netbuf_append(reply, args, len) < 0) {
+        return HANDLER_ERROR;
+    }
+    return netbuf_append(reply, "\n", 1) < 0 ? HANDLER_ERROR : HANDLER_REPLY;
+}
+
+// /upper 文本：转为大写（只转换ASCII字母）
+int command_upper(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    (void)ctx;
+    if (netbuf_reserve(reply, len + 1) < 0) return HANDLER_ERROR;
+    for (size_t i = 0; i < len; i++) {
+        char c = args[i];
+        reply->data[reply->len++] = c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+    }
+    reply->data[reply->len++] = '\n';
+    return HANDLER_REPLY;
+}
+
+// /time：服务器的本地时间
+int command_time(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    struct timespec ts;
+    struct tm tm;
+    char text[64];
+    
+    (void)ctx;
+    (void)args;
+    (void)len;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+    handler_printf(reply, "%s.%03ld\n", text, ts.tv_nsec / 1000000);
+    return HANDLER_REPLY;
+}
+
+// /stats：全部worker汇总的连接数、消息数、流量和延迟
+int command_stats(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    metrics_slot_t* m = malloc(sizeof(metrics_slot_t));
+    
+    (void)ctx;
+    (void)args;
+    (void)len;
+    if (m == NULL) {
+        handler_printf(reply, "%s\n", strerror(ENOMEM));
+        return HANDLER_ERROR;
+    }
+    metrics_snapshot(m);
+    handler_printf(reply, "模式 %s | 连接 %lld (累计 %llu, 拒绝 %llu, 超时 %llu) | 消息 %llu | "
+                   "接收 %.2f MB 发送 %.2f MB | p50 %.1fus p99 %.1fus | 错误 %llu\n",
+                   server_mode_name,
+                   (long long)(m->accepted - m->closed),
+                   (unsigned long long)m->accepted,
+                   (unsigned long long)m->rejected,
+                   (unsigned long long)m->timeouts,
+                   (unsigned long long)m->requests,
+                   m->bytes_in / 1e6,
+                   m->bytes_out / 1e6,
+                   m->service.total ? hist_percentile(&m->service, 50) / 1e3 : 0.0,
+                   m->service.total ? hist_percentile(&m->service, 99) / 1e3 : 0.0,
+                   (unsigned long long)m->errors);
+    if (kv_store != NULL) {
+        kv_stats_t kv;
+        kv_stats(kv_store, &kv);
+        handler_printf(reply, "键值 %llu 项 | 内存 %.2f/%.2f MB | 命中 %llu 未命中 %llu | 淘汰 %llu\n",
+                       (unsigned long long)kv.items, kv.used / 1e6, kv.capacity / 1e6,
+                       (unsigned long long)m->kv_hits,
+                       (unsigned long long)m->kv_misses,
+                       (unsigned long long)m->kv_evictions);
+    }
+    if (journal.shared != NULL) {
+        handler_printf(reply, "消息日志 %llu 条 | 同步 %llu 次 (平均每次 %.1f 条) | 失败 %llu\n",
+                       (unsigned long long)m->journal_records,
+                       (unsigned long long)m->journal_syncs,
+                       m->journal_syncs ? (double)m->journal_records / m->journal_syncs : 0.0,
+                       (unsigned long long)m->journal_errors);
+    }
+    free(m);
+    return HANDLER_REPLY;
+}
+
+// /info：处理这个连接的进程和线程
+int command_info(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    (void)args;
+    (void)len;
+    handler_printf(reply, "进程ID=%d, 线程ID=%ld, 模式=%s, 客户端=%s, 本连接命令数=%llu\n",
+                   getpid(), (long)pthread_self(), server_mode_name, ctx->peer,
+                   (unsigned long long)ctx->commands);
+    return HANDLER_REPLY;
+}
+
+// /quit：回复后断开连接
+int command_quit(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    (void)args;
+    (void)len;
+    log_info("👋 客户端 %s 请求断开连接\n", 
+             ctx->peer);
+    handler_printf(reply, "再见!\n");
+    return HANDLER_QUIT;
+}
+
+// 键值命令的参数用空格分隔，取出第一个参数，rest指向剩余部分；没有参数时返回-1
+int command_word(const char** args, size_t* len, const char** word, size_t* word_len) {
+    size_t end = 0;
+    
+    while (end < *len && (*args)[end] != ' ') end++;
+    if (end == 0) return -1;
+    *word = *args;
+    *word_len = end;
+    *args += end < *len ? end + 1 : end;
+    *len -= end < *len ? end + 1 : end;
+    return 0;
+}
+
+// 解析整数参数，不是[min, max]范围内的十进制整数时返回-1
+int command_int(const char* text, size_t len, long long min, long long max, long long* value) {
+    char buf[24];
+    char* end;
+    
+    if (len == 0 || len >= sizeof(buf)) return -1;
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    errno = 0;
+    *value = strtoll(buf, &end, 10);
+    return errno != 0 || *end != '\0' || *value < min || *value > max ? -1 : 0;
+}
+
+// 检查存储是否启用并取出键，失败时错误说明已写入reply
+int command_key(const char** args, size_t* len, const char** key, size_t* key_len, netbuf_t* reply) {
+    if (kv_store == NULL) {
+        handler_printf(reply, "服务器未启用键值存储 (--kv-memory)\n");
+        return -1;
+    }
+    if (command_word(args, len, key, key_len) < 0) {
+        handler_printf(reply, "缺少键\n");
+        return -1;
+    }
+    if (*key_len > KV_KEY_MAX) {
+        handler_printf(reply, "键太长 (最多%d字节)\n", KV_KEY_MAX);
+        return -1;
+    }
+    return 0;
+}
+
+// kv_set/kv_incr失败时的错误说明（键的长度已由command_key检查）
+int command_kv_error(netbuf_t* reply) {
+    if (errno == EINVAL) {
+        handler_printf(reply, "值不是整数\n");
+    } else if (errno == E2BIG) {
+        handler_printf(reply, "值太大\n");
+    } else if (errno == ERANGE) {
+        handler_printf(reply, "整数溢出\n");
+    } else {
+        handler_printf(reply, "%s\n", strerror(errno));
+    }
+    return HANDLER_ERROR;
+}
+
+// /get 键：返回值，键不存在或已过期时返回错误
+int command_get(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    const char* key;
+    size_t key_len;
+    int rc;
+    
+    (void)ctx;
+    if (command_key(&args, &len, &key, &key_len, reply) < 0) return HANDLER_ERROR;
+    rc = kv_get(kv_store, key, key_len, reply);
+    if (rc < 0) {
+        handler_printf(reply, "%s\n", strerror(ENOMEM));
+        return HANDLER_ERROR;
+    }
+    if (rc == 0) {
+        metrics_count(kv_misses, 1);
+        handler_printf(reply, "键不存在\n");
+        return HANDLER_ERROR;
+    }
+    metrics_count(kv_hits, 1);
+    return netbuf_append(reply, "\n", 1) < 0 ? HANDLER_ERROR : HANDLER_REPLY;
+}
+
+// 写入键值后回复OK
+int command_store(const char* key, size_t key_len, const char* value, size_t value_len, uint32_t ttl,
+                  netbuf_t* reply) {
+    int evicted = kv_set(kv_store, key, key_len, value, value_len, ttl);
+    
+    if (evicted < 0) return command_kv_error(reply);
+    if (evicted > 0) metrics_count(kv_evictions, evicted);
+    handler_printf(reply, "OK\n");
+    return HANDLER_REPLY;
+}
+
+// /set 键 值：写入键值，不过期
+int command_set(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    const char* key;
+    size_t key_len;
+    
+    (void)ctx;
+    if (command_key(&args, &len, &key, &key_len, reply) < 0) return HANDLER_ERROR;
+    return command_store(key, key_len, args, len, 0, reply);
+}
+
+// /setex 键 秒数 值：写入键值，指定秒数后过期
+int command_setex(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    const char* key;
+    const char* word;
+    size_t key_len, word_len;
+    long long ttl;
+    
+    (void)ctx;
+    if (command_key(&args, &len, &key, &key_len, reply) < 0) return HANDLER_ERROR;
+    if (command_word(&args, &len, &word, &word_len) < 0 ||
+        command_int(word, word_len, 1, 100L * 365 * 86400, &ttl) < 0) {
+        handler_printf(reply, "过期时间必须是正整数秒\n");
+        return HANDLER_ERROR;
+    }
+    return command_store(key, key_len, args, len, (uint32_t)ttl, reply);
+}
+
+// /del 键：删除了键时回复1，键不存在时回复0
+int command_del(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    const char* key;
+    size_t key_len;
+    
+    (void)ctx;
+    if (command_key(&args, &len, &key, &key_len, reply) < 0) return HANDLER_ERROR;
+    handler_printf(reply, "%d\n", kv_del(kv_store, key, key_len));
+    return HANDLER_REPLY;
+}
+
+// /incr 键 [增量]：把值作为整数加上增量（默认1），回复新值；键不存在时从0开始
+int command_incr(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    const char* key;
+    size_t key_len;
+    long long delta = 1;
+    int64_t value;
+    int evicted;
+    
+    (void)ctx;
+    if (command_key(&args, &len, &key, &key_len, reply) < 0) return HANDLER_ERROR;
+    if (len > 0 && command_int(args, len, INT64_MIN, INT64_MAX, &delta) < 0) {
+        handler_printf(reply, "增量必须是整数\n");
+        return HANDLER_ERROR;
+    }
+    evicted = kv_incr(kv_store, key, key_len, delta, &value);
+    if (evicted < 0) return command_kv_error(reply);
+    if (evicted > 0) metrics_count(kv_evictions, evicted);
+    handler_printf(reply, "%lld\n", (long long)value);
+    return HANDLER_REPLY;
+}
+
+const handler_t builtin_handlers[] = {
+    { "help", command_help, "列出可用的命令" },
+    { "echo", command_echo, "<文本> 回显文本" },
+    { "upper", command_upper, "<文本> 转为大写" },
+    { "time", command_time, "服务器的当前时间" },
+    { "stats", command_stats, "服务器的连接、消息和延迟统计" },
+    { "info", command_info, "处理本连接的进程和线程" },
+    { "quit", command_quit, "断开连接" },
+    { "get", command_get, "<键> 读取键值存储中的值" },
+    { "set", command_set, "<键> <值> 写入键值" },
+    { "setex", command_setex, "<键> <秒数> <值> 写入键值，指定秒数后过期" },
+    { "del", command_del, "<键> 删除键" },
+    { "incr", command_incr, "<键> [增量] 把值作为整数加上增量 (默认1)" },
+};
+
+handler_table_t handlers;
+
+// /help：列出分派表中的所有命令
+int command_help(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply) {
+    (void)ctx;
+    (void)args;
+    (void)len;
+    handler_printf(reply, "可用的命令 (以 %c 开头，其他消息原样回显):\n", HANDLER_PREFIX);
+    for (int i = 0; i < handlers.count; i++) {
+        handler_printf(reply, "  %c%-8s %s\n", HANDLER_PREFIX, handlers.entries[i].name, handlers.entries[i].help);
+    }
+    return HANDLER_REPLY;
+}
+
+// 建立命令分派表的索引，在启动任何worker之前调用
+int handlers_init() {
+    return handler_table_init(&handlers, builtin_handlers, sizeof(builtin_handlers) / sizeof(builtin_handlers[0]));
+}
+
+// 按--kv-memory创建键值存储，在启动任何worker之前调用，fork出的子进程共用同一块共享内存
+int kv_init() {
+    if (server_config.kv_memory == 0) return 0;
+    kv_store = kv_create((size_t)server_config.kv_memory << 20);
+    if (kv_store == NULL) return -1;
+    if (!server_config.quiet) {
+        printf("🗄️  键值存储: %d MB, %d 个分片, 每个分片 %u 个槽位 (最多 %u 项) 和 %u 个%d字节的块\n",
+               server_config.kv_memory, KV_SHARDS, kv_store->slots, kv_store->max_items,
+               kv_store->chunks, KV_CHUNK_SIZE);
+    }
+    return 0;
+}
+
+// ==================== 消息日志 ====================
+
+__thread uint64_t journal_last;     // 本线程最后写入的记录序号，--journal-wait时回复前等待它落盘
+
+// 把收到的一条消息写入日志（未启用时什么也不做），消息内容可能分成几段
+void journal_record(const char* peer, const struct iovec* iov, int iovcnt) {
+    uint64_t seq;
+    
+    if (journal.shared == NULL) return;
+    seq = journal_append(&journal, peer, iov, iovcnt);
+    if (seq == 0) {
+        metrics_count(journal_errors, 1);
+        log_error("❌ 写入消息日志失败 (客户端: %s): %s\n", 
+                  peer, strerror(errno));
+        return;
+    }
+    metrics_count(journal_records, 1);
+    journal_last = seq;
+}
+
+void journal_record_buffer(const char* peer, const void* data, size_t len) {
+    struct iovec iov = { (void*)data, len };
+    journal_record(peer, &iov, 1);
+}
+
+// 阻塞式模式在发送回复前调用：--journal-wait时等本线程写入的记录都落盘，同步由所有连接共用
+void journal_flush() {
+    if (!server_config.journal_wait || journal_last == 0) return;
+    if (journal_wait(&journal, journal_last) < 0) {
+        log_error("❌ 等待消息日志同步失败: %s\n", strerror(errno));
+    }
+    journal_last = 0;
+}
+
+// 同步线程每次同步成功后调用
+void journal_synced(uint64_t records, uint64_t ns) {
+    metrics_count(journal_syncs, 1);
+    if (ns > JOURNAL_SLOW_SYNC_NS) {
+        log_warn("🐢 消息日志同步耗时 %.1f ms (%llu 条记录)\n", ns / 1e6, (unsigned long long)records);
+    }
+}
+
+// 重放/setex：按记录的时间计算剩余的过期时间，已经过期的键删除
+void journal_replay_setex(const journal_record_t* record, const char* args, size_t len) {
+    const char* key;
+    const char* word;
+    size_t key_len, word_len;
+    long long ttl;
+    uint64_t expires;
+    uint32_t now = kv_now();
+    
+    if (command_word(&args, &len, &key, &key_len) < 0 || command_word(&args, &len, &word, &word_len) < 0 ||
+        command_int(word, word_len, 1, 100L * 365 * 86400, &ttl) < 0) {
+        return;
+    }
+    expires = record->time_ns / 1000000000ULL + (uint64_t)ttl;
+    if (expires <= now) {
+        kv_del(kv_store, key, key_len);
+    } else {
+        kv_set(kv_store, key, key_len, args, len, (uint32_t)(expires - now));
+    }
+}
+
+// 重放一条记录：启用了键值存储时重新执行其中的写命令，启动后的缓存与上次退出前大致相同
+// （并发的写命令在日志中的顺序和实际执行的顺序可能不同）
+void journal_replay_record(const journal_record_t* record, const char* peer, const char* payload, void* arg) {
+    static const char* const writes[] = { "set", "del", "incr" };
+    netbuf_t* reply = arg;
+    handler_ctx_t ctx;
+    const char* name;
+    const char* args;
+    size_t name_len, args_len;
+    
+    if (kv_store == NULL || !handler_parse(payload, record->length, &name, &name_len, &args, &args_len)) return;
+    if (name_len == 5 && memcmp(name, "setex", 5) == 0) {
+        journal_replay_setex(record, args, args_len);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(writes) / sizeof(writes[0]); i++) {
+        if (strlen(writes[i]) == name_len && memcmp(writes[i], name, name_len) == 0) {
+            handler_ctx_init(&ctx, peer);
+            reply->len = 0;
+            handler_dispatch(&handlers, &ctx, payload, record->length, reply);
+            return;
+        }
+    }
+}
+
+// 按--journal打开消息日志并重放已有的记录，在kv_init之后、启动任何worker之前调用
+int journal_init() {
+    journal_replay_stats_t stats;
+    netbuf_t reply = {0};
+    int rc;
+    
+    if (server_config.journal_dir[0] == '\0') return 0;
+    journal.on_sync = journal_synced;
+    rc = journal_open(&journal, server_config.journal_dir, (size_t)server_config.journal_segment << 20,
+                      server_config.journal_sync_ms, journal_replay_record, &reply, &stats);
+    netbuf_free(&reply);
+    if (rc < 0) return -1;
+    
+    printf("📜 消息日志: %s，重放了 %u 个段中的 %llu 条记录 (%.2f MB)%s\n",
+           server_config.journal_dir, stats.segments, (unsigned long long)stats.records, stats.bytes / 1e6,
+           kv_store != NULL ? "，键值存储已按其中的写命令恢复" : "");
+    if (stats.truncated > 0) {
+        printf("⚠️  %u 个段以不完整的记录结尾 (上次没有正常退出，或仍在被热重启前的进程写入)\n", stats.truncated);
+    }
+    if (!server_config.quiet) {
+        printf("📜 写入新的段 journal-%08u.log，每段 %d MB，有新记录后最多 %d ms 同步一次%s\n",
+               journal.shared->segment, server_config.journal_segment, server_config.journal_sync_ms,
+               server_config.journal_wait ? "，落盘后才回复" : "");
+    }
+    return 0;
+}
+
+// ==================== 零拷贝回显 ====================
+
+// 每个连接的接收环形缓冲区：容量为2的幂，head/tail单调递增，
+// 帧在缓冲区中原地解析，回复直接引用其中的负载，不再memset和整体搬移
+typedef struct {
+    char* data;
+    size_t cap;
+    size_t head;    // 下一个待处理的字节
+    size_t tail;    // 下一个写入位置
+} ringbuf_t;
+
+// 一批待发送的回复，iovec直接指向接收缓冲区中的负载
+// 需要压缩或解压的回复无法直接引用负载，完整地生成在scratch中；batch发送完之前scratch不会重新分配
+typedef struct {
+    struct iovec iov[REPLY_MAX_IOV];
+    int iovcnt;
+    unsigned char headers[REPLY_MAX_FRAMES][FRAME_HEADER_SIZE];
+    int frames;
+    size_t bytes;
+    netbuf_t scratch;       // 本批次生成的回复负载
+    netbuf_t plain;         // 正在处理的回复：前缀 + 解压后的负载
+    netbuf_t replies;       // 本批次命令的回复，可能重新分配，iovec中先记偏移
+    int fixups[REPLY_MAX_FRAMES];   // 指向replies的iovec下标，批次生成完后换成地址
+    int fixup_count;
+} reply_batch_t;
+
+size_t ring_used(const ringbuf_t* ring) {
+    return ring->tail - ring->head;
+}
+
+// 取出从head偏移offset开始的len字节所在的内存段（跨越末尾时为两段），返回段数
+int ring_segments(const ringbuf_t* ring, size_t offset, size_t len, struct iovec iov[2]) {
+    size_t start, first;
+    
+    if (len == 0) return 0;
+    start = (ring->head + offset) & (ring->cap - 1);
+    first = ring->cap - start < len ? ring->cap - start : len;
+    iov[0].iov_base = ring->data + start;
+    iov[0].iov_len = first;
+    if (first == len) return 1;
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+// 空闲空间所在的内存段，用于readv直接写入
+int ring_free_segments(const ringbuf_t* ring, struct iovec iov[2]) {
+    size_t free_len = ring->cap - ring_used(ring);
+    size_t start, first;
+    
+    if (free_len == 0) return 0;
+    start = ring->tail & (ring->cap - 1);
+    first = ring->cap - start < free_len ? ring->cap - start : free_len;
+    iov[0].iov_base = ring->data + start;
+    iov[0].iov_len = first;
+    if (first == free_len) return 1;
+    iov[1].iov_base = ring->data;
+    iov[1].iov_len = free_len - first;
+    return 2;
+}
+
+void ring_copy_out(const ringbuf_t* ring, size_t offset, void* dst, size_t len) {
+    struct iovec iov[2];
+    int n = ring_segments(ring, offset, len, iov);
+    
+    for (int i = 0; i < n; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst = (char*)dst + iov[i].iov_len;
+    }
+}
+
+// 保证容量至少为need字节，扩容时把已有数据整理为从0开始的连续数据
+int ring_reserve(ringbuf_t* ring, size_t need) {
+    size_t used = ring_used(ring);
+    size_t cap = ring->cap ? ring->cap : RING_MIN_CAPACITY;
+    char* data;
+    
+    if (ring->cap >= need) return 0;
+    while (cap < need) cap *= 2;
+    data = malloc(cap);
+    if (data == NULL) return -1;
+    
+    if (used > 0) ring_copy_out(ring, 0, data, used);
+    free(ring->data);
+    metrics_memory((int64_t)cap - (int64_t)ring->cap);
+    ring->data = data;
+    ring->cap = cap;
+    ring->head = 0;
+    ring->tail = used;
+    return 0;
+}
+
+int ring_append(ringbuf_t* ring, const void* src, size_t len) {
+    struct iovec iov[2];
+    int n;
+    
+    if (ring_reserve(ring, ring_used(ring) + len) < 0) return -1;
+    n = ring_free_segments(ring, iov);
+    for (int i = 0; i < n && len > 0; i++) {
+        size_t chunk = iov[i].iov_len < len ? iov[i].iov_len : len;
+        memcpy(iov[i].iov_base, src, chunk);
+        src = (const char*)src + chunk;
+        len -= chunk;
+        ring->tail += chunk;
+    }
+    return 0;
+}
+
+void ring_free(ringbuf_t* ring) {
+    free(ring->data);
+    metrics_memory(-(int64_t)ring->cap);
+    memset(ring, 0, sizeof(*ring));
+}
+
+// 缓冲区为空时，释放为大消息扩容的内存，下次读取时重新按最小容量分配
+void ring_shrink(ringbuf_t* ring) {
+    if (ring_used(ring) == 0 && ring->cap > RING_MIN_CAPACITY) ring_free(ring);
+}
+
+// 为下一次读取准备空间：缓冲区已满，或正在接收的帧超过当前容量时扩容
+int ring_prepare_read(ringbuf_t* ring) {
+    size_t need = ring_used(ring) + 1;
+    
+    if (ring_used(ring) >= FRAME_HEADER_SIZE) {
+        char raw[FRAME_HEADER_SIZE];
+        frame_header_t header;
+        ring_copy_out(ring, 0, raw, FRAME_HEADER_SIZE);
+        if (frame_parse(raw, FRAME_HEADER_SIZE, &header) >= 0 &&
+            FRAME_HEADER_SIZE + (size_t)header.length > need) {
+            need = FRAME_HEADER_SIZE + header.length;
+        }
+    }
+    if (need < RING_MIN_CAPACITY) need = RING_MIN_CAPACITY;
+    return ring_reserve(ring, need);
+}
+
+void batch_add(reply_batch_t* batch, const void* data, size_t len) {
+    batch->iov[batch->iovcnt].iov_base = (void*)data;
+    batch->iov[batch->iovcnt].iov_len = len;
+    batch->iovcnt++;
+    batch->bytes += len;
+}
+
+// 向batch添加一个负载为静态字符串的帧
+void batch_add_frame(reply_batch_t* batch, uint8_t type, const char* payload, size_t len) {
+    unsigned char* header = batch->headers[batch->frames++];
+    frame_encode_header(header, type, 0, (uint32_t)len);
+    batch_add(batch, header, FRAME_HEADER_SIZE);
+    if (len > 0) batch_add(batch, payload, len);
+}
+
+// DATA帧的负载不能直接引用时（需要解压、压缩，或者是命令）：在plain中拼接 前缀 + 负载，压缩的请求先解压
+// 返回0成功，-1表示负载无法解压
+int batch_load_plain(reply_batch_t* batch, const ringbuf_t* in, size_t offset, const frame_header_t* header,
+                     const char* prefix, size_t prefix_len) {
+    netbuf_t* plain = &batch->plain;
+    size_t length = header->length;
+    
+    plain->len = 0;
+    if (netbuf_append(plain, prefix, prefix_len) < 0) return -1;
+    if (header->flags & FRAME_FLAG_LZ) {
+        unsigned char raw[LZ_HEADER_SIZE];
+        ssize_t size;
+        
+        if (length < LZ_HEADER_SIZE) return -1;
+        ring_copy_out(in, offset, (char*)raw, LZ_HEADER_SIZE);
+        size = lz_unpacked_size(raw, LZ_HEADER_SIZE);
+        if (size < 0 || size > FRAME_MAX_PAYLOAD) return -1;
+        // 压缩的负载先复制到解压目标之后的空间，使它在内存中连续
+        if (netbuf_reserve(plain, size + length) < 0) return -1;
+        ring_copy_out(in, offset, plain->data + plain->len + size, length);
+        if (lz_unpack(plain->data + plain->len + size, length, plain->data + plain->len, size) != size) {
+            return -1;
+        }
+        plain->len += size;
+    } else {
+        if (netbuf_reserve(plain, length) < 0) return -1;
+        ring_copy_out(in, offset, plain->data + plain->len, length);
+        plain->len += length;
+    }
+    return plain->len > FRAME_MAX_PAYLOAD ? -1 : 0;
+}
+
+// 启用压缩的连接上的DATA帧：plain中的回复压缩（达到阈值时）或原样复制到scratch，batch中的iovec指向scratch
+// 返回0表示已加入batch，1表示scratch剩余空间不够、应先发送当前batch，-1表示内存不足
+int batch_add_packed(reply_batch_t* batch) {
+    netbuf_t* plain = &batch->plain;
+    int compress;
+    size_t need;
+    size_t packed = 0;
+    
+    compress = plain->len >= (size_t)server_config.compress_threshold;
+    need = compress ? LZ_HEADER_SIZE + lz_bound(plain->len) : plain->len;
+    if (batch->scratch.cap - batch->scratch.len < need) {
+        if (batch->scratch.len > 0) return 1;
+        if (netbuf_reserve(&batch->scratch, need) < 0) return -1;
+    }
+    
+    char* out = batch->scratch.data + batch->scratch.len;
+    if (compress) {
+        packed = lz_pack(plain->data, plain->len, out, need);
+        metrics_count(compress_in, plain->len);
+        metrics_count(compress_out, packed > 0 ? packed : plain->len);
+    }
+    if (packed == 0) memcpy(out, plain->data, plain->len);
+    
+    unsigned char* reply_header = batch->headers[batch->frames++];
+    size_t reply_len = packed > 0 ? packed : plain->len;
+    frame_encode_header(reply_header, FRAME_DATA, packed > 0 ? FRAME_FLAG_LZ : 0, (uint32_t)reply_len);
+    batch_add(batch, reply_header, FRAME_HEADER_SIZE);
+    batch_add(batch, out, reply_len);
+    batch->scratch.len += reply_len;
+    return 0;
+}
+
+// 执行plain中的命令（plain开头的回复前缀之后），回复追加到replies，返回处理函数的返回值
+// 命令的回复不压缩：它们通常很短，而且不经过scratch，一个批次中可以有任意多个命令
+int batch_add_command(reply_batch_t* batch, handler_ctx_t* ctx, size_t prefix_len) {
+    netbuf_t* replies = &batch->replies;
+    size_t start = replies->len;
+    int rc = handler_dispatch(&handlers, ctx, batch->plain.data + prefix_len,
+                              batch->plain.len - prefix_len, replies);
+    
+    if (replies->len - start > FRAME_MAX_PAYLOAD) replies->len = start + FRAME_MAX_PAYLOAD;
+    
+    unsigned char* reply_header = batch->headers[batch->frames++];
+    frame_encode_header(reply_header, rc == HANDLER_ERROR ? FRAME_ERROR : FRAME_DATA, 0,
+                        (uint32_t)(replies->len - start));
+    batch_add(batch, reply_header, FRAME_HEADER_SIZE);
+    if (replies->len > start) {
+        batch->fixups[batch->fixup_count++] = batch->iovcnt;
+        batch_add(batch, (void*)start, replies->len - start);
+    }
+    return rc;
+}
+
+// DATA帧的负载是否以命令前缀开头（压缩的负载要解压后才知道）
+int frame_is_command(const ringbuf_t* in, size_t offset, const frame_header_t* header) {
+    char first;
+    
+    if (header->length == 0 || (header->flags & FRAME_FLAG_LZ)) return 0;
+    ring_copy_out(in, offset, &first, 1);
+    return first == HANDLER_PREFIX;
+}
+
+// 解析in中的完整帧并生成回复：DATA帧的回复由 帧头 + 回复前缀 + 原始负载 组成，负载不复制；
+// 以'/'开头的DATA帧是命令，按分派表执行（tcp_handler.h）
+// ctx为连接的命令上下文（其中有客户端地址），consumed返回已处理的字节数，batch发送完之后调用者才能把它们从in中移除
+// compress为连接是否已在握手时协商启用压缩，收到带FRAME_FLAG_LZ的HELLO时更新
+// 返回1表示batch已满、可能还有帧未处理，0表示已处理完所有完整的帧，-1表示应关闭连接，
+// 2表示consumed之后是一个文件传输帧（GET/FILE），由调用者发出batch后开始传输
+int build_frame_replies(ringbuf_t* in, reply_batch_t* batch, const char* prefix, size_t prefix_len,
+                        handler_ctx_t* ctx, int* compress, size_t* consumed) {
+    const char* peer = ctx->peer;
+    char raw[FRAME_HEADER_SIZE];
+    frame_header_t header;
+    size_t offset = 0;
+    int result = 0;
+    
+    batch->iovcnt = batch->frames = 0;
+    batch->bytes = 0;
+    batch->scratch.len = 0;
+    batch->replies.len = 0;
+    batch->fixup_count = 0;
+    
+    while (1) {
+        size_t available = ring_used(in) - offset;
+        if (batch->frames == REPLY_MAX_FRAMES) {
+            result = 1;
+            break;
+        }
+        if (available < FRAME_HEADER_SIZE) break;
+        
+        ring_copy_out(in, offset, raw, FRAME_HEADER_SIZE);
+        int rc = frame_parse(raw, available, &header);
+        if (rc < 0) {
+            static const char invalid[] = "协议错误: 无效的帧头";
+            log_warn("❌ 客户端 %s 发送了无效的帧\n", 
+                     peer);
+            batch_add_frame(batch, FRAME_ERROR, invalid, sizeof(invalid) - 1);
+            result = -1;
+            break;
+        }
+        if (rc == 0) break;
+        
+        size_t payload_offset = offset + FRAME_HEADER_SIZE;
+        
+        if (header.type == FRAME_DATA && ((header.flags & FRAME_FLAG_LZ) || frame_is_command(in, payload_offset, &header) ||
+            (*compress && prefix_len + header.length >= (size_t)server_config.compress_threshold))) {
+            static const char corrupt[] = "协议错误: 无法解压的负载";
+            
+            rc = *compress || !(header.flags & FRAME_FLAG_LZ) ?
+                 batch_load_plain(batch, in, payload_offset, &header, prefix, prefix_len) : -1;
+            if (rc < 0) {
+                log_warn("❌ 客户端 %s 发送了无法解压的帧\n", 
+                         peer);
+                batch_add_frame(batch, FRAME_ERROR, corrupt, sizeof(corrupt) - 1);
+                result = -1;
+                break;
+            }
+            if (batch->plain.len > prefix_len && batch->plain.data[prefix_len] == HANDLER_PREFIX) {
+                log_debug("📨 收到来自 %s 的命令: %.*s\n", 
+                          peer, (int)(batch->plain.len - prefix_len), batch->plain.data + prefix_len);
+                offset += FRAME_HEADER_SIZE + header.length;
+                journal_record_buffer(peer, batch->plain.data + prefix_len, batch->plain.len - prefix_len);
+                if (batch_add_command(batch, ctx, prefix_len) == HANDLER_QUIT) {
+                    result = -1;
+                    break;
+                }
+                continue;
+            }
+            rc = batch_add_packed(batch);
+            if (rc == 1) {
+                result = 1;
+                break;
+            }
+            if (rc < 0) {
+                result = -1;
+                break;
+            }
+            log_debug("📨 收到来自 %s 的消息 (%u字节)\n", 
+                      peer, header.length);
+            journal_record_buffer(peer, batch->plain.data + prefix_len, batch->plain.len - prefix_len);
+            offset += FRAME_HEADER_SIZE + header.length;
+            continue;
+        }
+        // 文件传输由调用者处理：先发出之前的回复，再从这个帧开始传输
+        if ((header.type == FRAME_GET || header.type == FRAME_FILE) && files_dir_fd != -1) {
+            result = 2;
+            break;
+        }
+        offset += FRAME_HEADER_SIZE + header.length;
+        
+        if (header.type == FRAME_DATA) {
+            struct iovec payload[2];
+            int segments = ring_segments(in, payload_offset, header.length, payload);
+            unsigned char* reply_header = batch->headers[batch->frames++];
+            
+            log_debug("📨 收到来自 %s 的消息 (%u字节)\n", 
+                      peer, header.length);
+            journal_record(peer, payload, segments);
+            frame_encode_header(reply_header, FRAME_DATA, 0, (uint32_t)(prefix_len + header.length));
+            batch_add(batch, reply_header, FRAME_HEADER_SIZE);
+            batch_add(batch, prefix, prefix_len);
+            for (int i = 0; i < segments; i++) {
+                batch_add(batch, payload[i].iov_base, payload[i].iov_len);
+            }
+        } else if (header.type == FRAME_HELLO) {
+            // 回复的flags为连接上已启用的功能，客户端据此决定之后是否压缩；不带标志的HELLO（健康检查）不改变状态
+            unsigned char* reply_header = batch->headers[batch->frames++];
+            if (header.flags & FRAME_FLAG_LZ) *compress = server_config.compress;
+            frame_encode_header(reply_header, FRAME_HELLO, *compress ? FRAME_FLAG_LZ : 0, 0);
+            batch_add(batch, reply_header, FRAME_HEADER_SIZE);
+        } else if (header.type == FRAME_QUIT) {
+            log_info("👋 客户端 %s 请求断开连接\n", 
+                     peer);
+            result = -1;
+            break;
+        } else if (header.type == FRAME_GET || header.type == FRAME_FILE) {
+            static const char disabled[] = "服务器未启用文件传输 (--files)";
+            batch_add_frame(batch, FRAME_ERROR, disabled, sizeof(disabled) - 1);
+            // 上传帧后面的文件内容无法跳过
+            if (header.type == FRAME_FILE) {
+                result = -1;
+                break;
+            }
+        } else {
+            static const char unknown[] = "未知的帧类型";
+            batch_add_frame(batch, FRAME_ERROR, unknown, sizeof(unknown) - 1);
+        }
+    }
+    
+    // 命令的回复都已生成，replies不会再重新分配
+    for (int i = 0; i < batch->fixup_count; i++) {
+        struct iovec* iov = &batch->iov[batch->fixups[i]];
+        iov->iov_base = batch->replies.data + (size_t)iov->iov_base;
+    }
+    *consumed = offset;
+    return result;
+}
+
+// 阻塞式发送全部数据
+int send_all(int sock, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            metrics_count(errors, 1);
+            return -1;
+        }
+        metrics_count(bytes_out, n);
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// 跳过iovec数组中已发送的n字节，返回剩余的iovec个数
+int iov_advance(struct iovec** iov, int iovcnt, size_t n) {
+    while (iovcnt > 0 && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        iovcnt--;
+    }
+    if (iovcnt > 0) {
+        (*iov)->iov_base = (char*)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+    return iovcnt;
+}
+
+// 等待MSG_ZEROCOPY的完成通知：内核发送完毕之前，被引用的缓冲区不能复用
+int zerocopy_wait(int sock, unsigned sends) {
+    unsigned completed = 0;
+    char control[128];
+    
+    while (completed < sends) {
+        struct msghdr msg;
+        struct pollfd pfd;
+        
+        pfd.fd = sock;
+        pfd.events = 0; // POLLERR总会被报告
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+        
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+                if (err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                    completed += err->ee_data - err->ee_info + 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// 阻塞式发送iovec数组中的全部数据（会修改iov）
+// zerocopy_min不为0时，剩余数据不少于这么多字节的sendmsg使用MSG_ZEROCOPY（部分发送后剩下的
+// 小尾巴照常复制），返回前等待内核用完这些缓冲区
+int sendv_all(int sock, struct iovec* iov, int iovcnt, size_t zerocopy_min) {
+    struct msghdr msg;
+    unsigned sends = 0;
+    size_t left = 0;
+    
+    for (int i = 0; i < iovcnt; i++) left += iov[i].iov_len;
+    memset(&msg, 0, sizeof(msg));
+    while (iovcnt > 0) {
+        int zerocopy = zerocopy_min > 0 && left >= zerocopy_min;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            metrics_count(errors, 1);
+            return -1;
+        }
+        metrics_count(bytes_out, n);
+        if (zerocopy) sends++;
+        left -= n;
+        iovcnt = iov_advance(&iov, iovcnt, n);
+    }
+    return sends > 0 ? zerocopy_wait(sock, sends) : 0;
+}
+
+// ==================== 文件传输 ====================
+
+// 帧协议下客户端可以下载（GET）或上传（FILE）--files目录中的文件，文件内容不经过用户态：
+// 下载用sendfile从页缓存直接发送到socket，上传用splice经过管道从socket直接写入文件。
+// 上传先写入临时文件，收完后再rename为正式文件名，中途断开不会留下不完整的文件。
+typedef struct {
+    int fd;                 // 正在传输的文件
+    int upload;             // 1: 接收上传，0: 发送下载
+    int pipe[2];            // 上传时splice使用的管道
+    uint64_t size;
+    uint64_t done;          // 已传输的字节数
+    uint64_t reported;      // 上次输出进度时的字节数
+    uint64_t started;       // 开始时间（monotonic_ns）
+    const char* peer;
+    char name[FRAME_FILE_NAME_MAX + 1];
+    char temp[FRAME_FILE_NAME_MAX + 8];    // 上传的临时文件名，rename之后清空
+} xfer_t;
+
+// 打开--files目录，之后所有的文件都相对于它打开
+int files_init() {
+    if (server_config.files_dir[0] == '\0') return 0;
+    files_dir_fd = open(server_config.files_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return files_dir_fd == -1 ? -1 : 0;
+}
+
+// 文件名只能是目录中的一个普通名字：不能包含'/'和'\0'，不能以'.'开头（排除..和上传的临时文件）
+int file_name_valid(const char* name, size_t len) {
+    if (len == 0 || len > FRAME_FILE_NAME_MAX || name[0] == '.') return 0;
+    return memchr(name, '/', len) == NULL && memchr(name, '\0', len) == NULL;
+}
+
+// 结束传输并释放：上传没有完成时删除临时文件
+void xfer_free(xfer_t* xfer) {
+    if (xfer->fd != -1) close(xfer->fd);
+    if (xfer->upload) {
+        if (xfer->pipe[0] != -1) close(xfer->pipe[0]);
+        if (xfer->pipe[1] != -1) close(xfer->pipe[1]);
+        if (xfer->temp[0] != '\0') unlinkat(files_dir_fd, xfer->temp, 0);
+    }
+    free(xfer);
+    metrics_memory(-(int64_t)sizeof(xfer_t));
+}
+
+// 打开要下载的文件，成功时在reply中追加FILE帧头，失败返回错误说明
+const char* xfer_open_download(xfer_t* xfer, netbuf_t* reply) {
+    struct stat st;
+    
+    xfer->fd = openat(files_dir_fd, xfer->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (xfer->fd == -1 || fstat(xfer->fd, &st) < 0) return strerror(errno);
+    if (!S_ISREG(st.st_mode)) return "不是普通文件";
+    xfer->size = st.st_size;
+    posix_fadvise(xfer->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (frame_append_file(reply, xfer->size, xfer->name, strlen(xfer->name)) < 0) return strerror(ENOMEM);
+    return NULL;
+}
+
+// 创建上传的临时文件和管道，失败返回错误说明
+const char* xfer_open_upload(xfer_t* xfer) {
+    snprintf(xfer->temp, sizeof(xfer->temp), ".%s.part", xfer->name);
+    xfer->fd = openat(files_dir_fd, xfer->temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (xfer->fd == -1) {
+        int err = errno;
+        xfer->temp[0] = '\0';   // 不是自己创建的，不能删除
+        return err == EEXIST ? "该文件正在被上传" : strerror(err);
+    }
+    // 预先分配空间，磁盘空间不足时立即失败，而不是收到一半才发现
+    if (xfer->size > 0 && fallocate(xfer->fd, 0, 0, xfer->size) < 0 && errno == ENOSPC) {
+        return strerror(ENOSPC);
+    }
+    if (pipe2(xfer->pipe, O_CLOEXEC) < 0) return strerror(errno);
+    fcntl(xfer->pipe[1], F_SETPIPE_SZ, XFER_PIPE_SIZE);
+    return NULL;
+}
+
+// 把已经读入in的文件内容直接写入文件（上传帧和文件开头通常在同一次读取中到达）
+int xfer_absorb(xfer_t* xfer, ringbuf_t* in) {
+    size_t len = ring_used(in);
+    struct iovec segments[2];
+    struct iovec* iov = segments;
+    int iovcnt;
+    
+    if (len > xfer->size - xfer->done) len = xfer->size - xfer->done;
+    iovcnt = ring_segments(in, 0, len, segments);
+    while (iovcnt > 0) {
+        ssize_t n = writev(xfer->fd, iov, iovcnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        iovcnt = iov_advance(&iov, iovcnt, n);
+    }
+    in->head += len;
+    xfer->done += len;
+    return 0;
+}
+
+// 开始处理in开头的GET或FILE帧（调用者保证帧已完整），帧从in中移除
+// reply中追加要发给客户端的内容：下载时为FILE帧头，出错时为ERROR帧；*out返回开始的传输，出错时为NULL
+// 返回-1表示应在发出reply后关闭连接（上传出错时，后面的文件内容无法跳过）
+int xfer_start(ringbuf_t* in, netbuf_t* reply, const char* peer, xfer_t** out) {
+    static const char prefix[] = "文件传输失败: ";
+    char raw[FRAME_HEADER_SIZE];
+    char payload[FRAME_FILE_SIZE + FRAME_FILE_NAME_MAX];
+    frame_header_t header;
+    const char* name = payload;
+    const char* error = NULL;
+    size_t name_len = 0;
+    uint64_t size = 0;
+    xfer_t* xfer = NULL;
+    
+    *out = NULL;
+    ring_copy_out(in, 0, raw, FRAME_HEADER_SIZE);
+    if (frame_parse(raw, FRAME_HEADER_SIZE, &header) < 0) return -1;   // 只传入帧头，负载不在raw中时返回0
+    if (header.length <= sizeof(payload)) {
+        ring_copy_out(in, FRAME_HEADER_SIZE, payload, header.length);
+        name_len = header.length;
+    }
+    in->head += FRAME_HEADER_SIZE + header.length;
+    
+    if (header.type == FRAME_FILE && frame_parse_file(payload, name_len, &size, &name, &name_len) < 0) {
+        error = "无效的文件帧";
+    } else if (!file_name_valid(name, name_len)) {
+        error = "无效的文件名";
+    } else if (header.type == FRAME_FILE && !server_config.upload) {
+        error = "服务器不接受上传 (--upload)";
+    } else if (header.type == FRAME_FILE && name_len > XFER_UPLOAD_NAME_MAX) {
+        error = "文件名过长";
+    } else if ((xfer = calloc(1, sizeof(xfer_t))) == NULL) {
+        error = strerror(ENOMEM);
+    } else {
+        metrics_memory(sizeof(xfer_t));
+        xfer->fd = xfer->pipe[0] = xfer->pipe[1] = -1;
+        xfer->upload = header.type == FRAME_FILE;
+        xfer->size = size;
+        xfer->peer = peer;
+        xfer->started = monotonic_ns();
+        memcpy(xfer->name, name, name_len);
+        xfer->name[name_len] = '\0';
+        error = xfer->upload ? xfer_open_upload(xfer) : xfer_open_download(xfer, reply);
+        if (error == NULL && xfer->upload && xfer_absorb(xfer, in) < 0) error = strerror(errno);
+    }
+    
+    if (error != NULL) {
+        log_warn("❌ 客户端 %s %s %.*s 失败: %s\n", 
+                 peer, header.type == FRAME_FILE ? "上传" : "下载", (int)name_len, name, error);
+        frame_append(reply, FRAME_ERROR, 0, prefix, sizeof(prefix) - 1, error, strlen(error));
+        if (xfer != NULL) xfer_free(xfer);
+        return header.type == FRAME_FILE ? -1 : 0;
+    }
+    log_info("📁 客户端 %s 开始%s %s (%llu 字节)\n", 
+             peer, xfer->upload ? "上传" : "下载", xfer->name, (unsigned long long)xfer->size);
+    *out = xfer;
+    return 0;
+}
+
+// 每传输XFER_PROGRESS_BYTES字节输出一次进度（日志级别4）
+void xfer_progress(xfer_t* xfer) {
+    if (xfer->done - xfer->reported < XFER_PROGRESS_BYTES && xfer->done < xfer->size) return;
+    xfer->reported = xfer->done;
+    log_debug("📁 %s %s: %llu/%llu 字节\n", 
+              xfer->peer, xfer->name, (unsigned long long)xfer->done, (unsigned long long)xfer->size);
+}
+
+// 用sendfile发送文件的下一块：返回1表示发送完毕，2表示发送了一块、还有剩余，
+// 0表示socket发送缓冲区已满（非阻塞socket），-1表示出错
+int xfer_send(xfer_t* xfer, int sock) {
+    while (xfer->done < xfer->size) {
+        off_t offset = xfer->done;
+        size_t chunk = xfer->size - xfer->done < XFER_CHUNK ? xfer->size - xfer->done : XFER_CHUNK;
+        ssize_t n = sendfile(sock, xfer->fd, &offset, chunk);
+        
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;  // 文件在传输过程中被截短
+            metrics_count(errors, 1);
+            return -1;
+        }
+        xfer->done += n;
+        metrics_count(bytes_out, n);
+        xfer_progress(xfer);
+        return xfer->done < xfer->size ? 2 : 1;
+    }
+    return 1;
+}
+
+// 用splice把socket中的文件内容经管道写入文件，返回值与xfer_send相同
+int xfer_recv(xfer_t* xfer, int sock) {
+    while (xfer->done < xfer->size) {
+        size_t chunk = xfer->size - xfer->done < XFER_CHUNK ? xfer->size - xfer->done : XFER_CHUNK;
+        ssize_t n = splice(sock, NULL, xfer->pipe[1], NULL, chunk, SPLICE_F_MOVE);
+        
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) {
+            if (n == 0) errno = ECONNRESET;   // 对端在上传完之前关闭了连接
+            metrics_count(errors, 1);
+            return -1;
+        }
+        metrics_count(bytes_in, n);
+        
+        // 每次都把管道中的数据全部写入文件，下一次splice时管道总是空的
+        while (n > 0) {
+            ssize_t written = splice(xfer->pipe[0], NULL, xfer->fd, NULL, n, SPLICE_F_MOVE);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) return -1;
+            n -= written;
+            xfer->done += written;
+        }
+        xfer_progress(xfer);
+        return xfer->done < xfer->size ? 2 : 1;
+    }
+    return 1;
+}
+
+// 传输完成：上传的临时文件改为正式文件名，reply中追加确认；输出耗时和吞吐量
+// 返回-1表示出错（reply中为ERROR帧）
+int xfer_finish(xfer_t* xfer, netbuf_t* reply) {
+    double seconds = (monotonic_ns() - xfer->started) / 1e9;
+    double rate = seconds > 0 ? xfer->size / seconds / (1024 * 1024) : 0;
+    char message[FRAME_FILE_NAME_MAX + 64];
+    int len;
+    
+    if (xfer->upload) {
+        if (renameat(files_dir_fd, xfer->temp, files_dir_fd, xfer->name) < 0) {
+            static const char prefix[] = "文件传输失败: ";
+            const char* error = strerror(errno);
+            frame_append(reply, FRAME_ERROR, 0, prefix, sizeof(prefix) - 1, error, strlen(error));
+            return -1;
+        }
+        xfer->temp[0] = '\0';
+        len = snprintf(message, sizeof(message), "已保存 %s (%llu 字节)\n", 
+                       xfer->name, (unsigned long long)xfer->size);
+        frame_append(reply, FRAME_DATA, 0, NULL, 0, message, len);
+        metrics_count(files_received, 1);
+    } else {
+        metrics_count(files_sent, 1);
+    }
+    log_info("📁 客户端 %s %s %s 完成: %llu 字节, %.2f 秒, %.1f MB/s\n", 
+             xfer->peer, xfer->upload ? "上传" : "下载", xfer->name,
+             (unsigned long long)xfer->size, seconds, rate);
+    return 0;
+}
+
+// 阻塞式模式：完成in开头的文件传输请求，返回0继续处理后面的帧，-1表示应关闭连接
+// 下载的每一块都计入发送超时，上传的每一块都算作收到了数据
+int blocking_transfer(int sock, ringbuf_t* in, const char* peer, blocking_conn_t* timeouts) {
+    netbuf_t reply = {0};
+    xfer_t* xfer;
+    int rc = xfer_start(in, &reply, peer, &xfer);
+    
+    if (xfer != NULL) {
+        int step = 2;
+        
+        // 下载时先发出FILE帧头，文件内容紧随其后
+        if (reply.len > 0 && send_all(sock, reply.data, reply.len) < 0) step = -1;
+        reply.len = 0;
+        while (step == 2) {
+            blocking_mark(timeouts, &timeouts->times.write_since, !xfer->upload);
+            step = xfer->upload ? xfer_recv(xfer, sock) : xfer_send(xfer, sock);
+            blocking_mark(timeouts, &timeouts->times.write_since, 0);
+            if (xfer->upload) blocking_touch(timeouts);
+        }
+        if (step != 1) {
+            log_warn("✗ 文件传输中断 (客户端: %s, %s): %s\n", 
+                     peer, xfer->name, strerror(errno));
+            rc = -1;
+        } else if (xfer_finish(xfer, &reply) < 0) {
+            rc = -1;
+        }
+        xfer_free(xfer);
+    }
+    if (reply.len > 0 && send_all(sock, reply.data, reply.len) < 0) rc = -1;
+    netbuf_free(&reply);
+    return rc;
+}
+
+// ==================== 阻塞式服务器 ====================
+
+// 帧协议模式下处理客户端连接：数据直接读入环形缓冲区，
+// 每次读取后处理所有完整的帧，回复用一次sendmsg从缓冲区中发出
+void handle_client_framed(int client_socket, const char* peer, blocking_conn_t* timeouts) {
+    ringbuf_t in = {0};
+    netbuf_t welcome = {0};
+    reply_batch_t batch = {0};
+    handler_ctx_t ctx;
+    char prefix[64];
+    int prefix_len = format_reply_prefix(prefix, sizeof(prefix));
+    size_t zerocopy_min = 0;    // 一批回复达到该字节数时使用MSG_ZEROCOPY，0表示不使用
+    int compress = 0;
+    int done = 0;
+    int opt = 1;
+    
+    handler_ctx_init(&ctx, peer);
+    log_info("✓ 客户端 %s 已连接 (进程ID: %d, 线程ID: %ld, 帧协议)\n", 
+             peer,
+             getpid(),
+             pthread_self());
+    
+    // kTLS不支持MSG_ZEROCOPY，中继的socketpair也不支持
+    if (server_config.zerocopy_threshold > 0 && tls_ctx == NULL) {
+        if (setsockopt(client_socket, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) == 0) {
+            zerocopy_min = server_config.zerocopy_threshold > ZEROCOPY_MIN_BYTES ?
+                           (size_t)server_config.zerocopy_threshold : ZEROCOPY_MIN_BYTES;
+        }
+    }
+    
+    if (append_welcome(&welcome, peer) < 0 || send_all(client_socket, welcome.data, welcome.len) < 0) {
+        done = 1;
+    }
+    netbuf_free(&welcome);
+    
+    while (!done) {
+        struct iovec space[2];
+        
+        if (ring_prepare_read(&in) < 0) break;
+        ssize_t bytes_received = readv(client_socket, space, ring_free_segments(&in, space));
+        if (bytes_received <= 0) {
+            if (bytes_received < 0 && errno == EINTR) continue;
+            if (reaper_expired(timeouts)) break;
+            if (bytes_received == 0) {
+                log_info("✗ 客户端 %s 断开连接\n", 
+                         peer);
+            } else {
+                log_warn("✗ 接收数据失败 (客户端: %s): %s\n",
+                         peer,
+                         strerror(errno));
+                metrics_count(errors, 1);
+            }
+            break;
+        }
+        in.tail += bytes_received;
+        metrics_count(bytes_in, bytes_received);
+        blocking_touch(timeouts);
+        
+        uint64_t started = monotonic_ns();
+        int rc;
+        do {
+            size_t consumed;
+            rc = build_frame_replies(&in, &batch, prefix, prefix_len, &ctx, &compress, &consumed);
+            if (batch.iovcnt > 0) {
+                journal_flush();
+                blocking_mark(timeouts, &timeouts->times.write_since, 1);
+                if (sendv_all(client_socket, batch.iov, batch.iovcnt, zerocopy_min) < 0) {
+                    rc = -1;
+                }
+                blocking_mark(timeouts, &timeouts->times.write_since, 0);
+            }
+            if (batch.frames > 0) metrics_record_service(monotonic_ns() - started, batch.frames);
+            in.head += consumed;
+            if (rc == 2) rc = blocking_transfer(client_socket, &in, peer, timeouts) < 0 ? -1 : 1;
+        } while (rc == 1);
+        done = rc < 0;
+        ring_shrink(&in);
+        blocking_mark(timeouts, &timeouts->times.partial_since, ring_used(&in) > 0);
+    }
+    
+    ring_free(&in);
+    netbuf_free(&batch.scratch);
+    netbuf_free(&batch.plain);
+    netbuf_free(&batch.replies);
+    handler_ctx_release(&ctx);
+}
+
+// 文本协议模式下处理客户端连接：每次recv的内容作为一条消息
+void handle_client_text(int client_socket, const char* peer, blocking_conn_t* timeouts) {
+    char* buffer;
+    char welcome[BUFFER_SIZE];
+    char prefix[64];
+    struct iovec iov[2];
+    netbuf_t reply = {0};
+    handler_ctx_t ctx;
+    int prefix_len;
+    int bytes_received;
+    int rc;
+    
+    buffer = malloc(server_config.read_buffer);
+    if (buffer == NULL) {
+        log_error("❌ 内存分配失败: %s\n", strerror(errno));
+        return;
+    }
+    metrics_memory(server_config.read_buffer);
+    
+    log_info("✓ 客户端 %s 已连接 (进程ID: %d, 线程ID: %ld)\n", 
+             peer,
+             getpid(),
+             pthread_self());
+    
+    // 发送欢迎消息
+    format_welcome(welcome, sizeof(welcome), peer);
+    send(client_socket, welcome, strlen(welcome), MSG_NOSIGNAL);
+    
+    // 回复头部只格式化一次，之后每条回复用writev把头部和收到的数据一起发出，不再拼接复制
+    prefix_len = format_reply_prefix(prefix, sizeof(prefix));
+    handler_ctx_init(&ctx, peer);
+    
+    while (1) {
+        bytes_received = recv(client_socket, buffer, server_config.read_buffer - 1, 0);
+        
+        if (bytes_received <= 0) {
+            if (reaper_expired(timeouts)) break;
+            if (bytes_received == 0) {
+                log_info("✗ 客户端 %s 断开连接\n", 
+                         peer);
+            } else {
+                log_warn("✗ 接收数据失败 (客户端: %s): %s\n",
+                         peer,
+                         strerror(errno));
+                metrics_count(errors, 1);
+            }
+            break;
+        }
+        metrics_count(bytes_in, bytes_received);
+        blocking_touch(timeouts);
+        uint64_t started = monotonic_ns();
+        
+        buffer[bytes_received] = '\0';
+        log_debug("📨 收到来自 %s 的消息: %s", 
+                  peer, 
+                  buffer);
+        
+        journal_record_buffer(peer, buffer, bytes_received);
+        
+        // 检查是否是退出命令
+        if (is_quit_command(buffer)) {
+            log_info("👋 客户端 %s 请求断开连接\n", 
+                     peer);
+            break;
+        }
+        journal_flush();
+        
+        reply.len = 0;
+        rc = handler_dispatch(&handlers, &ctx, buffer, bytes_received, &reply);
+        if (rc != HANDLER_NONE) {
+            blocking_mark(timeouts, &timeouts->times.write_since, 1);
+            send_all(client_socket, reply.data, reply.len);
+            blocking_mark(timeouts, &timeouts->times.write_since, 0);
+            metrics_record_service(monotonic_ns() - started, 1);
+            if (rc == HANDLER_QUIT) break;
+            continue;
+        }
+        
+        iov[0].iov_base = prefix;
+        iov[0].iov_len = prefix_len;
+        iov[1].iov_base = buffer;
+        iov[1].iov_len = echo_payload_len(buffer);
+        blocking_mark(timeouts, &timeouts->times.write_since, 1);
+        sendv_all(client_socket, iov, 2, 0);
+        blocking_mark(timeouts, &timeouts->times.write_since, 0);
+        metrics_record_service(monotonic_ns() - started, 1);
+    }
+    
+    free(buffer);
+    metrics_memory(-server_config.read_buffer);
+    netbuf_free(&reply);
+    handler_ctx_release(&ctx);
+}
+
+// 处理客户端连接的函数：处理线程阻塞在recv/send中，超时由reaper线程检查
+void handle_client(int client_socket, peer_addr_t client_addr) {
+    char peer[PEER_ADDR_LEN];
+    blocking_conn_t timeouts;
+    const char* reason;
+    
+    format_peer(peer, sizeof(peer), client_addr);
+    metrics_count(accepted, 1);
+    if (peer_uses_tls(&client_addr) && (client_socket = tls_accept_client(client_socket, peer)) < 0) {
+        admit_release(admit_source(&client_addr));
+        metrics_count(closed, 1);
+        return;
+    }
+    reaper_register(&timeouts, client_socket);
+    
+    if (server_config.protocol == PROTOCOL_FRAMED) {
+        handle_client_framed(client_socket, peer, &timeouts);
+    } else {
+        handle_client_text(client_socket, peer, &timeouts);
+    }
+    
+    reason = reaper_unregister(&timeouts);
+    if (reason != NULL) log_timeout(peer, reason);
+    close(client_socket);
+    admit_release(admit_source(&client_addr));
+    metrics_count(closed, 1);
+}
+
+// 线程处理函数：参数直接是socket，客户端地址在线程中查询，accept时不再为每个连接分配参数
+void* thread_handler(void* arg) {
+    int client_socket = (int)(intptr_t)arg;
+    peer_addr_t client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    
+    memset(&client_addr, 0, sizeof(client_addr));
+    getpeername(client_socket, &client_addr.sa, &addr_len);
+    normalize_peer(client_socket, &client_addr);
+    handle_client(client_socket, client_addr);
+    __atomic_sub_fetch(&active_clients, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// 设置监听socket的选项，accept得到的socket会继承这些选项；UNIX socket只设置缓冲区大小
+void set_listen_options(int server_socket, int family) {
+    int opt = 1;
+    
+    // 缓冲区大小要在listen之前设置，才能影响窗口缩放
+    if (server_config.rcvbuf > 0 &&
+        setsockopt(server_socket, SOL_SOCKET, SO_RCVBUF, &server_config.rcvbuf, sizeof(int)) < 0) {
+        perror("⚠️  设置SO_RCVBUF失败");
+    }
+    if (server_config.sndbuf > 0 &&
+        setsockopt(server_socket, SOL_SOCKET, SO_SNDBUF, &server_config.sndbuf, sizeof(int)) < 0) {
+        perror("⚠️  设置SO_SNDBUF失败");
+    }
+    if (family == AF_UNIX) return;
+    if (server_config.nodelay &&
+        setsockopt(server_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0) {
+        perror("⚠️  设置TCP_NODELAY失败");
+    }
+    
+    // keepalive探测已经消失的对端（断电、断网时对端不会发送FIN）；
+    // TCP_USER_TIMEOUT让已发出的数据长时间得不到确认时由内核断开，与发送超时一致
+    if (server_config.keepalive) {
+        if (setsockopt(server_socket, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt)) < 0 ||
+            setsockopt(server_socket, IPPROTO_TCP, TCP_KEEPIDLE, &server_config.keepalive_idle, sizeof(int)) < 0 ||
+            setsockopt(server_socket, IPPROTO_TCP, TCP_KEEPINTVL, &server_config.keepalive_interval, sizeof(int)) < 0 ||
+            setsockopt(server_socket, IPPROTO_TCP, TCP_KEEPCNT, &server_config.keepalive_count, sizeof(int)) < 0) {
+            perror("⚠️  设置TCP keepalive失败");
+        }
+    }
+    if (server_config.write_timeout > 0) {
+        unsigned int user_timeout = (unsigned int)server_config.write_timeout * 1000;
+        if (setsockopt(server_socket, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout)) < 0) {
+            perror("⚠️  设置TCP_USER_TIMEOUT失败");
+        }
+    }
+}
+
+// 绑定UNIX socket的路径已经存在时，如果没有进程在监听（上次没有正常退出留下的文件）就删除它
+void unix_remove_stale(const listen_addr_t* addr) {
+    int fd;
+    
+    if (addr->addr.un.sun_path[0] == '\0') return; // 抽象命名空间随最后一个socket关闭而消失
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return;
+    if (connect(fd, &addr->addr.sa, addr->len) < 0 && errno == ECONNREFUSED) {
+        unlink(addr->addr.un.sun_path);
+    }
+    close(fd);
+}
+
+// 创建和配置一个地址上的服务器socket，监听socket都是非阻塞的
+// reuse_port为1时设置SO_REUSEPORT，允许多个socket绑定同一端口并由内核分发连接（UNIX socket不使用）
+int create_server_socket(listen_addr_t* addr, int reuse_port) {
+    int server_socket;
+    int family = addr->addr.sa.sa_family;
+    int opt = 1;
+    
+    // 热重启：沿用旧进程的监听socket，accept队列中的连接不会丢失；选项和backlog按新配置更新
+    server_socket = adopt_listen_fd(&addr->addr.sa, addr->len);
+    if (server_socket != -1) {
+        set_listen_options(server_socket, family);
+        listen(server_socket, server_config.backlog);
+        register_listen_fd(server_socket);
+        return server_socket;
+    }
+    
+    // 创建socket；系统没有启用IPv6时默认的"::"改为监听0.0.0.0
+    server_socket = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_socket == -1 && errno == EAFNOSUPPORT && listen_addr_is_any6(addr) && !addr->v6only) {
+        printf("⚠️  系统不支持IPv6，改为只监听IPv4 (0.0.0.0)\n");
+        parse_listen_addr("0.0.0.0", server_config.port, addr);
+        return create_server_socket(addr, reuse_port);
+    }
+    if (server_socket == -1) {
+        perror("❌ 创建socket失败");
+        return -1;
+    }
+    
+    if (family == AF_UNIX) {
+        unix_remove_stale(addr);
+    } else {
+        // 设置socket选项，允许重用地址
+        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+            perror("❌ 设置socket选项失败");
+            close(server_socket);
+            return -1;
+        }
+        
+        if (reuse_port && setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            perror("❌ 设置SO_REUSEPORT失败");
+            close(server_socket);
+            return -1;
+        }
+        
+        // 不依赖net.ipv6.bindv6only的系统设置
+        if (family == AF_INET6 &&
+            setsockopt(server_socket, IPPROTO_IPV6, IPV6_V6ONLY, &addr->v6only, sizeof(addr->v6only)) < 0) {
+            perror("❌ 设置IPV6_V6ONLY失败");
+            close(server_socket);
+            return -1;
+        }
+    }
+    
+    set_listen_options(server_socket, family);
+    
+    // 绑定socket
+    if (bind(server_socket, &addr->addr.sa, addr->len) < 0) {
+        if (errno == EADDRINUSE && family == AF_UNIX) {
+            printf("❌ %s 已被使用，另一个服务器正在监听\n", addr->name);
+        } else if (errno == EADDRINUSE) {
+            printf("❌ 端口 %d 已被占用 (%s)\n", server_config.port, addr->name);
+            printf("解决方案:\n");
+            printf("1. 等待几秒钟后重试\n");
+            printf("2. 检查是否有其他服务器实例在运行: ps aux | grep servertcp\n");
+            printf("3. 终止占用端口的进程: sudo lsof -ti:%d | xargs kill -9\n", server_config.port);
+        } else {
+            printf("❌ 绑定 %s 失败: %s\n", addr->name, strerror(errno));
+        }
+        close(server_socket);
+        return -1;
+    }
+    
+    // 监听连接
+    if (listen(server_socket, server_config.backlog) < 0) {
+        perror("❌ 监听失败");
+        close(server_socket);
+        return -1;
+    }
+    
+    register_listen_fd(server_socket);
+    return server_socket;
+}
+
+void listeners_close(listeners_t* listeners) {
+    for (int i = 0; i < listeners->count; i++) close(listeners->fds[i]);
+    listeners->count = 0;
+}
+
+// 为每个--bind地址创建一个监听socket，失败时关闭已经创建的并返回-1。
+// reuse_port为1时每次调用创建独立的SO_REUSEPORT socket；UNIX socket不能这样分发，
+// 第一次调用时创建，之后各次得到它的副本（dup），多个reactor/worker用EPOLLEXCLUSIVE共享
+int listeners_open(listeners_t* listeners, int reuse_port) {
+    listeners->count = 0;
+    for (int i = 0; i < listen_addr_count; i++) {
+        listen_addr_t* addr = &listen_addrs[i];
+        int fd;
+        
+        if (reuse_port && addr->addr.sa.sa_family == AF_UNIX && addr->shared_fd != -1) {
+            fd = fcntl(addr->shared_fd, F_DUPFD_CLOEXEC, 0);
+            if (fd == -1) perror("❌ 复制监听socket失败");
+        } else {
+            fd = create_server_socket(addr, reuse_port);
+            if (fd != -1 && addr->addr.sa.sa_family == AF_UNIX) addr->shared_fd = fd;
+        }
+        if (fd == -1) {
+            listeners_close(listeners);
+            return -1;
+        }
+        listeners->fds[listeners->count++] = fd;
+    }
+    return 0;
+}
+
+// 退出时删除UNIX socket文件；监听socket交给了热重启的新进程时保留，新进程还在使用
+void listeners_unlink() {
+    if (handed_over) return;
+    for (int i = 0; i < listen_addr_count; i++) {
+        if (listen_addrs[i].addr.sa.sa_family == AF_UNIX && listen_addrs[i].addr.un.sun_path[0] != '\0') {
+            unlink(listen_addrs[i].addr.un.sun_path);
+        }
+    }
+}
+
+// 基础TCP服务器
+void basic_server() {
+    listeners_t listeners;
+    int client_socket;
+    peer_addr_t client_addr;
+    int reserve_fd = reserve_fd_open();
+    
+    printf("\n🚀 启动基础TCP服务器\n");
+    printf("=====================================\n");
+    
+    if (listeners_open(&listeners, 0) < 0) return;
+    
+    print_server_ips();
+    
+    printf("✅ 基础TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("⚠️  注意: 基础服务器一次只能处理一个客户端连接\n");
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    // 开始排空时正在处理的客户端会先处理完
+    while (!server_draining()) {
+        client_socket = accept_client(&listeners, &client_addr, &reserve_fd);
+        if (client_socket < 0) continue;
+        
+        // 处理客户端（阻塞式，一次只能处理一个）
+        handle_client(client_socket, client_addr);
+    }
+    
+    listeners_close(&listeners);
+    if (reserve_fd != -1) close(reserve_fd);
+}
+
+// 多进程服务器
+void multiprocess_server() {
+    listeners_t listeners;
+    int client_socket;
+    peer_addr_t client_addr;
+    int reserve_fd = reserve_fd_open();
+    char peer[PEER_ADDR_LEN];
+    pid_t pid;
+    
+    printf("\n🚀 启动多进程TCP服务器\n");
+    printf("=====================================\n");
+    
+    // 设置信号处理器处理僵尸进程
+    signal(SIGCHLD, sigchld_handler);
+    
+    if (listeners_open(&listeners, 0) < 0) return;
+    
+    print_server_ips();
+    
+    printf("✅ 多进程TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("🔄 每个客户端连接将创建一个新进程处理\n");
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    while (!server_draining()) {
+        client_socket = accept_client(&listeners, &client_addr, &reserve_fd);
+        if (client_socket < 0) continue;
+        
+        // 创建子进程处理客户端
+        pid = fork();
+        if (pid == 0) {
+            // 子进程：退出信号保持屏蔽，由父进程统一排空；父进程排空超时退出时子进程随之结束
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            log_after_fork();
+            stats_after_fork();
+            reaper_after_fork();
+            listeners_close(&listeners); // 子进程不需要监听socket
+            close(reserve_fd);
+            handle_client(client_socket, client_addr);
+            // 子进程退出时中继线程随之结束，先等它把最后的回复发送完
+            if (tls_ctx != NULL) tls_relay_drain(TLS_HANDSHAKE_TIMEOUT_MS);
+            exit(0);
+        } else if (pid > 0) {
+            // 父进程
+            close(client_socket); // 父进程不需要客户端socket
+            log_info("🆕 创建子进程 %d 处理客户端 %s\n", 
+                     pid, format_peer(peer, sizeof(peer), client_addr));
+        } else {
+            log_error("❌ 创建进程失败: %s\n", strerror(errno));
+            close(client_socket);
+            admit_release(admit_source(&client_addr));
+        }
+    }
+    
+    // 等待所有子进程结束
+    listeners_close(&listeners);
+    if (reserve_fd != -1) close(reserve_fd);
+    signal(SIGCHLD, SIG_DFL);
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR);
+}
+
+// ==================== 连接表 ====================
+
+// 连接对象分配器（slab）：按对齐的64KB块向系统申请，块内切成固定大小的对象，
+// 每个块有自己的空闲链表。优先从有空位的块中分配，使连接对象集中在尽量少的块中；
+// 块完全空闲时归还给系统（保留一个空块，避免连接数在边界上抖动时反复申请）。
+// 每个事件循环各自持有一个连接表，只在本线程中使用，不加锁。
+typedef struct slab_chunk {
+    struct slab_chunk* prev;    // 有空位的块组成的双向链表
+    struct slab_chunk* next;
+    void* free_list;
+    size_t used;
+} slab_chunk_t;
+
+typedef struct {
+    size_t object_size;
+    size_t per_chunk;
+    size_t offset;              // 第一个对象在块内的偏移
+    slab_chunk_t* partial;      // 有空位的块
+    size_t chunks;
+    size_t empty_chunks;
+    size_t live;                // 正在使用的对象数
+    size_t peak;
+} slab_t;
+
+void slab_init(slab_t* slab, size_t object_size) {
+    memset(slab, 0, sizeof(*slab));
+    slab->object_size = (object_size + 15) & ~(size_t)15;
+    slab->offset = (sizeof(slab_chunk_t) + 15) & ~(size_t)15;
+    slab->per_chunk = (SLAB_CHUNK_SIZE - slab->offset) / slab->object_size;
+}
+
+void slab_unlink(slab_t* slab, slab_chunk_t* chunk) {
+    if (chunk->prev != NULL) chunk->prev->next = chunk->next;
+    else slab->partial = chunk->next;
+    if (chunk->next != NULL) chunk->next->prev = chunk->prev;
+    chunk->prev = chunk->next = NULL;
+}
+
+void slab_push(slab_t* slab, slab_chunk_t* chunk) {
+    chunk->prev = NULL;
+    chunk->next = slab->partial;
+    if (slab->partial != NULL) slab->partial->prev = chunk;
+    slab->partial = chunk;
+}
+
+// 分配一个清零的对象，失败返回NULL
+void* slab_alloc(slab_t* slab) {
+    slab_chunk_t* chunk = slab->partial;
+    
+    if (chunk == NULL) {
+        void* mem;
+        if (posix_memalign(&mem, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE) != 0) return NULL;
+        chunk = mem;
+        memset(chunk, 0, sizeof(*chunk));
+        for (size_t i = slab->per_chunk; i > 0; i--) {
+            void** object = (void**)((char*)chunk + slab->offset + (i - 1) * slab->object_size);
+            *object = chunk->free_list;
+            chunk->free_list = object;
+        }
+        slab_push(slab, chunk);
+        slab->chunks++;
+        slab->empty_chunks++;
+        metrics_memory(SLAB_CHUNK_SIZE);
+    }
+    
+    void** object = chunk->free_list;
+    chunk->free_list = *object;
+    if (chunk->used++ == 0) slab->empty_chunks--;
+    if (chunk->free_list == NULL) slab_unlink(slab, chunk);
+    if (++slab->live > slab->peak) slab->peak = slab->live;
+    memset(object, 0, slab->object_size);
+    return object;
+}
+
+void slab_free(slab_t* slab, void* ptr) {
+    slab_chunk_t* chunk = (slab_chunk_t*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+    void** object = ptr;
+    
+    if (chunk->free_list == NULL) slab_push(slab, chunk);
+    *object = chunk->free_list;
+    chunk->free_list = object;
+    slab->live--;
+    if (--chunk->used > 0) return;
+    
+    if (slab->empty_chunks > 0) {
+        slab_unlink(slab, chunk);
+        free(chunk);
+        slab->chunks--;
+        metrics_memory(-SLAB_CHUNK_SIZE);
+    } else {
+        slab->empty_chunks++;
+    }
+}
+
+// 释放所有块，调用者保证已经没有正在使用的对象
+void slab_destroy(slab_t* slab) {
+    while (slab->partial != NULL) {
+        slab_chunk_t* chunk = slab->partial;
+        slab_unlink(slab, chunk);
+        free(chunk);
+        metrics_memory(-SLAB_CHUNK_SIZE);
+    }
+    slab->chunks = slab->empty_chunks = 0;
+}
+
+// 用配置的栈大小创建分离（detach）或可join的线程，返回pthread_create的错误码
+// 默认8MB的栈只是地址空间预留，但线程很多时会耗尽地址空间并增加页表开销
+int create_thread(pthread_t* thread, void* (*start)(void*), void* arg, int detached) {
+    pthread_attr_t attr;
+    size_t stack_size = (size_t)server_config.thread_stack_kb * 1024;
+    int rc;
+    
+    pthread_attr_init(&attr);
+    if (stack_size < (size_t)PTHREAD_STACK_MIN) stack_size = PTHREAD_STACK_MIN;
+    pthread_attr_setstacksize(&attr, stack_size);
+    if (detached) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+    return rc;
+}
+
+// 启动时输出每个连接的内存预算，便于估算一台机器能承载的连接数
+void print_connection_memory(size_t object_size, int thread_per_connection) {
+    if (server_config.quiet) return;
+    if (thread_per_connection) {
+        printf("💾 每个连接: 读缓冲区 %d 字节 + 线程栈 %d KB (预留)，内核socket缓冲区另计\n",
+               server_config.read_buffer, server_config.thread_stack_kb);
+    } else {
+        printf("💾 每个空闲连接: 连接对象 %zu 字节 (每%d KB一块，按需分配)，"
+               "收发缓冲区只在有未处理数据时分配，内核socket缓冲区另计\n",
+               (object_size + 15) & ~(size_t)15, SLAB_CHUNK_SIZE / 1024);
+    }
+}
+
+// ==================== 线程池 ====================
+
+// 无锁队列的一个槽位，sequence用于判断槽位当前可写还是可读
+typedef struct {
+    size_t sequence;
+    thread_args_t item;
+} pool_slot_t;
+
+// 预先创建的固定大小线程池
+// accept线程通过有界无锁队列把连接交给worker，信号量只用于让空闲线程睡眠
+typedef struct {
+    pool_slot_t* slots;
+    size_t mask;
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    sem_t items;            // 队列中等待处理的连接数
+    sem_t spaces;           // 队列剩余空间，保证队列长度不超过queue_depth
+    int worker_count;
+    pthread_t* workers;
+} worker_pool_t;
+
+// 入队，队列满时返回-1（有界MPMC队列，参考Dmitry Vyukov的实现）
+int pool_enqueue(worker_pool_t* pool, const thread_args_t* item) {
+    pool_slot_t* slot;
+    size_t pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+    
+    while (1) {
+        slot = &pool->slots[pos & pool->mask];
+        size_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    slot->item = *item;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 出队，队列空时返回-1
+int pool_dequeue(worker_pool_t* pool, thread_args_t* item) {
+    pool_slot_t* slot;
+    size_t pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+    
+    while (1) {
+        slot = &pool->slots[pos & pool->mask];
+        size_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    *item = slot->item;
+    __atomic_store_n(&slot->sequence, pos + pool->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// worker线程：取出连接并处理，处理完后继续等待下一个
+void* pool_worker(void* arg) {
+    worker_pool_t* pool = (worker_pool_t*)arg;
+    thread_args_t item;
+    
+    while (1) {
+        if (sem_wait(&pool->items) != 0) continue; // EINTR
+        while (pool_dequeue(pool, &item) != 0) {
+            sched_yield(); // 生产者已占位但还没写完，极少发生
+        }
+        sem_post(&pool->spaces);
+        handle_client(item.client_socket, item.client_addr);
+        __atomic_sub_fetch(&active_clients, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// 创建线程池，队列容量向上取整为2的幂，实际长度由spaces信号量限制为queue_depth
+worker_pool_t* pool_create(int worker_count, int queue_depth) {
+    worker_pool_t* pool = calloc(1, sizeof(worker_pool_t));
+    size_t capacity = 1;
+    size_t i;
+    
+    if (pool == NULL) return NULL;
+    while (capacity < (size_t)queue_depth) capacity <<= 1;
+    
+    pool->slots = calloc(capacity, sizeof(pool_slot_t));
+    pool->workers = calloc(worker_count, sizeof(pthread_t));
+    if (pool->slots == NULL || pool->workers == NULL) {
+        free(pool->slots);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    for (i = 0; i < capacity; i++) pool->slots[i].sequence = i;
+    pool->mask = capacity - 1;
+    sem_init(&pool->items, 0, 0);
+    sem_init(&pool->spaces, 0, queue_depth);
+    
+    for (pool->worker_count = 0; pool->worker_count < worker_count; pool->worker_count++) {
+        if (create_thread(&pool->workers[pool->worker_count], pool_worker, pool, 0) != 0) {
+            perror("❌ 创建worker线程失败");
+            break;
+        }
+        pthread_detach(pool->workers[pool->worker_count]);
+    }
+    if (pool->worker_count == 0) {
+        // 线程已全部创建失败，没有线程引用pool，可以直接释放
+        sem_destroy(&pool->items);
+        sem_destroy(&pool->spaces);
+        free(pool->slots);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// queue策略下等待队列空位，开始排空时返回-1
+int pool_wait_space(worker_pool_t* pool) {
+    while (!server_draining()) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TIMEOUT_TICK_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (sem_timedwait(&pool->spaces, &deadline) == 0) return 0;
+    }
+    return -1;
+}
+
+const char* backpressure_name(backpressure_t policy) {
+    switch (policy) {
+        case BACKPRESSURE_REJECT: return "reject (拒绝新连接)";
+        case BACKPRESSURE_QUEUE:  return "queue (留在内核accept队列)";
+        case BACKPRESSURE_BLOCK:  return "block (接受后等待队列空位)";
+    }
+    return "unknown";
+}
+
+// 线程池服务器：固定数量的worker线程，不再为每个连接创建线程
+void thread_pool_server() {
+    listeners_t listeners;
+    int client_socket;
+    peer_addr_t client_addr;
+    int reserve_fd = reserve_fd_open();
+    worker_pool_t* pool;
+    thread_args_t item;
+    char peer[PEER_ADDR_LEN];
+    
+    printf("\n🚀 启动多线程TCP服务器 (线程池)\n");
+    printf("=====================================\n");
+    
+    if (listeners_open(&listeners, 0) < 0) return;
+    
+    pool = pool_create(server_config.pool_size, server_config.queue_depth);
+    if (pool == NULL) {
+        perror("❌ 创建线程池失败");
+        listeners_close(&listeners);
+        return;
+    }
+    
+    print_server_ips();
+    
+    printf("✅ 多线程TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("🧵 线程池: %d 个worker线程, 等待队列长度 %d, 队列满时策略: %s\n", 
+           pool->worker_count, server_config.queue_depth, 
+           backpressure_name(server_config.backpressure));
+    print_connection_memory(0, 1);
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    while (!server_draining()) {
+        // queue策略：先等待队列空位再accept，新连接留在内核的accept队列中
+        if (server_config.backpressure == BACKPRESSURE_QUEUE && pool_wait_space(pool) < 0) break;
+        
+        client_socket = accept_client(&listeners, &client_addr, &reserve_fd);
+        if (client_socket < 0) {
+            if (server_config.backpressure == BACKPRESSURE_QUEUE) sem_post(&pool->spaces);
+            continue;
+        }
+        
+        if (server_config.backpressure == BACKPRESSURE_REJECT) {
+            if (sem_trywait(&pool->spaces) != 0) {
+                log_warn("🚫 线程池已满，拒绝客户端 %s\n", 
+                         format_peer(peer, sizeof(peer), client_addr));
+                reject_busy(client_socket);
+                admit_release(admit_source(&client_addr));
+                metrics_count(rejected, 1);
+                continue;
+            }
+        } else if (server_config.backpressure == BACKPRESSURE_BLOCK) {
+            while (sem_wait(&pool->spaces) != 0);
+        }
+        
+        item.client_socket = client_socket;
+        item.client_addr = client_addr;
+        __atomic_add_fetch(&active_clients, 1, __ATOMIC_RELEASE);
+        pool_enqueue(pool, &item); // 已经占到空位，不会失败
+        sem_post(&pool->items);
+    }
+    
+    // 队列中的连接和正在处理的连接都处理完后返回，worker线程随进程退出
+    listeners_close(&listeners);
+    if (reserve_fd != -1) close(reserve_fd);
+    drain_wait_clients();
+}
+
+// 多线程服务器
+void multithread_server() {
+    listeners_t listeners;
+    int client_socket;
+    peer_addr_t client_addr;
+    int reserve_fd;
+    pthread_t thread;
+    char peer[PEER_ADDR_LEN];
+    
+    if (server_config.pool_size > 0) {
+        thread_pool_server();
+        return;
+    }
+    
+    printf("\n🚀 启动多线程TCP服务器\n");
+    printf("=====================================\n");
+    
+    if (listeners_open(&listeners, 0) < 0) return;
+    
+    print_server_ips();
+    
+    printf("✅ 多线程TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("🧵 每个客户端连接将创建一个新线程处理\n");
+    print_connection_memory(0, 1);
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    reserve_fd = reserve_fd_open();
+    while (!server_draining()) {
+        client_socket = accept_client(&listeners, &client_addr, &reserve_fd);
+        if (client_socket < 0) continue;
+        
+        // 创建分离的线程处理客户端，线程结束时自动清理资源
+        __atomic_add_fetch(&active_clients, 1, __ATOMIC_RELEASE);
+        int rc = create_thread(&thread, thread_handler, (void*)(intptr_t)client_socket, 1);
+        if (rc != 0) {
+            log_error("❌ 创建线程失败: %s\n", strerror(rc));
+            __atomic_sub_fetch(&active_clients, 1, __ATOMIC_RELEASE);
+            close(client_socket);
+            admit_release(admit_source(&client_addr));
+            continue;
+        }
+        log_info("🆕 创建线程 %ld 处理客户端 %s\n", 
+                 thread, format_peer(peer, sizeof(peer), client_addr));
+    }
+    
+    listeners_close(&listeners);
+    if (reserve_fd != -1) close(reserve_fd);
+    drain_wait_clients();
+}
+
+// ==================== 聊天室 ====================
+
+// 聊天室模式（事件驱动模式）：客户端发送的消息转发给同一房间的其他成员。
+// 每条消息只格式化、分配一次（chat_msg_t，引用计数），成员的发送队列中只保存指针，
+// 发送时用writev直接引用消息内容；积压超过chat_queue字节的成员被断开（慢速消费者），
+// 一个不读取的客户端既不会拖住整个房间，也不会让内存无限增长。
+// 同一事件循环中的所有连接共用一个chat_t，只在该线程中使用，不加锁
+
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];            // 完整的待发送数据（帧协议下包括帧头）
+} chat_msg_t;
+
+typedef struct chat_member {
+    struct chat_room* room;
+    int index;              // 在room->members中的位置
+    int dirty_index;        // 在待发送列表中的位置，-1表示不在列表中
+    int evicted;            // 积压过多，等待关闭
+    int fd;
+    conn_times_t* times;    // 所属连接的时间戳，发送阻塞时开始计算发送超时
+    void* owner;            // 所属连接
+    chat_msg_t** queue;     // 待发送消息的环形队列，容量为2的幂，按需增长
+    unsigned queue_cap;
+    unsigned queue_head;
+    unsigned queue_len;
+    size_t head_off;        // 队首消息已发送的字节数
+    size_t queued;          // 队列中尚未发送的字节数
+} chat_member_t;
+
+typedef struct chat_room {
+    char name[CHAT_ROOM_NAME];
+    chat_member_t** members;
+    int count;
+    int cap;
+    struct chat_room* next;
+} chat_room_t;
+
+typedef struct {
+    chat_room_t* buckets[CHAT_ROOM_BUCKETS];
+    chat_member_t** dirty;  // 本轮事件循环中有新消息或被驱逐的成员
+    int dirty_count;
+    int dirty_cap;
+    int dirty_pos;          // chat_next_dirty取到的位置
+    int framed;
+} chat_t;
+
+chat_t* chat_create() {
+    chat_t* chat = calloc(1, sizeof(chat_t));
+    if (chat != NULL) chat->framed = server_config.protocol == PROTOCOL_FRAMED;
+    return chat;
+}
+
+void chat_destroy(chat_t* chat) {
+    for (int i = 0; i < CHAT_ROOM_BUCKETS; i++) {
+        while (chat->buckets[i] != NULL) {
+            chat_room_t* room = chat->buckets[i];
+            chat->buckets[i] = room->next;
+            free(room->members);
+            free(room);
+        }
+    }
+    free(chat->dirty);
+    free(chat);
+}
+
+// 分配一条消息：[帧头] + head + body，文本协议下以换行结尾；调用者持有一个引用
+chat_msg_t* chat_msg_new(chat_t* chat, uint8_t type, const char* head, size_t head_len,
+                         const struct iovec* body, int segments) {
+    size_t body_len = 0;
+    size_t len;
+    chat_msg_t* msg;
+    char* p;
+    
+    for (int i = 0; i < segments; i++) body_len += body[i].iov_len;
+    len = head_len + body_len + (chat->framed ? FRAME_HEADER_SIZE : 1);
+    msg = malloc(sizeof(chat_msg_t) + len);
+    if (msg == NULL) return NULL;
+    metrics_memory(sizeof(chat_msg_t) + len);
+    msg->refs = 1;
+    msg->len = len;
+    
+    p = msg->data;
+    if (chat->framed) {
+        frame_encode_header((unsigned char*)p, type, 0, (uint32_t)(head_len + body_len));
+        p += FRAME_HEADER_SIZE;
+    }
+    if (head_len > 0) memcpy(p, head, head_len);
+    p += head_len;
+    for (int i = 0; i < segments; i++) {
+        memcpy(p, body[i].iov_base, body[i].iov_len);
+        p += body[i].iov_len;
+    }
+    if (!chat->framed) *p = '\n';
+    return msg;
+}
+
+void chat_msg_release(chat_msg_t* msg) {
+    if (--msg->refs > 0) return;
+    metrics_memory(-(int64_t)(sizeof(chat_msg_t) + msg->len));
+    free(msg);
+}
+
+void chat_mark_dirty(chat_t* chat, chat_member_t* member) {
+    if (member->dirty_index != -1) return;
+    if (chat->dirty_count == chat->dirty_cap) {
+        int cap = chat->dirty_cap ? chat->dirty_cap * 2 : 64;
+        chat_member_t** dirty = realloc(chat->dirty, cap * sizeof(chat_member_t*));
+        if (dirty == NULL) return; // 等下一次有新消息或可写时再发送
+        chat->dirty = dirty;
+        chat->dirty_cap = cap;
+    }
+    member->dirty_index = chat->dirty_count;
+    chat->dirty[chat->dirty_count++] = member;
+}
+
+// 取出下一个待发送的成员，取完后返回NULL并清空列表
+chat_member_t* chat_next_dirty(chat_t* chat) {
+    while (chat->dirty_pos < chat->dirty_count) {
+        chat_member_t* member = chat->dirty[chat->dirty_pos++];
+        if (member == NULL) continue;
+        member->dirty_index = -1;
+        return member;
+    }
+    chat->dirty_count = chat->dirty_pos = 0;
+    return NULL;
+}
+
+// 房间名的哈希桶（FNV-1a）
+chat_room_t** chat_bucket(chat_t* chat, const char* name) {
+    uint32_t hash = 2166136261u;
+    
+    for (const char* p = name; *p != '\0'; p++) hash = (hash ^ (unsigned char)*p) * 16777619u;
+    return &chat->buckets[hash % CHAT_ROOM_BUCKETS];
+}
+
+chat_room_t* chat_room_find(chat_t* chat, const char* name, int create) {
+    chat_room_t** bucket = chat_bucket(chat, name);
+    chat_room_t* room;
+    
+    for (room = *bucket; room != NULL; room = room->next) {
+        if (strcmp(room->name, name) == 0) return room;
+    }
+    if (!create || (room = calloc(1, sizeof(chat_room_t))) == NULL) return NULL;
+    snprintf(room->name, sizeof(room->name), "%s", name);
+    room->next = *bucket;
+    *bucket = room;
+    return room;
+}
+
+void chat_leave(chat_t* chat, chat_member_t* member) {
+    chat_room_t* room = member->room;
+    
+    if (room == NULL) return;
+    room->members[member->index] = room->members[--room->count];
+    room->members[member->index]->index = member->index;
+    member->room = NULL;
+    if (room->count > 0) return;
+    
+    // 最后一个成员离开时删除房间
+    chat_room_t** link = chat_bucket(chat, room->name);
+    while (*link != room) link = &(*link)->next;
+    *link = room->next;
+    free(room->members);
+    free(room);
+}
+
+int chat_join(chat_t* chat, chat_member_t* member, const char* name) {
+    chat_room_t* room = chat_room_find(chat, name, 1);
+    
+    if (room == NULL) return -1;
+    if (room == member->room) return 0;
+    if (room->count == room->cap) {
+        int cap = room->cap ? room->cap * 2 : 8;
+        chat_member_t** members = realloc(room->members, cap * sizeof(chat_member_t*));
+        if (members == NULL) return -1;
+        room->members = members;
+        room->cap = cap;
+    }
+    chat_leave(chat, member);
+    member->room = room;
+    member->index = room->count;
+    room->members[room->count++] = member;
+    return 0;
+}
+
+chat_member_t* chat_member_new(chat_t* chat, int fd, conn_times_t* times, void* owner) {
+    chat_member_t* member = calloc(1, sizeof(chat_member_t));
+    
+    if (member == NULL) return NULL;
+    member->fd = fd;
+    member->times = times;
+    member->owner = owner;
+    member->dirty_index = -1;
+    if (chat_join(chat, member, CHAT_DEFAULT_ROOM) < 0) {
+        free(member);
+        return NULL;
+    }
+    metrics_memory(sizeof(chat_member_t));
+    return member;
+}
+
+void chat_member_free(chat_t* chat, chat_member_t* member) {
+    chat_leave(chat, member);
+    if (member->dirty_index != -1) chat->dirty[member->dirty_index] = NULL;
+    while (member->queue_len > 0) {
+        chat_msg_release(member->queue[member->queue_head]);
+        member->queue_head = (member->queue_head + 1) & (member->queue_cap - 1);
+        member->queue_len--;
+    }
+    free(member->queue);
+    metrics_memory(-(int64_t)(sizeof(chat_member_t) + member->queue_cap * sizeof(chat_msg_t*)));
+    free(member);
+}
+
+// 放入成员的发送队列；已有积压且超过上限时标记为驱逐，由事件循环在本轮结束时关闭
+void chat_enqueue(chat_t* chat, chat_member_t* member, chat_msg_t* msg) {
+    if (member->evicted) return;
+    if (member->queue_len > 0 && member->queued + msg->len > (size_t)server_config.chat_queue) {
+        member->evicted = 1;
+        chat_mark_dirty(chat, member);
+        return;
+    }
+    if (member->queue_len == member->queue_cap) {
+        unsigned cap = member->queue_cap ? member->queue_cap * 2 : 8;
+        chat_msg_t** queue = malloc(cap * sizeof(chat_msg_t*));
+        if (queue == NULL) {
+            member->evicted = 1;
+            chat_mark_dirty(chat, member);
+            return;
+        }
+        for (unsigned i = 0; i < member->queue_len; i++) {
+            queue[i] = member->queue[(member->queue_head + i) & (member->queue_cap - 1)];
+        }
+        free(member->queue);
+        metrics_memory((int64_t)(cap - member->queue_cap) * sizeof(chat_msg_t*));
+        member->queue = queue;
+        member->queue_cap = cap;
+        member->queue_head = 0;
+    }
+    member->queue[(member->queue_head + member->queue_len++) & (member->queue_cap - 1)] = msg;
+    member->queued += msg->len;
+    msg->refs++;
+    chat_mark_dirty(chat, member);
+}
+
+// 转发给房间中除发送者以外的所有成员
+void chat_broadcast(chat_t* chat, chat_room_t* room, chat_member_t* sender, chat_msg_t* msg) {
+    int delivered = 0;
+    
+    for (int i = 0; i < room->count; i++) {
+        if (room->members[i] == sender) continue;
+        chat_enqueue(chat, room->members[i], msg);
+        delivered++;
+    }
+    metrics_count(fanout, delivered);
+}
+
+// 只发给自己的消息（握手、错误说明），与转发来的消息按顺序发送
+void chat_send(chat_t* chat, chat_member_t* member, uint8_t type, const char* text, size_t len) {
+    chat_msg_t* msg = chat_msg_new(chat, type, text, len, NULL, 0);
+    
+    if (msg == NULL) return;
+    chat_enqueue(chat, member, msg);
+    chat_msg_release(msg);
+}
+
+// 命令的执行结果
+void chat_reply(chat_t* chat, chat_member_t* member, const char* fmt, ...) {
+    char text[256];
+    va_list ap;
+    
+    va_start(ap, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(text)) len = sizeof(text) - 1;
+    chat_send(chat, member, FRAME_DATA, text, len);
+}
+
+// 处理一条消息：以'/'开头的是命令，其余转发给房间中的其他成员
+// 消息内容可能在接收环形缓冲区中分成两段
+void chat_on_message(chat_t* chat, chat_member_t* member, const char* peer, struct iovec* body, int segments) {
+    char head[CHAT_ROOM_NAME + PEER_ADDR_LEN + 8];
+    size_t len = 0;
+    chat_msg_t* msg;
+    
+    for (int i = 0; i < segments; i++) len += body[i].iov_len;
+    
+    // 文本协议下去掉行尾，转发时统一加上换行
+    while (!chat->framed && len > 0) {
+        struct iovec* last = &body[segments - 1];
+        char c = ((char*)last->iov_base)[last->iov_len - 1];
+        if (c != '\n' && c != '\r') break;
+        last->iov_len--;
+        len--;
+        if (last->iov_len == 0) segments--;
+    }
+    if (len == 0) return;
+    
+    if (*(char*)body[0].iov_base == '/') {
+        char command[CHAT_ROOM_NAME + 16];
+        size_t n = 0;
+        for (int i = 0; i < segments && n < sizeof(command) - 1; i++) {
+            size_t take = body[i].iov_len < sizeof(command) - 1 - n ? body[i].iov_len : sizeof(command) - 1 - n;
+            memcpy(command + n, body[i].iov_base, take);
+            n += take;
+        }
+        command[n] = '\0';
+        
+        if (strncmp(command, "/join ", 6) == 0 && len < sizeof(command) &&
+            command[6] != '\0' && strlen(command + 6) < CHAT_ROOM_NAME && strchr(command + 6, ' ') == NULL) {
+            if (chat_join(chat, member, command + 6) < 0) {
+                chat_reply(chat, member, "❌ 加入房间失败");
+                return;
+            }
+            log_info("💬 客户端 %s 加入房间 %s\n", peer, member->room->name);
+            chat_reply(chat, member, "✅ 已加入房间 %s (%d 人)", member->room->name, member->room->count);
+        } else if (strcmp(command, "/who") == 0) {
+            chat_reply(chat, member, "👥 房间 %s 有 %d 人", member->room->name, member->room->count);
+        } else {
+            chat_reply(chat, member, "❓ 可用命令: /join 房间名 (最长%d字节，不含空格), /who", CHAT_ROOM_NAME - 1);
+        }
+        return;
+    }
+    
+    int head_len = snprintf(head, sizeof(head), "[%s] %s: ", member->room->name, peer);
+    msg = chat_msg_new(chat, FRAME_DATA, head, head_len, body, segments);
+    if (msg == NULL) return;
+    log_debug("💬 %s 在房间 %s 发送了 %zu 字节，转发给 %d 人\n", peer, member->room->name, len, member->room->count - 1);
+    chat_broadcast(chat, member->room, member, msg);
+    chat_msg_release(msg);
+}
+
+// 帧协议：处理in中所有完整的帧，consumed返回已处理的字节数（帧的内容已复制，可以立即移除）
+// 返回处理的DATA帧数，-1表示应关闭连接
+int chat_on_frames(chat_t* chat, chat_member_t* member, ringbuf_t* in, const char* peer, size_t* consumed) {
+    char raw[FRAME_HEADER_SIZE];
+    frame_header_t header;
+    size_t offset = 0;
+    int messages = 0;
+    int result = 0;
+    
+    while (ring_used(in) - offset >= FRAME_HEADER_SIZE) {
+        ring_copy_out(in, offset, raw, FRAME_HEADER_SIZE);
+        int rc = frame_parse(raw, ring_used(in) - offset, &header);
+        if (rc < 0) {
+            static const char invalid[] = "协议错误: 无效的帧头";
+            log_warn("❌ 客户端 %s 发送了无效的帧\n", peer);
+            chat_send(chat, member, FRAME_ERROR, invalid, sizeof(invalid) - 1);
+            result = -1;
+            break;
+        }
+        if (rc == 0) break;
+        
+        size_t payload_offset = offset + FRAME_HEADER_SIZE;
+        offset += FRAME_HEADER_SIZE + header.length;
+        
+        if (header.type == FRAME_DATA && (header.flags & FRAME_FLAG_LZ)) {
+            // 聊天室的消息原样转发给其他成员，握手时不会同意压缩
+            static const char unsupported[] = "协议错误: 聊天室模式不支持压缩";
+            chat_send(chat, member, FRAME_ERROR, unsupported, sizeof(unsupported) - 1);
+            result = -1;
+            break;
+        } else if (header.type == FRAME_DATA) {
+            struct iovec payload[2];
+            int segments = ring_segments(in, payload_offset, header.length, payload);
+            journal_record(peer, payload, segments);
+            chat_on_message(chat, member, peer, payload, segments);
+            messages++;
+        } else if (header.type == FRAME_HELLO) {
+            chat_send(chat, member, FRAME_HELLO, NULL, 0);
+        } else if (header.type == FRAME_QUIT) {
+            log_info("👋 客户端 %s 请求断开连接\n", peer);
+            result = -1;
+            break;
+        } else {
+            static const char unknown[] = "未知的帧类型";
+            chat_send(chat, member, FRAME_ERROR, unknown, sizeof(unknown) - 1);
+        }
+    }
+    
+    *consumed = offset;
+    return result < 0 ? result : messages;
+}
+
+// 发送队列中的消息，每次writev最多CHAT_FLUSH_IOV条；返回0表示成功（包括发送缓冲区已满），-1表示连接出错
+int chat_flush(chat_member_t* member) {
+    int progress = 0;
+    
+    while (member->queue_len > 0) {
+        struct iovec iov[CHAT_FLUSH_IOV];
+        unsigned mask = member->queue_cap - 1;
+        int count = 0;
+        
+        for (; count < CHAT_FLUSH_IOV && (unsigned)count < member->queue_len; count++) {
+            chat_msg_t* msg = member->queue[(member->queue_head + count) & mask];
+            size_t off = count == 0 ? member->head_off : 0;
+            iov[count].iov_base = msg->data + off;
+            iov[count].iov_len = msg->len - off;
+        }
+        
+        ssize_t sent = writev(member->fd, iov, count);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // 对端每接收一部分数据，发送超时就重新计算
+            if (progress || member->times->write_since == 0) member->times->write_since = timeout_tick();
+            return 0;
+        }
+        if (sent < 0) {
+            metrics_count(errors, 1);
+            return -1;
+        }
+        metrics_count(bytes_out, sent);
+        member->queued -= sent;
+        progress = 1;
+        
+        while (sent > 0) {
+            chat_msg_t* msg = member->queue[member->queue_head];
+            size_t rest = msg->len - member->head_off;
+            if ((size_t)sent < rest) {
+                member->head_off += sent;
+                break;
+            }
+            sent -= rest;
+            member->head_off = 0;
+            member->queue_head = (member->queue_head + 1) & mask;
+            member->queue_len--;
+            chat_msg_release(msg);
+        }
+    }
+    member->times->write_since = 0;
+    return 0;
+}
+
+// ==================== 事件驱动(epoll)服务器 ====================
+
+// 连接状态机
+typedef enum {
+    CONN_HANDSHAKE, // TLS握手尚未完成
+    CONN_WELCOME,   // 欢迎消息尚未发送完毕
+    CONN_READING,   // 等待客户端消息
+    CONN_REPLYING,  // 回复未发送完毕，等待socket可写
+    CONN_TRANSFER,  // 正在传输文件，传输完后回到CONN_READING
+    CONN_QUIT       // 发送完剩余数据后关闭连接
+} conn_state_t;
+
+// 每个连接的状态，空闲连接只占用这个小结构体
+typedef struct {
+    timer_node_t timer;     // 超时检查，挂在reactor的时间轮上
+    conn_times_t times;
+    int fd;
+    conn_state_t state;
+    uint64_t source;        // 准入控制的来源（admit_source），关闭时归还准入计数
+    char peer[PEER_ADDR_LEN];   // accept时格式化好的"IP:端口"
+    char* pending;          // 未发送完的数据，仅在发送阻塞时分配
+    size_t pending_len;
+    size_t pending_off;
+    ringbuf_t in;           // 帧协议下尚未处理的数据，仅在需要时分配
+    chat_member_t* chat;    // 聊天室模式下的成员状态，否则为NULL
+    xfer_t* xfer;           // 正在进行的文件传输，否则为NULL
+    handler_ctx_t handler;  // 命令的连接上下文
+    int compress;           // 帧协议下握手时协商启用了负载压缩
+    SSL* ssl;               // TLS握手期间的状态，握手完成后释放
+} conn_t;
+
+// 事件循环（reactor）的状态，读写缓冲区由所有连接共享
+typedef struct {
+    int id;
+    int cpu;                // 绑定的CPU核心，-1表示不绑定
+    int epoll_fd;
+    listeners_t listeners;  // 开始排空后count为0
+    int reserve_fd;         // fd用尽时用于拒绝连接的预留fd
+    int active_connections;
+    char* buffer;           // 文本协议的读缓冲区，与reactor_t一起分配
+    char prefix[64];        // 回复头部，reactor线程固定，只格式化一次
+    int prefix_len;
+    ringbuf_t in;           // 帧协议的共享接收缓冲区
+    netbuf_t out;           // 欢迎消息、命令回复和文件传输回复的发送缓冲区
+    reply_batch_t batch;
+    slab_t conns;           // 本reactor的连接表
+    timer_wheel_t timers;   // 本reactor所有连接的超时
+    chat_t* chat;           // 聊天室模式下本reactor的房间，否则为NULL
+} reactor_t;
+
+// 设置非阻塞模式
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// 尽量提高文件描述符上限，事件驱动模式需要同时持有大量连接
+void raise_fd_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && !server_config.quiet) {
+        printf("📂 文件描述符上限: %llu\n", (unsigned long long)rl.rlim_cur);
+    }
+}
+
+// 关闭连接并释放资源
+void conn_close(reactor_t* reactor, conn_t* conn) {
+    timer_del(&reactor->timers, &conn->timer);
+    close(conn->fd); // close会自动将fd从epoll中移除
+    admit_release(conn->source);
+    if (conn->pending != NULL) {
+        free(conn->pending);
+        metrics_memory(-(int64_t)conn->pending_len);
+    }
+    ring_free(&conn->in);
+    if (conn->chat != NULL) chat_member_free(reactor->chat, conn->chat);
+    if (conn->xfer != NULL) xfer_free(conn->xfer);
+    if (conn->ssl != NULL) tls_free(conn->ssl);
+    handler_ctx_release(&conn->handler);
+    slab_free(&reactor->conns, conn);
+    reactor->active_connections--;
+    metrics_count(closed, 1);
+}
+
+// 发送数据，发送不完的部分保存到pending中等待EPOLLOUT
+// 返回0表示成功（包括部分发送），-1表示连接出错
+int conn_send(conn_t* conn, const char* data, size_t len) {
+    size_t sent = 0;
+    
+    while (sent < len) {
+        ssize_t n = send(conn->fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            metrics_count(errors, 1);
+            return -1;
+        }
+    }
+    metrics_count(bytes_out, sent);
+    
+    if (sent < len) {
+        // 读取在pending清空前暂停，所以这里pending一定为空
+        conn->pending = malloc(len - sent);
+        if (conn->pending == NULL) return -1;
+        metrics_memory(len - sent);
+        memcpy(conn->pending, data + sent, len - sent);
+        conn->pending_len = len - sent;
+        conn->pending_off = 0;
+        conn->times.write_since = timeout_tick();
+        if (conn->state == CONN_READING) conn->state = CONN_REPLYING;
+    } else if (conn->state == CONN_WELCOME) {
+        conn->state = CONN_READING;
+    }
+    return 0;
+}
+
+// 用writev直接发送多段数据，只有发送不完时才把剩余部分复制到pending
+// 返回0表示成功（包括部分发送），-1表示连接出错
+int conn_sendv(conn_t* conn, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(conn->fd, iov, iovcnt);
+        if (n > 0) {
+            iovcnt = iov_advance(&iov, iovcnt, n);
+            metrics_count(bytes_out, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            metrics_count(errors, 1);
+            return -1;
+        }
+    }
+    if (iovcnt == 0) {
+        if (conn->state == CONN_WELCOME) conn->state = CONN_READING;
+        return 0;
+    }
+    
+    // 慢路径：socket发送缓冲区已满
+    size_t remaining = 0;
+    for (int i = 0; i < iovcnt; i++) remaining += iov[i].iov_len;
+    conn->pending = malloc(remaining);
+    if (conn->pending == NULL) return -1;
+    metrics_memory(remaining);
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(conn->pending + conn->pending_len, iov[i].iov_base, iov[i].iov_len);
+        conn->pending_len += iov[i].iov_len;
+    }
+    conn->pending_off = 0;
+    conn->times.write_since = timeout_tick();
+    if (conn->state == CONN_READING) conn->state = CONN_REPLYING;
+    return 0;
+}
+
+// 继续发送pending中的数据，返回0表示成功，-1表示连接出错
+// 对端每接收一部分数据，发送超时就重新计算
+int conn_flush(conn_t* conn) {
+    size_t started = conn->pending_off;
+    
+    while (conn->pending_off < conn->pending_len) {
+        ssize_t n = send(conn->fd, conn->pending + conn->pending_off,
+                         conn->pending_len - conn->pending_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->pending_off += n;
+            metrics_count(bytes_out, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (conn->pending_off > started) conn->times.write_since = timeout_tick();
+            return 0;
+        } else {
+            metrics_count(errors, 1);
+            return -1;
+        }
+    }
+    
+    free(conn->pending);
+    metrics_memory(-(int64_t)conn->pending_len);
+    conn->pending = NULL;
+    conn->pending_len = conn->pending_off = 0;
+    conn->times.write_since = 0;
+    if (conn->state == CONN_WELCOME || conn->state == CONN_REPLYING) {
+        conn->state = CONN_READING;
+    }
+    return 0;
+}
+
+int conn_on_readable(reactor_t* reactor, conn_t* conn);
+
+// 连接可以开始收发消息：加入聊天室并发送欢迎消息，失败时关闭连接
+void conn_start(reactor_t* reactor, conn_t* conn) {
+    if (reactor->chat != NULL) {
+        conn->chat = chat_member_new(reactor->chat, conn->fd, &conn->times, conn);
+        if (conn->chat == NULL) {
+            conn_close(reactor, conn);
+            return;
+        }
+    }
+    
+    reactor->out.len = 0;
+    if (append_welcome(&reactor->out, conn->peer) < 0 ||
+        conn_send(conn, reactor->out.data, reactor->out.len) < 0) {
+        conn_close(reactor, conn);
+    }
+}
+
+// TLS握手在事件循环中非阻塞地推进：socket的读写事件都已注册（边沿触发），
+// 握手需要等待时直接返回；完成后换成收发数据用的fd（见tls_detach）重新注册，再发送欢迎消息
+void conn_handshake(reactor_t* reactor, conn_t* conn) {
+    struct epoll_event ev;
+    int rc = tls_handshake_step(conn->ssl);
+    
+    if (rc > 0) return;
+    if (rc < 0) {
+        tls_failed(conn->peer);
+        conn_close(reactor, conn);
+        return;
+    }
+    
+    // 交给中继线程的socket不能再留在本reactor的epoll中
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->fd = tls_established(conn->ssl, conn->fd, conn->peer, 1);
+    conn->ssl = NULL;
+    timeout_mark(&conn->times.partial_since, 0, reactor->timers.now);
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    if (conn->fd < 0 || epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+        conn_close(reactor, conn);
+        return;
+    }
+    conn->state = CONN_WELCOME;
+    conn_start(reactor, conn);
+}
+
+// 帧协议：in开头是GET或FILE帧，开始文件传输；上传时in中已经收到的文件内容直接写入文件
+// 返回-1表示连接已关闭
+int conn_start_transfer(reactor_t* reactor, conn_t* conn, ringbuf_t* in) {
+    int rc;
+    
+    reactor->out.len = 0;
+    rc = xfer_start(in, &reactor->out, conn->peer, &conn->xfer);
+    if (reactor->out.len > 0 && conn_send(conn, reactor->out.data, reactor->out.len) < 0) {
+        conn_close(reactor, conn);
+        return -1;
+    }
+    if (rc < 0) {
+        conn->state = CONN_QUIT;
+    } else if (conn->xfer != NULL) {
+        conn->state = CONN_TRANSFER;
+    }
+    return 0;
+}
+
+// 继续文件传输。每次最多传输XFER_BURST块，还没有遇到EAGAIN时用EPOLL_CTL_MOD重新触发边缘事件，
+// 下一轮再继续，同一reactor上的其他连接不会被一个大文件饿死。传输完后回到帧处理
+// 返回-1表示连接已关闭
+int conn_transfer(reactor_t* reactor, conn_t* conn) {
+    xfer_t* xfer = conn->xfer;
+    uint64_t before = xfer->done;
+    int rc = 2;
+    
+    for (int i = 0; i < XFER_BURST && rc == 2; i++) {
+        rc = xfer->upload ? xfer_recv(xfer, conn->fd) : xfer_send(xfer, conn->fd);
+    }
+    if (rc < 0) {
+        log_warn("✗ 文件传输中断 (客户端: %s, %s): %s\n", 
+                 conn->peer, xfer->name, strerror(errno));
+        conn_close(reactor, conn);
+        return -1;
+    }
+    if (xfer->upload && xfer->done > before) conn->times.last_read = reactor->timers.now;
+    if (!xfer->upload && rc == 0 && (xfer->done > before || conn->times.write_since == 0)) {
+        conn->times.write_since = timeout_tick();
+    }
+    if (rc == 2) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+    if (rc != 1) return 0;
+    
+    reactor->out.len = 0;
+    rc = xfer_finish(xfer, &reactor->out);
+    xfer_free(xfer);
+    conn->xfer = NULL;
+    conn->times.write_since = 0;
+    conn->state = rc < 0 ? CONN_QUIT : CONN_READING;
+    if (reactor->out.len > 0 && conn_send(conn, reactor->out.data, reactor->out.len) < 0) {
+        conn_close(reactor, conn);
+        return -1;
+    }
+    if (conn->pending != NULL) return 0;
+    if (conn->state == CONN_QUIT) {
+        conn_close(reactor, conn);
+        return -1;
+    }
+    return conn_on_readable(reactor, conn);
+}
+
+// 帧协议：先读入reactor共享的缓冲区，处理完后只有剩下不完整的帧时才复制到连接自己的缓冲区
+int conn_on_readable_framed(reactor_t* reactor, conn_t* conn) {
+    ringbuf_t* in = &conn->in;
+    uint64_t started = monotonic_ns();
+    
+    while (conn->state == CONN_READING) {
+        // 先处理缓冲区中已有的完整帧（上次因发送阻塞而暂停的帧也在这里继续）
+        int rc = 0;
+        while (ring_used(in) > 0 && conn->state == CONN_READING) {
+            size_t consumed;
+            if (conn->chat != NULL) {
+                rc = chat_on_frames(reactor->chat, conn->chat, in, conn->peer, &consumed);
+                if (rc > 0) metrics_record_service(monotonic_ns() - started, rc);
+                in->head += consumed;
+                if (rc < 0) conn->state = CONN_QUIT;
+                break;
+            }
+            rc = build_frame_replies(in, &reactor->batch, reactor->prefix, reactor->prefix_len,
+                                     &conn->handler, &conn->compress, &consumed);
+            if (reactor->batch.iovcnt > 0 &&
+                conn_sendv(conn, reactor->batch.iov, reactor->batch.iovcnt) < 0) {
+                conn_close(reactor, conn);
+                return -1;
+            }
+            if (reactor->batch.frames > 0) {
+                metrics_record_service(monotonic_ns() - started, reactor->batch.frames);
+            }
+            in->head += consumed;
+            if (rc == 2) {
+                if (conn_start_transfer(reactor, conn, in) < 0) return -1;
+                continue;
+            }
+            if (rc < 0) conn->state = CONN_QUIT;
+            if (rc != 1) break;
+        }
+        
+        if (in == &reactor->in) {
+            if (ring_used(in) > 0) {
+                size_t used = ring_used(in);
+                if (ring_reserve(&conn->in, used) < 0) {
+                    conn_close(reactor, conn);
+                    return -1;
+                }
+                ring_copy_out(in, 0, conn->in.data, used);
+                conn->in.head = 0;
+                conn->in.tail = used;
+            }
+            in->head = in->tail = 0;
+        }
+        if (ring_used(&conn->in) == 0 && conn->in.cap > 0) ring_free(&conn->in);
+        timeout_mark(&conn->times.partial_since, 
+                     ring_used(&conn->in) > 0 && conn->state != CONN_TRANSFER, reactor->timers.now);
+        if (conn->state != CONN_READING) break;
+        
+        in = ring_used(&conn->in) > 0 ? &conn->in : &reactor->in;
+        if (ring_prepare_read(in) < 0) {
+            conn_close(reactor, conn);
+            return -1;
+        }
+        
+        struct iovec space[2];
+        ssize_t bytes_received = readv(conn->fd, space, ring_free_segments(in, space));
+        
+        if (bytes_received < 0 && errno == EINTR) continue;
+        if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        
+        if (bytes_received <= 0) {
+            if (bytes_received == 0) {
+                log_info("✗ 客户端 %s 断开连接\n", 
+                         conn->peer);
+            } else {
+                log_warn("✗ 接收数据失败 (客户端: %s): %s\n",
+                         conn->peer,
+                         strerror(errno));
+                metrics_count(errors, 1);
+            }
+            conn_close(reactor, conn);
+            return -1;
+        }
+        in->tail += bytes_received;
+        metrics_count(bytes_in, bytes_received);
+        conn->times.last_read = reactor->timers.now;
+        started = monotonic_ns();
+    }
+    
+    if (conn->state == CONN_TRANSFER && conn->pending == NULL) return conn_transfer(reactor, conn);
+    if (conn->state == CONN_QUIT && conn->pending == NULL) {
+        if (conn->chat != NULL) chat_flush(conn->chat); // 尽量发出错误说明
+        conn_close(reactor, conn);
+        return -1;
+    }
+    return 0;
+}
+
+// 读取并处理消息，直到EAGAIN或需要等待发送（边缘触发必须读空）
+// 返回0表示连接仍然有效，-1表示连接已关闭
+int conn_on_readable(reactor_t* reactor, conn_t* conn) {
+    if (server_config.protocol == PROTOCOL_FRAMED) {
+        return conn_on_readable_framed(reactor, conn);
+    }
+    
+    while (conn->state == CONN_READING) {
+        ssize_t bytes_received = recv(conn->fd, reactor->buffer, server_config.read_buffer - 1, 0);
+        
+        if (bytes_received < 0 && errno == EINTR) continue;
+        if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        
+        if (bytes_received <= 0) {
+            if (bytes_received == 0) {
+                log_info("✗ 客户端 %s 断开连接\n", 
+                         conn->peer);
+            } else {
+                log_warn("✗ 接收数据失败 (客户端: %s): %s\n",
+                         conn->peer,
+                         strerror(errno));
+                metrics_count(errors, 1);
+            }
+            conn_close(reactor, conn);
+            return -1;
+        }
+        metrics_count(bytes_in, bytes_received);
+        conn->times.last_read = reactor->timers.now;
+        uint64_t started = monotonic_ns();
+        
+        reactor->buffer[bytes_received] = '\0';
+        log_debug("📨 收到来自 %s 的消息: %s", 
+                  conn->peer, 
+                  reactor->buffer);
+        journal_record_buffer(conn->peer, reactor->buffer, bytes_received);
+        
+        if (is_quit_command(reactor->buffer)) {
+            log_info("👋 客户端 %s 请求断开连接\n", 
+                     conn->peer);
+            conn->state = CONN_QUIT;
+            break;
+        }
+        
+        if (conn->chat != NULL) {
+            struct iovec body = { reactor->buffer, bytes_received };
+            chat_on_message(reactor->chat, conn->chat, conn->peer, &body, 1);
+            metrics_record_service(monotonic_ns() - started, 1);
+            continue;
+        }
+        
+        reactor->out.len = 0;
+        int rc = handler_dispatch(&handlers, &conn->handler, reactor->buffer, bytes_received, &reactor->out);
+        if (rc != HANDLER_NONE) {
+            if (conn_send(conn, reactor->out.data, reactor->out.len) < 0) {
+                conn_close(reactor, conn);
+                return -1;
+            }
+            metrics_record_service(monotonic_ns() - started, 1);
+            if (rc == HANDLER_QUIT) conn->state = CONN_QUIT;
+            continue;
+        }
+        
+        struct iovec iov[2];
+        iov[0].iov_base = reactor->prefix;
+        iov[0].iov_len = reactor->prefix_len;
+        iov[1].iov_base = reactor->buffer;
+        iov[1].iov_len = echo_payload_len(reactor->buffer);
+        if (conn_sendv(conn, iov, 2) < 0) {
+            conn_close(reactor, conn);
+            return -1;
+        }
+        metrics_record_service(monotonic_ns() - started, 1);
+    }
+    
+    if (conn->state == CONN_QUIT && conn->pending == NULL) {
+        conn_close(reactor, conn);
+        return -1;
+    }
+    return 0;
+}
+
+// socket可写：发送剩余数据，发送完毕后继续处理已到达的消息
+void conn_on_writable(reactor_t* reactor, conn_t* conn) {
+    if (conn_flush(conn) < 0) {
+        conn_close(reactor, conn);
+        return;
+    }
+    if (conn->pending != NULL) return;
+    
+    if (conn->state == CONN_QUIT) {
+        conn_close(reactor, conn);
+        return;
+    }
+    if (conn->state == CONN_TRANSFER) {
+        conn_transfer(reactor, conn);
+        return;
+    }
+    conn_on_readable(reactor, conn);
+}
+
+// 接受一个监听socket上等待中的连接，每次最多ACCEPT_BATCH个，剩下的由下一轮epoll_wait继续
+// （监听socket是水平触发的）
+void reactor_accept(reactor_t* reactor, int listen_fd) {
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        peer_addr_t client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_socket = accept4(listen_fd, &client_addr.sa, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (is_fd_exhausted(errno)) {
+                if (accept_shed(listen_fd, &reactor->reserve_fd, 0)) continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error("❌ 接受连接失败: %s\n", strerror(errno));
+            }
+            return;
+        }
+        normalize_peer(client_socket, &client_addr);
+        if (admit_or_reject(client_socket, &client_addr) < 0) continue;
+        
+        conn_t* conn = slab_alloc(&reactor->conns);
+        if (conn == NULL) {
+            log_error("❌ 内存分配失败: %s\n", strerror(errno));
+            close(client_socket);
+            admit_release(admit_source(&client_addr));
+            continue;
+        }
+        conn->fd = client_socket;
+        conn->source = admit_source(&client_addr);
+        format_peer(conn->peer, sizeof(conn->peer), client_addr);
+        handler_ctx_init(&conn->handler, conn->peer);
+        conn->state = peer_uses_tls(&client_addr) ? CONN_HANDSHAKE : CONN_WELCOME;
+        conn_times_init(&conn->times, reactor->timers.now);
+        // 没有完成的握手和不完整的消息一样受读取超时限制
+        if (conn->state == CONN_HANDSHAKE) conn->times.partial_since = reactor->timers.now;
+        
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+            log_error("❌ 注册epoll事件失败: %s\n", strerror(errno));
+            close(client_socket);
+            admit_release(conn->source);
+            slab_free(&reactor->conns, conn);
+            continue;
+        }
+        reactor->active_connections++;
+        metrics_count(accepted, 1);
+        timeout_schedule(&reactor->timers, &conn->timer, &conn->times);
+        
+        log_info("✓ 客户端 %s 已连接 (进程ID: %d, 线程ID: %ld, 当前连接数: %d)\n", 
+                 conn->peer,
+                 getpid(),
+                 pthread_self(),
+                 reactor->active_connections);
+        
+        if (conn->state == CONN_HANDSHAKE) {
+            conn->ssl = tls_new(tls_ctx, client_socket, 1);
+            if (conn->ssl == NULL) {
+                tls_failed(conn->peer);
+                conn_close(reactor, conn);
+            } else {
+                conn_handshake(reactor, conn);
+            }
+            continue;
+        }
+        conn_start(reactor, conn);
+    }
+}
+
+// 处理到期的定时器：真正超时的连接关闭，其余的按最新的时间点重新加入时间轮
+void reactor_expire(reactor_t* reactor) {
+    timer_node_t* node;
+    
+    while ((node = timer_expired(&reactor->timers)) != NULL) {
+        conn_t* conn = (conn_t*)node;
+        const char* reason;
+        uint64_t next = conn_timeout_check(&conn->times, reactor->timers.now, &reason);
+        
+        if (next == 0) {
+            log_timeout(conn->peer, reason);
+            conn_close(reactor, conn);
+        } else if (next != UINT64_MAX) {
+            timer_add(&reactor->timers, node, next);
+        }
+    }
+}
+
+// 发送本轮有新消息的成员的队列，关闭积压过多被驱逐的成员
+// 欢迎消息没有发送完的成员等socket可写后再发送
+void reactor_chat_flush(reactor_t* reactor) {
+    chat_member_t* member;
+    
+    while ((member = chat_next_dirty(reactor->chat)) != NULL) {
+        conn_t* conn = member->owner;
+        
+        if (member->evicted) {
+            log_warn("🐢 客户端 %s 接收太慢 (积压 %zu 字节)，断开连接\n", conn->peer, member->queued);
+            metrics_count(evicted, 1);
+            conn_close(reactor, conn);
+            continue;
+        }
+        if (conn->pending != NULL) continue;
+        if (chat_flush(member) < 0) conn_close(reactor, conn);
+    }
+}
+
+// 开始排空：不再接受新连接。监听socket可能还被其他进程持有（预派生master、热重启的新进程），
+// close不会把它从epoll中移除，需要先显式删除
+void reactor_stop_accepting(reactor_t* reactor) {
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, lifecycle_wake_fd, NULL);
+    for (int i = 0; i < reactor->listeners.count; i++) {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, reactor->listeners.fds[i], NULL);
+    }
+    listeners_close(&reactor->listeners);
+}
+
+// 运行事件循环，直到epoll出错或排空完成（不再监听且没有连接）
+// 有连接需要超时检查时epoll_wait最多等待一个tick
+void reactor_run(reactor_t* reactor) {
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    
+    reactor->prefix_len = format_reply_prefix(reactor->prefix, sizeof(reactor->prefix));
+    
+    while (reactor->listeners.count > 0 || reactor->active_connections > 0) {
+        int n = epoll_wait(reactor->epoll_fd, events, EPOLL_MAX_EVENTS,
+                           reactor->timers.count > 0 ? TIMEOUT_TICK_MS : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("❌ epoll_wait失败");
+            return;
+        }
+        
+        // 先推进时间轮再处理事件：到期的连接如果在本轮收到了数据，检查时就不再算作超时；
+        // 本轮被关闭的连接会从到期列表中移除
+        timer_advance(&reactor->timers, timeout_tick());
+        
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 < MAX_LISTENERS) {
+                // 排空后同一批中剩下的监听事件不再处理
+                int index = (int)events[i].data.u64;
+                if (index < reactor->listeners.count) reactor_accept(reactor, reactor->listeners.fds[index]);
+                continue;
+            }
+            if (events[i].data.ptr == reactor) {
+                reactor_stop_accepting(reactor);
+                continue;
+            }
+            
+            conn_t* conn = events[i].data.ptr;
+            uint32_t ev = events[i].events;
+            
+            // 有未发送完的数据时暂停读取，等socket可写后再继续
+            // 出错时由send/recv返回具体错误并关闭连接
+            // 聊天室成员在本轮结束时统一发送队列，先加入待发送列表（连接关闭时会自动移除）
+            if (conn->chat != NULL && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                chat_mark_dirty(reactor->chat, conn->chat);
+            }
+            if (conn->state == CONN_HANDSHAKE) {
+                conn_handshake(reactor, conn);
+                continue;
+            }
+            if (conn->pending != NULL) {
+                if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) conn_on_writable(reactor, conn);
+                continue;
+            }
+            if (conn->state == CONN_TRANSFER) {
+                conn_transfer(reactor, conn);
+                continue;
+            }
+            
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+                conn_on_readable(reactor, conn);
+            }
+        }
+        if (reactor->chat != NULL) reactor_chat_flush(reactor);
+        reactor_expire(reactor);
+    }
+}
+
+// 创建reactor：在监听socket上建立自己的epoll实例，reactor接管listeners中的socket（失败时关闭它们）
+// exclusive为1时使用EPOLLEXCLUSIVE，多个进程/线程共享同一监听socket时只唤醒其中一个
+reactor_t* reactor_create(listeners_t* listeners, int exclusive) {
+    struct epoll_event ev;
+    reactor_t* reactor;
+    
+    reactor = calloc(1, sizeof(reactor_t) + server_config.read_buffer);
+    if (reactor == NULL) {
+        perror("❌ 内存分配失败");
+        listeners_close(listeners);
+        return NULL;
+    }
+    reactor->buffer = (char*)(reactor + 1);
+    slab_init(&reactor->conns, sizeof(conn_t));
+    timer_wheel_init(&reactor->timers, timeout_tick());
+    reactor->cpu = -1;
+    reactor->listeners = *listeners;
+    
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epoll_fd == -1) {
+        perror("❌ 创建epoll失败");
+        listeners_close(&reactor->listeners);
+        free(reactor);
+        return NULL;
+    }
+    
+    // 监听socket用它在listeners中的下标标识，小于MAX_LISTENERS的值不会是连接的指针
+    for (int i = 0; i < reactor->listeners.count; i++) {
+        set_nonblocking(reactor->listeners.fds[i]);
+        ev.events = EPOLLIN | (exclusive ? EPOLLEXCLUSIVE : 0);
+        ev.data.u64 = i;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->listeners.fds[i], &ev) < 0) {
+            perror("❌ 注册epoll事件失败");
+            close(reactor->epoll_fd);
+            listeners_close(&reactor->listeners);
+            free(reactor);
+            return NULL;
+        }
+    }
+    
+    // lifecycle_wake_fd用reactor自身的指针标识，开始排空时可读
+    ev.events = EPOLLIN;
+    ev.data.ptr = reactor;
+    if (lifecycle_wake_fd != -1) epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, lifecycle_wake_fd, &ev);
+    
+    reactor->reserve_fd = reserve_fd_open();
+    return reactor;
+}
+
+void reactor_destroy(reactor_t* reactor) {
+    close(reactor->epoll_fd);
+    listeners_close(&reactor->listeners);
+    if (reactor->reserve_fd != -1) close(reactor->reserve_fd);
+    ring_free(&reactor->in);
+    netbuf_free(&reactor->out);
+    netbuf_free(&reactor->batch.scratch);
+    netbuf_free(&reactor->batch.plain);
+    netbuf_free(&reactor->batch.replies);
+    slab_destroy(&reactor->conns);
+    if (reactor->chat != NULL) chat_destroy(reactor->chat);
+    free(reactor);
+}
+
+// 事件驱动服务器（单线程非阻塞 + 边缘触发epoll）
+void event_loop_server() {
+    listeners_t listeners;
+    reactor_t* reactor;
+    
+    printf("\n🚀 启动事件驱动TCP服务器 (epoll)\n");
+    printf("=====================================\n");
+    
+    if (listeners_open(&listeners, 0) < 0) return;
+    reactor = reactor_create(&listeners, 0);
+    if (reactor == NULL) return;
+    if (server_config.chat && (reactor->chat = chat_create()) == NULL) {
+        perror("❌ 内存分配失败");
+        reactor_destroy(reactor);
+        return;
+    }
+    
+    print_server_ips();
+    raise_fd_limit();
+    
+    printf("✅ 事件驱动TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("⚡ 单线程处理所有客户端连接，空闲连接几乎不占用资源\n");
+    if (reactor->chat != NULL) {
+        printf("💬 聊天室模式：消息转发给同一房间的其他客户端，积压超过 %d 字节的客户端会被断开\n",
+               server_config.chat_queue);
+    }
+    print_connection_memory(sizeof(conn_t), 0);
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    reactor_run(reactor);
+    reactor_destroy(reactor);
+}
+
+// reactor线程入口
+void* reactor_thread(void* arg) {
+    reactor_t* reactor = (reactor_t*)arg;
+    
+    if (reactor->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(reactor->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            printf("⚠️  reactor %d 绑定CPU %d 失败\n", reactor->id, reactor->cpu);
+        }
+    }
+    
+    if (reactor->cpu >= 0) {
+        printf("🧵 reactor %d 已启动 (线程ID: %ld, 绑定CPU %d)\n", reactor->id, pthread_self(), reactor->cpu);
+    } else {
+        printf("🧵 reactor %d 已启动 (线程ID: %ld)\n", reactor->id, pthread_self());
+    }
+    reactor_run(reactor);
+    return NULL;
+}
+
+// 多reactor服务器：每个线程一个epoll实例和一组SO_REUSEPORT监听socket，
+// 由内核在各监听socket之间分发新连接，线程之间不共享任何连接状态；
+// UNIX socket由所有线程共享，用EPOLLEXCLUSIVE每次只唤醒一个线程
+void multi_reactor_server() {
+    int cpu_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = server_config.reactor_threads;
+    reactor_t** reactors;
+    pthread_t* threads;
+    int i;
+    
+    if (cpu_count < 1) cpu_count = 1;
+    if (thread_count <= 0) thread_count = cpu_count;
+    
+    printf("\n🚀 启动多reactor TCP服务器 (%d个epoll线程)\n", thread_count);
+    printf("=====================================\n");
+    
+    reactors = calloc(thread_count, sizeof(reactor_t*));
+    threads = calloc(thread_count, sizeof(pthread_t));
+    if (reactors == NULL || threads == NULL) {
+        perror("❌ 内存分配失败");
+        free(reactors);
+        free(threads);
+        return;
+    }
+    
+    // 先在主线程创建所有监听socket，绑定失败时可以直接退出
+    for (i = 0; i < thread_count; i++) {
+        listeners_t listeners;
+        reactors[i] = listeners_open(&listeners, 1) == 0 ? reactor_create(&listeners, 1) : NULL;
+        if (reactors[i] == NULL) {
+            while (--i >= 0) reactor_destroy(reactors[i]);
+            free(reactors);
+            free(threads);
+            return;
+        }
+        reactors[i]->id = i;
+        reactors[i]->cpu = server_config.cpu_affinity ? i % cpu_count : -1;
+    }
+    
+    print_server_ips();
+    raise_fd_limit();
+    
+    printf("✅ 多reactor TCP服务器正在监听端口 %d (backlog=%d)\n", server_config.port, server_config.backlog);
+    printf("⚡ 内核通过SO_REUSEPORT把新连接分发到 %d 个reactor线程\n", thread_count);
+    print_connection_memory(sizeof(conn_t), 0);
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    for (i = 0; i < thread_count; i++) {
+        if (create_thread(&threads[i], reactor_thread, reactors[i], 0) != 0) {
+            perror("❌ 创建线程失败");
+            thread_count = i;
+            break;
+        }
+    }
+    
+    for (i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+        reactor_destroy(reactors[i]);
+    }
+    
+    free(reactors);
+    free(threads);
+}
+
+// ==================== 预派生进程池 ====================
+
+// 预派生的worker进程
+typedef struct {
+    pid_t pid;
+    listeners_t listeners;  // 该worker使用的监听socket
+    time_t started_at;
+} prefork_worker_t;
+
+prefork_worker_t* prefork_workers;  // master开始排空时通知这些worker
+int prefork_worker_count;
+
+int listeners_contains(const listeners_t* listeners, int fd) {
+    for (int i = 0; i < listeners->count; i++) {
+        if (listeners->fds[i] == fd) return 1;
+    }
+    return 0;
+}
+
+// 关闭workers[0..count)的监听socket，keep中的除外（共享的socket只关闭一次）
+void prefork_close_workers(prefork_worker_t* workers, int count, const listeners_t* keep) {
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < workers[i].listeners.count; j++) {
+            int fd = workers[i].listeners.fds[j];
+            int seen = keep != NULL && listeners_contains(keep, fd);
+            for (int k = 0; k < i && !seen; k++) seen = listeners_contains(&workers[k].listeners, fd);
+            if (!seen) close(fd);
+        }
+    }
+}
+
+// 关闭master持有的监听socket
+void prefork_close_listeners() {
+    prefork_close_workers(prefork_workers, prefork_worker_count, NULL);
+    for (int i = 0; i < prefork_worker_count; i++) prefork_workers[i].listeners.count = 0;
+}
+
+// master开始排空：让worker各自排空，master也不再持有监听socket，新连接直接被拒绝（或只由热重启的新进程接受）
+void prefork_drain_workers() {
+    for (int i = 0; i < prefork_worker_count; i++) {
+        if (prefork_workers[i].pid > 0) kill(prefork_workers[i].pid, SIGTERM);
+    }
+    prefork_close_listeners();
+}
+
+// worker进程入口：在监听socket上运行自己的事件循环，排空完成后退出，不再返回
+void prefork_worker_main(int id, prefork_worker_t* workers, int worker_count) {
+    reactor_t* reactor;
+    
+    // master退出时worker随之排空并退出，避免留下孤儿进程继续占用端口
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGCHLD, SIG_DFL);
+    log_after_fork();
+    stats_after_fork();
+    lifecycle_after_fork();
+    
+    // 关闭其他worker的独立监听socket
+    prefork_close_workers(workers, worker_count, &workers[id].listeners);
+    
+    // 独立的SO_REUSEPORT socket只有本worker在等待，EPOLLEXCLUSIVE没有影响；UNIX socket总是共享的
+    reactor = reactor_create(&workers[id].listeners, 1);
+    if (reactor == NULL) exit(1);
+    reactor->id = id;
+    
+    printf("🧩 worker %d 已启动 (进程ID: %d)\n", id, getpid());
+    reactor_run(reactor);
+    if (tls_ctx != NULL) tls_relay_drain(TLS_HANDSHAKE_TIMEOUT_MS);
+    exit(server_draining() ? 0 : 1);
+}
+
+// 启动（或重启）第id个worker
+int prefork_spawn(int id, prefork_worker_t* workers, int worker_count) {
+    fflush(stdout); // 避免子进程重复输出缓冲区中的内容
+    pid_t pid = fork();
+    if (pid == 0) {
+        prefork_worker_main(id, workers, worker_count);
+    } else if (pid < 0) {
+        perror("❌ 创建worker进程失败");
+        return -1;
+    }
+    workers[id].pid = pid;
+    workers[id].started_at = time(NULL);
+    return 0;
+}
+
+// 预派生进程池服务器：启动时创建固定数量的worker进程，每个worker自己accept，
+// master只负责监控，worker异常退出时重新派生
+void prefork_server() {
+    int cpu_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int worker_count = server_config.prefork_workers;
+    prefork_worker_t* workers;
+    int i;
+    
+    if (cpu_count < 1) cpu_count = 1;
+    if (worker_count <= 0) worker_count = cpu_count;
+    
+    printf("\n🚀 启动预派生进程池TCP服务器 (%d个worker进程)\n", worker_count);
+    printf("=====================================\n");
+    
+    // master自己用waitpid回收worker
+    signal(SIGCHLD, SIG_DFL);
+    
+    workers = calloc(worker_count, sizeof(prefork_worker_t));
+    if (workers == NULL) {
+        perror("❌ 内存分配失败");
+        return;
+    }
+    
+    // 监听socket由master创建并一直持有，重启的worker沿用原来的socket和accept队列
+    for (i = 0; i < worker_count; i++) {
+        if (i > 0 && !server_config.prefork_reuseport) {
+            workers[i].listeners = workers[0].listeners;
+        } else if (listeners_open(&workers[i].listeners, server_config.prefork_reuseport) < 0) {
+            prefork_close_workers(workers, i, NULL);
+            free(workers);
+            return;
+        }
+    }
+    
+    print_server_ips();
+    raise_fd_limit();
+    
+    printf("✅ 预派生进程池TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("🧩 监听方式: %s\n", server_config.prefork_reuseport ?
+           "每个worker独立的SO_REUSEPORT监听socket" : "所有worker共享一个监听socket (EPOLLEXCLUSIVE)");
+    print_connection_memory(sizeof(conn_t), 0);
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    prefork_workers = workers;
+    prefork_worker_count = worker_count;
+    drain_hook = prefork_drain_workers;
+    for (i = 0; i < worker_count; i++) {
+        prefork_spawn(i, workers, worker_count);
+    }
+    
+    // 排空时不再重启worker，等所有worker处理完自己的连接后退出
+    while (1) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            if (errno != ECHILD || !server_draining()) perror("❌ waitpid失败");
+            break;
+        }
+        
+        for (i = 0; i < worker_count && workers[i].pid != pid; i++);
+        if (i == worker_count) continue;
+        
+        if (server_draining()) {
+            printf("🧩 worker %d (进程ID: %d) 已退出\n", i, pid);
+            workers[i].pid = 0;
+            continue;
+        }
+        if (WIFSIGNALED(status)) {
+            printf("💥 worker %d (进程ID: %d) 被信号 %d 终止，正在重启\n", i, pid, WTERMSIG(status));
+        } else {
+            printf("💥 worker %d (进程ID: %d) 退出 (状态码 %d)，正在重启\n", i, pid, WEXITSTATUS(status));
+        }
+        
+        // 启动后马上崩溃的worker等一秒再重启，避免fork风暴
+        if (time(NULL) - workers[i].started_at < 1) sleep(1);
+        while (prefork_spawn(i, workers, worker_count) != 0) sleep(1);
+        if (server_draining()) kill(workers[i].pid, SIGTERM); // 重启期间开始了排空
+    }
+    
+    drain_hook = NULL;
+    for (i = 0; i < worker_count; i++) {
+        if (workers[i].pid > 0) kill(workers[i].pid, SIGTERM);
+    }
+    prefork_close_listeners();
+    free(workers);
+}
+
+// ==================== io_uring服务器 ====================
+
+// user_data低3位表示请求类型，其余位是连接指针
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_TIMER 4    // 时间轮的tick，没有对应的连接
+#define URING_OP_WAKE 5     // lifecycle_wake_fd可读：开始排空
+#define URING_OP_MASK 7ULL
+#define URING_BUF_GROUP 0
+#define URING_MAX_PENDING (1024 * 1024)  // 客户端不读取回复时，最多为其积压的字节数（不含正在追加的回复）
+#define URING_CLOSE_GRACEFUL 1  // 发送完已积累的回复后关闭
+#define URING_CLOSE_ABORT 2     // 立即关闭
+
+// 不依赖liburing，直接通过系统调用和mmap使用io_uring
+typedef struct {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned sq_mask;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sqe_tail;          // 已填写的SQE
+    unsigned sqe_submitted;     // 已提交给内核的SQE
+    unsigned cq_mask;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    struct io_uring_cqe* cqes;
+    void* ring_ptr;
+    size_t ring_len;
+    size_t sqes_len;
+    
+    // 提供给内核的接收缓冲区环（provided buffer ring）
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_len;
+    char* buf_base;
+    unsigned buf_count;
+    unsigned buf_size;
+    unsigned short buf_tail;
+} uring_t;
+
+// io_uring模式下的连接
+typedef struct uring_conn {
+    timer_node_t timer;         // 超时检查，挂在服务器的时间轮上
+    conn_times_t times;
+    int fd;
+    uint64_t source;            // 准入控制的来源（admit_source），释放时归还准入计数
+    int closing;                // 0或URING_CLOSE_*
+    int inflight;               // 尚未结束的请求数（multishot recv + send）
+    int dirty;                  // 已在待发送列表中
+    struct uring_conn* next_dirty;
+    char peer[PEER_ADDR_LEN];   // accept时格式化好的"IP:端口"
+    char* out;                  // 正在积累的回复
+    size_t out_len;
+    size_t out_cap;
+    char* send_buf;             // 已提交给内核、正在发送的回复
+    size_t send_len;
+    size_t send_off;
+    size_t send_cap;
+    ringbuf_t in;               // 帧协议下未凑成完整帧的数据
+    handler_ctx_t handler;      // 命令的连接上下文
+    int compress;               // 帧协议下握手时协商启用了负载压缩
+} uring_conn_t;
+
+typedef struct {
+    uring_t ring;
+    listeners_t listeners;      // 开始排空后count为0
+    int reserve_fd;             // fd用尽时用于拒绝连接的预留fd
+    unsigned accept_paused;     // fd用尽时暂停accept的监听socket（按下标的位图），下一个tick再重新提交
+    int active_connections;
+    uring_conn_t* dirty_head;
+    char prefix[64];            // 回复头部，只格式化一次
+    int prefix_len;
+    netbuf_t out;               // 欢迎消息和命令回复的临时缓冲区
+    reply_batch_t batch;
+    slab_t conns;               // 连接表
+    timer_wheel_t timers;       // 所有连接的超时
+    int timer_armed;            // 已提交IORING_OP_TIMEOUT
+    struct __kernel_timespec tick;
+} uring_server_t;
+
+int uring_setup(uring_t* ring, unsigned entries) {
+    struct io_uring_params params;
+    char* ptr;
+    unsigned i;
+    
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    // multishot请求会产生大量完成事件，CQ开大一些
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    
+    ring->ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->ring_fd < 0) return -1;
+    
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        close(ring->ring_fd);
+        errno = ENOSYS;
+        return -1;
+    }
+    
+    ring->ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > ring->ring_len) {
+        ring->ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    }
+    ring->ring_ptr = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->ring_ptr == MAP_FAILED) {
+        close(ring->ring_fd);
+        return -1;
+    }
+    
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->ring_ptr, ring->ring_len);
+        close(ring->ring_fd);
+        return -1;
+    }
+    
+    ptr = ring->ring_ptr;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_mask = *(unsigned*)(ptr + params.sq_off.ring_mask);
+    ring->sq_head = (unsigned*)(ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(ptr + params.sq_off.tail);
+    ring->sq_array = (unsigned*)(ptr + params.sq_off.array);
+    ring->cq_mask = *(unsigned*)(ptr + params.cq_off.ring_mask);
+    ring->cq_head = (unsigned*)(ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(ptr + params.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe*)(ptr + params.cq_off.cqes);
+    
+    // SQE按顺序使用，索引数组固定为恒等映射
+    for (i = 0; i < ring->sq_entries; i++) ring->sq_array[i] = i;
+    ring->sqe_tail = ring->sqe_submitted = *ring->sq_tail;
+    return 0;
+}
+
+// 归还一个接收缓冲区给内核
+void uring_buf_recycle(uring_t* ring, unsigned short bid) {
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buf->addr = (unsigned long)(ring->buf_base + (size_t)bid * ring->buf_size);
+    buf->len = ring->buf_size - 1; // 留一个字节放字符串结束符
+    buf->bid = bid;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// 注册provided buffer ring，buf_count必须是2的幂
+int uring_setup_buffers(uring_t* ring, unsigned buf_count, unsigned buf_size) {
+    struct io_uring_buf_reg reg;
+    unsigned i;
+    
+    ring->buf_count = buf_count;
+    ring->buf_size = buf_size;
+    ring->buf_ring_len = buf_count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = buf_count;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(ring->buf_ring, ring->buf_ring_len);
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    
+    ring->buf_base = malloc((size_t)buf_count * buf_size);
+    if (ring->buf_base == NULL) {
+        syscall(__NR_io_uring_register, ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(ring->buf_ring, ring->buf_ring_len);
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    for (i = 0; i < buf_count; i++) uring_buf_recycle(ring, i);
+    return 0;
+}
+
+void uring_destroy(uring_t* ring) {
+    if (ring->buf_ring != NULL) munmap(ring->buf_ring, ring->buf_ring_len);
+    free(ring->buf_base);
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->ring_ptr, ring->ring_len);
+    close(ring->ring_fd);
+}
+
+// 提交所有已填写的SQE，wait_nr>0时同时等待完成事件
+int uring_submit(uring_t* ring, unsigned wait_nr) {
+    int ret;
+    
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->ring_fd, ring->sqe_tail - ring->sqe_submitted,
+                      wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret > 0) ring->sqe_submitted += ret;
+    return ret;
+}
+
+// 获取一个空闲SQE，SQ满时先提交一批
+struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+    struct io_uring_sqe* sqe;
+    
+    while (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_submit(ring, 0) < 0) return NULL;
+    }
+    sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// 内核是否支持本模式用到的multishot recv（Linux 6.0+）
+// multishot是IORING_OP_RECV的标志而不是新的操作码，IORING_REGISTER_PROBE探测不到，只能看内核版本
+int uring_kernel_supported() {
+    struct utsname info;
+    int major = 0;
+    
+    if (uname(&info) != 0 || sscanf(info.release, "%d", &major) != 1) return 0;
+    return major >= 6;
+}
+
+// accept请求的user_data中，连接指针的位置存放监听socket在listeners中的下标
+unsigned long uring_accept_data(int index) {
+    return (unsigned long)index << 3 | URING_OP_ACCEPT;
+}
+
+void uring_arm_accept(uring_server_t* server, int index) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&server->ring);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server->listeners.fds[index];
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = uring_accept_data(index);
+}
+
+void uring_arm_recv(uring_server_t* server, uring_conn_t* conn) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&server->ring);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (unsigned long)conn | URING_OP_RECV;
+    conn->inflight++;
+}
+
+void uring_arm_wake(uring_server_t* server) {
+    struct io_uring_sqe* sqe;
+    
+    if (lifecycle_wake_fd == -1 || (sqe = uring_get_sqe(&server->ring)) == NULL) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = lifecycle_wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_OP_WAKE;
+}
+
+// 开始排空：取消multishot accept并关闭监听socket（热重启时新进程仍持有它），
+// 之后到达的accept完成事件只处理已经接受的连接，不再重新提交
+void uring_stop_accepting(uring_server_t* server) {
+    for (int i = 0; i < server->listeners.count; i++) {
+        struct io_uring_sqe* sqe = uring_get_sqe(&server->ring);
+        
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = uring_accept_data(i);
+            sqe->user_data = 0;
+        }
+    }
+    listeners_close(&server->listeners);
+    server->accept_paused = 0;
+}
+
+// 有连接需要超时检查或accept被暂停时，每个tick产生一次完成事件
+void uring_arm_timer(uring_server_t* server) {
+    struct io_uring_sqe* sqe;
+    
+    if (server->timer_armed || (server->timers.count == 0 && !server->accept_paused)) return;
+    sqe = uring_get_sqe(&server->ring);
+    if (sqe == NULL) return;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&server->tick;
+    sqe->len = 1;
+    sqe->user_data = URING_OP_TIMER;
+    server->timer_armed = 1;
+}
+
+// 每次提交发送都重新开始计算发送超时：对端接收了上一次的数据才会有下一次发送
+void uring_send_pending(uring_server_t* server, uring_conn_t* conn) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&server->ring);
+    if (sqe == NULL) return;
+    conn->times.write_since = server->timers.now;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (unsigned long)(conn->send_buf + conn->send_off);
+    sqe->len = conn->send_len - conn->send_off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)conn | URING_OP_SEND;
+    conn->inflight++;
+}
+
+// 把回复追加到连接的输出缓冲区，本轮完成事件处理完后统一提交发送
+// 积压上限只计算已经在排队、还没有发出的回复，单个回复（最大可达FRAME_MAX_PAYLOAD）总能放入
+int uring_conn_queue(uring_server_t* server, uring_conn_t* conn, const char* data, size_t len) {
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : BUFFER_SIZE;
+        while (cap < conn->out_len + len) cap *= 2;
+        if (conn->out_len + conn->send_len > URING_MAX_PENDING) return -1;
+        char* out = realloc(conn->out, cap);
+        if (out == NULL) return -1;
+        metrics_memory((int64_t)cap - (int64_t)conn->out_cap);
+        conn->out = out;
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+    
+    if (!conn->dirty) {
+        conn->dirty = 1;
+        conn->next_dirty = server->dirty_head;
+        server->dirty_head = conn;
+    }
+    return 0;
+}
+
+// 把多段数据追加到待发送的回复中（异步发送期间缓冲区可能被复用，所以这里必须复制）
+int uring_conn_queuev(uring_server_t* server, uring_conn_t* conn, const struct iovec* iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        if (uring_conn_queue(server, conn, iov[i].iov_base, iov[i].iov_len) < 0) return -1;
+    }
+    return 0;
+}
+
+// 所有请求都结束后才能关闭fd并释放连接
+void uring_conn_release(uring_server_t* server, uring_conn_t* conn) {
+    if (!conn->closing || conn->inflight > 0 || conn->dirty) return;
+    if (conn->closing == URING_CLOSE_GRACEFUL && (conn->out_len > 0 || conn->send_len > 0)) return;
+    timer_del(&server->timers, &conn->timer);
+    close(conn->fd);
+    admit_release(conn->source);
+    free(conn->out);
+    free(conn->send_buf);
+    metrics_memory(-(int64_t)(conn->out_cap + conn->send_cap));
+    ring_free(&conn->in);
+    handler_ctx_release(&conn->handler);
+    slab_free(&server->conns, conn);
+    server->active_connections--;
+    metrics_count(closed, 1);
+}
+
+// 开始关闭连接：shutdown让multishot recv以0结束，调用者最后负责uring_conn_release
+// how为URING_CLOSE_GRACEFUL时只关闭读方向，已积累的回复仍会发送出去
+void uring_conn_close(uring_conn_t* conn, int how) {
+    if (conn->closing >= how) return;
+    conn->closing = how;
+    shutdown(conn->fd, how == URING_CLOSE_ABORT ? SHUT_RDWR : SHUT_RD);
+}
+
+// fd用尽时内核在等待连接之前就返回EMFILE，立即重新提交accept会空转，所以暂停到下一个tick
+void uring_on_accept(uring_server_t* server, struct io_uring_cqe* cqe) {
+    int index = (int)(cqe->user_data >> 3);
+    
+    if (cqe->res < 0 && server->listeners.count == 0) return; // 排空时被取消
+    if (cqe->res < 0 && is_fd_exhausted(-cqe->res)) {
+        errno = -cqe->res;
+        while (accept_shed(server->listeners.fds[index], &server->reserve_fd, 0));
+        if (!(cqe->flags & IORING_CQE_F_MORE)) server->accept_paused |= 1u << index;
+        return;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE) && server->listeners.count > 0) uring_arm_accept(server, index);
+    
+    if (cqe->res < 0) {
+        log_error("❌ 接受连接失败: %s\n", strerror(-cqe->res));
+        return;
+    }
+    
+    // multishot accept不能为每个连接单独返回地址，这里单独查询
+    peer_addr_t client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    memset(&client_addr, 0, sizeof(client_addr));
+    getpeername(cqe->res, &client_addr.sa, &addr_len);
+    normalize_peer(cqe->res, &client_addr);
+    if (admit_or_reject(cqe->res, &client_addr) < 0) return;
+    
+    uring_conn_t* conn = slab_alloc(&server->conns);
+    if (conn == NULL) {
+        log_error("❌ 内存分配失败: %s\n", strerror(errno));
+        close(cqe->res);
+        admit_release(admit_source(&client_addr));
+        return;
+    }
+    conn->fd = cqe->res;
+    conn->source = admit_source(&client_addr);
+    format_peer(conn->peer, sizeof(conn->peer), client_addr);
+    handler_ctx_init(&conn->handler, conn->peer);
+    server->active_connections++;
+    metrics_count(accepted, 1);
+    conn_times_init(&conn->times, server->timers.now);
+    timeout_schedule(&server->timers, &conn->timer, &conn->times);
+    
+    log_info("✓ 客户端 %s 已连接 (进程ID: %d, 线程ID: %ld, 当前连接数: %d)\n", 
+             conn->peer,
+             getpid(),
+             pthread_self(),
+             server->active_connections);
+    
+    server->out.len = 0;
+    append_welcome(&server->out, conn->peer);
+    uring_conn_queue(server, conn, server->out.data, server->out.len);
+    uring_arm_recv(server, conn);
+}
+
+void uring_on_recv(uring_server_t* server, uring_conn_t* conn, struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) conn->inflight--;
+    
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char* buffer = server->ring.buf_base + (size_t)bid * server->ring.buf_size;
+        uint64_t started = monotonic_ns();
+        buffer[cqe->res] = '\0';
+        metrics_count(bytes_in, cqe->res);
+        conn->times.last_read = server->timers.now;
+        
+        if (!conn->closing && server_config.protocol == PROTOCOL_FRAMED) {
+            int rc = 1;
+            if (ring_append(&conn->in, buffer, cqe->res) < 0) {
+                uring_conn_close(conn, URING_CLOSE_ABORT);
+                rc = 0;
+            }
+            while (rc == 1) {
+                size_t consumed;
+                rc = build_frame_replies(&conn->in, &server->batch, server->prefix, server->prefix_len,
+                                         &conn->handler, &conn->compress, &consumed);
+                if (uring_conn_queuev(server, conn, server->batch.iov, server->batch.iovcnt) < 0) {
+                    log_warn("🐢 客户端 %s 积压的回复过多，断开连接\n", 
+                             conn->peer);
+                    uring_conn_close(conn, URING_CLOSE_ABORT);
+                    break;
+                }
+                if (server->batch.frames > 0) {
+                    metrics_record_service(monotonic_ns() - started, server->batch.frames);
+                }
+                conn->in.head += consumed;
+                if (rc < 0) uring_conn_close(conn, URING_CLOSE_GRACEFUL);
+            }
+            if (ring_used(&conn->in) == 0) ring_free(&conn->in);
+            timeout_mark(&conn->times.partial_since, ring_used(&conn->in) > 0, server->timers.now);
+        } else if (!conn->closing) {
+            log_debug("📨 收到来自 %s 的消息: %s", 
+                      conn->peer, 
+                      buffer);
+            
+            int rc;
+            
+            server->out.len = 0;
+            journal_record_buffer(conn->peer, buffer, cqe->res);
+            if (is_quit_command(buffer)) {
+                log_info("👋 客户端 %s 请求断开连接\n", 
+                         conn->peer);
+                uring_conn_close(conn, URING_CLOSE_GRACEFUL);
+            } else if ((rc = handler_dispatch(&handlers, &conn->handler, buffer, cqe->res, &server->out)) !=
+                       HANDLER_NONE) {
+                if (uring_conn_queue(server, conn, server->out.data, server->out.len) < 0) {
+                    log_warn("🐢 客户端 %s 积压的回复过多，断开连接\n", 
+                             conn->peer);
+                    uring_conn_close(conn, URING_CLOSE_ABORT);
+                } else {
+                    metrics_record_service(monotonic_ns() - started, 1);
+                    if (rc == HANDLER_QUIT) uring_conn_close(conn, URING_CLOSE_GRACEFUL);
+                }
+            } else {
+                struct iovec iov[2];
+                iov[0].iov_base = server->prefix;
+                iov[0].iov_len = server->prefix_len;
+                iov[1].iov_base = buffer;
+                iov[1].iov_len = echo_payload_len(buffer);
+                if (uring_conn_queuev(server, conn, iov, 2) < 0) {
+                    log_warn("🐢 客户端 %s 积压的回复过多，断开连接\n", 
+                             conn->peer);
+                    uring_conn_close(conn, URING_CLOSE_ABORT);
+                } else {
+                    metrics_record_service(monotonic_ns() - started, 1);
+                }
+            }
+        }
+        uring_buf_recycle(&server->ring, bid);
+    } else if (cqe->res == 0 && !conn->closing) {
+        log_info("✗ 客户端 %s 断开连接\n", 
+                 conn->peer);
+        uring_conn_close(conn, URING_CLOSE_ABORT);
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && !conn->closing) {
+        log_warn("✗ 接收数据失败 (客户端: %s): %s\n",
+                 conn->peer,
+                 strerror(-cqe->res));
+        metrics_count(errors, 1);
+        uring_conn_close(conn, URING_CLOSE_ABORT);
+    }
+    
+    // 缓冲区暂时用完(ENOBUFS)等原因导致multishot结束时重新提交
+    if (!(cqe->flags & IORING_CQE_F_MORE) && !conn->closing) {
+        uring_arm_recv(server, conn);
+    }
+    uring_conn_release(server, conn);
+}
+
+void uring_on_send(uring_server_t* server, uring_conn_t* conn, struct io_uring_cqe* cqe) {
+    conn->inflight--;
+    
+    if (cqe->res < 0) {
+        metrics_count(errors, 1);
+        uring_conn_close(conn, URING_CLOSE_ABORT);
+        uring_conn_release(server, conn);
+        return;
+    }
+    
+    metrics_count(bytes_out, cqe->res);
+    conn->send_off += cqe->res;
+    if (conn->send_off < conn->send_len && conn->closing != URING_CLOSE_ABORT) {
+        uring_send_pending(server, conn); // 只发送了一部分，继续发送剩余数据
+        return;
+    }
+    conn->send_len = conn->send_off = 0;
+    conn->times.write_since = 0;
+    
+    // 发送完后连接空闲（没有新积累的回复），或缓冲区是为大批回复扩容的，就释放发送缓冲区，
+    // 空闲连接只保留连接对象本身
+    if (conn->out_len == 0 || conn->send_cap > URING_BUF_KEEP) {
+        free(conn->send_buf);
+        metrics_memory(-(int64_t)conn->send_cap);
+        conn->send_buf = NULL;
+        conn->send_cap = 0;
+    }
+    
+    // 发送期间积累的回复在本轮结束时一起发送
+    if (conn->out_len > 0 && !conn->dirty) {
+        conn->dirty = 1;
+        conn->next_dirty = server->dirty_head;
+        server->dirty_head = conn;
+    }
+    uring_conn_release(server, conn);
+}
+
+// 为本轮有新回复的连接提交发送，和下一次等待合并为一次系统调用
+void uring_flush_dirty(uring_server_t* server) {
+    while (server->dirty_head != NULL) {
+        uring_conn_t* conn = server->dirty_head;
+        server->dirty_head = conn->next_dirty;
+        conn->dirty = 0;
+        
+        if (conn->closing != URING_CLOSE_ABORT && conn->send_len == 0 && conn->out_len > 0) {
+            // 交换两个缓冲区：积累的回复变为发送中，旧发送缓冲区用于继续积累
+            char* buf = conn->send_buf;
+            size_t cap = conn->send_cap;
+            conn->send_buf = conn->out;
+            conn->send_cap = conn->out_cap;
+            conn->send_len = conn->out_len;
+            conn->send_off = 0;
+            conn->out = buf;
+            conn->out_cap = cap;
+            conn->out_len = 0;
+            uring_send_pending(server, conn);
+        }
+        uring_conn_release(server, conn);
+    }
+}
+
+// 处理到期的定时器：超时的连接立即关闭，其余的按最新的时间点重新加入时间轮
+void uring_expire(uring_server_t* server) {
+    timer_node_t* node;
+    
+    while ((node = timer_expired(&server->timers)) != NULL) {
+        uring_conn_t* conn = (uring_conn_t*)node;
+        const char* reason;
+        uint64_t next;
+        
+        if (conn->closing == URING_CLOSE_ABORT) continue; // 只是在等待请求结束
+        next = conn_timeout_check(&conn->times, server->timers.now, &reason);
+        if (next == 0) {
+            log_timeout(conn->peer, reason);
+            uring_conn_close(conn, URING_CLOSE_ABORT);
+            uring_conn_release(server, conn);
+        } else if (next != UINT64_MAX) {
+            timer_add(&server->timers, node, next);
+        }
+    }
+}
+
+// 运行事件循环，直到出错或排空完成（不再监听且没有连接）
+void uring_run(uring_server_t* server) {
+    uring_t* ring = &server->ring;
+    
+    for (int i = 0; i < server->listeners.count; i++) uring_arm_accept(server, i);
+    uring_arm_wake(server);
+    
+    while (server->listeners.count > 0 || server->active_connections > 0) {
+        uring_arm_timer(server);
+        // CQ溢出（EBUSY）或内核暂时无法分配请求（EAGAIN）不是致命错误：先处理已有的完成事件，
+        // 没有提交的SQE留到下一轮再提交；其他错误才结束事件循环
+        if (uring_submit(ring, 1) < 0 && errno != EBUSY && errno != EAGAIN) {
+            perror("❌ io_uring_enter失败");
+            return;
+        }
+        
+        // 与epoll模式一样，先推进时间轮，处理完本轮事件后再检查到期的连接
+        timer_advance(&server->timers, timeout_tick());
+        
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+            unsigned long type = cqe->user_data & URING_OP_MASK;
+            uring_conn_t* conn = (uring_conn_t*)(unsigned long)(cqe->user_data & ~URING_OP_MASK);
+            
+            if (type == URING_OP_ACCEPT) {
+                uring_on_accept(server, cqe);
+            } else if (type == URING_OP_RECV) {
+                uring_on_recv(server, conn, cqe);
+            } else if (type == URING_OP_SEND) {
+                uring_on_send(server, conn, cqe);
+            } else if (type == URING_OP_TIMER) {
+                server->timer_armed = 0;
+                for (int i = 0; i < server->listeners.count; i++) {
+                    if (server->accept_paused & (1u << i)) uring_arm_accept(server, i);
+                }
+                server->accept_paused = 0;
+            } else if (type == URING_OP_WAKE) {
+                if (server->listeners.count > 0) uring_stop_accepting(server);
+            }
+            
+            head++;
+            if (head == tail) {
+                // 处理期间可能有新的完成事件
+                __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+                tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+            }
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        
+        uring_expire(server);
+        uring_flush_dirty(server);
+    }
+}
+
+// io_uring服务器：multishot accept + multishot recv（provided buffer ring）+ 批量send，
+// 一次io_uring_enter同时提交本轮所有发送并等待下一批事件；内核不支持时回退到epoll
+void io_uring_server() {
+    uring_server_t* server;
+    
+    printf("\n🚀 启动io_uring TCP服务器\n");
+    printf("=====================================\n");
+    
+    server = calloc(1, sizeof(uring_server_t));
+    if (server == NULL) {
+        perror("❌ 内存分配失败");
+        return;
+    }
+    slab_init(&server->conns, sizeof(uring_conn_t));
+    timer_wheel_init(&server->timers, timeout_tick());
+    server->tick.tv_nsec = TIMEOUT_TICK_MS * 1000000L;
+    
+    if (!uring_kernel_supported() || uring_setup(&server->ring, server_config.uring_entries) < 0) {
+        printf("⚠️  当前内核不支持io_uring（或被禁用），回退到epoll事件驱动模式\n");
+        server_mode_name = "epoll";
+        free(server);
+        event_loop_server();
+        return;
+    }
+    if (uring_setup_buffers(&server->ring, server_config.uring_buffers, server_config.read_buffer) < 0) {
+        printf("⚠️  当前内核不支持provided buffer ring，回退到epoll事件驱动模式\n");
+        server_mode_name = "epoll";
+        uring_destroy(&server->ring);
+        free(server);
+        event_loop_server();
+        return;
+    }
+    
+    if (listeners_open(&server->listeners, 0) < 0) {
+        uring_destroy(&server->ring);
+        free(server);
+        return;
+    }
+    server->reserve_fd = reserve_fd_open();
+    
+    print_server_ips();
+    raise_fd_limit();
+    
+    printf("✅ io_uring TCP服务器正在监听端口 %d\n", server_config.port);
+    printf("⚡ SQ深度 %u, 接收缓冲区 %u 个 x %u 字节\n", 
+           server->ring.sq_entries, server->ring.buf_count, server->ring.buf_size);
+    print_connection_memory(sizeof(uring_conn_t), 0);
+    server_ready();
+    printf("📱 等待客户端连接...\n\n");
+    
+    server->prefix_len = format_reply_prefix(server->prefix, sizeof(server->prefix));
+    uring_run(server);
+    
+    listeners_close(&server->listeners);
+    if (server->reserve_fd != -1) close(server->reserve_fd);
+    uring_destroy(&server->ring);
+    netbuf_free(&server->out);
+    netbuf_free(&server->batch.scratch);
+    netbuf_free(&server->batch.plain);
+    netbuf_free(&server->batch.replies);
+    slab_destroy(&server->conns);
+    free(server);
+}
+
+// ==================== 运行统计 ====================
+
+// 回答一次统计请求：不管请求路径是什么，都返回Prometheus文本格式的全部指标
+void stats_serve(int client_socket, double uptime) {
+    metrics_slot_t* snapshot = malloc(sizeof(metrics_slot_t));
+    struct timeval timeout = { 1, 0 };
+    char request[1024];
+    char header[256];
+    char* body = NULL;
+    size_t body_len = 0;
+    size_t received = 0;
     
-    if (getifaddrs(&ifaddrs_ptr) == -1) {
-        perror("获取网络接口失败");
-        return;
+    // 读到请求头结束为止（curl、浏览器和Prometheus都会发送完整的请求头）
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (received < sizeof(request) - 1) {
+        ssize_t n = recv(client_socket, request + received, sizeof(request) - 1 - received, 0);
+        if (n <= 0) break;
+        received += n;
+        request[received] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
     }
     
-    for (ifa = ifaddrs_ptr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == NULL) continue;
-        
-        // 只处理IPv4地址
-        if (ifa->ifa_addr->sa_family == AF_INET) {
-            struct sockaddr_in* addr_in = (struct sockaddr_in*)ifa->ifa_addr;
-            inet_ntop(AF_INET, &(addr_in->sin_addr), ip_str, INET_ADDRSTRLEN);
-            
-            // 跳过回环地址，但仍显示以供参考
-            if (strcmp(ip_str, "127.0.0.1") == 0) {
-                printf("  %s:%d (本地回环 - 仅本机访问)\n", ip_str, PORT);
-            } else {
-                printf("  %s:%d (%s - 可供其他机器访问)\n", ip_str, PORT, ifa->ifa_name);
-            }
-        }
+    FILE* out = open_memstream(&body, &body_len);
+    if (snapshot != NULL && out != NULL) {
+        int threads = metrics_snapshot(snapshot);
+        metrics_write_prometheus(out, snapshot, threads, server_mode_name, uptime);
     }
+    if (out != NULL) fclose(out);
     
-    freeifaddrs(ifaddrs_ptr);
-    printf("====================\n");
-    printf("客户端可以使用上述任意IP地址连接到服务器\n");
-    printf("建议使用标注为'可供其他机器访问'的IP地址\n\n");
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n", body_len);
+    if (send_all(client_socket, header, header_len) == 0 && body_len > 0) {
+        send_all(client_socket, body, body_len);
+    }
+    free(body);
+    free(snapshot);
+    close(client_socket);
 }
 
-// 处理客户端连接的函数
-void handle_client(int client_socket, struct sockaddr_in client_addr) {
-    char buffer[BUFFER_SIZE];
-    char response[BUFFER_SIZE];
-    int bytes_received;
+// 输出一行统计摘要：吞吐按两次输出之间的差值计算，延迟分位数只统计这段时间内的消息
+void stats_print_summary(metrics_slot_t* current, metrics_slot_t* previous, double elapsed, double uptime) {
+    histogram_t* recent = &previous->service;   // 就地计算差值，previous随后会被current覆盖
     
-    printf("✓ 客户端 %s:%d 已连接 (进程ID: %d, 线程ID: %ld)\n", 
-           inet_ntoa(client_addr.sin_addr), 
-           ntohs(client_addr.sin_port),
-           getpid(),
-           pthread_self());
+    for (int i = 0; i < HIST_BUCKETS; i++) recent->counts[i] = current->service.counts[i] - recent->counts[i];
+    recent->total = current->service.total - recent->total;
+    recent->max = current->service.max;
     
-    // 发送欢迎消息
-    snprintf(response, sizeof(response), 
-             "欢迎连接到TCP服务器!\n服务器信息: 进程ID=%d, 线程ID=%ld\n客户端信息: %s:%d\n", 
-             getpid(), pthread_self(),
-             inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-    send(client_socket, response, strlen(response), 0);
+    long long active = (long long)(current->accepted - current->closed);
+    
+    printf("📊 [%.0fs] 连接 %lld (累计 %llu, 拒绝 %llu, 超时 %llu) | 消息 %.0f/s | 接收 %.2f MB/s 发送 %.2f MB/s | "
+           "p50 %.1fus p99 %.1fus | 内存 %.1f MB (%lld 字节/连接) | 错误 %llu\n",
+           uptime,
+           active,
+           (unsigned long long)current->accepted,
+           (unsigned long long)current->rejected,
+           (unsigned long long)current->timeouts,
+           (current->requests - previous->requests) / elapsed,
+           (current->bytes_in - previous->bytes_in) / elapsed / 1e6,
+           (current->bytes_out - previous->bytes_out) / elapsed / 1e6,
+           recent->total ? hist_percentile(recent, 50) / 1e3 : 0.0,
+           recent->total ? hist_percentile(recent, 99) / 1e3 : 0.0,
+           (long long)current->memory / 1e6,
+           active > 0 ? (long long)current->memory / active : 0LL,
+           (unsigned long long)current->errors);
+    fflush(stdout);
+}
+
+// 统计线程：在统计端口上回答查询，并按间隔输出摘要；只在主进程（master）中运行
+void* stats_thread(void* arg) {
+    metrics_slot_t* snapshots = calloc(2, sizeof(metrics_slot_t));
+    uint64_t started = monotonic_ns();
+    uint64_t interval = (uint64_t)server_config.stats_interval * 1000000000ULL;
+    uint64_t last = started;
+    int current = 0;
+    
+    (void)arg;
+    if (snapshots == NULL) interval = 0;
     
     while (1) {
-        memset(buffer, 0, BUFFER_SIZE);
-        bytes_received = recv(client_socket, buffer, BUFFER_SIZE - 1, 0);
+        uint64_t now = monotonic_ns();
+        int timeout = -1;
         
-        if (bytes_received <= 0) {
-            if (bytes_received == 0) {
-                printf("✗ 客户端 %s:%d 断开连接\n", 
-                       inet_ntoa(client_addr.sin_addr), 
-                       ntohs(client_addr.sin_port));
-            } else {
-                printf("✗ 接收数据失败 (客户端: %s:%d): %s\n",
-                       inet_ntoa(client_addr.sin_addr), 
-                       ntohs(client_addr.sin_port),
-                       strerror(errno));
+        if (interval > 0) {
+            if (now - last >= interval) {
+                metrics_snapshot(&snapshots[current]);
+                stats_print_summary(&snapshots[current], &snapshots[!current],
+                                    (now - last) / 1e9, (now - started) / 1e9);
+                current = !current;
+                last = now;
             }
-            break;
+            timeout = (int)((last + interval - now) / 1000000) + 1;
         }
-        
-        buffer[bytes_received] = '\0';
-        printf("📨 收到来自 %s:%d 的消息: %s", 
-               inet_ntoa(client_addr.sin_addr), 
-               ntohs(client_addr.sin_port), 
-               buffer);
-        
-        // 检查是否是退出命令
-        if (strncmp(buffer, "quit", 4) == 0) {
-            printf("👋 客户端 %s:%d 请求断开连接\n", 
-                   inet_ntoa(client_addr.sin_addr), 
-                   ntohs(client_addr.sin_port));
-            break;
+        if (stats_listen_fd == -1) {
+            if (timeout < 0) break;
+            poll(NULL, 0, timeout);
+            continue;
         }
         
-        // 回显消息，但限制长度避免缓冲区溢出
-        int max_msg_len = BUFFER_SIZE - 100; // 为格式字符串留出空间
-        if ((int)strlen(buffer) > max_msg_len) {
-            buffer[max_msg_len] = '\0';
+        // 开始排空后统计端口交给热重启的新进程（或随进程关闭），只继续输出摘要
+        struct pollfd pfd[2] = { { stats_listen_fd, POLLIN, 0 }, { lifecycle_wake_fd, POLLIN, 0 } };
+        if (poll(pfd, 2, timeout) <= 0) continue;
+        if (pfd[1].revents != 0) {
+            close(stats_listen_fd);
+            stats_listen_fd = -1;
+            continue;
         }
         
-        snprintf(response, sizeof(response), 
-                 "服务器回复 [PID:%d,TID:%ld]: %s", 
-                 getpid(), (long)pthread_self(), buffer);
-        send(client_socket, response, strlen(response), 0);
+        int client_socket = accept4(stats_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_socket >= 0) stats_serve(client_socket, (monotonic_ns() - started) / 1e9);
     }
     
-    close(client_socket);
-}
-
-// 线程处理函数
-void* thread_handler(void* arg) {
-    thread_args_t* args = (thread_args_t*)arg;
-    handle_client(args->client_socket, args->client_addr);
-    free(args);
+    free(snapshots);
     return NULL;
 }
 
-// 创建和配置服务器socket
-int create_server_socket() {
-    int server_socket;
-    struct sockaddr_in server_addr;
+// 在启动任何worker之前调用：创建共享的统计区域、统计端口和统计线程
+void start_stats() {
+    struct sockaddr_in addr;
+    pthread_t thread;
     int opt = 1;
+    int rc;
     
-    // 创建socket
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1) {
-        perror("❌ 创建socket失败");
-        return -1;
+    if (metrics_init() < 0) {
+        printf("⚠️  创建统计共享内存失败，子进程的统计不会被汇总\n");
     }
     
-    // 设置socket选项，允许重用地址
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("❌ 设置socket选项失败");
-        close(server_socket);
-        return -1;
+    if (server_config.stats_port > 0) {
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(server_config.stats_port);
+        stats_listen_fd = adopt_listen_fd((struct sockaddr*)&addr, sizeof(addr));
+        if (stats_listen_fd == -1 &&
+            ((stats_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ||
+             setsockopt(stats_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+             bind(stats_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+             listen(stats_listen_fd, 16) < 0)) {
+            printf("⚠️  统计端口 %d 不可用 (%s)，不提供统计查询\n", server_config.stats_port, strerror(errno));
+            if (stats_listen_fd != -1) close(stats_listen_fd);
+            stats_listen_fd = -1;
+        }
+        if (stats_listen_fd != -1) {
+            register_listen_fd(stats_listen_fd);
+            printf("📊 统计: curl http://127.0.0.1:%d/metrics\n", server_config.stats_port);
+        }
     }
     
-    // 配置服务器地址
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY; // 监听所有网络接口
-    server_addr.sin_port = htons(PORT);
+    if (stats_listen_fd == -1 && server_config.stats_interval <= 0) return;
+    rc = pthread_create(&thread, NULL, stats_thread, NULL);
+    if (rc != 0) {
+        printf("⚠️  创建统计线程失败: %s\n", strerror(rc));
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// 检查网络环境
+void check_network_environment() {
+    printf("\n🔍 检查网络环境\n");
+    printf("===================\n");
     
-    // 绑定socket
-    if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        if (errno == EADDRINUSE) {
-            printf("❌ 端口 %d 已被占用\n", PORT);
-            printf("解决方案:\n");
-            printf("1. 等待几秒钟后重试\n");
-            printf("2. 检查是否有其他服务器实例在运行: ps aux | grep servertcp\n");
-            printf("3. 终止占用端口的进程: sudo lsof -ti:%d | xargs kill -9\n", PORT);
+    // 检查各监听地址上的端口是否被占用（UNIX socket在启动时处理）
+    for (int i = 0; i < listen_addr_count; i++) {
+        const listen_addr_t* addr = &listen_addrs[i];
+        int test_socket;
+        
+        if (addr->addr.sa.sa_family == AF_UNIX) continue;
+        test_socket = socket(addr->addr.sa.sa_family, SOCK_STREAM, 0);
+        if (test_socket == -1) continue;
+        if (addr->addr.sa.sa_family == AF_INET6) {
+            setsockopt(test_socket, IPPROTO_IPV6, IPV6_V6ONLY, &addr->v6only, sizeof(addr->v6only));
+        }
+        if (bind(test_socket, &addr->addr.sa, addr->len) == 0) {
+            printf("✅ %s 可用\n", addr->name);
         } else {
-            perror("❌ 绑定失败");
+            printf("❌ %s 被占用\n", addr->name);
+            printf("   运行以下命令查看占用进程: sudo lsof -i:%d\n", server_config.port);
         }
-        close(server_socket);
-        return -1;
-    }
-    
-    // 监听连接
-    if (listen(server_socket, MAX_CLIENTS) < 0) {
-        perror("❌ 监听失败");
-        close(server_socket);
-        return -1;
+        close(test_socket);
     }
     
-    return server_socket;
+    printf("\n💡 防火墙配置提示:\n");
+    printf("   Ubuntu/Debian: sudo ufw allow %d\n", server_config.port);
+    printf("   CentOS/RHEL: sudo firewall-cmd --permanent --add-port=%d/tcp && sudo firewall-cmd --reload\n", server_config.port);
+    printf("\n");
 }
 
-// 基础TCP服务器
-void basic_server() {
-    int server_socket, client_socket;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
+// 读取一个非负整数，回车或输入无效时使用默认值
+int prompt_int(const char* prompt, int default_value) {
+    char line[64];
+    char* end;
+    long value;
     
-    printf("\n🚀 启动基础TCP服务器\n");
-    printf("=====================================\n");
+    printf("%s (回车使用默认 %d): ", prompt, default_value);
+    fflush(stdout);
     
-    server_socket = create_server_socket();
-    if (server_socket == -1) return;
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        printf("\n");
+        return default_value;
+    }
+    line[strcspn(line, "\n")] = 0;
+    if (strlen(line) == 0) return default_value;
     
-    print_server_ips();
+    value = strtol(line, &end, 10);
+    if (*end != '\0' || value < 0 || value > 1000000) {
+        printf("⚠️  输入无效，使用默认值 %d\n", default_value);
+        return default_value;
+    }
+    return (int)value;
+}
+
+// 读取y/n选择，回车使用默认值
+int prompt_yes_no(const char* prompt, int default_value) {
+    char line[16];
     
-    printf("✅ 基础TCP服务器正在监听端口 %d\n", PORT);
-    printf("⚠️  注意: 基础服务器一次只能处理一个客户端连接\n");
-    printf("📱 等待客户端连接...\n\n");
+    printf("%s (%s): ", prompt, default_value ? "Y/n" : "y/N");
+    fflush(stdout);
     
-    while (1) {
-        client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) {
-            perror("❌ 接受连接失败");
-            continue;
-        }
-        
-        // 处理客户端（阻塞式，一次只能处理一个）
-        handle_client(client_socket, client_addr);
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        printf("\n");
+        return default_value;
     }
-    
-    close(server_socket);
+    if (line[0] == 'y' || line[0] == 'Y') return 1;
+    if (line[0] == 'n' || line[0] == 'N') return 0;
+    return default_value;
 }
 
-// 多进程服务器
-void multiprocess_server() {
-    int server_socket, client_socket;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    pid_t pid;
+// 交互式配置多reactor参数
+void configure_multi_reactor() {
+    int cpu_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
     
-    printf("\n🚀 启动多进程TCP服务器\n");
-    printf("=====================================\n");
+    printf("\n🔧 多reactor配置\n");
+    printf("=======================\n");
+    if (server_config.reactor_threads == 0) server_config.reactor_threads = cpu_count > 0 ? cpu_count : 1;
+    server_config.reactor_threads = prompt_int("reactor线程数", server_config.reactor_threads);
+    server_config.cpu_affinity = prompt_yes_no("是否将每个reactor线程绑定到CPU核心", server_config.cpu_affinity);
+    server_config.backlog = prompt_int("listen backlog", server_config.backlog);
+    if (server_config.backlog <= 0) server_config.backlog = DEFAULT_BACKLOG;
+}
+
+// 交互式配置线程池参数
+void configure_thread_pool() {
+    printf("\n🔧 线程池配置\n");
+    printf("=======================\n");
+    server_config.pool_size = prompt_int("worker线程数 (0表示每个连接一个线程)", server_config.pool_size);
+    if (server_config.pool_size == 0) return;
     
-    // 设置信号处理器处理僵尸进程
-    signal(SIGCHLD, sigchld_handler);
+    server_config.queue_depth = prompt_int("等待队列长度", server_config.queue_depth);
+    if (server_config.queue_depth <= 0) server_config.queue_depth = DEFAULT_QUEUE_DEPTH;
     
-    server_socket = create_server_socket();
-    if (server_socket == -1) return;
+    printf("队列满时的策略: 1=reject(拒绝) 2=queue(留在内核队列) 3=block(阻塞等待)\n");
+    int policy = prompt_int("请选择策略", server_config.backpressure);
+    if (policy >= BACKPRESSURE_REJECT && policy <= BACKPRESSURE_BLOCK) {
+        server_config.backpressure = (backpressure_t)policy;
+    }
+}
+
+// 交互式配置预派生进程池参数
+void configure_prefork() {
+    int cpu_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
     
-    print_server_ips();
+    printf("\n🔧 预派生进程池配置\n");
+    printf("=======================\n");
+    if (server_config.prefork_workers == 0) server_config.prefork_workers = cpu_count > 0 ? cpu_count : 1;
+    server_config.prefork_workers = prompt_int("worker进程数", server_config.prefork_workers);
+    server_config.prefork_reuseport = prompt_yes_no("每个worker使用独立的SO_REUSEPORT监听socket",
+                                                    server_config.prefork_reuseport);
+}
+
+// 交互式选择应用层协议
+void configure_protocol() {
+    if (prompt_yes_no("使用长度前缀帧协议 (客户端需使用 -F 参数)", server_config.protocol == PROTOCOL_FRAMED)) {
+        server_config.protocol = PROTOCOL_FRAMED;
+        printf("📦 已启用帧协议\n");
+        // 零拷贝发送需要等待内核的完成通知，只对较大的回复才划算
+        server_config.zerocopy_threshold = prompt_int("MSG_ZEROCOPY阈值 (字节，0表示不启用，仅阻塞式模式)",
+                                                      server_config.zerocopy_threshold);
+        if (server_config.zerocopy_threshold < 0) server_config.zerocopy_threshold = 0;
+        server_config.compress = prompt_yes_no("同意客户端请求的负载压缩 (客户端需使用 -z 参数)",
+                                               server_config.compress);
+    } else {
+        server_config.protocol = PROTOCOL_TEXT;
+    }
+}
+
+void configure_logging() {
+    int level = prompt_int("日志级别 (0关闭 1错误 2警告 3连接 4每条消息)", server_config.log_level);
     
-    printf("✅ 多进程TCP服务器正在监听端口 %d\n", PORT);
-    printf("🔄 每个客户端连接将创建一个新进程处理\n");
-    printf("📱 等待客户端连接...\n\n");
+    if (level < LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+    if (level > LOG_LEVEL_DEBUG) level = LOG_LEVEL_DEBUG;
+    server_config.log_level = level;
+    if (level >= LOG_LEVEL_INFO) {
+        server_config.log_rate_limit = prompt_int("每个线程每秒最多输出的连接/消息日志条数 (0表示不限)",
+                                                  server_config.log_rate_limit);
+        if (server_config.log_rate_limit < 0) server_config.log_rate_limit = 0;
+    }
+}
+
+void configure_timeouts() {
+    server_config.idle_timeout = prompt_int("空闲超时 (秒，多久没有收到数据就断开，0表示不限)",
+                                            server_config.idle_timeout);
+}
+
+void configure_metrics() {
+    server_config.stats_port = prompt_int("统计端口 (仅127.0.0.1，0表示不启用)", server_config.stats_port);
+    if (server_config.stats_port > 65535) server_config.stats_port = DEFAULT_STATS_PORT;
+    server_config.stats_interval = prompt_int("统计摘要输出间隔 (秒，0表示不输出)", server_config.stats_interval);
+}
+
+// ==================== 命令行和配置文件 ====================
+
+// 菜单编号对应的模式名，也是统计指标的mode标签
+const char* server_mode_names[] = {
+    NULL, "basic", "multiprocess", "multithread", NULL, "epoll", "multi_reactor", "prefork", "io_uring"
+};
+
+// 命令行选项，配置文件使用相同的名字（key = value）
+typedef struct {
+    const char* name;
+    char short_name;
+    const char* arg;        // 参数说明，NULL表示开关（配置文件中写 yes/no）
+    const char* help;
+} server_option_t;
+
+server_option_t server_options[] = {
+    { "config", 'c', "FILE", "从配置文件读取参数，命令行中的其他参数优先" },
+    { "mode", 'm', "MODE", "服务器类型，指定后不再交互式询问: basic | multiprocess | multithread |\n"
+      "                            epoll | multi_reactor | prefork | io_uring (或菜单编号)" },
+    { "bind", 'b', "ADDRS", "监听地址，逗号分隔: IPv4、IPv6 或 unix:路径 (默认 ::，同时接受IPv4和IPv6)" },
+    { "port", 'p', "PORT", "监听端口 (默认 8888)" },
+    { "backlog", 0, "N", "listen队列长度 (默认 SOMAXCONN)" },
+    { "read-buffer", 0, "BYTES", "文本协议每次读取的字节数，io_uring为每个接收缓冲区的大小 (默认 1024)" },
+    { "rcvbuf", 0, "BYTES", "SO_RCVBUF (默认使用内核设置)" },
+    { "sndbuf", 0, "BYTES", "SO_SNDBUF (默认使用内核设置)" },
+    { "nodelay", 0, NULL, "设置TCP_NODELAY" },
+    { "thread-stack", 0, "KB", "worker和reactor线程的栈大小 (默认 128)" },
+    { "framed", 'F', NULL, "使用长度前缀帧协议" },
+    { "zerocopy-threshold", 0, "BYTES", "帧协议下一批回复达到该字节数 (至少10KB) 时使用MSG_ZEROCOPY (默认 0，不启用)" },
+    { "compress", 0, NULL, "帧协议下同意客户端请求的LZ4负载压缩 (客户端需使用 -z 参数)" },
+    { "compress-threshold", 0, "BYTES", "启用压缩的连接上回复达到该字节数时才压缩 (默认 1024)" },
+    { "files", 0, "DIR", "帧协议下允许客户端下载该目录中的文件 (clienttcp --get)" },
+    { "upload", 0, NULL, "同时允许客户端上传文件到 --files 目录 (clienttcp --put)" },
+    { "kv-memory", 0, "MB", "启用/get /set等键值命令，所有worker共用的存储的总内存 (默认 0，不启用)" },
+    { "journal", 0, "DIR", "把收到的消息追加到该目录中的持久化日志，启动时重放" },
+    { "journal-segment", 0, "MB", "每个日志段文件的大小，写满后创建下一个 (默认 64)" },
+    { "journal-sync-ms", 0, "MS", "有新记录后最多等待多久批量同步一次 (默认 10)" },
+    { "journal-wait", 0, NULL, "阻塞式模式 (1/2/3) 等消息落盘后才回复" },
+    { "tls-cert", 0, "FILE", "启用TLS，FILE为PEM格式的证书链" },
+    { "tls-key", 0, "FILE", "TLS证书的私钥 (PEM格式)" },
+    { "pool-size", 0, "N", "多线程模式的worker线程数，0表示每个连接一个线程 (默认 64)" },
+    { "queue-depth", 0, "N", "线程池等待队列长度 (默认 256)" },
+    { "backpressure", 0, "POLICY", "线程池队列满时的策略: reject | queue | block (默认 block)" },
+    { "reactor-threads", 0, "N", "多reactor模式的线程数 (默认 CPU核数)" },
+    { "cpu-affinity", 0, NULL, "把reactor线程绑定到CPU核心" },
+    { "workers", 0, "N", "预派生worker进程数 (默认 CPU核数)" },
+    { "reuseport", 0, NULL, "预派生worker各自使用SO_REUSEPORT监听socket" },
+    { "uring-entries", 0, "N", "io_uring提交队列深度 (默认 1024)" },
+    { "uring-buffers", 0, "N", "io_uring接收缓冲区个数，向上取整为2的幂 (默认 1024)" },
+    { "idle-timeout", 0, "SEC", "多久没有收到任何数据就断开连接，0表示不限 (默认 0)" },
+    { "read-timeout", 0, "SEC", "帧协议下一条消息开始到达后必须在多久内收完，0表示不限 (默认 30)" },
+    { "write-timeout", 0, "SEC", "对端不接收数据导致发送阻塞的最长时间，0表示不限 (默认 30)" },
+    { "max-lifetime", 0, "SEC", "连接的最长存活时间，0表示不限 (默认 0)" },
+    { "keepalive", 0, NULL, "启用TCP keepalive探测已经消失的对端 (默认 yes)" },
+    { "keepalive-idle", 0, "SEC", "连接空闲多久后开始keepalive探测 (默认 60)" },
+    { "keepalive-interval", 0, "SEC", "keepalive探测间隔 (默认 10)" },
+    { "keepalive-count", 0, "N", "连续多少次探测无响应后断开 (默认 6)" },
+    { "max-connections", 0, "N", "所有进程合计的最大连接数，超过时立即拒绝新连接，0表示不限 (默认 0)" },
+    { "max-per-ip", 0, "N", "每个来源IP的最大连接数，0表示不限 (默认 0)" },
+    { "per-ip-rate", 0, "N", "每个来源IP每秒最多新建的连接数，0表示不限 (默认 0)" },
+    { "per-ip-burst", 0, "N", "每个来源IP允许的突发连接数 (默认 与 --per-ip-rate 相同)" },
+    { "drain-timeout", 0, "SEC", "收到SIGTERM或热重启后等待现有连接结束的最长时间 (默认 30)" },
+    { "chat", 0, NULL, "聊天室模式：消息转发给同一房间的其他客户端 (仅事件驱动模式)" },
+    { "chat-queue", 0, "BYTES", "聊天室中每个客户端最多积压的字节数，超过时断开 (默认 262144)" },
+    { "log-level", 'l', "N", "日志级别: 0关闭 1错误 2警告 3连接 4每条消息 (默认 4)" },
+    { "log-rate", 0, "N", "每个线程每秒最多输出的连接/消息日志条数，0表示不限 (默认 0)" },
+    { "stats-port", 0, "PORT", "统计端口，仅监听127.0.0.1，0表示不启用 (默认 8889)" },
+    { "stats-interval", 0, "SEC", "统计摘要输出间隔，0表示不输出 (默认 10)" },
+    { "quiet", 'q', NULL, "不输出启动横幅、网络环境检查和IP地址列表" },
+    { "help", 'h', NULL, "显示帮助" },
+    { NULL, 0, NULL, NULL }
+};
+
+void print_usage(const char* program_name) {
+    char left[64];
     
-    while (1) {
-        client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) {
-            if (errno == EINTR) continue; // 被信号中断，继续
-            perror("❌ 接受连接失败");
-            continue;
+    printf("🌐 TCP服务器程序\n");
+    printf("=======================================\n");
+    printf("使用方法: %s [选项]\n", program_name);
+    printf("不指定 --mode 时启动后交互式选择服务器类型和参数\n");
+    printf("\n选项:\n");
+    for (server_option_t* opt = server_options; opt->name != NULL; opt++) {
+        if (opt->short_name) {
+            snprintf(left, sizeof(left), "-%c, --%s%s%s", opt->short_name, opt->name,
+                     opt->arg ? " " : "", opt->arg ? opt->arg : "");
+        } else {
+            snprintf(left, sizeof(left), "    --%s%s%s", opt->name, opt->arg ? " " : "", opt->arg ? opt->arg : "");
         }
-        
-        // 创建子进程处理客户端
-        pid = fork();
-        if (pid == 0) {
-            // 子进程
-            close(server_socket); // 子进程不需要监听socket
-            handle_client(client_socket, client_addr);
-            exit(0);
-        } else if (pid > 0) {
-            // 父进程
-            close(client_socket); // 父进程不需要客户端socket
-            printf("🆕 创建子进程 %d 处理客户端 %s:%d\n", 
-                   pid, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        if (strlen(left) >= 26) {
+            printf("  %s\n  %-26s%s\n", left, "", opt->help);
         } else {
-            perror("❌ 创建进程失败");
+            printf("  %-26s%s\n", left, opt->help);
         }
     }
-    
-    close(server_socket);
+    printf("\n示例:\n");
+    printf("  %s -m epoll -q                          # 事件驱动模式，跳过所有交互和环境检查\n", program_name);
+    printf("  %s -m prefork --workers 8 --backlog 4096 --log-level 2\n", program_name);
+    printf("  %s -c /etc/servertcp.conf -p 9000       # 使用配置文件，端口以命令行为准\n", program_name);
+    printf("  %s -m epoll -b 10.0.0.5,::1,unix:/run/servertcp.sock  # 多个监听地址，本机程序走UNIX socket\n",
+           program_name);
+    printf("\n信号:\n");
+    printf("  SIGTERM/SIGINT  停止接受新连接，等现有连接结束后退出 (最多 --drain-timeout 秒)\n");
+    printf("  SIGUSR2         热重启: 以相同参数启动新程序并交出监听socket，然后排空退出\n");
+    printf("\n配置文件示例:\n");
+    printf("  # servertcp.conf\n");
+    printf("  mode = multi_reactor\n");
+    printf("  backlog = 4096\n");
+    printf("  rcvbuf = 262144\n");
+    printf("  nodelay = yes\n");
 }
 
-// 多线程服务器
-void multithread_server() {
-    int server_socket, client_socket;
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    pthread_t thread;
-    thread_args_t* args;
+// 解析整数参数，失败时返回-1
+int parse_option_int(const char* name, const char* value, int min, int max) {
+    char* end;
+    long n;
     
-    printf("\n🚀 启动多线程TCP服务器\n");
-    printf("=====================================\n");
+    n = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || n < min || n > max) {
+        printf("❌ 选项 %s 的值必须在 %d-%d 之间: %s\n", name, min, max, value);
+        return -1;
+    }
+    return (int)n;
+}
+
+// 解析开关参数：yes/no、on/off、true/false、1/0，失败时返回-1
+int parse_option_bool(const char* name, const char* value) {
+    if (strcasecmp(value, "yes") == 0 || strcasecmp(value, "on") == 0 ||
+        strcasecmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+        return 1;
+    }
+    if (strcasecmp(value, "no") == 0 || strcasecmp(value, "off") == 0 ||
+        strcasecmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+        return 0;
+    }
+    printf("❌ 选项 %s 的值必须是 yes 或 no: %s\n", name, value);
+    return -1;
+}
+
+// 解析服务器类型：模式名或菜单编号，失败时返回-1
+int parse_mode(const char* value) {
+    for (int i = 1; i <= 8; i++) {
+        if (server_mode_names[i] != NULL && strcasecmp(value, server_mode_names[i]) == 0) return i;
+    }
+    if (strcasecmp(value, "thread_pool") == 0) return 3;
+    // 菜单中的4是退出程序
+    if (value[0] >= '1' && value[0] <= '8' && value[0] != '4' && value[1] == '\0') return value[0] - '0';
+    printf("❌ 未知的服务器类型: %s\n", value);
+    return -1;
+}
+
+server_option_t* find_option(const char* name, char short_name) {
+    for (server_option_t* opt = server_options; opt->name != NULL; opt++) {
+        if (name != NULL ? strcmp(opt->name, name) == 0 : opt->short_name == short_name) return opt;
+    }
+    return NULL;
+}
+
+// 设置一个参数，命令行和配置文件共用；返回0表示成功，-1表示参数无效（已输出原因）
+int set_config_option(const char* name, const char* value) {
+    int n = 0;
     
-    server_socket = create_server_socket();
-    if (server_socket == -1) return;
+    if (strcmp(name, "mode") == 0) {
+        if ((n = parse_mode(value)) < 0) return -1;
+        server_config.mode = n;
+    } else if (strcmp(name, "bind") == 0) {
+        listen_addr_t addrs[MAX_LISTENERS];
+        if (parse_bind_list(value, 0, addrs) < 0) return -1;
+        strcpy(server_config.bind_addr, value);
+    } else if (strcmp(name, "port") == 0) {
+        if ((n = parse_option_int(name, value, 1, 65535)) < 0) return -1;
+        server_config.port = n;
+    } else if (strcmp(name, "backlog") == 0) {
+        if ((n = parse_option_int(name, value, 1, 1000000)) < 0) return -1;
+        server_config.backlog = n;
+    } else if (strcmp(name, "read-buffer") == 0) {
+        if ((n = parse_option_int(name, value, MIN_READ_BUFFER, MAX_READ_BUFFER)) < 0) return -1;
+        server_config.read_buffer = n;
+    } else if (strcmp(name, "rcvbuf") == 0) {
+        if ((n = parse_option_int(name, value, 0, 256 * 1024 * 1024)) < 0) return -1;
+        server_config.rcvbuf = n;
+    } else if (strcmp(name, "sndbuf") == 0) {
+        if ((n = parse_option_int(name, value, 0, 256 * 1024 * 1024)) < 0) return -1;
+        server_config.sndbuf = n;
+    } else if (strcmp(name, "nodelay") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.nodelay = n;
+    } else if (strcmp(name, "thread-stack") == 0) {
+        if ((n = parse_option_int(name, value, 16, 1024 * 1024)) < 0) return -1;
+        server_config.thread_stack_kb = n;
+    } else if (strcmp(name, "framed") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.protocol = n ? PROTOCOL_FRAMED : PROTOCOL_TEXT;
+    } else if (strcmp(name, "zerocopy-threshold") == 0) {
+        if ((n = parse_option_int(name, value, 0, FRAME_MAX_PAYLOAD)) < 0) return -1;
+        server_config.zerocopy_threshold = n;
+    } else if (strcmp(name, "compress") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.compress = n;
+    } else if (strcmp(name, "compress-threshold") == 0) {
+        if ((n = parse_option_int(name, value, 0, FRAME_MAX_PAYLOAD)) < 0) return -1;
+        server_config.compress_threshold = n;
+    } else if (strcmp(name, "files") == 0) {
+        if (strlen(value) >= sizeof(server_config.files_dir)) {
+            printf("❌ 目录路径太长: %s\n", value);
+            return -1;
+        }
+        strcpy(server_config.files_dir, value);
+    } else if (strcmp(name, "upload") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.upload = n;
+    } else if (strcmp(name, "kv-memory") == 0) {
+        if ((n = parse_option_int(name, value, 0, 1 << 20)) < 0) return -1;
+        server_config.kv_memory = n;
+    } else if (strcmp(name, "journal") == 0) {
+        if (strlen(value) >= sizeof(server_config.journal_dir)) {
+            printf("❌ 目录路径太长: %s\n", value);
+            return -1;
+        }
+        strcpy(server_config.journal_dir, value);
+    } else if (strcmp(name, "journal-segment") == 0) {
+        // 一个段至少要能放下最大的帧
+        if ((n = parse_option_int(name, value, 32, 4096)) < 0) return -1;
+        server_config.journal_segment = n;
+    } else if (strcmp(name, "journal-sync-ms") == 0) {
+        if ((n = parse_option_int(name, value, 1, 10000)) < 0) return -1;
+        server_config.journal_sync_ms = n;
+    } else if (strcmp(name, "journal-wait") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.journal_wait = n;
+    } else if (strcmp(name, "tls-cert") == 0) {
+        if (strlen(value) >= sizeof(server_config.tls_cert)) {
+            printf("❌ 文件路径太长: %s\n", value);
+            return -1;
+        }
+        strcpy(server_config.tls_cert, value);
+    } else if (strcmp(name, "tls-key") == 0) {
+        if (strlen(value) >= sizeof(server_config.tls_key)) {
+            printf("❌ 文件路径太长: %s\n", value);
+            return -1;
+        }
+        strcpy(server_config.tls_key, value);
+    } else if (strcmp(name, "pool-size") == 0) {
+        if ((n = parse_option_int(name, value, 0, 100000)) < 0) return -1;
+        server_config.pool_size = n;
+    } else if (strcmp(name, "queue-depth") == 0) {
+        if ((n = parse_option_int(name, value, 1, 1000000)) < 0) return -1;
+        server_config.queue_depth = n;
+    } else if (strcmp(name, "backpressure") == 0) {
+        if (strcasecmp(value, "reject") == 0) {
+            server_config.backpressure = BACKPRESSURE_REJECT;
+        } else if (strcasecmp(value, "queue") == 0) {
+            server_config.backpressure = BACKPRESSURE_QUEUE;
+        } else if (strcasecmp(value, "block") == 0) {
+            server_config.backpressure = BACKPRESSURE_BLOCK;
+        } else {
+            printf("❌ 选项 %s 的值必须是 reject、queue 或 block: %s\n", name, value);
+            return -1;
+        }
+    } else if (strcmp(name, "reactor-threads") == 0) {
+        if ((n = parse_option_int(name, value, 0, 1024)) < 0) return -1;
+        server_config.reactor_threads = n;
+    } else if (strcmp(name, "cpu-affinity") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.cpu_affinity = n;
+    } else if (strcmp(name, "workers") == 0) {
+        if ((n = parse_option_int(name, value, 0, 1024)) < 0) return -1;
+        server_config.prefork_workers = n;
+    } else if (strcmp(name, "reuseport") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.prefork_reuseport = n;
+    } else if (strcmp(name, "uring-entries") == 0) {
+        if ((n = parse_option_int(name, value, 1, 32768)) < 0) return -1;
+        server_config.uring_entries = n;
+    } else if (strcmp(name, "uring-buffers") == 0) {
+        if ((n = parse_option_int(name, value, 1, 32768)) < 0) return -1;
+        server_config.uring_buffers = 1;
+        while (server_config.uring_buffers < (unsigned)n) server_config.uring_buffers *= 2;
+    } else if (strcmp(name, "idle-timeout") == 0) {
+        if ((n = parse_option_int(name, value, 0, 30 * 86400)) < 0) return -1;
+        server_config.idle_timeout = n;
+    } else if (strcmp(name, "read-timeout") == 0) {
+        if ((n = parse_option_int(name, value, 0, 30 * 86400)) < 0) return -1;
+        server_config.read_timeout = n;
+    } else if (strcmp(name, "write-timeout") == 0) {
+        if ((n = parse_option_int(name, value, 0, 86400)) < 0) return -1;
+        server_config.write_timeout = n;
+    } else if (strcmp(name, "max-lifetime") == 0) {
+        if ((n = parse_option_int(name, value, 0, 365 * 86400)) < 0) return -1;
+        server_config.max_lifetime = n;
+    } else if (strcmp(name, "keepalive") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.keepalive = n;
+    } else if (strcmp(name, "keepalive-idle") == 0) {
+        if ((n = parse_option_int(name, value, 1, 32767)) < 0) return -1;
+        server_config.keepalive_idle = n;
+    } else if (strcmp(name, "keepalive-interval") == 0) {
+        if ((n = parse_option_int(name, value, 1, 32767)) < 0) return -1;
+        server_config.keepalive_interval = n;
+    } else if (strcmp(name, "keepalive-count") == 0) {
+        if ((n = parse_option_int(name, value, 1, 127)) < 0) return -1;
+        server_config.keepalive_count = n;
+    } else if (strcmp(name, "max-connections") == 0) {
+        if ((n = parse_option_int(name, value, 0, 10000000)) < 0) return -1;
+        server_config.max_connections = n;
+    } else if (strcmp(name, "max-per-ip") == 0) {
+        if ((n = parse_option_int(name, value, 0, 10000000)) < 0) return -1;
+        server_config.max_per_ip = n;
+    } else if (strcmp(name, "per-ip-rate") == 0) {
+        if ((n = parse_option_int(name, value, 0, 1000000)) < 0) return -1;
+        server_config.per_ip_rate = n;
+    } else if (strcmp(name, "per-ip-burst") == 0) {
+        if ((n = parse_option_int(name, value, 0, 1000000)) < 0) return -1;
+        server_config.per_ip_burst = n;
+    } else if (strcmp(name, "drain-timeout") == 0) {
+        if ((n = parse_option_int(name, value, 0, 86400)) < 0) return -1;
+        server_config.drain_timeout = n;
+    } else if (strcmp(name, "chat") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.chat = n;
+    } else if (strcmp(name, "chat-queue") == 0) {
+        if ((n = parse_option_int(name, value, 1024, 1024 * 1024 * 1024)) < 0) return -1;
+        server_config.chat_queue = n;
+    } else if (strcmp(name, "log-level") == 0) {
+        if ((n = parse_option_int(name, value, LOG_LEVEL_OFF, LOG_LEVEL_DEBUG)) < 0) return -1;
+        server_config.log_level = n;
+    } else if (strcmp(name, "log-rate") == 0) {
+        if ((n = parse_option_int(name, value, 0, 100000000)) < 0) return -1;
+        server_config.log_rate_limit = n;
+    } else if (strcmp(name, "stats-port") == 0) {
+        if ((n = parse_option_int(name, value, 0, 65535)) < 0) return -1;
+        server_config.stats_port = n;
+    } else if (strcmp(name, "stats-interval") == 0) {
+        if ((n = parse_option_int(name, value, 0, 86400)) < 0) return -1;
+        server_config.stats_interval = n;
+    } else if (strcmp(name, "quiet") == 0) {
+        if ((n = parse_option_bool(name, value)) < 0) return -1;
+        server_config.quiet = n;
+    } else {
+        printf("❌ 未知选项: %s\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+// 去掉首尾空白，返回新的起始位置
+char* trim(char* str) {
+    char* end;
     
-    print_server_ips();
+    while (*str == ' ' || *str == '\t') str++;
+    end = str + strlen(str);
+    while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) end--;
+    *end = '\0';
+    return str;
+}
+
+// 读取配置文件：每行"key = value"或"key value"，#之后为注释，key中的'_'等同于'-'
+int load_config_file(const char* path) {
+    char line[512];
+    int line_no = 0;
+    FILE* file = fopen(path, "r");
     
-    printf("✅ 多线程TCP服务器正在监听端口 %d\n", PORT);
-    printf("🧵 每个客户端连接将创建一个新线程处理\n");
-    printf("📱 等待客户端连接...\n\n");
+    if (file == NULL) {
+        printf("❌ 无法打开配置文件 %s: %s\n", path, strerror(errno));
+        return -1;
+    }
     
-    while (1) {
-        client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &client_len);
-        if (client_socket < 0) {
-            perror("❌ 接受连接失败");
-            continue;
-        }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        line[strcspn(line, "#")] = '\0';
+        char* key = trim(line);
+        if (*key == '\0') continue;
         
-        // 为线程准备参数
-        args = malloc(sizeof(thread_args_t));
-        if (args == NULL) {
-            perror("❌ 内存分配失败");
-            close(client_socket);
-            continue;
+        char* value = key + strcspn(key, "= \t");
+        if (*value != '\0') {
+            *value++ = '\0';
+            value = trim(value);
+            if (*value == '=') value = trim(value + 1);
         }
-        
-        args->client_socket = client_socket;
-        args->client_addr = client_addr;
-        
-        // 创建线程处理客户端
-        if (pthread_create(&thread, NULL, thread_handler, args) != 0) {
-            perror("❌ 创建线程失败");
-            free(args);
-            close(client_socket);
-            continue;
+        for (char* p = key; *p; p++) {
+            if (*p == '_') *p = '-';
         }
         
-        // 分离线程，让其自动清理资源
-        pthread_detach(thread);
-        printf("🆕 创建线程 %ld 处理客户端 %s:%d\n", 
-               thread, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+        server_option_t* opt = find_option(key, 0);
+        if (opt != NULL && opt->arg == NULL && *value == '\0') value = "yes";
+        if (opt == NULL || strcmp(key, "config") == 0 || strcmp(key, "help") == 0 ||
+            (opt->arg != NULL && *value == '\0') || set_config_option(key, value) < 0) {
+            if (opt == NULL) printf("❌ 未知选项: %s\n", key);
+            else if (opt->arg != NULL && *value == '\0') printf("❌ 选项 %s 需要一个参数\n", key);
+            printf("   位置: %s 第 %d 行\n", path, line_no);
+            fclose(file);
+            return -1;
+        }
     }
     
-    close(server_socket);
+    fclose(file);
+    return 0;
 }
 
-// 检查网络环境
-void check_network_environment() {
-    printf("\n🔍 检查网络环境\n");
-    printf("===================\n");
-    
-    // 检查端口是否被占用
-    int test_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (test_socket != -1) {
-        struct sockaddr_in test_addr;
-        test_addr.sin_family = AF_INET;
-        test_addr.sin_addr.s_addr = INADDR_ANY;
-        test_addr.sin_port = htons(PORT);
-        
-        if (bind(test_socket, (struct sockaddr*)&test_addr, sizeof(test_addr)) == 0) {
-            printf("✅ 端口 %d 可用\n", PORT);
-        } else {
-            printf("❌ 端口 %d 被占用\n", PORT);
-            printf("   运行以下命令查看占用进程: sudo lsof -i:%d\n", PORT);
+// 解析命令行：先读取所有配置文件，再应用其余参数，使命令行优先于配置文件
+// 返回0表示继续启动，1表示已显示帮助，-1表示参数错误
+int parse_command_line(int argc, char* argv[]) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 1; i < argc; i++) {
+            char name[64];
+            const char* arg = argv[i];
+            const char* value = NULL;
+            server_option_t* opt = NULL;
+            
+            if (strncmp(arg, "--", 2) == 0) {
+                size_t len = strcspn(arg + 2, "=");
+                if (len < sizeof(name)) {
+                    memcpy(name, arg + 2, len);
+                    name[len] = '\0';
+                    opt = find_option(name, 0);
+                }
+                if (arg[2 + len] == '=') value = arg + 3 + len;
+            } else if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0') {
+                opt = find_option(NULL, arg[1]);
+            }
+            if (opt == NULL) {
+                printf("❌ 未知参数: %s\n", arg);
+                printf("💡 提示: 使用 %s -h 查看帮助信息\n", argv[0]);
+                return -1;
+            }
+            
+            if (opt->arg == NULL) {
+                if (value == NULL) value = "yes";
+            } else if (value == NULL) {
+                if (i + 1 >= argc) {
+                    printf("❌ 选项 %s 需要一个参数\n", arg);
+                    return -1;
+                }
+                value = argv[++i];
+            }
+            
+            if (strcmp(opt->name, "help") == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            if ((strcmp(opt->name, "config") == 0) != (pass == 0)) continue;
+            if (pass == 0) {
+                if (load_config_file(value) < 0) return -1;
+            } else if (set_config_option(opt->name, value) < 0) {
+                return -1;
+            }
         }
-        close(test_socket);
     }
-    
-    printf("\n💡 防火墙配置提示:\n");
-    printf("   Ubuntu/Debian: sudo ufw allow %d\n", PORT);
-    printf("   CentOS/RHEL: sudo firewall-cmd --permanent --add-port=%d/tcp && sudo firewall-cmd --reload\n", PORT);
-    printf("\n");
+    return 0;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     int choice;
+    int c;
+    int rc;
     
-    printf("🌐 TCP服务器程序 (跨机器版本)\n");
-    printf("=======================================\n");
-    printf("版本: 1.1 - 支持跨机器连接\n");
-    printf("端口: %d\n", PORT);
-    printf("=======================================\n");
+    rc = parse_command_line(argc, argv);
+    if (rc != 0) return rc < 0 ? 1 : 0;
+    // 端口可能在--bind之后指定，参数都确定后再解析监听地址（格式已经检查过）
+    listen_addr_count = parse_bind_list(server_config.bind_addr, server_config.port, listen_addrs);
+    if (listen_addr_count < 0) return 1;
     
-    check_network_environment();
+    if (!server_config.quiet) {
+        printf("🌐 TCP服务器程序 (跨机器版本)\n");
+        printf("=======================================\n");
+        printf("版本: 1.1 - 支持跨机器连接\n");
+        printf("端口: %d\n", server_config.port);
+        printf("=======================================\n");
+        
+        check_network_environment();
+    }
     
-    printf("请选择服务器类型:\n");
-    printf("1. 基础TCP服务器 (单线程，一次处理一个客户端)\n");
-    printf("2. 多进程TCP服务器 (每个客户端一个进程)\n");
-    printf("3. 多线程TCP服务器 (每个客户端一个线程) [推荐]\n");
-    printf("4. 退出程序\n");
-    printf("请输入选择 (1-4): ");
+    choice = server_config.mode;
+    if (choice == 0) {
+        printf("请选择服务器类型:\n");
+        printf("1. 基础TCP服务器 (单线程，一次处理一个客户端)\n");
+        printf("2. 多进程TCP服务器 (每个客户端一个进程)\n");
+        printf("3. 多线程TCP服务器 (线程池，也可每个客户端一个线程) [推荐]\n");
+        printf("4. 退出程序\n");
+        printf("5. 事件驱动TCP服务器 (单线程epoll，适合大量空闲连接)\n");
+        printf("6. 多reactor TCP服务器 (每个CPU核心一个epoll线程)\n");
+        printf("7. 预派生进程池TCP服务器 (启动时创建worker进程，崩溃自动重启)\n");
+        printf("8. io_uring TCP服务器 (批量提交，减少系统调用；不支持时回退到epoll)\n");
+        printf("请输入选择 (1-8): ");
+        
+        if (scanf("%d", &choice) != 1) {
+            printf("❌ 输入错误\n");
+            return 1;
+        }
+        // 丢弃本行剩余输入，后续配置项按行读取
+        while ((c = getchar()) != '\n' && c != EOF);
+        
+        // 4保持原来"退出程序"的编号，新增的模式排在后面；0也当作退出
+        if (choice == 4 || choice == 0) {
+            printf("👋 程序退出\n");
+            return 0;
+        }
+        if (choice < 1 || choice > 8) {
+            printf("❌ 无效选择\n");
+            return 1;
+        }
+        
+        // 交互式配置，默认值来自命令行和配置文件
+        configure_protocol();
+        configure_logging();
+        configure_timeouts();
+        configure_metrics();
+        if (choice == 3) configure_thread_pool();
+        if (choice == 6) configure_multi_reactor();
+        if (choice == 7) configure_prefork();
+    }
     
-    if (scanf("%d", &choice) != 1) {
-        printf("❌ 输入错误\n");
+    // 分派表中有重复的命令名属于编码错误，直接退出
+    if (handlers_init() < 0) {
+        printf("❌ 命令分派表无效 (命令名重复或命令过多)\n");
+        return 1;
+    }
+    // 在创建任何线程之前屏蔽退出信号并启动lifecycle线程
+    if (lifecycle_init(argv) < 0) {
+        printf("⚠️  启动信号处理线程失败，SIGTERM和热重启不可用\n");
+    }
+    if (log_init(server_config.log_level, server_config.log_rate_limit) < 0) {
+        printf("⚠️  启动日志线程失败，已关闭日志\n");
+    }
+    // 房间中的所有成员必须在同一个事件循环中；io_uring模式改用epoll事件循环
+    if (server_config.chat && choice == 8) {
+        printf("💬 聊天室模式使用epoll事件循环\n");
+        choice = 5;
+    } else if (server_config.chat && choice != 5) {
+        printf("⚠️  聊天室模式只支持事件驱动服务器，已忽略 --chat\n");
+        server_config.chat = 0;
+    }
+    if (server_config.compress && server_config.protocol != PROTOCOL_FRAMED) {
+        printf("⚠️  负载压缩需要帧协议 (-F)，已忽略 --compress\n");
+        server_config.compress = 0;
+    }
+    // 文件传输用sendfile/splice直接读写socket，io_uring模式改用epoll事件循环
+    if (server_config.files_dir[0] != '\0') {
+        if (server_config.protocol != PROTOCOL_FRAMED || server_config.chat) {
+            printf("⚠️  文件传输需要帧协议 (-F) 且不能用于聊天室模式，已忽略 --files\n");
+        } else if (files_init() < 0) {
+            printf("⚠️  无法打开文件目录 %s: %s，已忽略 --files\n", server_config.files_dir, strerror(errno));
+        } else {
+            if (choice == 8) {
+                printf("📁 文件传输使用epoll事件循环\n");
+                choice = 5;
+            }
+            printf("📁 文件目录: %s (%s)\n", server_config.files_dir, 
+                   server_config.upload ? "可下载、可上传" : "只可下载");
+            // sendfile/splice没有MSG_NOSIGNAL，客户端中途断开时不能因SIGPIPE终止进程
+            signal(SIGPIPE, SIG_IGN);
+        }
+    }
+    if ((server_config.tls_cert[0] == '\0') != (server_config.tls_key[0] == '\0')) {
+        printf("❌ --tls-cert 和 --tls-key 需要同时指定\n");
+        return 1;
+    }
+    // 要求加密时不能退回明文
+    if (tls_init() < 0) {
+        printf("❌ 无法启用TLS: %s\n", tls_last_error());
+        return 1;
+    }
+    // TLS握手在事件循环中非阻塞地推进，io_uring模式改用epoll事件循环
+    if (tls_ctx != NULL && choice == 8) {
+        printf("🔒 TLS使用epoll事件循环\n");
+        choice = 5;
+    }
+    server_mode_name = server_mode_names[choice];
+    if (choice == 3 && server_config.pool_size > 0) server_mode_name = "thread_pool";
+    start_stats();
+    if (admit_init() < 0) {
+        printf("⚠️  创建准入控制共享内存失败，不限制连接数\n");
+    }
+    if (kv_init() < 0) {
+        printf("⚠️  创建键值存储失败: %s，/get /set等命令不可用\n", strerror(errno));
+    }
+    // 事件驱动模式中一个线程服务许多连接，不能为某个连接阻塞等待同步
+    if (server_config.journal_wait && (server_config.journal_dir[0] == '\0' || choice > 3)) {
+        printf("⚠️  --journal-wait 需要 --journal 且只支持阻塞式模式 (1/2/3)，已忽略\n");
+        server_config.journal_wait = 0;
+    }
+    // 审计日志不可用时不能继续运行
+    if (journal_init() < 0) {
+        printf("❌ 无法打开消息日志 %s: %s\n", server_config.journal_dir, strerror(errno));
         return 1;
     }
     
@@ -387,13 +6484,23 @@ int main() {
         case 3:
             multithread_server();
             break;
-        case 4:
-            printf("👋 程序退出\n");
-            return 0;
-        default:
-            printf("❌ 无效选择\n");
-            return 1;
+        case 5:
+            event_loop_server();
+            break;
+        case 6:
+            multi_reactor_server();
+            break;
+        case 7:
+            prefork_server();
+            break;
+        case 8:
+            io_uring_server();
+            break;
     }
     
+    journal_close(&journal);
+    if (tls_ctx != NULL) tls_relay_drain(TLS_HANDSHAKE_TIMEOUT_MS);
+    listeners_unlink();
+    if (server_draining()) printf("👋 所有连接已结束，服务器退出\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,815 @@
+// 客户端连接池：到一个或多个服务器的长连接，供需要复用连接的程序（批处理任务、交互式客户端）使用
+//
+// - 服务器地址可以是IPv4、IPv6（"[::1]:端口"）、主机名或"unix:路径"（"unix:@名字"为抽象命名空间）；
+//   主机名每次连接时用getaddrinfo解析，多个地址按happy eyeballs（RFC 8305）交替IPv6/IPv4并行尝试
+// - 连接池有固定数量的连接槽，开始时轮流分配给各个服务器；连接建立后读掉服务器的欢迎消息
+// - 选择连接：轮询（round-robin）或在途请求最少（least-inflight），跳过没有连上的槽
+// - 连接失败、发送失败或服务器关闭连接时，该服务器按指数退避（带随机抖动）延迟重连，
+//   期间连接槽改连其他可用的服务器；连接成功后退避清零
+// - 健康检查：空闲超过health_interval_ms的连接发送一个HELLO帧并等待回复，失败则断开重连
+// - 请求失败时在另一条连接上重试一次
+// - 可选的负载压缩（帧协议）：连接建立时发送带FRAME_FLAG_LZ的HELLO协商，服务器同意后
+//   达到compress_threshold的请求按tcp_lz.h的格式压缩，收到的压缩回复自动解压
+// - 文件传输（帧协议，服务器需使用--files）：client_get_file/client_put_file在一条连接上下载或上传文件，
+//   文件内容用splice/sendfile在内核中直接搬运；这两个函数需要在包含本文件前定义_GNU_SOURCE
+// - 可选的TLS（需要定义TCP_TLS并链接OpenSSL，见tcp_tls.h）：pool->tls不为NULL时连接建立后先握手，
+//   每个服务器保存上次的会话，重连时恢复会话只做简短握手；握手之后conn->fd照常收发明文
+//
+// 帧协议按帧头确定回复边界；文本协议没有消息边界，一次recv读到的内容当作一个回复，只适合一问一答。
+// 所有函数都是阻塞的，连接池不加锁，每个线程使用自己的连接池。
+
+#ifndef TCP_CLIENT_H
+#define TCP_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef _GNU_SOURCE
+#include <sys/sendfile.h>
+#endif
+
+#include "tcp_frame.h"
+#include "tcp_lz.h"
+#include "tcp_tls.h"
+
+#define CLIENT_MAX_SERVERS 16
+#define CLIENT_HOST_LEN 256             // 主机名、IP或UNIX socket路径的长度
+#define CLIENT_ADDR_LEN (CLIENT_HOST_LEN + 16) // "主机:端口"字符串的长度
+#define CLIENT_HAPPY_EYEBALLS_MS 250    // 一个地址这么久没有连上就同时尝试下一个地址
+#define CLIENT_CONNECT_TIMEOUT_MS 5000
+#define CLIENT_REQUEST_TIMEOUT_MS 5000
+#define CLIENT_HEALTH_INTERVAL_MS 10000
+#define CLIENT_BACKOFF_MIN_MS 100
+#define CLIENT_BACKOFF_MAX_MS 10000
+#define CLIENT_COMPRESS_THRESHOLD 1024  // 请求达到该字节数时才压缩
+#define CLIENT_XFER_CHUNK (4 * 1024 * 1024) // 文件传输每次splice/sendfile的最大字节数
+
+typedef enum {
+    CLIENT_ROUND_ROBIN = 0,
+    CLIENT_LEAST_INFLIGHT = 1
+} client_policy_t;
+
+typedef struct {
+    char host[CLIENT_HOST_LEN];  // 主机名或IP，port为0时是UNIX socket路径（'@'开头为抽象命名空间）
+    int port;
+    char name[CLIENT_ADDR_LEN];
+    int failures;               // 连续失败次数，决定退避时间
+    uint64_t retry_at;          // 在此之前不再尝试连接（毫秒，单调时钟）
+    SSL_SESSION* tls_session;   // 上次TLS握手的会话，重连时用来恢复
+} client_server_t;
+
+typedef struct {
+    int fd;                     // -1表示未连接
+    int server;                 // 连接（或下次优先尝试）的服务器下标
+    int inflight;               // 已发送、还没有收到回复的请求数
+    uint64_t last_used;         // 最近一次收发数据的时间，健康检查只检查空闲的连接
+    netbuf_t welcome;           // 最近一次连接时收到的欢迎消息（帧协议下只有负载）
+    netbuf_t in;                // 收到但还没有取走的数据
+    int compress;               // 握手时服务器同意了负载压缩
+    size_t compress_threshold;  // 达到该字节数的请求才压缩
+    netbuf_t packed;            // 压缩后的请求/压缩的回复，复用避免每次分配
+    int tls_info;               // 最近一次TLS握手的TLS_INFO_*（是否恢复了会话、是否由kTLS加解密）
+} client_conn_t;
+
+typedef struct {
+    client_server_t servers[CLIENT_MAX_SERVERS];
+    int server_count;
+    client_conn_t* conns;
+    int conn_count;
+    int next;                   // 轮询的位置
+    client_policy_t policy;
+    int framed;
+    int compress;               // 帧协议下请求服务器启用负载压缩
+    int compress_threshold;
+    int connect_timeout_ms;
+    int request_timeout_ms;
+    int health_interval_ms;     // 0表示不做健康检查
+    int backoff_min_ms;
+    int backoff_max_ms;
+    uint32_t seed;              // 退避抖动的随机数状态
+    SSL_CTX* tls;               // 不为NULL时所有连接使用TLS，由调用者创建和释放
+} client_pool_t;
+
+static inline uint64_t client_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 解析"主机"、"主机:端口"、"[IPv6]:端口"、IPv6地址或"unix:路径"，没有端口时使用default_port
+// host返回主机名或IP（UNIX socket为路径，port为0），只检查格式，不做解析；失败返回-1
+static inline int client_parse_addr(const char* text, int default_port, char* host, size_t size, int* port) {
+    const char* end = text + strlen(text);
+    const char* colon = strrchr(text, ':');
+    int bracketed = text[0] == '[';   // "[IPv6]"，去掉方括号后text指向地址
+
+    if (strncmp(text, "unix:", 5) == 0) {
+        size_t len = strlen(text + 5);
+        if (len == 0 || len >= size || len >= sizeof(((struct sockaddr_un*)0)->sun_path)) return -1;
+        memcpy(host, text + 5, len + 1);
+        *port = 0;
+        return 0;
+    }
+
+    *port = default_port;
+    if (bracketed) {
+        const char* close = strchr(text, ']');
+        if (close == NULL || (close[1] != '\0' && close[1] != ':')) return -1;
+        colon = close[1] == ':' ? close + 1 : NULL;
+        end = close;
+        text++;
+    } else if (colon != NULL && strchr(text, ':') != colon) {
+        colon = NULL;   // 不带方括号的IPv6地址，不能带端口
+    }
+    if (colon != NULL) {
+        char* tail;
+        long value = strtol(colon + 1, &tail, 10);
+        if (*tail != '\0' || value <= 0 || value > 65535) return -1;
+        *port = (int)value;
+        if (!bracketed) end = colon;
+    }
+    if (end == text || (size_t)(end - text) >= size) return -1;
+    memcpy(host, text, end - text);
+    host[end - text] = '\0';
+    return 0;
+}
+
+// 把fd恢复为阻塞模式，失败时关闭fd返回-1
+static inline int client_connected(int fd) {
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK) == 0) return fd;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+// 连接host:port（port为0时host是UNIX socket路径），最多等待timeout_ms毫秒；成功后恢复为阻塞模式并返回fd
+// 主机名解析出多个地址时按happy eyeballs交替IPv6/IPv4：上一个地址失败或CLIENT_HAPPY_EYEBALLS_MS内
+// 没有连上就开始下一个，先连上的胜出，其余关闭
+// 失败返回-1，errno为最后一个地址的失败原因（超时为ETIMEDOUT，解析失败为ENXIO）
+static inline int client_connect(const char* host, int port, int timeout_ms) {
+    struct addrinfo hints;
+    struct addrinfo* list = NULL;
+    struct addrinfo* order[16];
+    struct pollfd pfds[16];
+    char service[8];
+    int count = 0;
+    int started = 0;
+    int pending = 0;
+    int fd = -1;
+    int err = ETIMEDOUT;
+    uint64_t deadline = client_now_ms() + timeout_ms;
+    uint64_t next_at = 0;
+
+    if (port == 0) {
+        struct sockaddr_un addr;
+        size_t len = strlen(host);
+
+        if (len >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, host, len);
+        if (host[0] == '@') addr.sun_path[0] = '\0';
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) return -1;
+        // UNIX socket的connect在对方backlog满时阻塞，等待时间由SO_SNDTIMEO限制
+        struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, (struct sockaddr*)&addr,
+                    offsetof(struct sockaddr_un, sun_path) + len + (host[0] != '@')) < 0) {
+            err = errno;
+            close(fd);
+            errno = err == EAGAIN ? ETIMEDOUT : err;
+            return -1;
+        }
+        tv.tv_sec = tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        return fd;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &list) != 0 || list == NULL) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    // 交替排列两个地址族，第一个地址的地址族（通常是解析器偏好的IPv6）优先
+    struct addrinfo* first = list;
+    struct addrinfo* second = list;
+    while (count < 16 && (first != NULL || second != NULL)) {
+        while (first != NULL && first->ai_family != list->ai_family) first = first->ai_next;
+        while (second != NULL && second->ai_family == list->ai_family) second = second->ai_next;
+        if (first != NULL && count < 16) {
+            order[count++] = first;
+            first = first->ai_next;
+        }
+        if (second != NULL && count < 16) {
+            order[count++] = second;
+            second = second->ai_next;
+        }
+    }
+
+    while (fd == -1) {
+        uint64_t now = client_now_ms();
+        int wait;
+        int rc;
+
+        if (started < count && (pending == 0 || now >= next_at)) {
+            struct addrinfo* a = order[started];
+            int s = socket(a->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+            pfds[started].fd = -1;
+            pfds[started].events = POLLOUT;
+            pfds[started].revents = 0;
+            started++;
+            if (s == -1) {
+                err = errno;
+                continue;
+            }
+            if (connect(s, a->ai_addr, a->ai_addrlen) == 0) {
+                fd = s;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                err = errno;
+                close(s);
+                continue;
+            }
+            pfds[started - 1].fd = s;
+            pending++;
+            next_at = now + CLIENT_HAPPY_EYEBALLS_MS;
+        }
+        if (pending == 0) {
+            if (started < count) continue;
+            break;
+        }
+        if (now >= deadline) {
+            err = ETIMEDOUT;
+            break;
+        }
+
+        wait = (int)(deadline - now);
+        if (started < count && next_at - now < (uint64_t)wait) wait = (int)(next_at - now);
+        while ((rc = poll(pfds, started, wait)) < 0 && errno == EINTR);
+        if (rc < 0) {
+            err = errno;
+            break;
+        }
+        for (int i = 0; i < started && fd == -1; i++) {
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+
+            if (pfds[i].fd == -1 || pfds[i].revents == 0) continue;
+            if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &so_error, &len) < 0) so_error = errno;
+            if (so_error == 0) {
+                fd = pfds[i].fd;
+            } else {
+                err = so_error;
+                close(pfds[i].fd);
+                pending--;
+                next_at = 0;    // 失败了就立即尝试下一个地址
+            }
+            pfds[i].fd = -1;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        if (pfds[i].fd != -1) close(pfds[i].fd);
+    }
+    freeaddrinfo(list);
+    if (fd == -1) {
+        errno = err;
+        return -1;
+    }
+    return client_connected(fd);
+}
+
+// 第failures次失败后的等待时间：min * 2^(failures-1)，不超过max，再在[一半, 全部]之间随机，
+// 避免大量客户端在服务器重启后同时重连
+static inline int client_backoff_ms(client_pool_t* pool, int failures) {
+    uint64_t delay = pool->backoff_min_ms;
+
+    while (--failures > 0 && delay < (uint64_t)pool->backoff_max_ms) delay *= 2;
+    if (delay > (uint64_t)pool->backoff_max_ms) delay = pool->backoff_max_ms;
+
+    pool->seed ^= pool->seed << 13;
+    pool->seed ^= pool->seed >> 17;
+    pool->seed ^= pool->seed << 5;
+    return (int)(delay / 2 + pool->seed % (delay / 2 + 1));
+}
+
+static inline void client_pool_init(client_pool_t* pool, int framed) {
+    memset(pool, 0, sizeof(*pool));
+    pool->policy = CLIENT_ROUND_ROBIN;
+    pool->framed = framed;
+    pool->compress_threshold = CLIENT_COMPRESS_THRESHOLD;
+    pool->connect_timeout_ms = CLIENT_CONNECT_TIMEOUT_MS;
+    pool->request_timeout_ms = CLIENT_REQUEST_TIMEOUT_MS;
+    pool->health_interval_ms = CLIENT_HEALTH_INTERVAL_MS;
+    pool->backoff_min_ms = CLIENT_BACKOFF_MIN_MS;
+    pool->backoff_max_ms = CLIENT_BACKOFF_MAX_MS;
+    pool->seed = ((uint32_t)client_now_ms() ^ ((uint32_t)getpid() << 16)) | 1;
+}
+
+// 添加一个服务器（"主机"、"主机:端口"、"[IPv6]:端口"或"unix:路径"），失败返回-1
+static inline int client_pool_add(client_pool_t* pool, const char* text, int default_port) {
+    client_server_t* server;
+
+    if (pool->server_count == CLIENT_MAX_SERVERS) return -1;
+    server = &pool->servers[pool->server_count];
+    memset(server, 0, sizeof(*server));
+    if (client_parse_addr(text, default_port, server->host, sizeof(server->host), &server->port) < 0) return -1;
+    if (server->port == 0) {
+        snprintf(server->name, sizeof(server->name), "%s", text);
+    } else {
+        snprintf(server->name, sizeof(server->name), strchr(server->host, ':') != NULL ? "[%s]:%d" : "%s:%d",
+                 server->host, server->port);
+    }
+    pool->server_count++;
+    return 0;
+}
+
+static inline void client_conn_close(client_conn_t* conn) {
+    if (conn->fd != -1) close(conn->fd);
+    conn->fd = -1;
+    conn->inflight = 0;
+    conn->compress = 0;
+    conn->in.len = 0;
+}
+
+// 连接出错：关闭连接，所连的服务器开始退避
+static inline void client_conn_failed(client_pool_t* pool, client_conn_t* conn) {
+    client_server_t* server = &pool->servers[conn->server];
+
+    client_conn_close(conn);
+    server->failures++;
+    server->retry_at = client_now_ms() + client_backoff_ms(pool, server->failures);
+}
+
+// 等待fd可读，最多timeout_ms毫秒，超时返回0
+static inline int client_wait_readable(int fd, int timeout_ms) {
+    struct pollfd pfd;
+    int rc;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR);
+    if (rc == 0) errno = ETIMEDOUT;
+    return rc;
+}
+
+// 再读一些数据到conn->in，返回读到的字节数，0表示连接关闭，-1表示出错或超时
+static inline ssize_t client_conn_fill(client_conn_t* conn, int timeout_ms) {
+    ssize_t n;
+
+    if (netbuf_reserve(&conn->in, 4096) < 0) return -1;
+    if (client_wait_readable(conn->fd, timeout_ms) <= 0) return -1;
+    while ((n = recv(conn->fd, conn->in.data + conn->in.len, conn->in.cap - conn->in.len, 0)) < 0 &&
+           errno == EINTR);
+    if (n > 0) conn->in.len += n;
+    if (n == 0) errno = ECONNRESET;
+    return n;
+}
+
+// 取出一个回复：帧协议下是下一个完整的帧，文本协议下是已经收到的全部数据
+// reply为负载，返回帧类型（文本协议为FRAME_DATA），-1表示连接出错或超时
+static inline int client_conn_recv(client_conn_t* conn, netbuf_t* reply, int framed, int timeout_ms) {
+    frame_header_t header;
+    int rc;
+
+    reply->len = 0;
+    if (!framed) {
+        if (conn->in.len == 0 && client_conn_fill(conn, timeout_ms) <= 0) return -1;
+        if (netbuf_append(reply, conn->in.data, conn->in.len) < 0) return -1;
+        conn->in.len = 0;
+        return FRAME_DATA;
+    }
+
+    while ((rc = frame_parse(conn->in.data, conn->in.len, &header)) == 0) {
+        if (client_conn_fill(conn, timeout_ms) <= 0) return -1;
+    }
+    if (rc < 0 || ((header.flags & FRAME_FLAG_LZ) && !conn->compress)) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (header.flags & FRAME_FLAG_LZ) {
+        const char* payload = conn->in.data + FRAME_HEADER_SIZE;
+        ssize_t size = lz_unpacked_size(payload, header.length);
+
+        if (size < 0 || size > FRAME_MAX_PAYLOAD || netbuf_reserve(reply, size) < 0 ||
+            lz_unpack(payload, header.length, reply->data, size) != size) {
+            errno = EPROTO;
+            return -1;
+        }
+        reply->len = size;
+    } else if (netbuf_append(reply, conn->in.data + FRAME_HEADER_SIZE, header.length) < 0) {
+        return -1;
+    }
+    netbuf_consume(&conn->in, FRAME_HEADER_SIZE + header.length);
+    return header.type;
+}
+
+// 发送一个请求（帧协议下为DATA帧），启用了压缩的连接上较大的DATA帧压缩后发送，返回0成功，-1表示连接出错
+static inline int client_conn_send(client_conn_t* conn, uint8_t type, const void* data, size_t len, int framed) {
+    unsigned char header[FRAME_HEADER_SIZE];
+    struct iovec iov[2];
+    int iovcnt = 0;
+    uint8_t flags = 0;
+
+    if (framed && conn->compress && type == FRAME_DATA && len >= conn->compress_threshold) {
+        size_t need = LZ_HEADER_SIZE + lz_bound(len);
+        size_t packed;
+
+        conn->packed.len = 0;
+        if (netbuf_reserve(&conn->packed, need) < 0) return -1;
+        packed = lz_pack(data, len, conn->packed.data, need);
+        if (packed > 0) {
+            data = conn->packed.data;
+            len = packed;
+            flags = FRAME_FLAG_LZ;
+        }
+    }
+    if (framed) {
+        frame_encode_header(header, type, flags, (uint32_t)len);
+        iov[iovcnt].iov_base = header;
+        iov[iovcnt++].iov_len = FRAME_HEADER_SIZE;
+    }
+    if (len > 0) {
+        iov[iovcnt].iov_base = (void*)data;
+        iov[iovcnt++].iov_len = len;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    conn->last_used = client_now_ms();
+    return 0;
+}
+
+// 请求启用负载压缩：发送带FRAME_FLAG_LZ的HELLO并等待回复，服务器同意时回复中也带有该标志
+// 回复之前收到的其他帧（例如聊天室的推送）留在conn->in中，返回-1表示连接出错或超时
+static inline int client_conn_negotiate(client_pool_t* pool, client_conn_t* conn) {
+    unsigned char hello[FRAME_HEADER_SIZE];
+    frame_header_t header;
+    size_t offset = 0;
+    size_t frame_len;
+    ssize_t n;
+    int rc;
+
+    frame_encode_header(hello, FRAME_HELLO, FRAME_FLAG_LZ, 0);
+    while ((n = send(conn->fd, hello, sizeof(hello), MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(hello)) return -1;
+
+    while ((rc = frame_parse(conn->in.data + offset, conn->in.len - offset, &header)) != 1 ||
+           header.type != FRAME_HELLO) {
+        if (rc < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (rc == 1) {
+            offset += FRAME_HEADER_SIZE + header.length;
+        } else if (client_conn_fill(conn, pool->connect_timeout_ms) <= 0) {
+            return -1;
+        }
+    }
+    frame_len = FRAME_HEADER_SIZE + header.length;
+    memmove(conn->in.data + offset, conn->in.data + offset + frame_len, conn->in.len - offset - frame_len);
+    conn->in.len -= frame_len;
+    conn->compress = (header.flags & FRAME_FLAG_LZ) != 0;
+    conn->compress_threshold = pool->compress_threshold;
+    return 0;
+}
+
+// 为连接槽建立连接：从conn->server开始依次尝试不在退避中的服务器，并读掉欢迎消息
+// pool->compress时接着协商压缩；返回0成功，-1表示暂时没有可以尝试的服务器或都连接失败
+static inline int client_conn_open(client_pool_t* pool, client_conn_t* conn) {
+    uint64_t now = client_now_ms();
+
+    for (int i = 0; i < pool->server_count; i++) {
+        int index = (conn->server + i) % pool->server_count;
+        client_server_t* server = &pool->servers[index];
+        int type;
+
+        if (server->retry_at > now) continue;
+        conn->server = index;
+        conn->fd = client_connect(server->host, server->port, pool->connect_timeout_ms);
+        // 服务器的UNIX socket不使用TLS
+        if (conn->fd != -1 && pool->tls != NULL && server->port != 0) {
+            conn->fd = tls_connect(pool->tls, conn->fd, server->host, &server->tls_session,
+                                   pool->connect_timeout_ms, &conn->tls_info);
+        }
+        if (conn->fd == -1) {
+            client_conn_failed(pool, conn);
+            continue;
+        }
+
+        // 被拒绝的连接（服务器繁忙）会先收到一条说明再被关闭，同样算作失败
+        type = client_conn_recv(conn, &conn->welcome, pool->framed, pool->connect_timeout_ms);
+        if (type != (pool->framed ? FRAME_WELCOME : FRAME_DATA)) {
+            if (type != -1) errno = ECONNREFUSED;
+            client_conn_failed(pool, conn);
+            continue;
+        }
+        if (pool->framed && pool->compress && client_conn_negotiate(pool, conn) < 0) {
+            client_conn_failed(pool, conn);
+            continue;
+        }
+        server->failures = 0;
+        server->retry_at = 0;
+        conn->last_used = client_now_ms();
+        return 0;
+    }
+    return -1;
+}
+
+// 下一次有服务器退避结束的时间
+static inline uint64_t client_pool_next_retry(const client_pool_t* pool) {
+    uint64_t next = UINT64_MAX;
+
+    for (int i = 0; i < pool->server_count; i++) {
+        if (pool->servers[i].retry_at < next) next = pool->servers[i].retry_at;
+    }
+    return next;
+}
+
+// 创建size个连接槽并尝试全部连接，返回连上的个数，-1表示内存不足
+static inline int client_pool_start(client_pool_t* pool, int size) {
+    int connected = 0;
+
+    pool->conns = calloc(size, sizeof(client_conn_t));
+    if (pool->conns == NULL) return -1;
+    pool->conn_count = size;
+    for (int i = 0; i < size; i++) {
+        pool->conns[i].fd = -1;
+        pool->conns[i].server = pool->server_count > 0 ? i % pool->server_count : 0;
+        if (client_conn_open(pool, &pool->conns[i]) == 0) connected++;
+    }
+    return connected;
+}
+
+static inline void client_pool_destroy(client_pool_t* pool) {
+    for (int i = 0; i < pool->conn_count; i++) {
+        client_conn_close(&pool->conns[i]);
+        netbuf_free(&pool->conns[i].in);
+        netbuf_free(&pool->conns[i].welcome);
+        netbuf_free(&pool->conns[i].packed);
+    }
+    free(pool->conns);
+    pool->conns = NULL;
+    pool->conn_count = 0;
+    for (int i = 0; i < pool->server_count; i++) {
+        tls_session_free(pool->servers[i].tls_session);
+        pool->servers[i].tls_session = NULL;
+    }
+}
+
+// 选择一个可用的连接，没有连上的槽先尝试重连（退避中的服务器跳过）；都不可用时返回NULL
+static inline client_conn_t* client_pool_pick(client_pool_t* pool) {
+    client_conn_t* best = NULL;
+
+    for (int i = 0; i < pool->conn_count; i++) {
+        int index = (pool->next + i) % pool->conn_count;
+        client_conn_t* conn = &pool->conns[index];
+
+        if (conn->fd == -1 && client_conn_open(pool, conn) < 0) continue;
+        if (pool->policy == CLIENT_ROUND_ROBIN) {
+            pool->next = (index + 1) % pool->conn_count;
+            return conn;
+        }
+        if (best == NULL || conn->inflight < best->inflight) best = conn;
+        if (best->inflight == 0) break;
+    }
+    if (best != NULL) pool->next = (int)(best - pool->conns + 1) % pool->conn_count;
+    return best;
+}
+
+// 发送一个请求并等待回复，失败时在另一条连接上重试一次
+// reply为回复的负载，返回回复的帧类型（FRAME_DATA或FRAME_ERROR），-1表示失败
+static inline int client_request(client_pool_t* pool, const void* data, size_t len, netbuf_t* reply) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        client_conn_t* conn = client_pool_pick(pool);
+        int type;
+
+        if (conn == NULL) {
+            errno = EAGAIN;
+            return -1;
+        }
+        conn->inflight++;
+        if (client_conn_send(conn, FRAME_DATA, data, len, pool->framed) == 0) {
+            do {
+                type = client_conn_recv(conn, reply, pool->framed, pool->request_timeout_ms);
+            } while (type == FRAME_HELLO);
+            if (type == FRAME_DATA || type == FRAME_ERROR) {
+                conn->inflight--;
+                conn->last_used = client_now_ms();
+                return type;
+            }
+        }
+        client_conn_failed(pool, conn);
+    }
+    return -1;
+}
+
+// 定期调用：重连退避结束的连接槽，检查空闲的连接是否还活着
+// 帧协议下发送HELLO并等待回复；文本协议只检查连接是否已被对端关闭。返回可用的连接数
+static inline int client_pool_check(client_pool_t* pool) {
+    uint64_t now = client_now_ms();
+    int healthy = 0;
+    netbuf_t reply = {0};
+
+    for (int i = 0; i < pool->conn_count; i++) {
+        client_conn_t* conn = &pool->conns[i];
+
+        if (conn->fd == -1) {
+            if (client_conn_open(pool, conn) == 0) healthy++;
+            continue;
+        }
+        if (pool->health_interval_ms == 0 || conn->inflight > 0 ||
+            now - conn->last_used < (uint64_t)pool->health_interval_ms) {
+            healthy++;
+            continue;
+        }
+
+        int ok;
+        if (pool->framed) {
+            ok = client_conn_send(conn, FRAME_HELLO, NULL, 0, 1) == 0 &&
+                 client_conn_recv(conn, &reply, 1, pool->request_timeout_ms) == FRAME_HELLO;
+        } else {
+            char byte;
+            ok = recv(conn->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+                 (errno == EAGAIN || errno == EWOULDBLOCK);
+            if (ok) conn->last_used = now;
+        }
+        if (ok) {
+            healthy++;
+        } else {
+            client_conn_failed(pool, conn);
+        }
+    }
+    netbuf_free(&reply);
+    return healthy;
+}
+
+#ifdef _GNU_SOURCE
+
+// 文件传输的进度回调：done为已传输的字节数，size为文件大小
+typedef void (*client_progress_fn)(uint64_t done, uint64_t size, void* arg);
+
+// 等待GET/FILE请求的回复，跳过健康检查的HELLO；返回帧类型，-1表示连接出错或超时
+static inline int client_xfer_reply(client_conn_t* conn, netbuf_t* reply, int timeout_ms) {
+    int type;
+
+    do {
+        type = client_conn_recv(conn, reply, 1, timeout_ms);
+    } while (type == FRAME_HELLO);
+    return type;
+}
+
+// 下载服务器--files目录中的文件name，内容写入fd（普通文件或管道，splice不支持终端）
+// 返回FRAME_FILE表示下载完成，FRAME_ERROR表示服务器拒绝（reply中为说明，连接仍然可用），
+// -1表示连接出错或超时，这时连接中可能还有没读完的文件内容，应关闭连接
+static inline int client_get_file(client_conn_t* conn, const char* name, int fd, int timeout_ms,
+                                  client_progress_fn progress, void* arg, netbuf_t* reply) {
+    const char* file_name;
+    size_t name_len;
+    uint64_t size;
+    uint64_t done = 0;
+    int pipefd[2];
+    int type;
+
+    if (client_conn_send(conn, FRAME_GET, name, strlen(name), 1) < 0) return -1;
+    type = client_xfer_reply(conn, reply, timeout_ms);
+    if (type != FRAME_FILE) {
+        if (type != -1 && type != FRAME_ERROR) errno = EPROTO;
+        return type == FRAME_ERROR ? FRAME_ERROR : -1;
+    }
+    if (frame_parse_file(reply->data, reply->len, &size, &file_name, &name_len) < 0) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    // 和FILE帧一起收到的文件开头已经在conn->in中
+    if (conn->in.len > 0) {
+        size_t len = conn->in.len < size ? conn->in.len : (size_t)size;
+        size_t written = 0;
+
+        while (written < len) {
+            ssize_t n = write(fd, conn->in.data + written, len - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            written += n;
+        }
+        netbuf_consume(&conn->in, len);
+        done = len;
+    }
+    if (progress != NULL) progress(done, size, arg);
+    if (done == size) return FRAME_FILE;
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0) return -1;
+    fcntl(pipefd[1], F_SETPIPE_SZ, 1024 * 1024);
+    while (done < size) {
+        size_t chunk = size - done < CLIENT_XFER_CHUNK ? (size_t)(size - done) : CLIENT_XFER_CHUNK;
+        ssize_t n;
+
+        if (client_wait_readable(conn->fd, timeout_ms) <= 0) break;
+        n = splice(conn->fd, NULL, pipefd[1], NULL, chunk, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = ECONNRESET;
+            break;
+        }
+        while (n > 0) {
+            ssize_t written = splice(pipefd[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) break;
+            n -= written;
+            done += written;
+        }
+        if (n > 0) break;
+        if (progress != NULL) progress(done, size, arg);
+    }
+    int err = errno;
+    close(pipefd[0]);
+    close(pipefd[1]);
+    errno = err;
+    conn->last_used = client_now_ms();
+    return done == size ? FRAME_FILE : -1;
+}
+
+// 把fd中size字节的内容上传为服务器--files目录中的name（服务器需使用--upload），fd从当前偏移开始读
+// 返回FRAME_DATA表示服务器已保存（reply中为确认），FRAME_ERROR表示服务器拒绝（服务器随后关闭连接），
+// -1表示连接出错或超时。调用者应忽略SIGPIPE：服务器拒绝时可能在文件发完之前关闭连接
+static inline int client_put_file(client_conn_t* conn, const char* name, int fd, uint64_t size, int timeout_ms,
+                                  client_progress_fn progress, void* arg, netbuf_t* reply) {
+    char meta[FRAME_FILE_SIZE + FRAME_FILE_NAME_MAX];
+    size_t name_len = strlen(name);
+    uint64_t done = 0;
+
+    if (name_len == 0 || name_len > FRAME_FILE_NAME_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < FRAME_FILE_SIZE; i++) meta[i] = (char)(size >> (56 - 8 * i));
+    memcpy(meta + FRAME_FILE_SIZE, name, name_len);
+    if (client_conn_send(conn, FRAME_FILE, meta, FRAME_FILE_SIZE + name_len, 1) < 0) return -1;
+
+    if (progress != NULL) progress(0, size, arg);
+    while (done < size) {
+        size_t chunk = size - done < CLIENT_XFER_CHUNK ? (size_t)(size - done) : CLIENT_XFER_CHUNK;
+        ssize_t n = sendfile(conn->fd, fd, NULL, chunk);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;   // 文件比size短
+            // 服务器拒绝上传时会先发出说明再关闭连接，尽量读出来
+            if (n < 0 && client_conn_recv(conn, reply, 1, 0) == FRAME_ERROR) return FRAME_ERROR;
+            return -1;
+        }
+        done += n;
+        if (progress != NULL) progress(done, size, arg);
+    }
+    conn->last_used = client_now_ms();
+    return client_xfer_reply(conn, reply, timeout_ms);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+// 长度前缀帧协议：服务器和客户端共用的帧格式与缓冲区工具
+//
+// 帧格式（8字节帧头 + 负载）:
+//   +-------+------+-------+----------+----------------------+
+//   | magic | type | flags | reserved | length (4字节,大端)  |  payload ...
+//   +-------+------+-------+----------+----------------------+
+// 帧边界只由帧头决定，与TCP如何拆分/合并数据无关，因此客户端可以连续发送
+// 多个请求（pipelining）而不必等待每个回复。
+//
+// 文件传输: FILE帧的负载为 文件大小(8字节,大端) + 文件名，帧之后紧跟"文件大小"字节的文件内容，
+// 内容不分帧，这样发送方可以用sendfile、接收方可以用splice直接在socket和文件之间搬运数据。
+
+#ifndef TCP_FRAME_H
+#define TCP_FRAME_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_MAGIC 0xA5
+#define FRAME_HEADER_SIZE 8
+#define FRAME_MAX_PAYLOAD (16 * 1024 * 1024)
+
+// 帧类型
+#define FRAME_HELLO   1     // 双向：握手与功能协商，服务器在回复的flags中给出同意启用的功能
+#define FRAME_WELCOME 2     // 服务器 -> 客户端：欢迎消息
+#define FRAME_DATA    3     // 双向：请求/回复数据
+#define FRAME_QUIT    4     // 客户端 -> 服务器：断开连接
+#define FRAME_ERROR   5     // 服务器 -> 客户端：错误说明
+#define FRAME_GET     6     // 客户端 -> 服务器：请求下载文件，负载为文件名
+#define FRAME_FILE    7     // 双向：文件（服务器回复下载请求，或客户端上传），见文件开头的说明
+
+#define FRAME_FILE_SIZE 8           // FILE帧负载中文件大小字段的长度
+#define FRAME_FILE_NAME_MAX 255
+
+// 帧标志
+#define FRAME_FLAG_LZ 0x01  // HELLO: 支持负载压缩；DATA: 负载为tcp_lz.h的lz_pack格式
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t length;
+} frame_header_t;
+
+// 可增长的字节缓冲区，data[0..len)为有效数据
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} netbuf_t;
+
+// 保证至少还能追加extra字节，失败返回-1
+static inline int netbuf_reserve(netbuf_t* buf, size_t extra) {
+    if (buf->cap - buf->len >= extra) return 0;
+
+    size_t cap = buf->cap ? buf->cap : 1024;
+    while (cap - buf->len < extra) cap *= 2;
+    char* data = realloc(buf->data, cap);
+    if (data == NULL) return -1;
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+static inline int netbuf_append(netbuf_t* buf, const void* data, size_t len) {
+    if (netbuf_reserve(buf, len) < 0) return -1;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+// 丢弃开头的len字节
+static inline void netbuf_consume(netbuf_t* buf, size_t len) {
+    if (len >= buf->len) {
+        buf->len = 0;
+        return;
+    }
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+static inline void netbuf_free(netbuf_t* buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+static inline void frame_encode_header(unsigned char* out, uint8_t type, uint8_t flags, uint32_t length) {
+    out[0] = FRAME_MAGIC;
+    out[1] = type;
+    out[2] = flags;
+    out[3] = 0;
+    out[4] = (unsigned char)(length >> 24);
+    out[5] = (unsigned char)(length >> 16);
+    out[6] = (unsigned char)(length >> 8);
+    out[7] = (unsigned char)length;
+}
+
+// 解析帧头：返回1表示缓冲区中已有完整的帧，0表示还需要更多数据，-1表示协议错误
+static inline int frame_parse(const char* data, size_t len, frame_header_t* header) {
+    const unsigned char* p = (const unsigned char*)data;
+
+    if (len < FRAME_HEADER_SIZE) return 0;
+    if (p[0] != FRAME_MAGIC) return -1;
+
+    header->type = p[1];
+    header->flags = p[2];
+    header->length = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    if (header->length > FRAME_MAX_PAYLOAD) return -1;
+
+    return len - FRAME_HEADER_SIZE >= header->length ? 1 : 0;
+}
+
+// 追加一个帧，负载由prefix和payload两段拼接而成（prefix可为空）
+static inline int frame_append(netbuf_t* out, uint8_t type, uint8_t flags,
+                               const void* prefix, size_t prefix_len,
+                               const void* payload, size_t payload_len) {
+    unsigned char header[FRAME_HEADER_SIZE];
+
+    if (netbuf_reserve(out, FRAME_HEADER_SIZE + prefix_len + payload_len) < 0) return -1;
+    frame_encode_header(header, type, flags, (uint32_t)(prefix_len + payload_len));
+    netbuf_append(out, header, FRAME_HEADER_SIZE);
+    if (prefix_len > 0) netbuf_append(out, prefix, prefix_len);
+    if (payload_len > 0) netbuf_append(out, payload, payload_len);
+    return 0;
+}
+
+// 追加一个FILE帧（只有帧头和负载，文件内容由调用者随后发送）
+static inline int frame_append_file(netbuf_t* out, uint64_t size, const char* name, size_t name_len) {
+    unsigned char meta[FRAME_FILE_SIZE];
+
+    for (int i = 0; i < FRAME_FILE_SIZE; i++) meta[i] = (unsigned char)(size >> (56 - 8 * i));
+    return frame_append(out, FRAME_FILE, 0, meta, sizeof(meta), name, name_len);
+}
+
+// 解析FILE帧的负载，name指向负载中的文件名（不以'\0'结尾），格式错误返回-1
+static inline int frame_parse_file(const char* payload, size_t len, uint64_t* size,
+                                   const char** name, size_t* name_len) {
+    const unsigned char* p = (const unsigned char*)payload;
+
+    if (len <= FRAME_FILE_SIZE || len - FRAME_FILE_SIZE > FRAME_FILE_NAME_MAX) return -1;
+    *size = 0;
+    for (int i = 0; i < FRAME_FILE_SIZE; i++) *size = (*size << 8) | p[i];
+    *name = payload + FRAME_FILE_SIZE;
+    *name_len = len - FRAME_FILE_SIZE;
+    return 0;
+}
+
+#endif
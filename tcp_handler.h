@@ -0,0 +1,155 @@
+// 请求处理接口：以'/'开头的消息是命令，按命令名在分派表中找到处理函数执行，其余消息照常回显
+//
+// 命令格式: /名称 [参数]，名称和参数之间用一个空格分隔，参数末尾的换行会被去掉。
+// 处理函数把回复追加到reply（只能追加，不能修改reply中已有的内容），返回值决定如何发出:
+//   HANDLER_REPLY  普通回复（帧协议为DATA帧）
+//   HANDLER_ERROR  错误说明（帧协议为ERROR帧），连接仍然可用
+//   HANDLER_QUIT   发出回复后关闭连接
+// 每个连接有一个handler_ctx_t：命令可以把自己的连接状态放在state中，连接关闭时调用release释放。
+// 同一个连接上的命令总是在同一个线程中依次执行，不同连接的命令可能并发执行。
+//
+// 分派表是一个静态的handler_t数组，启动时用handler_table_init建立开放寻址的哈希索引，
+// 之后查找一个命令只需一次哈希和一两次比较，和命令的数量无关。新增命令只需实现处理函数并加入数组，
+// 不需要修改收发数据的代码。
+
+#ifndef TCP_HANDLER_H
+#define TCP_HANDLER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tcp_frame.h"
+
+#define HANDLER_NONE -1     // 不是命令，按普通消息处理
+#define HANDLER_REPLY 0
+#define HANDLER_ERROR 1
+#define HANDLER_QUIT 2
+
+#define HANDLER_PREFIX '/'
+#define HANDLER_BUCKETS 256 // 哈希索引的大小（2的幂），最多容纳一半数量的命令，保持探测序列很短
+
+// 嵌在每个连接的结构体中，保持很小，空闲连接的内存占用不会因此明显增加
+typedef struct {
+    const char* peer;       // 客户端地址
+    uint64_t commands;      // 本连接执行过的命令数
+    void* state;            // 命令自己的连接状态
+    void (*release)(void* state);
+} handler_ctx_t;
+
+typedef int (*handler_fn)(handler_ctx_t* ctx, const char* args, size_t len, netbuf_t* reply);
+
+typedef struct {
+    const char* name;
+    handler_fn fn;
+    const char* help;       // /help中显示的说明
+} handler_t;
+
+typedef struct {
+    const handler_t* entries;
+    int count;
+    uint8_t index[HANDLER_BUCKETS]; // 命令下标+1，0表示空位
+} handler_table_t;
+
+static inline uint32_t handler_hash(const char* name, size_t len) {
+    uint32_t h = 2166136261U;
+
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619U;
+    return h;
+}
+
+// 建立分派表的索引，命令太多或有重复的命令名时返回-1
+static inline int handler_table_init(handler_table_t* table, const handler_t* entries, int count) {
+    table->entries = entries;
+    table->count = count;
+    memset(table->index, 0, sizeof(table->index));
+    if (count > HANDLER_BUCKETS / 2) return -1;
+
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(entries[i].name);
+        uint32_t slot = handler_hash(entries[i].name, len) & (HANDLER_BUCKETS - 1);
+
+        while (table->index[slot] != 0) {
+            if (strcmp(entries[table->index[slot] - 1].name, entries[i].name) == 0) return -1;
+            slot = (slot + 1) & (HANDLER_BUCKETS - 1);
+        }
+        table->index[slot] = (uint8_t)(i + 1);
+    }
+    return 0;
+}
+
+// 按命令名查找（name来自客户端，可能含有'\0'，按长度比较），找不到返回NULL
+static inline const handler_t* handler_find(const handler_table_t* table, const char* name, size_t len) {
+    uint32_t slot = handler_hash(name, len) & (HANDLER_BUCKETS - 1);
+
+    while (table->index[slot] != 0) {
+        const handler_t* entry = &table->entries[table->index[slot] - 1];
+        if (strlen(entry->name) == len && memcmp(entry->name, name, len) == 0) return entry;
+        slot = (slot + 1) & (HANDLER_BUCKETS - 1);
+    }
+    return NULL;
+}
+
+// 消息是命令时返回1，name和args指向msg中的命令名和参数（去掉末尾的\r\n）
+static inline int handler_parse(const char* msg, size_t len, const char** name, size_t* name_len,
+                                const char** args, size_t* args_len) {
+    size_t end = 1;
+
+    if (len == 0 || msg[0] != HANDLER_PREFIX) return 0;
+    while (len > 1 && (msg[len - 1] == '\n' || msg[len - 1] == '\r')) len--;
+    while (end < len && msg[end] != ' ') end++;
+    *name = msg + 1;
+    *name_len = end - 1;
+    *args = end < len ? msg + end + 1 : msg + len;
+    *args_len = end < len ? len - end - 1 : 0;
+    return 1;
+}
+
+// 按格式追加到reply，返回0成功，-1表示内存不足
+static inline int handler_printf(netbuf_t* reply, const char* fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || netbuf_reserve(reply, (size_t)n + 1) < 0) return -1;
+    va_start(ap, fmt);
+    vsnprintf(reply->data + reply->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    reply->len += n;
+    return 0;
+}
+
+// 消息是命令时执行它，回复追加到reply；不是命令时返回HANDLER_NONE
+static inline int handler_dispatch(const handler_table_t* table, handler_ctx_t* ctx,
+                                   const char* msg, size_t len, netbuf_t* reply) {
+    const handler_t* handler;
+    const char* name;
+    const char* args;
+    size_t name_len, args_len;
+
+    if (!handler_parse(msg, len, &name, &name_len, &args, &args_len)) return HANDLER_NONE;
+    ctx->commands++;
+    handler = handler_find(table, name, name_len);
+    if (handler == NULL) {
+        handler_printf(reply, "未知命令: /%.*s，输入 /help 查看可用的命令\n", (int)name_len, name);
+        return HANDLER_ERROR;
+    }
+    return handler->fn(ctx, args, args_len, reply);
+}
+
+static inline void handler_ctx_init(handler_ctx_t* ctx, const char* peer) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->peer = peer;
+}
+
+// 连接关闭时调用，释放命令保存的连接状态
+static inline void handler_ctx_release(handler_ctx_t* ctx) {
+    if (ctx->release != NULL && ctx->state != NULL) ctx->release(ctx->state);
+    ctx->state = NULL;
+    ctx->release = NULL;
+}
+
+#endif
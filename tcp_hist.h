@@ -0,0 +1,107 @@
+// HDR风格的对数-线性直方图：压测工具和服务器统计共用
+//
+// 每个2的幂区间再细分为 2^HIST_SUB_BITS 个子桶，相对误差约为 1/2^HIST_SUB_BITS；
+// 小于 2^(HIST_SUB_BITS+1) 的值直接对应下标，最大可记录约2^40纳秒（18分钟）。
+// 包含本文件前可以定义HIST_SUB_BITS来调整精度和内存占用。
+
+#ifndef TCP_HIST_H
+#define TCP_HIST_H
+
+#include <stdint.h>
+
+#ifndef HIST_SUB_BITS
+#define HIST_SUB_BITS 6
+#endif
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT 34
+#define HIST_BUCKETS ((HIST_MAX_SHIFT + 2) * HIST_SUB_COUNT)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+} histogram_t;
+
+static inline int hist_index(uint64_t value) {
+    int shift;
+
+    if (value < 2 * HIST_SUB_COUNT) return (int)value;
+    shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    if (shift > HIST_MAX_SHIFT) return HIST_BUCKETS - 1;
+    return (shift + 1) * HIST_SUB_COUNT + (int)(value >> shift) - HIST_SUB_COUNT;
+}
+
+// 桶内的最大值（与HdrHistogram一样按"等价范围的上界"报告）
+static inline uint64_t hist_value(int index) {
+    int shift;
+    uint64_t mantissa;
+
+    if (index < 2 * HIST_SUB_COUNT) return index;
+    shift = index / HIST_SUB_COUNT - 1;
+    mantissa = index % HIST_SUB_COUNT + HIST_SUB_COUNT;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static inline void hist_record(histogram_t* hist, uint64_t value) {
+    hist->counts[hist_index(value)]++;
+    if (hist->total == 0 || value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->total++;
+    hist->sum += value;
+}
+
+// 多个写者（或写者与读者在不同进程中）时使用，只用原子操作，不加锁
+static inline void hist_record_shared(histogram_t* hist, uint64_t value) {
+    uint64_t old;
+
+    __atomic_fetch_add(&hist->counts[hist_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    old = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > old && !__atomic_compare_exchange_n(&hist->max, &old, value, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    old = __atomic_load_n(&hist->min, __ATOMIC_RELAXED);
+    while ((old == 0 || value < old) && !__atomic_compare_exchange_n(&hist->min, &old, value, 1,
+                                                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+}
+
+// 把src累加到dst，src可能正在被其他线程更新（读取使用原子操作）
+static inline void hist_merge(histogram_t* dst, const histogram_t* src) {
+    uint64_t total = __atomic_load_n(&src->total, __ATOMIC_RELAXED);
+    uint64_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+
+    if (total == 0) return;
+    for (int i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+    if (dst->total == 0 || min < dst->min) dst->min = min;
+    if (max > dst->max) dst->max = max;
+    dst->total += total;
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t hist_percentile(const histogram_t* hist, double percentile) {
+    uint64_t target = (uint64_t)(hist->total * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+
+    if (target == 0) target = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) {
+            uint64_t value = hist_value(i);
+            return value > hist->max ? hist->max : value;
+        }
+    }
+    return hist->max;
+}
+
+// 不超过value的记录数（按桶的上界判断，用于导出固定边界的累积桶）
+static inline uint64_t hist_count_below(const histogram_t* hist, uint64_t value) {
+    uint64_t count = 0;
+
+    for (int i = 0; i < HIST_BUCKETS && hist_value(i) <= value; i++) count += hist->counts[i];
+    return count;
+}
+
+#endif
@@ -0,0 +1,472 @@
+// 持久化消息日志：收到的消息依次追加到目录中的段文件，后台线程批量fdatasync（group commit）
+//
+// - 段文件（journal-00000001.log、journal-00000002.log……）创建时预分配固定大小并整个映射到内存，
+//   追加一条记录只是在锁内memcpy；写满后创建下一个段。预分配使磁盘写满时在创建段时失败，
+//   而不是在写入映射时收到SIGBUS
+// - 记录为 24字节记录头 + 客户端地址 + 负载，按8字节对齐。CRC32C覆盖记录头中CRC之后的部分、地址和负载，
+//   崩溃时只写了一半的记录在重放时被发现，重放在此停止
+// - 写入位置等状态在MAP_SHARED的匿名共享内存中，由进程间共享的互斥锁保护：多进程和预派生模式的子进程
+//   写入同一个段。fork出的子进程继承映射，段轮转后各进程在下次写入时重新映射
+// - 同步线程在有新记录后最多等待sync_ms毫秒就fdatasync一次，有写入者在等待时立即同步；
+//   同步期间到达的记录由下一次同步一起完成，因此每条消息不必各自等待一次fsync
+// - 启动时按编号顺序重放已有的段，之后总是从新的段开始写：旧段可能仍在被热重启前的进程写入，
+//   本进程从不修改它们
+//
+// 文件中的整数为本机字节序。
+
+#ifndef TCP_JOURNAL_H
+#define TCP_JOURNAL_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "TCPJRNL1"
+#define JOURNAL_PEER_MAX 255
+#define JOURNAL_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct {
+    char magic[8];
+    uint32_t segment;
+    uint32_t reserved;
+} journal_segment_t;
+
+typedef struct {
+    uint32_t crc;
+    uint32_t length;        // 负载字节数
+    uint64_t time_ns;       // 收到消息的时间（CLOCK_REALTIME纳秒），0表示段在此结束
+    uint16_t peer_len;      // 记录头之后的客户端地址的字节数
+    uint16_t reserved[3];
+} journal_record_t;
+
+typedef struct {
+    pthread_mutex_t lock;   // 进程间共享，保护以下所有字段
+    pthread_cond_t work;    // 通知同步线程有写入者在等待或需要退出
+    pthread_cond_t synced;  // 同步完成
+    uint32_t segment;       // 正在写入的段
+    int waiters;
+    int stop;
+    int error;              // 创建段或同步失败时的errno，之后不再写入
+    uint64_t offset;        // 段中下一条记录的位置
+    uint64_t seq;           // 本次启动以来写入的记录数
+    uint64_t durable;       // 其中已同步到磁盘的记录数
+} journal_shared_t;
+
+typedef struct {
+    journal_shared_t* shared;
+    int dir_fd;
+    size_t segment_size;
+    int sync_ms;
+    void (*on_sync)(uint64_t records, uint64_t ns);     // 每次同步成功后在同步线程中调用，可以为NULL
+    pthread_t thread;
+    // 本进程对当前段的映射，由shared->lock保护
+    uint32_t mapped;
+    char* map;
+} journal_t;
+
+typedef struct {
+    uint32_t segments;
+    uint32_t last_segment;  // 编号最大的段，0表示没有
+    uint64_t records;
+    uint64_t bytes;         // 负载字节数
+    uint32_t truncated;     // 以不完整或损坏的记录结束的段数
+} journal_replay_stats_t;
+
+typedef void (*journal_visit_fn)(const journal_record_t* record, const char* peer, const char* payload, void* arg);
+
+static uint32_t journal_crc_table[8][256];
+
+// CRC32C（Castagnoli），slicing-by-8：每次查8张表处理8个字节
+static inline void journal_crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0x82F63B78U & (0U - (crc & 1)));
+        journal_crc_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t prev = journal_crc_table[t - 1][i];
+            journal_crc_table[t][i] = (prev >> 8) ^ journal_crc_table[0][prev & 0xff];
+        }
+    }
+}
+
+static inline uint32_t journal_crc(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = data;
+
+    crc = ~crc;
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = journal_crc_table[7][lo & 0xff] ^ journal_crc_table[6][(lo >> 8) & 0xff] ^
+              journal_crc_table[5][(lo >> 16) & 0xff] ^ journal_crc_table[4][lo >> 24] ^
+              journal_crc_table[3][hi & 0xff] ^ journal_crc_table[2][(hi >> 8) & 0xff] ^
+              journal_crc_table[1][(hi >> 16) & 0xff] ^ journal_crc_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) crc = (crc >> 8) ^ journal_crc_table[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+static inline void journal_segment_name(char* name, size_t size, uint32_t segment) {
+    snprintf(name, size, "journal-%08u.log", segment);
+}
+
+// 段文件名对应的编号，不是段文件时返回0
+static inline uint32_t journal_segment_number(const char* name) {
+    unsigned int segment;
+    char tail;
+
+    if (sscanf(name, "journal-%8u.lo%c", &segment, &tail) != 2 || tail != 'g' || strlen(name) != 20) return 0;
+    return segment;
+}
+
+// 记录在文件中占用的字节数
+static inline size_t journal_record_size(size_t peer_len, size_t length) {
+    return JOURNAL_ALIGN(sizeof(journal_record_t) + peer_len + length);
+}
+
+// 检查offset处的记录，返回它占用的字节数，0表示段在此结束，-1表示记录不完整或损坏
+static inline ssize_t journal_check(const char* map, size_t size, size_t offset) {
+    journal_record_t record;
+    size_t total;
+    uint32_t crc;
+
+    if (size - offset < sizeof(record)) return 0;
+    memcpy(&record, map + offset, sizeof(record));
+    if (record.time_ns == 0) return 0;
+    total = journal_record_size(record.peer_len, record.length);
+    if (record.peer_len > JOURNAL_PEER_MAX || total > size - offset) return -1;
+    crc = journal_crc(0, map + offset + sizeof(uint32_t), sizeof(record) - sizeof(uint32_t) + record.peer_len + record.length);
+    return crc == record.crc ? (ssize_t)total : -1;
+}
+
+// 按编号顺序读取目录中的所有段，每条完整的记录调用一次fn（fn可以为NULL，只做检查）
+// 返回0成功，-1表示无法读取目录或段文件
+static inline int journal_replay(int dir_fd, journal_visit_fn fn, void* arg, journal_replay_stats_t* stats) {
+    struct dirent** names;
+    int count;
+    int rc = 0;
+    int fd;
+
+    memset(stats, 0, sizeof(*stats));
+    // 编号是定长的，按文件名排序即按编号排序
+    count = scandirat(dir_fd, ".", &names, NULL, alphasort);
+    if (count < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t segment = journal_segment_number(names[i]->d_name);
+        struct stat st;
+        char* map;
+        size_t offset = sizeof(journal_segment_t);
+
+        if (segment == 0 || rc < 0) continue;
+        fd = openat(dir_fd, names[i]->d_name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || fstat(fd, &st) < 0) {
+            if (fd != -1) close(fd);
+            rc = -1;
+            continue;
+        }
+        stats->segments++;
+        stats->last_segment = segment;
+        if ((size_t)st.st_size < sizeof(journal_segment_t)) {
+            stats->truncated++;
+            close(fd);
+            continue;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            rc = -1;
+            continue;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        if (memcmp(map, JOURNAL_MAGIC, 8) != 0) {
+            stats->truncated++;
+            offset = st.st_size;
+        }
+        while (offset < (size_t)st.st_size) {
+            ssize_t size = journal_check(map, st.st_size, offset);
+            const journal_record_t* record = (const journal_record_t*)(map + offset);
+            if (size <= 0) {
+                if (size < 0) stats->truncated++;
+                break;
+            }
+            if (fn != NULL) fn(record, map + offset + sizeof(*record), map + offset + sizeof(*record) + record->peer_len, arg);
+            stats->records++;
+            stats->bytes += record->length;
+            offset += size;
+        }
+        munmap(map, st.st_size);
+    }
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+    return rc;
+}
+
+// 映射一个段，create为1时创建并预分配（段已存在时失败，errno为EEXIST）；调用者持有锁
+static inline int journal_map(journal_t* j, uint32_t segment, int create) {
+    char name[32];
+    char* map;
+    int fd;
+    int rc;
+
+    journal_segment_name(name, sizeof(name), segment);
+    fd = openat(j->dir_fd, name, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (fd == -1) return -1;
+    if (create && (rc = posix_fallocate(fd, 0, (off_t)j->segment_size)) != 0) {
+        close(fd);
+        unlinkat(j->dir_fd, name, 0);
+        errno = rc;
+        return -1;
+    }
+    map = mmap(NULL, j->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        if (create) unlinkat(j->dir_fd, name, 0);
+        return -1;
+    }
+    if (create) {
+        journal_segment_t header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, 8);
+        header.segment = segment;
+        memcpy(map, &header, sizeof(header));
+    }
+    if (j->map != NULL) munmap(j->map, j->segment_size);
+    j->map = map;
+    j->mapped = segment;
+    return 0;
+}
+
+// 创建下一个段；编号被其他进程（热重启前后的另一代进程）占用时继续往后找。调用者持有锁
+static inline int journal_rotate(journal_t* j) {
+    journal_shared_t* s = j->shared;
+
+    for (uint32_t segment = s->segment + 1; segment != 0; segment++) {
+        if (journal_map(j, segment, 1) == 0) {
+            s->segment = segment;
+            s->offset = sizeof(journal_segment_t);
+            return 0;
+        }
+        if (errno != EEXIST) break;
+    }
+    s->error = errno;
+    return -1;
+}
+
+// 追加一条记录，返回它的序号（从1开始），失败返回0并设置errno；返回后记录还不一定在磁盘上
+static inline uint64_t journal_append(journal_t* j, const char* peer, const struct iovec* iov, int iovcnt) {
+    journal_shared_t* s = j->shared;
+    journal_record_t record;
+    struct timespec now;
+    size_t peer_len = strlen(peer);
+    size_t length = 0;
+    size_t size;
+    uint64_t seq = 0;
+    uint32_t crc;
+
+    if (peer_len > JOURNAL_PEER_MAX) peer_len = JOURNAL_PEER_MAX;
+    for (int i = 0; i < iovcnt; i++) length += iov[i].iov_len;
+    size = journal_record_size(peer_len, length);
+    if (length > UINT32_MAX || size > j->segment_size - sizeof(journal_segment_t)) {
+        errno = EMSGSIZE;
+        return 0;
+    }
+
+    // CRC在锁外计算，锁内只有复制
+    clock_gettime(CLOCK_REALTIME, &now);
+    memset(&record, 0, sizeof(record));
+    record.length = (uint32_t)length;
+    record.time_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record.peer_len = (uint16_t)peer_len;
+    crc = journal_crc(0, (const char*)&record + sizeof(uint32_t), sizeof(record) - sizeof(uint32_t));
+    crc = journal_crc(crc, peer, peer_len);
+    for (int i = 0; i < iovcnt; i++) crc = journal_crc(crc, iov[i].iov_base, iov[i].iov_len);
+    record.crc = crc;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->error == 0 && s->offset + size > j->segment_size) journal_rotate(j);
+    if (s->error != 0) {
+        errno = s->error;
+    } else if (j->mapped == s->segment || journal_map(j, s->segment, 0) == 0) {
+        char* out = j->map + s->offset + sizeof(record);
+        memcpy(out, peer, peer_len);
+        out += peer_len;
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(out, iov[i].iov_base, iov[i].iov_len);
+            out += iov[i].iov_len;
+        }
+        memcpy(j->map + s->offset, &record, sizeof(record));
+        s->offset += size;
+        seq = ++s->seq;
+        // 上次同步之后的第一条记录：唤醒同步线程开始计时
+        if (seq == s->durable + 1) pthread_cond_signal(&s->work);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return seq;
+}
+
+// 等待序号不超过seq的记录都同步到磁盘，返回0成功，-1表示同步失败或日志已关闭
+static inline int journal_wait(journal_t* j, uint64_t seq) {
+    journal_shared_t* s = j->shared;
+    int rc;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->durable < seq && s->error == 0 && !s->stop) {
+        s->waiters++;
+        pthread_cond_signal(&s->work);
+        pthread_cond_wait(&s->synced, &s->lock);
+        s->waiters--;
+    }
+    rc = s->durable >= seq ? 0 : -1;
+    if (rc < 0) errno = s->error != 0 ? s->error : ESHUTDOWN;
+    pthread_mutex_unlock(&s->lock);
+    return rc;
+}
+
+// 同步从first到last的所有段（上次同步之后可能轮转过），段有变化时同步目录，使新文件的目录项落盘
+static inline int journal_sync_segments(journal_t* j, uint32_t first, uint32_t last) {
+    for (uint32_t segment = first; segment <= last && segment != 0; segment++) {
+        char name[32];
+        int fd;
+        int rc;
+
+        journal_segment_name(name, sizeof(name), segment);
+        fd = openat(j->dir_fd, name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1 && errno == ENOENT) continue;
+        if (fd == -1) return -1;
+        rc = fdatasync(fd);
+        close(fd);
+        if (rc < 0) return -1;
+    }
+    return first == last ? 0 : fsync(j->dir_fd);
+}
+
+static inline void* journal_sync_thread(void* arg) {
+    journal_t* j = arg;
+    journal_shared_t* s = j->shared;
+    uint32_t synced;
+
+    pthread_mutex_lock(&s->lock);
+    synced = s->segment;
+    while (1) {
+        struct timespec deadline, started, finished;
+        uint64_t target;
+        uint32_t segment;
+        int rc;
+
+        // 没有新记录时一直等待；有新记录后最多再等sync_ms积累一批，有写入者在等待时立即同步
+        while (!s->stop && s->durable == s->seq) pthread_cond_wait(&s->work, &s->lock);
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)(j->sync_ms % 1000) * 1000000L;
+        deadline.tv_sec += j->sync_ms / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (!s->stop && s->waiters == 0 && pthread_cond_timedwait(&s->work, &s->lock, &deadline) != ETIMEDOUT);
+        target = s->seq;
+        segment = s->segment;
+        pthread_mutex_unlock(&s->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        rc = journal_sync_segments(j, synced, segment);
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+
+        pthread_mutex_lock(&s->lock);
+        if (rc == 0) {
+            if (j->on_sync != NULL && target > s->durable) {
+                j->on_sync(target - s->durable, (uint64_t)(finished.tv_sec - started.tv_sec) * 1000000000ULL +
+                           finished.tv_nsec - started.tv_nsec);
+            }
+            s->durable = target;
+            synced = segment;
+        } else if (s->error == 0) {
+            s->error = errno;
+        }
+        pthread_cond_broadcast(&s->synced);
+        if (s->stop || s->error != 0) break;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// 打开日志目录：先重放已有的段（fn可以为NULL），再创建新的段并启动同步线程
+// j->on_sync需在调用前设置；在创建任何worker之前调用，返回0成功，-1失败（errno说明原因）
+static inline int journal_open(journal_t* j, const char* dir, size_t segment_size, int sync_ms,
+                               journal_visit_fn fn, void* arg, journal_replay_stats_t* stats) {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    journal_shared_t* s;
+    int saved;
+
+    j->shared = NULL;
+    j->map = NULL;
+    j->mapped = 0;
+    j->segment_size = segment_size;
+    j->sync_ms = sync_ms;
+    journal_crc_init();
+    mkdir(dir, 0755);
+    j->dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (j->dir_fd == -1) return -1;
+    if (journal_replay(j->dir_fd, fn, arg, stats) < 0) goto fail;
+
+    s = mmap(NULL, sizeof(journal_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (s == MAP_FAILED) goto fail;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&s->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->work, &cond_attr);
+    pthread_cond_init(&s->synced, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    s->segment = stats->last_segment;
+    j->shared = s;
+
+    if (journal_rotate(j) < 0 || (errno = pthread_create(&j->thread, NULL, journal_sync_thread, j)) != 0) {
+        saved = errno;
+        if (j->map != NULL) munmap(j->map, j->segment_size);
+        munmap(s, sizeof(journal_shared_t));
+        j->shared = NULL;
+        j->map = NULL;
+        errno = saved;
+        goto fail;
+    }
+    // 新段的目录项立即落盘，之后同步线程只在轮转时同步目录
+    fsync(j->dir_fd);
+    return 0;
+
+fail:
+    saved = errno;
+    close(j->dir_fd);
+    j->dir_fd = -1;
+    errno = saved;
+    return -1;
+}
+
+// 同步剩余的记录并停止同步线程；只在调用journal_open的进程中调用。
+// 映射保留到进程退出：其他线程或子进程此后仍可以追加，只是不再有人等待同步
+static inline void journal_close(journal_t* j) {
+    if (j->shared == NULL) return;
+    pthread_mutex_lock(&j->shared->lock);
+    j->shared->stop = 1;
+    pthread_cond_broadcast(&j->shared->work);
+    pthread_mutex_unlock(&j->shared->lock);
+    pthread_join(j->thread, NULL);
+}
+
+#endif
@@ -0,0 +1,453 @@
+// 键值存储：/get /set /del /incr 等命令使用的共享内存缓存
+//
+// 整个存储是一块MAP_SHARED的匿名共享内存，在创建worker之前建立，多线程、多进程和预派生模式下
+// 所有worker看到的是同一份数据。按键的哈希分成KV_SHARDS个分片，每个分片有自己的读写锁
+// （进程间共享）、哈希表和内存区：不同分片的操作互不影响，同一分片上的读操作之间也不互斥，
+// 没有任何全局锁。
+//
+// - 哈希表是线性探测的开放寻址表，删除时把后面的项前移（backward shift），没有墓碑
+// - 键和值连续存放在分片内存区的64字节块中，一项占用若干块，用链表连起来；
+//   块大小固定，没有碎片，释放的块直接放回空闲链表
+// - 总内存固定：空闲块或槽位不够时按CLOCK算法淘汰——读取时设置访问位，淘汰指针扫过时
+//   清除访问位，遇到一轮内没有被读过的项就淘汰；已过期的项直接删除
+// - 过期时间用CLOCK_REALTIME的秒数（各进程一致），过期的项读取时视为不存在
+//
+// 锁由进程共享的pthread_rwlock实现，持锁的进程崩溃时该分片会一直被锁住，
+// 因此存储只适合作为缓存：需要时重启服务器即可重建。
+
+#ifndef TCP_KV_H
+#define TCP_KV_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "tcp_frame.h"
+
+#define KV_SHARD_BITS 6
+#define KV_SHARDS (1 << KV_SHARD_BITS)
+#define KV_CHUNK_SIZE 64
+#define KV_CHUNK_DATA (KV_CHUNK_SIZE - sizeof(uint32_t))
+#define KV_KEY_MAX 250
+#define KV_VALUE_MAX (64 * 1024)    // 分片较小时实际上限更低：一项最多占分片的1/4
+#define KV_SLOT_BYTES 80            // 每个槽位对应的内存，决定槽位数和块数的比例
+#define KV_NONE UINT32_MAX
+#define KV_ALIGN(n) (((n) + 63) & ~(size_t)63)
+
+typedef struct {
+    uint32_t hash;          // 键哈希的低32位，决定在表中的起始位置
+    uint32_t chunk;         // 第一个块的下标
+    uint32_t value_len;
+    uint32_t expires;       // 过期时间（CLOCK_REALTIME秒），0表示不过期
+    uint8_t key_len;        // 0表示空槽位
+    uint8_t ref;            // CLOCK访问位，持读锁时也会被设置
+} kv_slot_t;
+
+typedef struct {
+    uint32_t next;          // 同一项的下一个块，或空闲链表中的下一个块
+    char data[KV_CHUNK_DATA];
+} kv_chunk_t;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    uint32_t items;
+    uint32_t free_list;     // 空闲链表头
+    uint32_t free_count;    // 空闲链表中的块数加上从未分配过的块数
+    uint32_t bump;          // 从未分配过的第一个块
+    uint32_t hand;          // CLOCK淘汰指针
+} kv_shard_t;
+
+// 共享内存的开头，之后是KV_SHARDS个分片，每个分片依次为kv_shard_t、槽位数组和块数组
+typedef struct {
+    size_t size;            // 整个映射的字节数
+    size_t shard_size;
+    uint32_t slots;         // 每个分片的槽位数（2的幂）
+    uint32_t max_items;     // 每个分片最多的项数，保持装载率不超过3/4
+    uint32_t chunks;        // 每个分片的块数
+} kv_store_t;
+
+typedef struct {
+    uint64_t items;
+    uint64_t used;          // 已分配的块占用的字节数
+    uint64_t capacity;      // 全部块的字节数
+} kv_stats_t;
+
+// FNV-1a加上murmur3的混合步骤，高位选分片、低位选槽位都足够均匀
+static inline uint64_t kv_hash(const char* key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+static inline uint32_t kv_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+static inline kv_shard_t* kv_shard(kv_store_t* kv, uint64_t hash) {
+    return (kv_shard_t*)((char*)kv + KV_ALIGN(sizeof(kv_store_t)) + (hash >> (64 - KV_SHARD_BITS)) * kv->shard_size);
+}
+
+static inline kv_slot_t* kv_slots(kv_shard_t* shard) {
+    return (kv_slot_t*)((char*)shard + KV_ALIGN(sizeof(kv_shard_t)));
+}
+
+static inline kv_chunk_t* kv_chunks(kv_store_t* kv, kv_shard_t* shard) {
+    return (kv_chunk_t*)((char*)kv_slots(shard) + KV_ALIGN(kv->slots * sizeof(kv_slot_t)));
+}
+
+static inline uint32_t kv_item_chunks(size_t bytes) {
+    return (uint32_t)((bytes + KV_CHUNK_DATA - 1) / KV_CHUNK_DATA);
+}
+
+static inline int kv_expired(const kv_slot_t* slot, uint32_t now) {
+    return slot->expires != 0 && slot->expires <= now;
+}
+
+// 按总内存（字节）创建存储，失败返回NULL
+static inline kv_store_t* kv_create(size_t memory) {
+    size_t per_shard = memory / KV_SHARDS;
+    size_t head = KV_ALIGN(sizeof(kv_shard_t));
+    pthread_rwlockattr_t attr;
+    uint32_t slots = 64;
+    kv_store_t* kv;
+    size_t size;
+
+    while ((size_t)slots * 2 * KV_SLOT_BYTES <= per_shard && slots < (1U << 30)) slots *= 2;
+    if (per_shard < head + KV_ALIGN(slots * sizeof(kv_slot_t)) + 64 * KV_CHUNK_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+    size = KV_ALIGN(sizeof(kv_store_t)) + per_shard * KV_SHARDS;
+    kv = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (kv == MAP_FAILED) return NULL;
+
+    kv->size = size;
+    kv->shard_size = per_shard;
+    kv->slots = slots;
+    kv->max_items = slots / 4 * 3;
+    kv->chunks = (uint32_t)((per_shard - head - KV_ALIGN(slots * sizeof(kv_slot_t))) / KV_CHUNK_SIZE);
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < KV_SHARDS; i++) {
+        kv_shard_t* shard = (kv_shard_t*)((char*)kv + KV_ALIGN(sizeof(kv_store_t)) + (size_t)i * per_shard);
+        pthread_rwlock_init(&shard->lock, &attr);
+        shard->free_list = KV_NONE;
+        shard->free_count = kv->chunks;
+    }
+    pthread_rwlockattr_destroy(&attr);
+    return kv;
+}
+
+// 以下kv_item_*、kv_find、kv_remove、kv_evict和kv_put都要求调用者持有分片的锁
+
+// 从一项的第offset个字节开始复制len个字节
+static inline void kv_item_copy(kv_chunk_t* chunks, uint32_t index, size_t offset, char* dst, size_t len) {
+    while (offset >= KV_CHUNK_DATA) {
+        index = chunks[index].next;
+        offset -= KV_CHUNK_DATA;
+    }
+    while (len > 0) {
+        size_t n = KV_CHUNK_DATA - offset < len ? KV_CHUNK_DATA - offset : len;
+        memcpy(dst, chunks[index].data + offset, n);
+        dst += n;
+        len -= n;
+        offset = 0;
+        index = chunks[index].next;
+    }
+}
+
+// 一项开头的len个字节是否等于key
+static inline int kv_item_equal(kv_chunk_t* chunks, uint32_t index, const char* key, size_t len) {
+    while (len > 0) {
+        size_t n = len < KV_CHUNK_DATA ? len : KV_CHUNK_DATA;
+        if (memcmp(chunks[index].data, key, n) != 0) return 0;
+        key += n;
+        len -= n;
+        index = chunks[index].next;
+    }
+    return 1;
+}
+
+static inline uint32_t kv_chunk_alloc(kv_chunk_t* chunks, kv_shard_t* shard) {
+    uint32_t index = shard->free_list;
+
+    if (index != KV_NONE) {
+        shard->free_list = chunks[index].next;
+    } else {
+        index = shard->bump++;
+    }
+    shard->free_count--;
+    chunks[index].next = KV_NONE;
+    return index;
+}
+
+// 把键和值写入新分配的块，返回第一个块；调用者保证空闲块足够
+static inline uint32_t kv_item_write(kv_chunk_t* chunks, kv_shard_t* shard, const char* key, size_t key_len,
+                                     const char* value, size_t value_len) {
+    uint32_t first = kv_chunk_alloc(chunks, shard);
+    uint32_t current = first;
+    size_t used = 0;
+
+    for (int part = 0; part < 2; part++) {
+        const char* src = part == 0 ? key : value;
+        size_t len = part == 0 ? key_len : value_len;
+
+        while (len > 0) {
+            size_t n;
+            if (used == KV_CHUNK_DATA) {
+                uint32_t next = kv_chunk_alloc(chunks, shard);
+                chunks[current].next = next;
+                current = next;
+                used = 0;
+            }
+            n = KV_CHUNK_DATA - used < len ? KV_CHUNK_DATA - used : len;
+            memcpy(chunks[current].data + used, src, n);
+            used += n;
+            src += n;
+            len -= n;
+        }
+    }
+    return first;
+}
+
+static inline void kv_item_free(kv_chunk_t* chunks, kv_shard_t* shard, uint32_t first) {
+    uint32_t last = first;
+    uint32_t count = 1;
+
+    while (chunks[last].next != KV_NONE) {
+        last = chunks[last].next;
+        count++;
+    }
+    chunks[last].next = shard->free_list;
+    shard->free_list = first;
+    shard->free_count += count;
+}
+
+// 查找键所在的槽位，不存在返回-1
+static inline int64_t kv_find(kv_store_t* kv, kv_shard_t* shard, uint32_t hash, const char* key, size_t len) {
+    kv_slot_t* slots = kv_slots(shard);
+    kv_chunk_t* chunks = kv_chunks(kv, shard);
+    uint32_t mask = kv->slots - 1;
+
+    for (uint32_t i = hash & mask; slots[i].key_len != 0; i = (i + 1) & mask) {
+        if (slots[i].hash == hash && slots[i].key_len == len && kv_item_equal(chunks, slots[i].chunk, key, len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 删除一个槽位的项，把同一探测序列中后面的项前移填补空位
+static inline void kv_remove(kv_store_t* kv, kv_shard_t* shard, uint32_t i) {
+    kv_slot_t* slots = kv_slots(shard);
+    uint32_t mask = kv->slots - 1;
+    uint32_t j = i;
+
+    kv_item_free(kv_chunks(kv, shard), shard, slots[i].chunk);
+    shard->items--;
+    for (;;) {
+        uint32_t home;
+        j = (j + 1) & mask;
+        if (slots[j].key_len == 0) break;
+        // j的起始位置不在(i, j]之间时，移到i后仍然能被找到
+        home = slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    memset(&slots[i], 0, sizeof(slots[i]));
+}
+
+// 从淘汰指针开始删除一项：过期的项直接删除，访问位为1的清零后跳过，为0的淘汰
+// 返回1表示淘汰了一个未过期的项，0表示删除的是过期的项，-1表示分片是空的
+static inline int kv_evict(kv_store_t* kv, kv_shard_t* shard, uint32_t now) {
+    kv_slot_t* slots = kv_slots(shard);
+    uint32_t mask = kv->slots - 1;
+
+    if (shard->items == 0) return -1;
+    for (;;) {
+        kv_slot_t* slot = &slots[shard->hand];
+        if (slot->key_len != 0) {
+            int expired = kv_expired(slot, now);
+            // 删除后原位置可能前移了别的项，淘汰指针停在原处，下次从这里继续
+            if (expired || !slot->ref) {
+                kv_remove(kv, shard, shard->hand);
+                return !expired;
+            }
+            slot->ref = 0;
+        }
+        shard->hand = (shard->hand + 1) & mask;
+    }
+}
+
+// 写入或替换一项，空间不够时先淘汰，返回淘汰的未过期项数；调用者已检查大小
+static inline int kv_put(kv_store_t* kv, kv_shard_t* shard, uint32_t hash, const char* key, size_t key_len,
+                         const char* value, size_t value_len, uint32_t expires, uint32_t now) {
+    kv_slot_t* slots = kv_slots(shard);
+    uint32_t mask = kv->slots - 1;
+    uint32_t need = kv_item_chunks(key_len + value_len);
+    int64_t found = kv_find(kv, shard, hash, key, key_len);
+    int evicted = 0;
+    uint32_t i;
+
+    if (found >= 0) kv_remove(kv, shard, (uint32_t)found);
+    while (shard->free_count < need || shard->items >= kv->max_items) {
+        int rc = kv_evict(kv, shard, now);
+        if (rc < 0) break;
+        evicted += rc;
+    }
+    for (i = hash & mask; slots[i].key_len != 0; i = (i + 1) & mask);
+    slots[i].hash = hash;
+    slots[i].chunk = kv_item_write(kv_chunks(kv, shard), shard, key, key_len, value, value_len);
+    slots[i].value_len = (uint32_t)value_len;
+    slots[i].expires = expires;
+    slots[i].key_len = (uint8_t)key_len;
+    slots[i].ref = 1;       // 新写入的项至少经过淘汰指针一轮
+    shard->items++;
+    return evicted;
+}
+
+static inline int kv_check_size(kv_store_t* kv, size_t key_len, size_t value_len) {
+    if (key_len == 0 || key_len > KV_KEY_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (value_len > KV_VALUE_MAX || kv_item_chunks(key_len + value_len) > kv->chunks / 4) {
+        errno = E2BIG;
+        return -1;
+    }
+    return 0;
+}
+
+// 读取键的值追加到out，返回1表示找到，0表示不存在或已过期，-1表示内存不足
+static inline int kv_get(kv_store_t* kv, const char* key, size_t key_len, netbuf_t* out) {
+    uint64_t hash = kv_hash(key, key_len);
+    kv_shard_t* shard = kv_shard(kv, hash);
+    int64_t i;
+    int rc = 0;
+
+    if (key_len == 0 || key_len > KV_KEY_MAX) return 0;
+    pthread_rwlock_rdlock(&shard->lock);
+    i = kv_find(kv, shard, (uint32_t)hash, key, key_len);
+    if (i >= 0 && !kv_expired(&kv_slots(shard)[i], kv_now())) {
+        kv_slot_t* slot = &kv_slots(shard)[i];
+        // 持读锁的线程可能同时设置同一个访问位，写入的都是1，只需避免反复写同一缓存行
+        if (!__atomic_load_n(&slot->ref, __ATOMIC_RELAXED)) __atomic_store_n(&slot->ref, 1, __ATOMIC_RELAXED);
+        rc = netbuf_reserve(out, slot->value_len) < 0 ? -1 : 1;
+        if (rc == 1) {
+            kv_item_copy(kv_chunks(kv, shard), slot->chunk, key_len, out->data + out->len, slot->value_len);
+            out->len += slot->value_len;
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return rc;
+}
+
+// 写入键值，ttl为过期秒数（0表示不过期），替换已有的值和过期时间
+// 返回为腾出空间淘汰的项数；键或值的长度不合法时返回-1（errno为EINVAL或E2BIG）
+static inline int kv_set(kv_store_t* kv, const char* key, size_t key_len, const char* value, size_t value_len,
+                         uint32_t ttl) {
+    uint64_t hash = kv_hash(key, key_len);
+    kv_shard_t* shard = kv_shard(kv, hash);
+    uint32_t now = kv_now();
+    int evicted;
+
+    if (kv_check_size(kv, key_len, value_len) < 0) return -1;
+    pthread_rwlock_wrlock(&shard->lock);
+    evicted = kv_put(kv, shard, (uint32_t)hash, key, key_len, value, value_len, ttl ? now + ttl : 0, now);
+    pthread_rwlock_unlock(&shard->lock);
+    return evicted;
+}
+
+// 删除键，返回1表示删除了未过期的项，0表示不存在
+static inline int kv_del(kv_store_t* kv, const char* key, size_t key_len) {
+    uint64_t hash = kv_hash(key, key_len);
+    kv_shard_t* shard = kv_shard(kv, hash);
+    int64_t i;
+    int rc = 0;
+
+    if (key_len == 0 || key_len > KV_KEY_MAX) return 0;
+    pthread_rwlock_wrlock(&shard->lock);
+    i = kv_find(kv, shard, (uint32_t)hash, key, key_len);
+    if (i >= 0) {
+        rc = !kv_expired(&kv_slots(shard)[i], kv_now());
+        kv_remove(kv, shard, (uint32_t)i);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return rc;
+}
+
+// 把键的值作为十进制整数加上delta，新值写入result；不存在的键按0处理，已有的过期时间保持不变
+// 返回值同kv_set；值不是整数时errno为EINVAL，结果溢出时为ERANGE
+static inline int kv_incr(kv_store_t* kv, const char* key, size_t key_len, int64_t delta, int64_t* result) {
+    uint64_t hash = kv_hash(key, key_len);
+    kv_shard_t* shard = kv_shard(kv, hash);
+    uint32_t now = kv_now();
+    uint32_t expires = 0;
+    long long value = 0;
+    char text[24];
+    int64_t i;
+    int rc = -1;
+    int n;
+
+    if (kv_check_size(kv, key_len, sizeof(text)) < 0) return -1;
+    pthread_rwlock_wrlock(&shard->lock);
+    i = kv_find(kv, shard, (uint32_t)hash, key, key_len);
+    if (i >= 0 && kv_expired(&kv_slots(shard)[i], now)) {
+        kv_remove(kv, shard, (uint32_t)i);
+        i = -1;
+    }
+    if (i >= 0) {
+        kv_slot_t* slot = &kv_slots(shard)[i];
+        char* end;
+        errno = EINVAL;
+        if (slot->value_len == 0 || slot->value_len >= sizeof(text)) goto out;
+        kv_item_copy(kv_chunks(kv, shard), slot->chunk, key_len, text, slot->value_len);
+        text[slot->value_len] = '\0';
+        errno = 0;
+        value = strtoll(text, &end, 10);
+        if (errno != 0 || end != text + slot->value_len) {
+            errno = EINVAL;
+            goto out;
+        }
+        expires = slot->expires;
+    }
+    if (__builtin_add_overflow(value, delta, &value)) {
+        errno = ERANGE;
+        goto out;
+    }
+    n = snprintf(text, sizeof(text), "%lld", value);
+    rc = kv_put(kv, shard, (uint32_t)hash, key, key_len, text, (size_t)n, expires, now);
+    *result = value;
+out:
+    pthread_rwlock_unlock(&shard->lock);
+    return rc;
+}
+
+// 汇总所有分片的项数和内存使用
+static inline void kv_stats(kv_store_t* kv, kv_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < KV_SHARDS; i++) {
+        kv_shard_t* shard = kv_shard(kv, (uint64_t)i << (64 - KV_SHARD_BITS));
+        pthread_rwlock_rdlock(&shard->lock);
+        stats->items += shard->items;
+        stats->used += (uint64_t)(kv->chunks - shard->free_count) * KV_CHUNK_SIZE;
+        pthread_rwlock_unlock(&shard->lock);
+    }
+    stats->capacity = (uint64_t)kv->chunks * KV_CHUNK_SIZE * KV_SHARDS;
+}
+
+#endif
@@ -0,0 +1,301 @@
+// 异步批量日志：把printf移出热路径
+//
+// 每个线程第一次写日志时分配自己的单生产者/单消费者环形缓冲区，写日志只是
+// 格式化后把一条变长记录追加到本线程的缓冲区，不加锁；后台writer线程定期收集
+// 所有缓冲区中的记录，合并成一次fwrite输出。缓冲区满时丢弃新日志并计数，
+// 热路径永远不会因为stdout阻塞。
+//
+// 日志级别从低到高依次包含更多内容，LOG_LEVEL_INFO以下不会输出每条消息的日志。
+// 限流按线程计算（令牌桶），只作用于连接和消息级别，错误和警告总是输出。
+
+#ifndef TCP_LOG_H
+#define TCP_LOG_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SIZE (64 * 1024)       // 每个线程的缓冲区大小（2的幂）
+#define LOG_RECORD_MAX 1280             // 单条日志的最大长度，超出部分截断
+#define LOG_RECORD_WRAP 0xFFFF          // 记录头中的特殊长度：跳到缓冲区开头
+#define LOG_WRITER_BATCH (64 * 1024)    // writer一次输出的最大字节数
+#define LOG_WRITER_IDLE_NS 5000000L     // 没有日志时writer的休眠时间(5ms)
+
+typedef enum {
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_ERROR = 1,
+    LOG_LEVEL_WARN = 2,
+    LOG_LEVEL_INFO = 3,     // 连接建立/断开
+    LOG_LEVEL_DEBUG = 4     // 每条收到的消息
+} log_level_t;
+
+// 缓冲区中的记录为 2字节长度 + 文本，按2字节对齐；末尾放不下时写入WRAP标记
+typedef struct log_ring {
+    char* data;
+    unsigned head;              // writer读取的位置
+    unsigned tail;              // 本线程写入的位置
+    unsigned long dropped;      // 缓冲区满而丢弃的条数
+    unsigned long suppressed;   // 被限流丢弃的条数
+    int closed;                 // 所属线程已退出，读完后由writer释放
+    double tokens;              // 令牌桶，只由所属线程访问
+    struct timespec refill;
+    long tid;
+    struct log_ring* next;
+} log_ring_t;
+
+typedef struct {
+    int level;
+    int rate_limit;             // 每个线程每秒最多的连接/消息日志条数，0表示不限
+    int running;
+    pid_t writer_pid;           // writer线程所在的进程，fork后需要重新启动
+    pthread_t writer;
+    pthread_mutex_t lock;       // 只保护rings链表的增删
+    pthread_key_t key;
+    log_ring_t* rings;
+} log_state_t;
+
+static log_state_t log_state = { .level = LOG_LEVEL_DEBUG, .lock = PTHREAD_MUTEX_INITIALIZER };
+static __thread log_ring_t* log_local;
+
+static inline int log_enabled(int level) {
+    return level <= log_state.level;
+}
+
+// 线程退出时只做标记，缓冲区里可能还有没输出的日志
+static inline void log_thread_exit(void* arg) {
+    log_ring_t* ring = arg;
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+}
+
+static inline log_ring_t* log_ring_register(void) {
+    log_ring_t* ring = calloc(1, sizeof(log_ring_t));
+    if (ring == NULL) return NULL;
+    ring->data = malloc(LOG_RING_SIZE);
+    if (ring->data == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->tokens = log_state.rate_limit;
+    clock_gettime(CLOCK_MONOTONIC, &ring->refill);
+    ring->tid = (long)pthread_self();
+
+    pthread_mutex_lock(&log_state.lock);
+    ring->next = log_state.rings;
+    log_state.rings = ring;
+    pthread_mutex_unlock(&log_state.lock);
+
+    pthread_setspecific(log_state.key, ring);
+    log_local = ring;
+    return ring;
+}
+
+// 令牌桶：每秒补充rate_limit个令牌，最多积累一秒的量
+static inline int log_take_token(log_ring_t* ring) {
+    struct timespec now;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - ring->refill.tv_sec) + (now.tv_nsec - ring->refill.tv_nsec) / 1e9;
+    ring->refill = now;
+    ring->tokens += elapsed * log_state.rate_limit;
+    if (ring->tokens > log_state.rate_limit) ring->tokens = log_state.rate_limit;
+    if (ring->tokens < 1) return 0;
+    ring->tokens -= 1;
+    return 1;
+}
+
+static inline void log_vwrite(int level, const char* fmt, va_list ap) {
+    log_ring_t* ring = log_local;
+    char text[LOG_RECORD_MAX];
+    unsigned short header;
+    unsigned tail, pos, contig, need, total;
+    int len;
+
+    if (ring == NULL && (ring = log_ring_register()) == NULL) return;
+
+    if (level >= LOG_LEVEL_INFO && log_state.rate_limit > 0 && !log_take_token(ring)) {
+        __atomic_add_fetch(&ring->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    len = vsnprintf(text, sizeof(text), fmt, ap);
+    if (len < 0) return;
+    if (len >= (int)sizeof(text)) {
+        len = sizeof(text) - 1;
+        text[len - 1] = '\n';
+    }
+
+    tail = ring->tail;
+    pos = tail & (LOG_RING_SIZE - 1);
+    contig = LOG_RING_SIZE - pos;
+    need = (sizeof(header) + len + 1) & ~1u;
+    total = contig < need ? contig + need : need;
+    if (LOG_RING_SIZE - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) < total) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (contig < need) {
+        header = LOG_RECORD_WRAP;
+        memcpy(ring->data + pos, &header, sizeof(header));
+        tail += contig;
+        pos = 0;
+    }
+    header = (unsigned short)len;
+    memcpy(ring->data + pos, &header, sizeof(header));
+    memcpy(ring->data + pos + sizeof(header), text, len);
+    __atomic_store_n(&ring->tail, tail + need, __ATOMIC_RELEASE);
+}
+
+__attribute__((format(printf, 2, 3)))
+static inline void log_write(int level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, fmt, ap);
+    va_end(ap);
+}
+
+// 参数只在级别开启时才会求值和格式化
+#define log_error(...) do { if (log_enabled(LOG_LEVEL_ERROR)) log_write(LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+#define log_warn(...)  do { if (log_enabled(LOG_LEVEL_WARN))  log_write(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#define log_info(...)  do { if (log_enabled(LOG_LEVEL_INFO))  log_write(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#define log_debug(...) do { if (log_enabled(LOG_LEVEL_DEBUG)) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+static inline void log_batch_flush(char* batch, size_t* len) {
+    if (*len == 0) return;
+    fwrite(batch, 1, *len, stdout);
+    fflush(stdout);
+    *len = 0;
+}
+
+// 收集所有线程的日志并输出，返回本轮输出的记录条数
+// report为1时同时输出各线程被丢弃的日志条数（writer每秒汇报一次，避免刷屏）
+static inline int log_drain(char* batch, int report) {
+    size_t len = 0;
+    int count = 0;
+    log_ring_t* ring;
+
+    pthread_mutex_lock(&log_state.lock);
+    ring = log_state.rings;
+    pthread_mutex_unlock(&log_state.lock);
+
+    // 新线程只会插入到链表头部，已经拿到的节点只有writer自己会删除，可以无锁遍历
+    for (; ring != NULL; ring = ring->next) {
+        unsigned head = ring->head;
+        unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        unsigned long dropped, suppressed;
+
+        while (head != tail) {
+            unsigned pos = head & (LOG_RING_SIZE - 1);
+            unsigned short record_len;
+
+            memcpy(&record_len, ring->data + pos, sizeof(record_len));
+            if (record_len == LOG_RECORD_WRAP) {
+                head += LOG_RING_SIZE - pos;
+                continue;
+            }
+            if (len + record_len > LOG_WRITER_BATCH) log_batch_flush(batch, &len);
+            memcpy(batch + len, ring->data + pos + sizeof(record_len), record_len);
+            len += record_len;
+            head += (sizeof(record_len) + record_len + 1) & ~1u;
+            count++;
+        }
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+        if (!report) continue;
+        dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        suppressed = __atomic_exchange_n(&ring->suppressed, 0, __ATOMIC_RELAXED);
+        if (dropped > 0 || suppressed > 0) {
+            if (len + 160 > LOG_WRITER_BATCH) log_batch_flush(batch, &len);
+            len += snprintf(batch + len, LOG_WRITER_BATCH - len,
+                            "⚠️  线程 %ld 的日志: 缓冲区满丢弃 %lu 条, 限流丢弃 %lu 条\n",
+                            ring->tid, dropped, suppressed);
+        }
+    }
+    log_batch_flush(batch, &len);
+
+    // 释放已退出且读完的线程缓冲区
+    pthread_mutex_lock(&log_state.lock);
+    for (log_ring_t** link = &log_state.rings; *link != NULL;) {
+        ring = *link;
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+            ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            *link = ring->next;
+            free(ring->data);
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&log_state.lock);
+
+    return count;
+}
+
+static inline void* log_writer(void* arg) {
+    char* batch = malloc(LOG_WRITER_BATCH);
+    struct timespec idle = { 0, LOG_WRITER_IDLE_NS };
+    struct timespec now;
+    time_t last_report = 0;
+
+    (void)arg;
+    if (batch == NULL) return NULL;
+    while (__atomic_load_n(&log_state.running, __ATOMIC_ACQUIRE)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int report = now.tv_sec != last_report;
+        if (report) last_report = now.tv_sec;
+        if (log_drain(batch, report) == 0) nanosleep(&idle, NULL);
+    }
+    log_drain(batch, 1);
+    free(batch);
+    return NULL;
+}
+
+// 停止writer并输出剩余的日志（通过atexit在进程正常退出时调用）
+static inline void log_shutdown(void) {
+    if (log_state.writer_pid != getpid() || !log_state.running) return;
+    __atomic_store_n(&log_state.running, 0, __ATOMIC_RELEASE);
+    pthread_join(log_state.writer, NULL);
+}
+
+static inline int log_start_writer(void) {
+    log_state.writer_pid = getpid();
+    log_state.running = 1;
+    if (pthread_create(&log_state.writer, NULL, log_writer, NULL) != 0) {
+        log_state.running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// 启动日志系统，失败时保持关闭状态（log_*不会输出任何内容）
+static inline int log_init(int level, int rate_limit) {
+    log_state.level = level;
+    log_state.rate_limit = rate_limit;
+    if (level == LOG_LEVEL_OFF) return 0;
+
+    if (pthread_key_create(&log_state.key, log_thread_exit) != 0 || log_start_writer() < 0) {
+        log_state.level = LOG_LEVEL_OFF;
+        return -1;
+    }
+    atexit(log_shutdown);
+    return 0;
+}
+
+// fork出的子进程中只有调用fork的线程，需要丢弃从父进程复制来的缓冲区并重新启动writer
+static inline void log_after_fork(void) {
+    if (log_state.level == LOG_LEVEL_OFF) return;
+
+    pthread_mutex_init(&log_state.lock, NULL);
+    log_state.rings = NULL;
+    log_local = NULL;
+    pthread_setspecific(log_state.key, NULL);
+    if (log_start_writer() < 0) log_state.level = LOG_LEVEL_OFF;
+}
+
+#endif
@@ -0,0 +1,199 @@
+// LZ4块格式的压缩/解压：服务器和客户端共用，不依赖外部库
+//
+// 压缩后的数据由若干序列组成，每个序列为:
+//   token(高4位字面量长度, 低4位匹配长度-4) [字面量长度扩展] 字面量 offset(2字节,小端) [匹配长度扩展]
+// 长度字段为15时后面跟扩展字节，每个255继续累加；最后一个序列只有字面量。
+// 压缩只用一张4096项的哈希表查找最近一次出现的4字节序列，追求速度而不是压缩率，
+// 对重复较多的文本/日志类负载通常能压缩到几分之一，对已压缩的数据几乎不增大。
+//
+// 帧负载（lz_pack的格式）: 原始长度(4字节,大端) + 压缩数据
+
+#ifndef TCP_LZ_H
+#define TCP_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5      // 最后5个字节总是作为字面量
+#define LZ_MFLIMIT 12           // 最后一个匹配必须在距结尾12字节之前开始
+#define LZ_MAX_OFFSET 65535
+#define LZ_SKIP_TRIGGER 6       // 连续找不到匹配时逐渐加大步长，不可压缩的数据很快跳过
+#define LZ_HEADER_SIZE 4
+
+// len字节的数据压缩后的最大长度
+static inline size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+static inline uint32_t lz_read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static inline unsigned char* lz_put_length(unsigned char* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// 写出一个序列：literals字面量，随后是offset/match（match为0表示最后一个序列）
+static inline unsigned char* lz_put_sequence(unsigned char* op, const unsigned char* literals, size_t lit,
+                                             size_t offset, size_t match) {
+    unsigned char* token = op++;
+
+    *token = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = lz_put_length(op, lit - 15);
+    memcpy(op, literals, lit);
+    op += lit;
+    if (match == 0) return op;
+
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    match -= LZ_MIN_MATCH;
+    *token |= (unsigned char)(match >= 15 ? 15 : match);
+    if (match >= 15) op = lz_put_length(op, match - 15);
+    return op;
+}
+
+// 压缩src[0..len)到dst，cap至少为lz_bound(len)，返回压缩后的长度，cap不够时返回0
+static inline size_t lz_compress(const void* src, size_t len, void* dst, size_t cap) {
+    const unsigned char* in = (const unsigned char*)src;
+    unsigned char* op = (unsigned char*)dst;
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t anchor = 0;
+
+    if (cap < lz_bound(len)) return 0;
+
+    if (len > LZ_MFLIMIT) {
+        size_t match_limit = len - LZ_LAST_LITERALS;
+        size_t ip = 1;
+
+        memset(table, 0, sizeof(table));
+        while (ip < len - LZ_MFLIMIT) {
+            uint32_t seq = lz_read32(in + ip);
+            uint32_t h = lz_hash(seq);
+            size_t ref = table[h];
+
+            table[h] = (uint32_t)ip;
+            if (ip - ref > LZ_MAX_OFFSET || lz_read32(in + ref) != seq) {
+                ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+
+            size_t match = LZ_MIN_MATCH;
+            while (ip + match < match_limit && in[ref + match] == in[ip + match]) match++;
+            while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+                ip--;
+                ref--;
+                match++;
+            }
+
+            op = lz_put_sequence(op, in + anchor, ip - anchor, ip - ref, match);
+            ip += match;
+            anchor = ip;
+        }
+    }
+
+    op = lz_put_sequence(op, in + anchor, len - anchor, 0, 0);
+    return op - (unsigned char*)dst;
+}
+
+// 读取一个扩展长度，输入不完整时返回-1
+static inline int lz_get_length(const unsigned char** ip, const unsigned char* end, size_t* len) {
+    unsigned char b;
+
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// 解压src[0..len)到dst，返回解压后的长度；数据损坏或dst放不下时返回-1，不会越界读写
+static inline ssize_t lz_decompress(const void* src, size_t len, void* dst, size_t cap) {
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* end = ip + len;
+    unsigned char* out = (unsigned char*)dst;
+    size_t produced = 0;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+
+        if (lit == 15 && lz_get_length(&ip, end, &lit) < 0) return -1;
+        if ((size_t)(end - ip) < lit || cap - produced < lit) return -1;
+        memcpy(out + produced, ip, lit);
+        ip += lit;
+        produced += lit;
+        if (ip == end) break;
+
+        if (end - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        size_t match = token & 15;
+        ip += 2;
+        if (match == 15 && lz_get_length(&ip, end, &match) < 0) return -1;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > produced || cap - produced < match) return -1;
+
+        // 匹配可能与正在写入的部分重叠（offset < match），只能逐字节复制
+        unsigned char* op = out + produced;
+        const unsigned char* ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+        } else {
+            for (size_t i = 0; i < match; i++) op[i] = ref[i];
+        }
+        produced += match;
+    }
+    return (ssize_t)produced;
+}
+
+// 按帧负载格式压缩：dst至少需要LZ_HEADER_SIZE + lz_bound(len)字节
+// 返回写入的长度，压缩后不比原始数据小时返回0（应按原样发送）
+static inline size_t lz_pack(const void* src, size_t len, void* dst, size_t cap) {
+    unsigned char* out = (unsigned char*)dst;
+    size_t n;
+
+    if (len > UINT32_MAX || cap < LZ_HEADER_SIZE) return 0;
+    n = lz_compress(src, len, out + LZ_HEADER_SIZE, cap - LZ_HEADER_SIZE);
+    if (n == 0 || LZ_HEADER_SIZE + n >= len) return 0;
+    out[0] = (unsigned char)(len >> 24);
+    out[1] = (unsigned char)(len >> 16);
+    out[2] = (unsigned char)(len >> 8);
+    out[3] = (unsigned char)len;
+    return LZ_HEADER_SIZE + n;
+}
+
+// 帧负载解压后的长度（由发送方声明，解压时会再核对），格式错误时返回-1
+static inline ssize_t lz_unpacked_size(const void* src, size_t len) {
+    const unsigned char* in = (const unsigned char*)src;
+
+    if (len < LZ_HEADER_SIZE) return -1;
+    return (ssize_t)(((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3]);
+}
+
+// 解压lz_pack格式的负载，dst的大小应为lz_unpacked_size，返回解压后的长度，失败返回-1
+static inline ssize_t lz_unpack(const void* src, size_t len, void* dst, size_t cap) {
+    ssize_t size = lz_unpacked_size(src, len);
+
+    if (size < 0 || (size_t)size > cap) return -1;
+    if (lz_decompress((const unsigned char*)src + LZ_HEADER_SIZE, len - LZ_HEADER_SIZE, dst, size) != size) {
+        return -1;
+    }
+    return size;
+}
+
+#endif
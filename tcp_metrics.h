@@ -0,0 +1,276 @@
+// 服务器运行统计：每个线程一组计数器和处理时间直方图，查询时再汇总
+//
+// 计数器放在MAP_SHARED的匿名共享内存中，多进程和预派生模式下子进程的统计
+// 也能被主进程看到。每个线程第一次计数时占用一个槽位，之后只更新自己的槽位
+// （无锁、没有线程间共享的缓存行）；线程或进程退出时把槽位中的数值合并到
+// retired中并归还槽位。只有归还和汇总需要加锁，热路径上从不加锁。
+
+#ifndef TCP_METRICS_H
+#define TCP_METRICS_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef HIST_SUB_BITS
+#define HIST_SUB_BITS 4     // 服务器统计只需约6%的精度，每个槽位的直方图约4.5KB
+#endif
+#include "tcp_hist.h"
+
+#define METRICS_MAX_SLOTS 1024
+
+typedef struct {
+    int in_use;
+    pid_t pid;              // 槽位所属的进程，进程异常退出后由汇总方回收
+    uint64_t accepted;      // 建立的连接数
+    uint64_t closed;        // 关闭的连接数
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t requests;      // 处理的消息数
+    uint64_t errors;        // 收发出错的次数
+    uint64_t rejected;      // 因过载被拒绝的连接数
+    uint64_t timeouts;      // 因空闲、读写超时或超过最大连接时长被关闭的连接数
+    uint64_t fanout;        // 聊天室模式下放入成员发送队列的消息数
+    uint64_t evicted;       // 聊天室模式下因积压过多被断开的慢速客户端数
+    uint64_t compress_in;   // 压缩前的回复字节数（只统计尝试压缩的回复）
+    uint64_t compress_out;  // 这些回复实际发送的负载字节数
+    uint64_t files_sent;    // 下载完成的文件数
+    uint64_t files_received;    // 上传完成的文件数
+    uint64_t kv_hits;       // 键值存储读取命中的次数
+    uint64_t kv_misses;     // 键值存储读取未命中的次数
+    uint64_t kv_evictions;  // 键值存储为腾出空间淘汰的未过期项数
+    uint64_t journal_records;   // 写入消息日志的记录数
+    uint64_t journal_syncs;     // 消息日志的同步次数，每次同步覆盖这期间所有连接写入的记录
+    uint64_t journal_errors;    // 写入消息日志失败的次数
+    uint64_t tls_handshakes;    // 完成的TLS握手数
+    uint64_t tls_resumed;       // 其中恢复了之前会话的简短握手数
+    uint64_t tls_offloaded;     // 其中由kTLS加解密、不经过中继线程的连接数
+    uint64_t tls_failures;      // 握手失败的连接数
+    uint64_t memory;        // 连接对象和收发缓冲区占用的字节数（按有符号数增减）
+    histogram_t service;    // 每条消息的处理时间（纳秒）：从收到数据到回复发出（或提交发送）
+} __attribute__((aligned(64))) metrics_slot_t;
+
+typedef struct {
+    pthread_mutex_t lock;   // 进程间共享，只保护槽位的归还、回收和汇总
+    metrics_slot_t retired; // 已退出线程的累计值；槽位用完时也直接计入这里
+    metrics_slot_t slots[METRICS_MAX_SLOTS];
+} metrics_shared_t;
+
+static metrics_shared_t* metrics_area;
+static metrics_slot_t metrics_fallback;     // metrics_init之前的计数
+static pthread_key_t metrics_key;
+static __thread metrics_slot_t* metrics_tls;
+
+#define metrics_count(field, n) __atomic_fetch_add(&metrics_local()->field, (n), __ATOMIC_RELAXED)
+#define metrics_memory(delta) metrics_count(memory, (uint64_t)(int64_t)(delta))
+
+static inline void metrics_fold(metrics_slot_t* dst, metrics_slot_t* src) {
+    __atomic_fetch_add(&dst->accepted, __atomic_load_n(&src->accepted, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->closed, __atomic_load_n(&src->closed, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->bytes_in, __atomic_load_n(&src->bytes_in, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->bytes_out, __atomic_load_n(&src->bytes_out, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->requests, __atomic_load_n(&src->requests, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->errors, __atomic_load_n(&src->errors, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->rejected, __atomic_load_n(&src->rejected, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->timeouts, __atomic_load_n(&src->timeouts, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->fanout, __atomic_load_n(&src->fanout, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->evicted, __atomic_load_n(&src->evicted, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->compress_in, __atomic_load_n(&src->compress_in, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->compress_out, __atomic_load_n(&src->compress_out, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->files_sent, __atomic_load_n(&src->files_sent, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->files_received, __atomic_load_n(&src->files_received, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->kv_hits, __atomic_load_n(&src->kv_hits, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->kv_misses, __atomic_load_n(&src->kv_misses, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->kv_evictions, __atomic_load_n(&src->kv_evictions, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->journal_records, __atomic_load_n(&src->journal_records, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->journal_syncs, __atomic_load_n(&src->journal_syncs, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->journal_errors, __atomic_load_n(&src->journal_errors, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->tls_handshakes, __atomic_load_n(&src->tls_handshakes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->tls_resumed, __atomic_load_n(&src->tls_resumed, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->tls_offloaded, __atomic_load_n(&src->tls_offloaded, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->tls_failures, __atomic_load_n(&src->tls_failures, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dst->memory, __atomic_load_n(&src->memory, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    hist_merge(&dst->service, &src->service);
+}
+
+// 把槽位合并到retired并归还，调用者需持有锁
+static inline void metrics_retire_locked(metrics_slot_t* slot) {
+    metrics_fold(&metrics_area->retired, slot);
+    memset((char*)slot + sizeof(slot->in_use), 0, sizeof(*slot) - sizeof(slot->in_use));
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static inline void metrics_release(metrics_slot_t* slot) {
+    if (metrics_area == NULL || slot == NULL || slot == &metrics_area->retired || slot == &metrics_fallback) return;
+    pthread_mutex_lock(&metrics_area->lock);
+    metrics_retire_locked(slot);
+    pthread_mutex_unlock(&metrics_area->lock);
+}
+
+static inline void metrics_thread_exit(void* arg) {
+    metrics_release(arg);
+}
+
+static inline metrics_slot_t* metrics_claim(void) {
+    if (metrics_area == NULL) return &metrics_fallback;
+
+    for (int i = 0; i < METRICS_MAX_SLOTS; i++) {
+        metrics_slot_t* slot = &metrics_area->slots[i];
+        int expected = 0;
+        if (__atomic_load_n(&slot->in_use, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&slot->in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            slot->pid = getpid();
+            pthread_setspecific(metrics_key, slot);
+            return slot;
+        }
+    }
+    return &metrics_area->retired;
+}
+
+static inline metrics_slot_t* metrics_local(void) {
+    if (__builtin_expect(metrics_tls == NULL, 0)) metrics_tls = metrics_claim();
+    return metrics_tls;
+}
+
+static inline void metrics_record_service(uint64_t ns, uint64_t requests) {
+    metrics_slot_t* slot = metrics_local();
+    __atomic_fetch_add(&slot->requests, requests, __ATOMIC_RELAXED);
+    for (uint64_t i = 0; i < requests; i++) hist_record_shared(&slot->service, ns);
+}
+
+// 在创建任何worker之前调用，失败时统计仍然可用，只是子进程的数值不会被汇总
+static inline int metrics_init(void) {
+    pthread_mutexattr_t attr;
+    metrics_shared_t* area = mmap(NULL, sizeof(metrics_shared_t), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) return -1;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&area->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (pthread_key_create(&metrics_key, metrics_thread_exit) != 0) {
+        munmap(area, sizeof(metrics_shared_t));
+        return -1;
+    }
+    metrics_area = area;
+    return 0;
+}
+
+static inline void metrics_process_exit(void) {
+    metrics_release(metrics_tls);
+    metrics_tls = NULL;
+}
+
+// fork出的子进程不能继续使用父进程线程的槽位，第一次计数时重新占用
+static inline void metrics_after_fork(void) {
+    if (metrics_area == NULL) return;
+    metrics_tls = NULL;
+    pthread_setspecific(metrics_key, NULL);
+    atexit(metrics_process_exit);
+}
+
+// 汇总所有槽位，返回正在使用的槽位数（即有过计数的线程数）
+static inline int metrics_snapshot(metrics_slot_t* out) {
+    int active = 0;
+
+    memset(out, 0, sizeof(*out));
+    if (metrics_area == NULL) {
+        metrics_fold(out, &metrics_fallback);
+        return 1;
+    }
+
+    pthread_mutex_lock(&metrics_area->lock);
+    for (int i = 0; i < METRICS_MAX_SLOTS; i++) {
+        metrics_slot_t* slot = &metrics_area->slots[i];
+        if (!__atomic_load_n(&slot->in_use, __ATOMIC_ACQUIRE)) continue;
+        // 被信号杀死的子进程来不及归还槽位，它占用的内存已经随进程释放
+        if (slot->pid != 0 && slot->pid != getpid() && kill(slot->pid, 0) < 0 && errno == ESRCH) {
+            slot->memory = 0;
+            metrics_retire_locked(slot);
+            continue;
+        }
+        metrics_fold(out, slot);
+        active++;
+    }
+    metrics_fold(out, &metrics_area->retired);
+    metrics_fold(out, &metrics_fallback);
+    pthread_mutex_unlock(&metrics_area->lock);
+    return active;
+}
+
+// 以Prometheus文本格式输出汇总结果
+static inline void metrics_write_prometheus(FILE* out, const metrics_slot_t* m, int threads,
+                                            const char* mode, double uptime) {
+    static const double buckets[] = {
+        0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025,
+        0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+    };
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+#define METRIC_COUNTER(name, help, value) \
+    fprintf(out, "# HELP " name " " help "\n# TYPE " name " counter\n" name "{mode=\"%s\"} %llu\n", \
+            mode, (unsigned long long)(value))
+#define METRIC_GAUGE(name, help, fmt, value) \
+    fprintf(out, "# HELP " name " " help "\n# TYPE " name " gauge\n" name "{mode=\"%s\"} " fmt "\n", mode, value)
+
+    METRIC_GAUGE("tcp_server_uptime_seconds", "Seconds since the server started.", "%.3f", uptime);
+    METRIC_GAUGE("tcp_server_worker_threads", "Threads that have handled connections and are still alive.", "%d", threads);
+    METRIC_GAUGE("tcp_server_connections_active", "Currently open client connections.", "%lld",
+                 (long long)(m->accepted - m->closed));
+    METRIC_GAUGE("tcp_server_connection_memory_bytes", "Heap bytes held by connection objects and I/O buffers.", "%lld",
+                 (long long)m->memory);
+    METRIC_GAUGE("tcp_server_memory_per_connection_bytes", "Connection memory divided by open connections.", "%lld",
+                 m->accepted > m->closed ? (long long)m->memory / (long long)(m->accepted - m->closed) : 0LL);
+    METRIC_COUNTER("tcp_server_connections_accepted_total", "Client connections accepted.", m->accepted);
+    METRIC_COUNTER("tcp_server_connections_rejected_total", "Client connections rejected because the server was busy.", m->rejected);
+    METRIC_COUNTER("tcp_server_connections_timed_out_total", "Client connections closed by idle/read/write timeouts or max lifetime.", m->timeouts);
+    METRIC_COUNTER("tcp_server_chat_fanout_total", "Chat messages queued to room members.", m->fanout);
+    METRIC_COUNTER("tcp_server_chat_evicted_total", "Chat clients disconnected because their outbound queue was full.", m->evicted);
+    METRIC_COUNTER("tcp_server_compress_input_bytes_total", "Reply payload bytes considered for compression.", m->compress_in);
+    METRIC_COUNTER("tcp_server_compress_output_bytes_total", "Payload bytes actually sent for those replies.", m->compress_out);
+    METRIC_COUNTER("tcp_server_files_sent_total", "Files fully sent to clients (downloads).", m->files_sent);
+    METRIC_COUNTER("tcp_server_files_received_total", "Files fully received from clients (uploads).", m->files_received);
+    METRIC_COUNTER("tcp_server_kv_hits_total", "Key-value GET requests that found the key.", m->kv_hits);
+    METRIC_COUNTER("tcp_server_kv_misses_total", "Key-value GET requests for missing or expired keys.", m->kv_misses);
+    METRIC_COUNTER("tcp_server_kv_evictions_total", "Unexpired key-value items evicted to make room.", m->kv_evictions);
+    METRIC_COUNTER("tcp_server_journal_records_total", "Received messages appended to the message journal.", m->journal_records);
+    METRIC_COUNTER("tcp_server_journal_syncs_total", "Group-commit fdatasync calls on the message journal.", m->journal_syncs);
+    METRIC_COUNTER("tcp_server_journal_errors_total", "Messages that could not be appended to the message journal.", m->journal_errors);
+    METRIC_COUNTER("tcp_server_tls_handshakes_total", "Completed TLS handshakes.", m->tls_handshakes);
+    METRIC_COUNTER("tcp_server_tls_resumed_total", "TLS handshakes that resumed a previous session.", m->tls_resumed);
+    METRIC_COUNTER("tcp_server_tls_offloaded_total", "TLS connections encrypted by kernel TLS instead of the relay thread.", m->tls_offloaded);
+    METRIC_COUNTER("tcp_server_tls_failures_total", "Connections whose TLS handshake failed.", m->tls_failures);
+    METRIC_COUNTER("tcp_server_received_bytes_total", "Bytes received from clients.", m->bytes_in);
+    METRIC_COUNTER("tcp_server_sent_bytes_total", "Bytes sent to clients.", m->bytes_out);
+    METRIC_COUNTER("tcp_server_requests_total", "Messages processed.", m->requests);
+    METRIC_COUNTER("tcp_server_errors_total", "Socket receive/send errors.", m->errors);
+#undef METRIC_COUNTER
+#undef METRIC_GAUGE
+
+    fprintf(out, "# HELP tcp_server_service_seconds Time from receiving a message to sending its reply.\n");
+    fprintf(out, "# TYPE tcp_server_service_seconds histogram\n");
+    for (size_t i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+        fprintf(out, "tcp_server_service_seconds_bucket{mode=\"%s\",le=\"%g\"} %llu\n", mode, buckets[i],
+                (unsigned long long)hist_count_below(&m->service, (uint64_t)(buckets[i] * 1e9)));
+    }
+    fprintf(out, "tcp_server_service_seconds_bucket{mode=\"%s\",le=\"+Inf\"} %llu\n", mode,
+            (unsigned long long)m->service.total);
+    fprintf(out, "tcp_server_service_seconds_sum{mode=\"%s\"} %.9f\n", mode, m->service.sum / 1e9);
+    fprintf(out, "tcp_server_service_seconds_count{mode=\"%s\"} %llu\n", mode,
+            (unsigned long long)m->service.total);
+
+    fprintf(out, "# HELP tcp_server_service_quantile_seconds Service time quantiles since start.\n");
+    fprintf(out, "# TYPE tcp_server_service_quantile_seconds gauge\n");
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fprintf(out, "tcp_server_service_quantile_seconds{mode=\"%s\",quantile=\"%g\"} %.9f\n", mode, quantiles[i],
+                m->service.total ? hist_percentile(&m->service, quantiles[i] * 100) / 1e9 : 0.0);
+    }
+}
+
+#endif
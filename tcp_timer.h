@@ -0,0 +1,139 @@
+// 分层时间轮：添加、删除和每个tick的推进都是O(1)，适合为大量连接维护超时
+//
+// 4层 x 64个槽位：第0层每个槽位1个tick，第1层64个tick，依此类推，共可表示64^4个tick
+// （tick为100ms时约19天，更远的定时器先放在最后一层，到时再重新放置）。
+// 推进到第0层的槽位0时，把上一层对应槽位中的定时器按剩余时间重新放入下层（cascade）。
+// 定时器节点嵌入在调用者的结构体中，不需要额外分配内存；时间轮本身不加锁。
+
+#ifndef TCP_TIMER_H
+#define TCP_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_LEVELS 4
+#define TIMER_RANGE (1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS))
+
+typedef struct timer_node {
+    struct timer_node* next;    // 不在时间轮中时为NULL
+    struct timer_node* prev;
+    uint64_t expires;           // 到期的tick
+} timer_node_t;
+
+typedef struct {
+    uint64_t now;               // 已经推进到的tick
+    size_t count;               // 时间轮中（包括已到期未取走）的定时器数
+    timer_node_t expired;       // 已到期、等待调用者取走的定时器
+    timer_node_t slots[TIMER_LEVELS][TIMER_SLOTS];
+} timer_wheel_t;
+
+static inline void timer_list_init(timer_node_t* head) {
+    head->next = head->prev = head;
+}
+
+static inline void timer_list_add(timer_node_t* head, timer_node_t* node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static inline void timer_list_unlink(timer_node_t* node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+}
+
+static inline int timer_pending(const timer_node_t* node) {
+    return node->next != NULL;
+}
+
+static inline void timer_wheel_init(timer_wheel_t* wheel, uint64_t now) {
+    wheel->now = now;
+    wheel->count = 0;
+    timer_list_init(&wheel->expired);
+    for (int level = 0; level < TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_SLOTS; slot++) timer_list_init(&wheel->slots[level][slot]);
+    }
+}
+
+// 按剩余时间选择层和槽位
+static inline void timer_place(timer_wheel_t* wheel, timer_node_t* node) {
+    uint64_t expires = node->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires <= wheel->now) {
+        timer_list_add(&wheel->expired, node);
+        return;
+    }
+    delta = expires - wheel->now;
+    if (delta >= TIMER_RANGE) {
+        expires = wheel->now + TIMER_RANGE - 1;
+        delta = TIMER_RANGE - 1;
+    }
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TIMER_LEVEL_BITS * (level + 1)))) break;
+    }
+    timer_list_add(&wheel->slots[level][(expires >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK], node);
+}
+
+static inline void timer_add(timer_wheel_t* wheel, timer_node_t* node, uint64_t expires) {
+    node->expires = expires;
+    timer_place(wheel, node);
+    wheel->count++;
+}
+
+static inline void timer_del(timer_wheel_t* wheel, timer_node_t* node) {
+    if (!timer_pending(node)) return;
+    timer_list_unlink(node);
+    wheel->count--;
+}
+
+// 把一个槽位中的定时器全部重新放置
+static inline void timer_cascade(timer_wheel_t* wheel, timer_node_t* head) {
+    timer_node_t list;
+
+    if (head->next == head) return;
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    timer_list_init(head);
+    while (list.next != &list) {
+        timer_node_t* node = list.next;
+        timer_list_unlink(node);
+        timer_place(wheel, node);
+    }
+}
+
+// 推进到now，到期的定时器移入expired列表，由timer_expired逐个取出
+static inline void timer_advance(timer_wheel_t* wheel, uint64_t now) {
+    if (wheel->count == 0) {
+        if (now > wheel->now) wheel->now = now;
+        return;
+    }
+    while (wheel->now < now) {
+        uint64_t tick = ++wheel->now;
+        for (int level = 1; level < TIMER_LEVELS; level++) {
+            if ((tick >> (TIMER_LEVEL_BITS * (level - 1))) & TIMER_MASK) break;
+            timer_cascade(wheel, &wheel->slots[level][(tick >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK]);
+        }
+        timer_cascade(wheel, &wheel->slots[0][tick & TIMER_MASK]);
+    }
+}
+
+// 取出一个已到期的定时器，没有时返回NULL
+static inline timer_node_t* timer_expired(timer_wheel_t* wheel) {
+    timer_node_t* node = wheel->expired.next;
+
+    if (node == &wheel->expired) return NULL;
+    timer_list_unlink(node);
+    wheel->count--;
+    return node;
+}
+
+#endif
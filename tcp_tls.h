@@ -0,0 +1,554 @@
+// TLS传输层（OpenSSL）：服务器和客户端共用，握手之后连接仍然是一个普通的fd，收发数据的代码不需要改变
+//
+// - 握手完成后如果内核TLS（kTLS）接管了两个方向的加解密，SSL对象直接释放，之后在原socket上
+//   send/recv/writev/sendfile/splice收发的都是明文，由内核加密成TLS记录；文件下载的sendfile
+//   仍然不经过用户态。kTLS不支持MSG_ZEROCOPY，TLS连接上不使用SO_ZEROCOPY
+// - 内核或OpenSSL不支持kTLS时，连接交给中继线程：调用者拿到一个socketpair的一端，中继线程在另一端
+//   和TCP socket之间用SSL_read/SSL_write转发。每个进程一个中继线程，第一次需要时启动
+// - 只使用TLS 1.2和AEAD套件：OpenSSL 3.0的kTLS只能接收TLS 1.2，TLS 1.3握手后的NewSessionTicket
+//   等消息也不能用普通的recv读取。关闭了重新协商，握手后不会再有非数据记录
+// - 会话恢复：服务器使用会话票据（session ticket），票据密钥在创建SSL_CTX时随机生成，
+//   fork出的子进程（多进程、预派生模式）共享同一个密钥；客户端保存上次的会话，重连时只做简短握手
+//
+// 编译时定义TCP_TLS并链接-lssl -lcrypto（make TLS=1）；没有定义时只提供同名的空实现，
+// 创建SSL_CTX总是失败，包含本文件的程序不依赖OpenSSL。
+
+#ifndef TCP_TLS_H
+#define TCP_TLS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define TLS_INFO_RESUMED 1      // 握手恢复了之前的会话
+#define TLS_INFO_OFFLOADED 2    // 两个方向都由kTLS处理，没有经过中继线程
+#define TLS_HANDSHAKE_TIMEOUT_MS 10000
+#define TLS_RELAY_BUFFER 16384  // 中继每个方向的缓冲区，正好是一个TLS记录的最大明文长度
+#define TLS_RELAY_EVENTS 64
+#define TLS_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:" \
+                    "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:" \
+                    "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+
+#ifdef TCP_TLS
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+// 中继中的一个连接：down是从网络解密后等待写给应用的数据，up是应用写出、等待加密发送的数据
+typedef struct tls_relay_conn {
+    SSL* ssl;
+    int net_fd;
+    int app_fd;
+    int net_eof;                // 对端发送了close_notify
+    int app_eof;                // 应用关闭或半关闭了自己这一端，已经发送close_notify
+    int closed;                 // 本轮事件处理中已关闭，处理完这一轮再释放
+    struct tls_relay_conn* next_free;
+    size_t down_len, down_off;
+    size_t up_len, up_off;
+    char down[TLS_RELAY_BUFFER];
+    char up[TLS_RELAY_BUFFER];
+} tls_relay_conn_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t idle;        // active降为0时通知tls_relay_drain
+    pid_t pid;                  // 中继线程所在的进程，fork出的子进程需要自己启动
+    int epoll_fd;
+    int active;                 // 本进程中继中的连接数
+} tls_relay_t;
+
+static tls_relay_t tls_relay = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, -1, 0 };
+
+// 最近一次失败的原因：OpenSSL的错误队列为空时是errno
+static inline const char* tls_last_error(void) {
+    static __thread char text[256];
+    unsigned long err = ERR_peek_last_error();
+
+    if (err == 0) return strerror(errno);
+    ERR_error_string_n(err, text, sizeof(text));
+    ERR_clear_error();
+    return text;
+}
+
+static inline SSL_CTX* tls_ctx_new(const SSL_METHOD* method) {
+    SSL_CTX* ctx = SSL_CTX_new(method);
+
+    if (ctx == NULL) return NULL;
+    if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION) ||
+        !SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION) ||
+        !SSL_CTX_set_cipher_list(ctx, TLS_CIPHERS)) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_NO_COMPRESSION);
+    // 空闲连接不保留读写缓冲区；中继每次重试SSL_write时缓冲区的位置可能已经前移
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                          SSL_MODE_RELEASE_BUFFERS);
+    return ctx;
+}
+
+// 服务器的SSL_CTX：cert是PEM格式的证书链，key是私钥；失败返回NULL，原因见tls_last_error
+// 会话只通过票据恢复，服务器不保存会话缓存，多个进程之间也就不需要共享缓存
+static inline SSL_CTX* tls_server_ctx(const char* cert, const char* key) {
+    SSL_CTX* ctx = tls_ctx_new(TLS_server_method());
+
+    if (ctx == NULL) return NULL;
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    return ctx;
+}
+
+// 客户端的SSL_CTX：ca为信任的证书文件，NULL时使用系统的证书；verify为0时不验证服务器证书
+static inline SSL_CTX* tls_client_ctx(const char* ca, int verify) {
+    SSL_CTX* ctx = tls_ctx_new(TLS_client_method());
+
+    if (ctx == NULL) return NULL;
+    if (verify && (ca != NULL ? SSL_CTX_load_verify_locations(ctx, ca, NULL)
+                              : SSL_CTX_set_default_verify_paths(ctx)) != 1) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_verify(ctx, verify ? SSL_VERIFY_PEER : SSL_VERIFY_NONE, NULL);
+    return ctx;
+}
+
+static inline void tls_ctx_free(SSL_CTX* ctx) {
+    SSL_CTX_free(ctx);
+}
+
+static inline SSL* tls_new(SSL_CTX* ctx, int fd, int server) {
+    SSL* ssl = SSL_new(ctx);
+
+    if (ssl == NULL) return NULL;
+    if (SSL_set_fd(ssl, fd) != 1) {
+        SSL_free(ssl);
+        return NULL;
+    }
+    if (server) {
+        SSL_set_accept_state(ssl);
+    } else {
+        SSL_set_connect_state(ssl);
+    }
+    return ssl;
+}
+
+static inline void tls_free(SSL* ssl) {
+    SSL_free(ssl);
+}
+
+static inline void tls_session_free(SSL_SESSION* session) {
+    SSL_SESSION_free(session);
+}
+
+// 非阻塞地推进握手：返回0表示完成，POLLIN/POLLOUT表示需要等待的事件，-1表示失败
+static inline int tls_handshake_step(SSL* ssl) {
+    int rc;
+
+    ERR_clear_error();
+    errno = 0;
+    rc = SSL_do_handshake(ssl);
+    if (rc == 1) return 0;
+    switch (SSL_get_error(ssl, rc)) {
+        case SSL_ERROR_WANT_READ:
+            return POLLIN;
+        case SSL_ERROR_WANT_WRITE:
+            return POLLOUT;
+        case SSL_ERROR_SYSCALL:
+            if (errno == 0) errno = ECONNRESET;
+            return -1;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+// 阻塞地完成握手，最多等待timeout_ms毫秒（超时errno为ETIMEDOUT），期间fd临时设为非阻塞
+static inline int tls_handshake(SSL* ssl, int fd, int timeout_ms) {
+    struct timespec ts;
+    int flags = fcntl(fd, F_GETFL, 0);
+    int64_t deadline;
+    int rc;
+
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    deadline = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + timeout_ms;
+    while ((rc = tls_handshake_step(ssl)) > 0) {
+        struct pollfd pfd = { fd, (short)rc, 0 };
+        int64_t left;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        left = deadline - ((int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+        if (left <= 0 || (rc = poll(&pfd, 1, (int)left)) == 0) {
+            errno = ETIMEDOUT;
+            rc = -1;
+            break;
+        }
+        if (rc < 0 && errno != EINTR) break;
+    }
+    if (fcntl(fd, F_SETFL, flags) < 0) rc = -1;
+    return rc;
+}
+
+static inline int tls_info(SSL* ssl) {
+    int info = SSL_session_reused(ssl) ? TLS_INFO_RESUMED : 0;
+
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+        info |= TLS_INFO_OFFLOADED;
+    }
+    return info;
+}
+
+static inline void tls_relay_close(tls_relay_conn_t* conn, tls_relay_conn_t** free_list) {
+    close(conn->app_fd);
+    close(conn->net_fd);
+    SSL_free(conn->ssl);
+    conn->closed = 1;
+    conn->next_free = *free_list;
+    *free_list = conn;
+    pthread_mutex_lock(&tls_relay.lock);
+    if (--tls_relay.active == 0) pthread_cond_broadcast(&tls_relay.idle);
+    pthread_mutex_unlock(&tls_relay.lock);
+}
+
+// 在两个方向上尽量转发，直到都需要等待；返回-1表示连接应当关闭。
+// 两个fd都以边沿触发注册、共用一个conn，任何一个有事件都把两个方向重新处理一遍。
+// 两个方向分别结束：一端半关闭后另一个方向继续转发（客户端发完请求后shutdown写端，仍然要收到回复）
+static inline int tls_relay_pump(tls_relay_conn_t* conn) {
+    int progress = 1;
+
+    while (progress) {
+        ssize_t n;
+        int rc;
+
+        progress = 0;
+        // 网络 -> 应用
+        if (conn->down_off == conn->down_len && !conn->net_eof) {
+            conn->down_len = conn->down_off = 0;
+            ERR_clear_error();
+            rc = SSL_read(conn->ssl, conn->down, sizeof(conn->down));
+            if (rc > 0) {
+                conn->down_len = rc;
+                progress = 1;
+            } else {
+                switch (SSL_get_error(conn->ssl, rc)) {
+                    case SSL_ERROR_WANT_READ:
+                    case SSL_ERROR_WANT_WRITE:
+                        break;
+                    case SSL_ERROR_ZERO_RETURN:
+                        // 对端正常关闭：应用读到EOF，等应用关闭自己这一端
+                        conn->net_eof = 1;
+                        shutdown(conn->app_fd, SHUT_WR);
+                        break;
+                    default:
+                        return -1;
+                }
+            }
+        }
+        while (conn->down_off < conn->down_len) {
+            n = send(conn->app_fd, conn->down + conn->down_off, conn->down_len - conn->down_off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EAGAIN) break;
+            if (n < 0) return -1;
+            conn->down_off += n;
+            progress = 1;
+        }
+
+        // 应用 -> 网络：应用这一端读到EOF时发送close_notify；应用已经完全关闭时（POLLHUP）不再有人读取回复
+        if (conn->up_off == conn->up_len && !conn->app_eof) {
+            conn->up_len = conn->up_off = 0;
+            n = recv(conn->app_fd, conn->up, sizeof(conn->up), 0);
+            if (n == 0) {
+                struct pollfd pfd = { conn->app_fd, 0, 0 };
+
+                conn->app_eof = 1;
+                SSL_shutdown(conn->ssl);
+                if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLHUP)) return -1;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EINTR) return -1;
+            if (n > 0) {
+                conn->up_len = n;
+                progress = 1;
+            }
+        }
+        if (conn->up_off < conn->up_len) {
+            ERR_clear_error();
+            rc = SSL_write(conn->ssl, conn->up + conn->up_off, conn->up_len - conn->up_off);
+            if (rc > 0) {
+                conn->up_off += rc;
+                progress = 1;
+            } else {
+                rc = SSL_get_error(conn->ssl, rc);
+                if (rc != SSL_ERROR_WANT_READ && rc != SSL_ERROR_WANT_WRITE) return -1;
+            }
+        }
+    }
+    return conn->app_eof && conn->net_eof && conn->down_off == conn->down_len ? -1 : 0;
+}
+
+static inline void* tls_relay_thread(void* arg) {
+    int epoll_fd = (int)(intptr_t)arg;
+    struct epoll_event events[TLS_RELAY_EVENTS];
+
+    for (;;) {
+        tls_relay_conn_t* free_list = NULL;
+        int n = epoll_wait(epoll_fd, events, TLS_RELAY_EVENTS, -1);
+
+        for (int i = 0; i < n; i++) {
+            tls_relay_conn_t* conn = events[i].data.ptr;
+            if (!conn->closed && tls_relay_pump(conn) < 0) tls_relay_close(conn, &free_list);
+        }
+        while (free_list != NULL) {
+            tls_relay_conn_t* conn = free_list;
+            free_list = conn->next_free;
+            free(conn);
+        }
+    }
+    return NULL;
+}
+
+// 确保本进程的中继线程已经启动，返回它的epoll fd
+static inline int tls_relay_start(void) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int epoll_fd;
+
+    pthread_mutex_lock(&tls_relay.lock);
+    if (tls_relay.pid != getpid()) {
+        // 继承自父进程的epoll fd属于父进程的中继线程
+        if (tls_relay.epoll_fd != -1) close(tls_relay.epoll_fd);
+        tls_relay.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (tls_relay.epoll_fd != -1 &&
+            pthread_create(&thread, &attr, tls_relay_thread, (void*)(intptr_t)tls_relay.epoll_fd) != 0) {
+            close(tls_relay.epoll_fd);
+            tls_relay.epoll_fd = -1;
+        }
+        pthread_attr_destroy(&attr);
+        if (tls_relay.epoll_fd != -1) tls_relay.pid = getpid();
+        tls_relay.active = 0;
+    }
+    epoll_fd = tls_relay.epoll_fd;
+    if (epoll_fd != -1) tls_relay.active++;
+    pthread_mutex_unlock(&tls_relay.lock);
+    return epoll_fd;
+}
+
+// 等待中继把已关闭连接剩余的数据发送完，最多timeout_ms毫秒；进程退出前调用，否则中继线程随进程结束，
+// 应用最后写出的回复可能还没有加密发送。返回仍在中继中的连接数
+static inline int tls_relay_drain(int timeout_ms) {
+    struct timespec deadline;
+    int active;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock(&tls_relay.lock);
+    if (tls_relay.pid != getpid()) tls_relay.active = 0;
+    while (tls_relay.active > 0 && pthread_cond_timedwait(&tls_relay.idle, &tls_relay.lock, &deadline) == 0);
+    active = tls_relay.active;
+    pthread_mutex_unlock(&tls_relay.lock);
+    return active;
+}
+
+// 握手完成后取出收发数据用的fd，ssl随之释放：
+// kTLS接管了两个方向时就是fd本身，否则把连接交给中继线程，返回socketpair的一端（nonblock时为非阻塞）。
+// 失败返回-1，fd已经关闭
+static inline int tls_detach(SSL* ssl, int fd, int nonblock) {
+    tls_relay_conn_t* conn;
+    struct epoll_event ev;
+    int epoll_fd;
+    int pair[2];
+
+    if (tls_info(ssl) & TLS_INFO_OFFLOADED) {
+        SSL_free(ssl);
+        return fd;
+    }
+    if ((epoll_fd = tls_relay_start()) == -1) goto fail;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) < 0) goto fail_active;
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) goto fail_pair;
+    conn->ssl = ssl;
+    conn->net_fd = fd;
+    conn->app_fd = pair[1];
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0 ||
+        (!nonblock && fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL, 0) & ~O_NONBLOCK) < 0)) {
+        goto fail_conn;
+    }
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pair[1], &ev) < 0) goto fail_conn;
+    // 注册之后中继线程随时可能处理这个连接，不能再访问conn；
+    // 失败时关闭应用这一端，中继线程读到EOF后自己关闭其余的部分
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        int err = errno;
+        close(pair[0]);
+        errno = err;
+        return -1;
+    }
+    return pair[0];
+
+fail_conn:
+    free(conn);
+fail_pair:
+    close(pair[0]);
+    close(pair[1]);
+fail_active:
+    pthread_mutex_lock(&tls_relay.lock);
+    if (--tls_relay.active == 0) pthread_cond_broadcast(&tls_relay.idle);
+    pthread_mutex_unlock(&tls_relay.lock);
+fail:
+    SSL_free(ssl);
+    close(fd);
+    return -1;
+}
+
+// 客户端握手：session指向上次连接同一服务器时保存的会话（没有时为NULL），成功后更新为本次的会话；
+// host不为NULL且验证证书时，证书必须包含这个IP地址或主机名；主机名同时通过SNI发给服务器。
+// info返回TLS_INFO_*，成功返回收发数据用的fd，失败返回-1，fd已经关闭
+static inline int tls_connect(SSL_CTX* ctx, int fd, const char* host, SSL_SESSION** session,
+                              int timeout_ms, int* info) {
+    SSL* ssl = tls_new(ctx, fd, 0);
+    unsigned char ip[sizeof(struct in6_addr)];
+
+    if (ssl == NULL) {
+        close(fd);
+        return -1;
+    }
+    if (host != NULL && (inet_pton(AF_INET, host, ip) == 1 || inet_pton(AF_INET6, host, ip) == 1)) {
+        if (SSL_get_verify_mode(ssl) != SSL_VERIFY_NONE &&
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host) != 1) {
+            goto fail;
+        }
+    } else if (host != NULL) {
+        if (SSL_set_tlsext_host_name(ssl, host) != 1) goto fail;
+        if (SSL_get_verify_mode(ssl) != SSL_VERIFY_NONE &&
+            X509_VERIFY_PARAM_set1_host(SSL_get0_param(ssl), host, 0) != 1) {
+            goto fail;
+        }
+    }
+    if (*session != NULL && SSL_set_session(ssl, *session) != 1) goto fail;
+    if (tls_handshake(ssl, fd, timeout_ms) < 0) goto fail;
+
+    SSL_SESSION_free(*session);
+    *session = SSL_get1_session(ssl);
+    *info = tls_info(ssl);
+    return tls_detach(ssl, fd, 0);
+
+fail:
+    SSL_free(ssl);
+    close(fd);
+    return -1;
+}
+
+#else
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_session_st SSL_SESSION;
+
+static inline const char* tls_last_error(void) {
+    return "编译时没有启用TLS (需要OpenSSL，用 make TLS=1 编译)";
+}
+
+static inline SSL_CTX* tls_server_ctx(const char* cert, const char* key) {
+    (void)cert;
+    (void)key;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static inline SSL_CTX* tls_client_ctx(const char* ca, int verify) {
+    (void)ca;
+    (void)verify;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static inline void tls_ctx_free(SSL_CTX* ctx) {
+    (void)ctx;
+}
+
+static inline SSL* tls_new(SSL_CTX* ctx, int fd, int server) {
+    (void)ctx;
+    (void)fd;
+    (void)server;
+    errno = ENOTSUP;
+    return NULL;
+}
+
+static inline void tls_free(SSL* ssl) {
+    (void)ssl;
+}
+
+static inline void tls_session_free(SSL_SESSION* session) {
+    (void)session;
+}
+
+static inline int tls_handshake_step(SSL* ssl) {
+    (void)ssl;
+    errno = ENOTSUP;
+    return -1;
+}
+
+static inline int tls_handshake(SSL* ssl, int fd, int timeout_ms) {
+    (void)ssl;
+    (void)fd;
+    (void)timeout_ms;
+    errno = ENOTSUP;
+    return -1;
+}
+
+static inline int tls_info(SSL* ssl) {
+    (void)ssl;
+    return 0;
+}
+
+static inline int tls_detach(SSL* ssl, int fd, int nonblock) {
+    (void)ssl;
+    (void)fd;
+    (void)nonblock;
+    errno = ENOTSUP;
+    return -1;
+}
+
+static inline int tls_relay_drain(int timeout_ms) {
+    (void)timeout_ms;
+    return 0;
+}
+
+static inline int tls_connect(SSL_CTX* ctx, int fd, const char* host, SSL_SESSION** session,
+                              int timeout_ms, int* info) {
+    (void)ctx;
+    (void)fd;
+    (void)host;
+    (void)session;
+    (void)timeout_ms;
+    (void)info;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
+
+#endif
@@ -73,4 +73,5 @@ done
 echo "清理临时文件..."
 rm -rf "$TEST_DIR"
 
-echo "测试脚本执行完毕"
\ No newline at end of file
+echo "测试脚本执行完毕"
+echo "💡 需要测量吞吐量和延迟时请使用压测工具: ./benchtcp -c $NUM_CLIENTS -d 10 $SERVER_IP $SERVER_PORT"
\ No newline at end of file
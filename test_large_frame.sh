@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# 帧协议大消息测试脚本：发送超过1MB的DATA帧，检查服务器能完整回显
+# 用法: ./test_large_frame.sh [服务器模式] [消息字节数] [端口]
+
+MODE=${1:-"io_uring"}
+SIZE=${2:-2000000}
+PORT=${3:-"9988"}
+
+echo "=== 帧协议大消息测试 ==="
+echo "服务器模式: $MODE"
+echo "消息大小: $SIZE 字节"
+echo "================================"
+
+if [ ! -f "./servertcp" ] || [ ! -f "./benchtcp" ]; then
+    echo "程序未编译，正在编译..."
+    make
+    echo ""
+fi
+
+LOG_FILE="/tmp/tcp_large_frame_$$.log"
+./servertcp -m "$MODE" -F -q --log-level 2 --stats-port 0 -p "$PORT" > "$LOG_FILE" 2>&1 &
+SERVER_PID=$!
+sleep 1
+
+if ! kill -0 "$SERVER_PID" 2>/dev/null; then
+    echo "错误: 服务器启动失败"
+    cat "$LOG_FILE"
+    rm -f "$LOG_FILE"
+    exit 1
+fi
+
+# 单个连接，收到回复立即发送下一条，持续2秒
+RESULT=$(./benchtcp -F -c 1 -d 2 -s "$SIZE" 127.0.0.1 "$PORT" 2>&1 | grep "收到回复")
+kill "$SERVER_PID"
+wait "$SERVER_PID" 2>/dev/null
+
+echo "$RESULT"
+REPLIES=$(echo "$RESULT" | sed -n 's/.*收到回复: \([0-9]*\).*/\1/p')
+ERRORS=$(echo "$RESULT" | sed -n 's/.*错误: \([0-9]*\).*/\1/p')
+
+if [ -z "$REPLIES" ] || [ "$REPLIES" -eq 0 ] || [ "$ERRORS" != "0" ]; then
+    echo "❌ 测试失败：服务器没有完整回显 $SIZE 字节的消息"
+    echo "--- 服务器日志 ---"
+    cat "$LOG_FILE"
+    rm -f "$LOG_FILE"
+    exit 1
+fi
+
+rm -f "$LOG_FILE"
+echo "✅ 测试通过"